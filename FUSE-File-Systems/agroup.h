@@ -0,0 +1,64 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Allocation groups header file.
+ *
+ * The blocks of the file system are split into groups of AGROUP_BLOCKS
+ * consecutive blocks. Each inode has a home group where its blocks are
+ * allocated first; the groups after it are used, in order, once it is full
+ * (free blocks are found with the free extent tree, see freetree.h).
+ */
+
+#pragma once
+
+#include "util.h"
+#include "vsfs.h"
+
+/** Number of blocks in a group. */
+#define AGROUP_BLOCKS 1024
+
+
+/**
+ * Get the number of groups of a file system; the last one may be smaller.
+ *
+ * @param num_blocks  number of blocks in the file system.
+ * @return            number of groups.
+ */
+static inline uint32_t agroup_count(vsfs_blk_t num_blocks)
+{
+	return div_round_up(num_blocks, AGROUP_BLOCKS);
+}
+
+/**
+ * Get the group of a block.
+ *
+ * @param blk  block number.
+ * @return     group number.
+ */
+static inline uint32_t agroup_of(vsfs_blk_t blk)
+{
+	return blk / AGROUP_BLOCKS;
+}
+
+/**
+ * Get the first block of a group.
+ *
+ * @param g  group number.
+ * @return   block number.
+ */
+static inline vsfs_blk_t agroup_start(uint32_t g)
+{
+	return (vsfs_blk_t)g * AGROUP_BLOCKS;
+}
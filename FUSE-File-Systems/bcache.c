@@ -0,0 +1,435 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block buffer cache implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bcache.h"
+#include "util.h"
+
+/** Maximum number of dirty buffers written back together on eviction. */
+#define BCACHE_WRITEBACK_BATCH 32
+/** The cache must be able to hold every block pinned by one operation. */
+#define BCACHE_MIN_BUFS 16
+
+
+// Remove buf from the LRU list
+static void lru_remove(bcache *bc, bcache_buf *buf)
+{
+	if (buf->prev) {
+		buf->prev->next = buf->next;
+	} else {
+		bc->head = buf->next;
+	}
+	if (buf->next) {
+		buf->next->prev = buf->prev;
+	} else {
+		bc->tail = buf->prev;
+	}
+	buf->prev = NULL;
+	buf->next = NULL;
+}
+
+// Insert buf at the head (most recently used end) of the LRU list
+static void lru_push_head(bcache *bc, bcache_buf *buf)
+{
+	buf->prev = NULL;
+	buf->next = bc->head;
+	if (bc->head) {
+		bc->head->prev = buf;
+	} else {
+		bc->tail = buf;
+	}
+	bc->head = buf;
+}
+
+// Insert buf at the tail (least recently used end) of the LRU list
+static void lru_push_tail(bcache *bc, bcache_buf *buf)
+{
+	buf->next = NULL;
+	buf->prev = bc->tail;
+	if (bc->tail) {
+		bc->tail->next = buf;
+	} else {
+		bc->head = buf;
+	}
+	bc->tail = buf;
+}
+
+static int buf_cmp(const void *a, const void *b)
+{
+	vsfs_blk_t x = (*(bcache_buf *const *)a)->blk;
+	vsfs_blk_t y = (*(bcache_buf *const *)b)->blk;
+	return (x > y) - (x < y);
+}
+
+// Write back n dirty buffers in block order
+static bool write_bufs(bdev *bd, bcache_buf **bufs, int n)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	if (n == 0) {
+		return true;
+	}
+	qsort(bufs, n, sizeof(*bufs), buf_cmp);
+	if (!bc->io->write(bd, bufs, n)) {
+		return false;
+	}
+	for (int i = 0; i < n; ++i) {
+		bufs[i]->dirty = false;
+	}
+	bc->writebacks += n;
+	return true;
+}
+
+// Find a buffer that can be reused, writing back the dirty buffers at the
+// cold end of the LRU list together. Returns NULL if all buffers are pinned.
+static bcache_buf *get_victim(bdev *bd)
+{
+	bcache *bc = (bcache *)bd->priv;
+	bcache_buf *victim = NULL;
+
+	for (bcache_buf *buf = bc->tail; buf != NULL; buf = buf->prev) {
+		if (buf->pins == 0) {
+			victim = buf;
+			break;
+		}
+	}
+	if (victim == NULL) {
+		fprintf(stderr, "bcache: all %zu buffers are in use\n", bc->nbufs);
+		return NULL;
+	}
+
+	if (victim->dirty) {
+		bcache_buf *batch[BCACHE_WRITEBACK_BATCH];
+		int n = 0;
+		for (bcache_buf *buf = victim; buf != NULL && n < BCACHE_WRITEBACK_BATCH;
+		     buf = buf->prev) {
+			if (buf->dirty && buf->pins == 0) {
+				batch[n++] = buf;
+			}
+		}
+		if (!write_bufs(bd, batch, n)) {
+			return NULL;
+		}
+	}
+
+	if (victim->blk != 0) {
+		bc->map[victim->blk] = NULL;
+		victim->blk = 0;
+	}
+	return victim;
+}
+
+// Write back the buffers that have been dirty since before the previous pass,
+// coldest first, a batch at a time. The lock is released between batches, so
+// that file system operations are only held up by one batch.
+static void writeback_pass(bdev *bd)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	++bc->pass;
+	while (!bc->stop) {
+		bcache_buf *batch[BCACHE_WRITEBACK_BATCH];
+		int n = 0;
+		for (bcache_buf *buf = bc->tail; buf != NULL && n < BCACHE_WRITEBACK_BATCH;
+		     buf = buf->prev) {
+			if (buf->dirty && buf->pins == 0 && bc->pass - buf->dirtied >= 2) {
+				batch[n++] = buf;
+			}
+		}
+		// On error the buffers stay dirty; bcache_flush() reports it
+		if (n == 0 || !write_bufs(bd, batch, n)) {
+			break;
+		}
+		pthread_mutex_unlock(&bc->lock);
+		pthread_mutex_lock(&bc->lock);
+	}
+}
+
+// Write-back thread: run a pass every interval until asked to stop
+static void *writeback_thread(void *arg)
+{
+	bdev *bd = (bdev *)arg;
+	bcache *bc = (bcache *)bd->priv;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	pthread_mutex_lock(&bc->lock);
+	while (!bc->stop) {
+		next.tv_sec += bc->interval_ms / 1000;
+		next.tv_nsec += (long)(bc->interval_ms % 1000) * 1000000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		int ret = 0;
+		while (!bc->stop && ret != ETIMEDOUT) {
+			ret = pthread_cond_timedwait(&bc->wake, &bc->lock, &next);
+		}
+		writeback_pass(bd);
+	}
+	pthread_mutex_unlock(&bc->lock);
+	return NULL;
+}
+
+bool bcache_init(bdev *bd, const bcache_io *io)
+{
+	bcache *bc = calloc(1, sizeof(*bc));
+	if (bc == NULL) {
+		return false;
+	}
+	bc->io = io;
+	bc->nbufs = bd->cache_blocks;
+	if (bc->nbufs < BCACHE_MIN_BUFS) {
+		bc->nbufs = BCACHE_MIN_BUFS;
+	}
+
+	bc->bufs = calloc(bc->nbufs, sizeof(bcache_buf));
+	bc->map = calloc(bd->nblocks, sizeof(bcache_buf *));
+	// One block-aligned allocation for all the buffer contents
+	if (bc->bufs == NULL || bc->map == NULL ||
+	    posix_memalign(&bc->mem, VSFS_BLOCK_SIZE,
+	                   bc->nbufs * VSFS_BLOCK_SIZE) != 0)
+	{
+		fprintf(stderr, "Failed to allocate buffer cache\n");
+		free(bc->bufs);
+		free(bc->map);
+		free(bc);
+		return false;
+	}
+
+	for (size_t i = 0; i < bc->nbufs; ++i) {
+		bc->bufs[i].data = bc->mem + i * VSFS_BLOCK_SIZE;
+		lru_push_head(bc, &bc->bufs[i]);
+	}
+	pthread_mutex_init(&bc->lock, NULL);
+	// Passes are timed with the monotonic clock, immune to clock changes
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bc->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	bd->priv = bc;
+	return true;
+}
+
+bool bcache_writeback(bdev *bd, unsigned int interval_ms)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	assert(interval_ms > 0 && !bc->running);
+	bc->interval_ms = interval_ms;
+	int ret = pthread_create(&bc->flusher, NULL, writeback_thread, bd);
+	if (ret != 0) {
+		fprintf(stderr, "bcache: failed to start write-back thread: %s\n",
+		        strerror(ret));
+		return false;
+	}
+	bc->running = true;
+	return true;
+}
+
+void bcache_destroy(bdev *bd)
+{
+	bcache *bc = (bcache *)bd->priv;
+	if (bc->running) {
+		pthread_mutex_lock(&bc->lock);
+		bc->stop = true;
+		pthread_cond_signal(&bc->wake);
+		pthread_mutex_unlock(&bc->lock);
+		pthread_join(bc->flusher, NULL);
+	}
+	pthread_cond_destroy(&bc->wake);
+	pthread_mutex_destroy(&bc->lock);
+	free(bc->mem);
+	free(bc->map);
+	free(bc->bufs);
+	free(bc);
+	bd->priv = NULL;
+}
+
+// Get (and pin) a block, with the lock held
+static void *get_buf(bdev *bd, vsfs_blk_t blk, bool zero)
+{
+	bcache *bc = (bcache *)bd->priv;
+	bcache_buf *buf = bc->map[blk];
+
+	if (buf != NULL) {
+		++bc->hits;
+		lru_remove(bc, buf);
+		lru_push_head(bc, buf);
+		if (zero) {
+			memset(buf->data, 0, VSFS_BLOCK_SIZE);
+		}
+		++buf->pins;
+		return buf->data;
+	}
+
+	++bc->misses;
+	buf = get_victim(bd);
+	if (buf == NULL) {
+		return NULL;
+	}
+	buf->blk = blk;
+	if (zero) {
+		memset(buf->data, 0, VSFS_BLOCK_SIZE);
+	} else if (!bc->io->read(bd, &buf, 1)) {
+		buf->blk = 0;
+		return NULL;
+	}
+	bc->map[blk] = buf;
+	lru_remove(bc, buf);
+	lru_push_head(bc, buf);
+	buf->pins = 1;
+	return buf->data;
+}
+
+void *bcache_get(bdev *bd, vsfs_blk_t blk, bool zero)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	pthread_mutex_lock(&bc->lock);
+	void *data = get_buf(bd, blk, zero);
+	pthread_mutex_unlock(&bc->lock);
+	return data;
+}
+
+void bcache_put(bdev *bd, vsfs_blk_t blk, bool dirty)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	pthread_mutex_lock(&bc->lock);
+	bcache_buf *buf = bc->map[blk];
+	assert(buf != NULL && buf->pins > 0);
+	--buf->pins;
+	if (dirty && !buf->dirty) {
+		buf->dirty = true;
+		buf->dirtied = bc->pass;
+	}
+	pthread_mutex_unlock(&bc->lock);
+}
+
+void bcache_readahead(bdev *bd, const vsfs_blk_t *blks, int n)
+{
+	bcache *bc = (bcache *)bd->priv;
+	bcache_buf *batch[n];
+	int count = 0;
+
+	pthread_mutex_lock(&bc->lock);
+	for (int i = 0; i < n; ++i) {
+		vsfs_blk_t blk = blks[i];
+		if (blk == 0 || blk < bd->meta_blocks || bc->map[blk] != NULL) {
+			continue;
+		}
+		bcache_buf *buf = get_victim(bd);
+		if (buf == NULL) {
+			break;
+		}
+		// Pin it so that the next victim isn't the same buffer
+		buf->blk = blk;
+		buf->pins = 1;
+		bc->map[blk] = buf;
+		lru_remove(bc, buf);
+		lru_push_head(bc, buf);
+		batch[count++] = buf;
+	}
+	if (count == 0) {
+		pthread_mutex_unlock(&bc->lock);
+		return;
+	}
+
+	qsort(batch, count, sizeof(*batch), buf_cmp);
+	bool ok = bc->io->read(bd, batch, count);
+	for (int i = 0; i < count; ++i) {
+		batch[i]->pins = 0;
+		if (!ok) {
+			// Forget about these; bcache_get() will report the error
+			bc->map[batch[i]->blk] = NULL;
+			batch[i]->blk = 0;
+		}
+	}
+	bc->misses += count;
+	pthread_mutex_unlock(&bc->lock);
+}
+
+void bcache_discard(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n)
+{
+	bcache *bc = (bcache *)bd->priv;
+
+	pthread_mutex_lock(&bc->lock);
+	for (vsfs_blk_t b = blk; b < blk + n; ++b) {
+		bcache_buf *buf = bc->map[b];
+		if (buf == NULL) {
+			continue;
+		}
+		assert(buf->pins == 0);
+		bc->map[b] = NULL;
+		buf->blk = 0;
+		buf->dirty = false;
+		// Unused buffers are the first to be reused
+		lru_remove(bc, buf);
+		lru_push_tail(bc, buf);
+	}
+	pthread_mutex_unlock(&bc->lock);
+}
+
+// Blocks past the new end are discarded already; only the map changes size
+bool bcache_resize(bdev *bd, size_t size)
+{
+	bcache *bc = (bcache *)bd->priv;
+	vsfs_blk_t nblocks = size / VSFS_BLOCK_SIZE;
+
+	pthread_mutex_lock(&bc->lock);
+	bcache_buf **map = realloc(bc->map, nblocks * sizeof(*map));
+	if (map == NULL) {
+		pthread_mutex_unlock(&bc->lock);
+		fprintf(stderr, "Failed to allocate buffer cache map\n");
+		return false;
+	}
+	for (vsfs_blk_t blk = bd->nblocks; blk < nblocks; ++blk) {
+		map[blk] = NULL;
+	}
+	bc->map = map;
+	pthread_mutex_unlock(&bc->lock);
+	return true;
+}
+
+bool bcache_flush(bdev *bd)
+{
+	bcache *bc = (bcache *)bd->priv;
+	bcache_buf **dirty = malloc(bc->nbufs * sizeof(*dirty));
+	int n = 0;
+
+	if (dirty == NULL) {
+		return false;
+	}
+	pthread_mutex_lock(&bc->lock);
+	for (size_t i = 0; i < bc->nbufs; ++i) {
+		if (bc->bufs[i].dirty) {
+			dirty[n++] = &bc->bufs[i];
+		}
+	}
+	bool ret = write_bufs(bd, dirty, n);
+	pthread_mutex_unlock(&bc->lock);
+	free(dirty);
+	return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block buffer cache header file.
+ *
+ * A fixed number of block-sized buffers, managed with the LRU policy and
+ * written back lazily (when evicted or flushed). Shared by the block device
+ * backends that don't map the image (pread, uring); they only differ in how
+ * they move blocks between the buffers and the image file.
+ *
+ * Optionally, a background thread also writes back the buffers that have
+ * stayed dirty for a while (see bcache_writeback()), so that eviction and
+ * flush find mostly clean buffers. Repeated writes to a block in between are
+ * absorbed in memory. The metadata is not in the cache; it is only written
+ * by bdev_flush(), after the data.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bdev.h"
+
+/** A cached block. */
+typedef struct bcache_buf {
+	/** Block number; 0 if the buffer is unused. */
+	vsfs_blk_t blk;
+	/** Number of bdev_get() calls without a matching bdev_put(). */
+	unsigned int pins;
+	/** True if the contents differ from the image. */
+	bool dirty;
+	/** Write-back pass during which the buffer became dirty. */
+	unsigned int dirtied;
+	/** LRU list links; the head is the most recently used buffer. */
+	struct bcache_buf *prev;
+	struct bcache_buf *next;
+	/** Block contents (VSFS_BLOCK_SIZE bytes, block-aligned). */
+	void *data;
+} bcache_buf;
+
+/**
+ * Backend I/O functions. Both get an array of buffers sorted by block number
+ * and return true if all of them were transferred.
+ */
+typedef struct bcache_io {
+	bool (*read)(bdev *bd, bcache_buf **bufs, int n);
+	bool (*write)(bdev *bd, bcache_buf **bufs, int n);
+} bcache_io;
+
+/** Buffer cache state (bdev->priv for the cached backends). */
+typedef struct bcache {
+	/** Backend I/O functions. */
+	const bcache_io *io;
+	/** Backend private state. */
+	void *io_priv;
+
+	/** Buffers and their contents. */
+	size_t nbufs;
+	bcache_buf *bufs;
+	void *mem;
+	/** Cached buffer for each block number, or NULL. */
+	bcache_buf **map;
+	/** LRU list of all buffers. */
+	bcache_buf *head;
+	bcache_buf *tail;
+
+	/** Statistics. */
+	size_t hits;
+	size_t misses;
+	size_t writebacks;
+
+	/** Protects the cache from the write-back thread. */
+	pthread_mutex_t lock;
+	/** Background write-back thread; see bcache_writeback(). */
+	pthread_t flusher;
+	pthread_cond_t wake;
+	bool running;
+	/** Set to make the write-back thread exit. */
+	bool stop;
+	/** Time between write-back passes in milliseconds. */
+	unsigned int interval_ms;
+	/** Number of write-back passes started. */
+	unsigned int pass;
+} bcache;
+
+/**
+ * Allocate the buffer cache for a block device (bd->cache_blocks buffers).
+ *
+ * @param bd  pointer to the block device; bd->priv is set to the cache.
+ * @param io  backend I/O functions.
+ * @return    true on success; false on failure.
+ */
+bool bcache_init(bdev *bd, const bcache_io *io);
+
+/**
+ * Start writing back dirty buffers in the background. Every interval_ms
+ * milliseconds, the buffers that have been dirty since before the previous
+ * pass are written back, least recently used first, in batches; the cache is
+ * only locked for one batch at a time. Stopped by bcache_destroy().
+ *
+ * @param bd           pointer to the block device.
+ * @param interval_ms  time between passes in milliseconds (not 0).
+ * @return             true on success; false if the thread can't be started.
+ */
+bool bcache_writeback(bdev *bd, unsigned int interval_ms);
+
+// Implementations of the bdev_ops functions for the cached backends
+void bcache_destroy(bdev *bd);
+void *bcache_get(bdev *bd, vsfs_blk_t blk, bool zero);
+void bcache_put(bdev *bd, vsfs_blk_t blk, bool dirty);
+void bcache_readahead(bdev *bd, const vsfs_blk_t *blks, int n);
+bool bcache_flush(bdev *bd);
+void bcache_discard(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n);
+bool bcache_resize(bdev *bd, size_t size);
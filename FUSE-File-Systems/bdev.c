@@ -0,0 +1,510 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block device (disk image access) implementation.
+ */
+
+// O_DIRECT, fallocate()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bdev.h"
+#include "crc32c.h"
+#include "util.h"
+
+extern const bdev_ops bdev_mmap_ops;
+extern const bdev_ops bdev_pread_ops;
+extern const bdev_ops bdev_uring_ops;
+
+/* The backends array gives us a mapping between the name of a backend as
+ * given in the backend mount option and its functions. The first one is the
+ * default.
+ */
+static const bdev_ops *backends[] = {
+	&bdev_mmap_ops,
+	&bdev_pread_ops,
+	&bdev_uring_ops,
+};
+static const size_t num_backends = sizeof(backends) / sizeof(backends[0]);
+
+/** Default buffer cache size in blocks (8 MiB). */
+#define BDEV_DEFAULT_CACHE_BLOCKS 2048
+
+/** Checksum state of a block. */
+enum {
+	/** Not read since checksums were enabled. */
+	CSUM_UNCHECKED = 0,
+	/** Matches its checksum (or has none, like the table itself). */
+	CSUM_OK,
+	/** Modified; the checksum is recomputed on flush. */
+	CSUM_STALE,
+};
+
+
+bool bdev_open(bdev *bd, const char *path, const char *backend,
+               size_t cache_blocks, bool direct)
+{
+	memset(bd, 0, sizeof(*bd));
+	bd->fd = -1;
+	bd->ops = direct ? &bdev_pread_ops : backends[0];
+	if (backend != NULL) {
+		bd->ops = NULL;
+		for (size_t i = 0; i < num_backends; ++i) {
+			if (strcmp(backends[i]->name, backend) == 0) {
+				bd->ops = backends[i];
+				break;
+			}
+		}
+		if (bd->ops == NULL) {
+			fprintf(stderr, "Unknown backend: %s\n", backend);
+			return false;
+		}
+	}
+	bd->cache_blocks = cache_blocks ? cache_blocks
+	                                : BDEV_DEFAULT_CACHE_BLOCKS;
+	bd->direct = direct;
+
+	// Open the file for reading and writing
+	bd->fd = open(path, O_RDWR | (direct ? O_DIRECT : 0));
+	if (bd->fd < 0) {
+		if (direct && errno == EINVAL) {
+			fprintf(stderr, "%s: O_DIRECT is not supported by the file "
+			        "system that holds the image\n", path);
+		} else {
+			perror(path);
+		}
+		return false;
+	}
+
+	// Check that the file size is valid
+	struct stat s;
+	if (fstat(bd->fd, &s) < 0) {
+		perror("fstat");
+		goto err;
+	}
+	if (s.st_size == 0) {
+		fprintf(stderr, "Image file is empty\n");
+		goto err;
+	}
+	if (s.st_size % VSFS_BLOCK_SIZE != 0) {
+		fprintf(stderr, "Image file size is not a multiple of block size\n");
+		goto err;
+	}
+	bd->size = s.st_size;
+	bd->nblocks = s.st_size / VSFS_BLOCK_SIZE;
+	bd->stripe.count = 1;
+	bd->fds[0] = bd->fd;
+
+	if (!bd->ops->open(bd)) {
+		goto err;
+	}
+	return true;
+
+err:
+	close(bd->fd);
+	bd->fd = -1;
+	return false;
+}
+
+void bdev_close(bdev *bd)
+{
+	if (bd->fd < 0) {
+		return;
+	}
+	bdev_flush(bd);
+	bd->ops->close(bd);
+	if (!bd->mapped) {
+		free(bd->meta);
+	}
+	free(bd->csums);
+	free(bd->csum_state);
+	for (uint32_t i = 1; i < bd->stripe.count; ++i) {
+		close(bd->fds[i]);
+	}
+	close(bd->fd);
+	bd->fd = -1;
+}
+
+// Read or write blocks [blk, blk + n) of the device, one run of blocks
+// stored consecutively in the same image at a time
+static bool image_io(bdev *bd, void *buf, vsfs_blk_t blk, vsfs_blk_t n,
+                     bool write)
+{
+	while (n > 0) {
+		off_t off;
+		vsfs_blk_t run;
+		int fd = bdev_locate(bd, blk, &off, &run);
+		if (run > n) {
+			run = n;
+		}
+		ssize_t len = (ssize_t)run * VSFS_BLOCK_SIZE;
+		if ((write ? pwrite(fd, buf, len, off)
+		           : pread(fd, buf, len, off)) != len) {
+			perror(write ? "pwrite" : "pread");
+			return false;
+		}
+		buf += len;
+		blk += run;
+		n -= run;
+	}
+	return true;
+}
+
+bool bdev_stripe(bdev *bd, const stripe_layout *sl, const char *const *paths)
+{
+	assert(bd->stripe.count == 1 && bd->csums == NULL);
+	if (!stripe_valid(sl)) {
+		return false;
+	}
+	if (sl->count == 1) {
+		return true;
+	}
+	if (bd->meta_blocks > sl->base) {
+		fprintf(stderr, "Invalid stripe layout\n");
+		return false;
+	}
+
+	vsfs_blk_t blocks[STRIPE_MAX_IMAGES] = { bd->nblocks };
+	uint32_t opened = 1;
+	for (; opened < sl->count; ++opened) {
+		const char *path = paths[opened - 1];
+		int fd = open(path, O_RDWR | (bd->direct ? O_DIRECT : 0));
+		if (fd < 0) {
+			perror(path);
+			goto err;
+		}
+		bd->fds[opened] = fd;
+		struct stat s;
+		if (fstat(fd, &s) < 0) {
+			perror(path);
+			++opened;
+			goto err;
+		}
+		blocks[opened] = s.st_size / VSFS_BLOCK_SIZE;
+	}
+	vsfs_blk_t nblocks = stripe_fit(sl, blocks);
+	if (nblocks == 0) {
+		fprintf(stderr, "Striped images are too small\n");
+		goto err;
+	}
+
+	// The backend sees the new layout, and the size of the whole device
+	bd->stripe = *sl;
+	if (bd->ops->resize != NULL &&
+	    !bd->ops->resize(bd, (size_t)nblocks * VSFS_BLOCK_SIZE)) {
+		bd->stripe.count = 1;
+		goto err;
+	}
+	bd->size = (size_t)nblocks * VSFS_BLOCK_SIZE;
+	bd->nblocks = nblocks;
+	return true;
+
+err:
+	for (uint32_t i = 1; i < opened; ++i) {
+		close(bd->fds[i]);
+	}
+	return false;
+}
+
+void *bdev_map_meta(bdev *bd, vsfs_blk_t nblocks)
+{
+	assert(nblocks <= bd->nblocks);
+	if (bd->mapped) {
+		bd->meta_blocks = nblocks;
+		return bd->meta;
+	}
+
+	// Block-aligned, so that it can be used for direct I/O
+	void *meta;
+	size_t len = (size_t)nblocks * VSFS_BLOCK_SIZE;
+	if (posix_memalign(&meta, VSFS_BLOCK_SIZE, len) != 0) {
+		fprintf(stderr, "Failed to allocate metadata buffer\n");
+		return NULL;
+	}
+	if (!image_io(bd, meta, 0, nblocks, false)) {
+		free(meta);
+		return NULL;
+	}
+	free(bd->meta);
+	bd->meta = meta;
+	bd->meta_blocks = nblocks;
+	return meta;
+}
+
+// Check the contents of a block against its checksum
+static bool csum_verify(bdev *bd, vsfs_blk_t blk, const void *data)
+{
+	uint32_t crc = crc32c(0, data, VSFS_BLOCK_SIZE);
+	if (crc != bd->csums[blk]) {
+		fprintf(stderr, "Checksum mismatch in block %u: %08x, expected %08x\n",
+		        blk, crc, bd->csums[blk]);
+		return false;
+	}
+	bd->csum_state[blk] = CSUM_OK;
+	return true;
+}
+
+// Recompute the checksums of modified blocks; the metadata blocks are
+// modified in memory without bdev_put(), so theirs are always recomputed
+static bool csum_update(bdev *bd)
+{
+	bool ret = true;
+
+	for (vsfs_blk_t blk = 0; blk < bd->csum_nblocks; ++blk) {
+		if (blk < bd->meta_blocks) {
+			bd->csums[blk] = crc32c(0, bd->meta + (size_t)blk *
+			                           VSFS_BLOCK_SIZE, VSFS_BLOCK_SIZE);
+			bd->csum_state[blk] = CSUM_OK;
+		} else if (bd->csum_state[blk] == CSUM_STALE) {
+			void *data = bd->ops->get(bd, blk, false);
+			if (data == NULL) {
+				ret = false;
+				continue;
+			}
+			bd->csums[blk] = crc32c(0, data, VSFS_BLOCK_SIZE);
+			bd->ops->put(bd, blk, false);
+			bd->csum_state[blk] = CSUM_OK;
+		}
+	}
+	return ret;
+}
+
+bool bdev_csum_enable(bdev *bd, vsfs_blk_t table_blk, vsfs_blk_t nblocks)
+{
+	vsfs_blk_t table_blocks = VSFS_CSUM_BLOCKS(nblocks);
+	assert(nblocks <= bd->nblocks && table_blk >= bd->meta_blocks &&
+	       table_blk + table_blocks <= nblocks);
+
+	void *table;
+	size_t len = (size_t)table_blocks * VSFS_BLOCK_SIZE;
+	if (posix_memalign(&table, VSFS_BLOCK_SIZE, len) != 0) {
+		fprintf(stderr, "Failed to allocate checksum table\n");
+		return false;
+	}
+	if (!image_io(bd, table, table_blk, table_blocks, false)) {
+		free(table);
+		return false;
+	}
+	uint8_t *state = calloc(nblocks, sizeof(*state));
+	if (state == NULL) {
+		fprintf(stderr, "Failed to allocate checksum state\n");
+		free(table);
+		return false;
+	}
+	for (vsfs_blk_t i = 0; i < table_blocks; ++i) {
+		state[table_blk + i] = CSUM_OK;
+	}
+
+	bd->csums = table;
+	bd->csum_blk = table_blk;
+	bd->csum_blocks = table_blocks;
+	bd->csum_nblocks = nblocks;
+	bd->csum_state = state;
+
+	for (vsfs_blk_t blk = 0; blk < bd->meta_blocks; ++blk) {
+		if (!csum_verify(bd, blk, bd->meta + (size_t)blk * VSFS_BLOCK_SIZE)) {
+			free(bd->csums);
+			free(bd->csum_state);
+			bd->csums = NULL;
+			bd->csum_state = NULL;
+			bd->csum_nblocks = 0;
+			return false;
+		}
+	}
+	return true;
+}
+
+void *bdev_get(bdev *bd, vsfs_blk_t blk)
+{
+	assert(blk < bd->nblocks);
+	if (blk < bd->meta_blocks) {
+		return bd->meta + (size_t)blk * VSFS_BLOCK_SIZE;
+	}
+	void *data = bd->ops->get(bd, blk, false);
+
+	// Only the first read is checked, so the common path is a single test
+	if (data != NULL && blk < bd->csum_nblocks &&
+	    bd->csum_state[blk] == CSUM_UNCHECKED &&
+	    !csum_verify(bd, blk, data)) {
+		bd->ops->put(bd, blk, false);
+		return NULL;
+	}
+	return data;
+}
+
+void *bdev_get_zeroed(bdev *bd, vsfs_blk_t blk)
+{
+	assert(blk < bd->nblocks);
+	if (blk < bd->csum_nblocks) {
+		bd->csum_state[blk] = CSUM_STALE;
+	}
+	if (blk < bd->meta_blocks) {
+		void *data = bd->meta + (size_t)blk * VSFS_BLOCK_SIZE;
+		memset(data, 0, VSFS_BLOCK_SIZE);
+		return data;
+	}
+	return bd->ops->get(bd, blk, true);
+}
+
+void bdev_put(bdev *bd, vsfs_blk_t blk, bool dirty)
+{
+	if (dirty && blk < bd->csum_nblocks) {
+		bd->csum_state[blk] = CSUM_STALE;
+	}
+	if (blk >= bd->meta_blocks) {
+		bd->ops->put(bd, blk, dirty);
+	}
+}
+
+void bdev_readahead(bdev *bd, const vsfs_blk_t *blks, int n)
+{
+	bd->ops->readahead(bd, blks, n);
+}
+
+bool bdev_discard(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n)
+{
+	assert(blk >= bd->meta_blocks && blk + n <= bd->nblocks);
+
+	// Drop cached copies first, so that they are never written back over
+	// the hole
+	bd->ops->discard(bd, blk, n);
+	for (vsfs_blk_t b = blk; b < blk + n; ) {
+		off_t off;
+		vsfs_blk_t run;
+		int fd = bdev_locate(bd, b, &off, &run);
+		if (run > blk + n - b) {
+			run = blk + n - b;
+		}
+		if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+		              (off_t)run * VSFS_BLOCK_SIZE) < 0) {
+			perror("fallocate");
+			return false;
+		}
+		b += run;
+	}
+	// The blocks read as zeros now
+	for (vsfs_blk_t i = blk; i < blk + n && i < bd->csum_nblocks; ++i) {
+		bd->csum_state[i] = CSUM_STALE;
+	}
+	return true;
+}
+
+bool bdev_resize(bdev *bd, vsfs_blk_t nblocks)
+{
+	assert(nblocks >= bd->meta_blocks && bd->stripe.count == 1);
+	vsfs_blk_t old = bd->nblocks;
+	size_t size = (size_t)nblocks * VSFS_BLOCK_SIZE;
+
+	if (bd->csums != NULL) {
+		assert(VSFS_CSUM_BLOCKS(nblocks) == bd->csum_blocks &&
+		       bd->csum_blk + bd->csum_blocks <= nblocks);
+		uint8_t *state = realloc(bd->csum_state, nblocks);
+		if (state == NULL) {
+			fprintf(stderr, "Failed to allocate checksum state\n");
+			return false;
+		}
+		bd->csum_state = state;
+	}
+
+	if (nblocks > old) {
+		if (ftruncate(bd->fd, size) < 0) {
+			perror("ftruncate");
+			return false;
+		}
+		if (bd->ops->resize != NULL && !bd->ops->resize(bd, size)) {
+			if (ftruncate(bd->fd, bd->size) < 0) {
+				perror("ftruncate");
+			}
+			return false;
+		}
+	} else {
+		bd->ops->discard(bd, nblocks, old - nblocks);
+		if (bd->ops->resize != NULL && !bd->ops->resize(bd, size)) {
+			return false;
+		}
+		// If this fails, the file is only larger than it needs to be
+		if (ftruncate(bd->fd, size) < 0) {
+			perror("ftruncate");
+		}
+	}
+	bd->size = size;
+	bd->nblocks = nblocks;
+
+	// New blocks read as zeros; their checksums are computed on flush
+	if (bd->csums != NULL) {
+		for (vsfs_blk_t blk = old; blk < nblocks; ++blk) {
+			bd->csum_state[blk] = CSUM_STALE;
+		}
+		for (vsfs_blk_t blk = nblocks; blk < old; ++blk) {
+			bd->csums[blk] = 0;
+		}
+		bd->csum_nblocks = nblocks;
+	}
+	return true;
+}
+
+bool bdev_writeback(bdev *bd, unsigned int interval_ms)
+{
+	if (bd->ops->writeback == NULL) {
+		fprintf(stderr, "The %s backend has no background write-back\n",
+		        bd->ops->name);
+		return false;
+	}
+	return bd->ops->writeback(bd, interval_ms);
+}
+
+// Wait for everything written to the images to reach stable storage
+static bool sync_images(bdev *bd)
+{
+	bool ret = true;
+	for (uint32_t i = 0; i < bd->stripe.count; ++i) {
+		if (fdatasync(bd->fds[i]) < 0) {
+			perror("fdatasync");
+			ret = false;
+		}
+	}
+	return ret;
+}
+
+bool bdev_flush(bdev *bd)
+{
+	bool ret = (bd->csums != NULL) ? csum_update(bd) : true;
+	ret = bd->ops->flush(bd) && ret;
+
+	// Metadata goes last, so that it never points to data that isn't in
+	// the image yet. The host may persist writes in any order until they
+	// are synced, so the data is synced on its own first. (The mmap
+	// backend's flush syncs already; its metadata is in the same mapping
+	// and is written along with the data.)
+	if (!bd->mapped && !sync_images(bd)) {
+		ret = false;
+	}
+	if (bd->csums != NULL &&
+	    !image_io(bd, bd->csums, bd->csum_blk, bd->csum_blocks, true)) {
+		ret = false;
+	}
+	if (!bd->mapped && bd->meta_blocks > 0 &&
+	    !image_io(bd, bd->meta, 0, bd->meta_blocks, true)) {
+		ret = false;
+	}
+	return sync_images(bd) && ret;
+}
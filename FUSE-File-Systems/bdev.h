@@ -0,0 +1,301 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block device (disk image access) header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "stripe.h"
+#include "vsfs.h"
+
+// All accesses to the disk image go through a block device. The metadata
+// blocks at the start of the image (superblock, bitmaps, inode table) stay
+// resident in memory for the lifetime of the mount, so the rest of the code
+// can keep plain pointers into them. Data blocks are accessed one at a time:
+// bdev_get() returns a pointer to the contents of a block, which stays valid
+// until the matching bdev_put().
+//
+// There are several backends (I/O strategies) that implement this interface,
+// selected by name with the backend mount option:
+//   mmap   map the whole image into memory (the original vsfs approach)
+//   pread  pread()/pwrite() through an LRU buffer cache (see bcache.h)
+//   uring  same buffer cache, but misses and write-back are submitted to
+//          io_uring in batches
+//
+// The cached backends can also open the image with O_DIRECT, bypassing the
+// host page cache so that data is only cached once, in our buffer cache. All
+// transfers then use the block-aligned cache buffers and metadata copy.
+//
+// If the image has block checksums (see vsfs.h), they are checked and kept
+// up to date here, for all backends: see bdev_csum_enable().
+//
+// A file system can also be striped over several images (see stripe.h and
+// bdev_stripe()). Block numbers are then translated into an image and an
+// offset in it by bdev_locate(); the mmap backend maps the images so that
+// the blocks are at consecutive addresses anyway.
+
+
+typedef struct bdev bdev;
+
+/** Each backend is represented by a structure with its name and functions. */
+typedef struct bdev_ops {
+	/** Name used to select the backend. */
+	const char *name;
+	/** Set up the backend. bd->fd, size and nblocks are already set. */
+	bool (*open)(bdev *bd);
+	/** Release everything allocated in open(). Data is flushed already. */
+	void (*close)(bdev *bd);
+	/** Get (and pin) a data block; if zero, skip reading and zero it. */
+	void *(*get)(bdev *bd, vsfs_blk_t blk, bool zero);
+	/** Unpin a data block; dirty if its contents were modified. */
+	void (*put)(bdev *bd, vsfs_blk_t blk, bool dirty);
+	/** Hint that the given data blocks will be read soon. */
+	void (*readahead)(bdev *bd, const vsfs_blk_t *blks, int n);
+	/** Write back all modified data blocks. */
+	bool (*flush)(bdev *bd);
+	/** Forget cached contents of blocks [blk, blk + n) without writing. */
+	void (*discard)(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n);
+	/**
+	 * Adapt to a new image size or layout (bd->size is still the old one;
+	 * the files have their new size already, unless they are shrinking).
+	 * NULL if there is nothing to do.
+	 */
+	bool (*resize)(bdev *bd, size_t size);
+	/**
+	 * Start writing back modified blocks in the background (see
+	 * bdev_writeback()). NULL if the backend doesn't support it.
+	 */
+	bool (*writeback)(bdev *bd, unsigned int interval_ms);
+} bdev_ops;
+
+/** An open disk image. */
+struct bdev {
+	/** Backend functions. */
+	const bdev_ops *ops;
+	/** Image file descriptor (of the first image, if striped). */
+	int fd;
+	/** Image size in bytes (of all images, if striped). */
+	size_t size;
+	/** Image size in blocks (of all images, if striped). */
+	vsfs_blk_t nblocks;
+	/** Layout of the images; a single image has a count of 1. */
+	stripe_layout stripe;
+	/** File descriptors of the images; fds[0] is fd. */
+	int fds[STRIPE_MAX_IMAGES];
+	/** Number of data blocks the buffer cache can hold (if used). */
+	size_t cache_blocks;
+	/** True if the image is opened with O_DIRECT. */
+	bool direct;
+
+	/** Resident copy of blocks [0, meta_blocks); see bdev_map_meta(). */
+	void *meta;
+	vsfs_blk_t meta_blocks;
+	/** True if the whole image is mapped at meta (no copy to write back). */
+	bool mapped;
+
+	/** Checksum table (block-aligned copy); NULL if checksums are off. */
+	uint32_t *csums;
+	/** First block of the table in the image, and its size in blocks. */
+	vsfs_blk_t csum_blk;
+	vsfs_blk_t csum_blocks;
+	/** Number of blocks that have checksums. */
+	vsfs_blk_t csum_nblocks;
+	/** Checksum state of each block (see bdev.c). */
+	uint8_t *csum_state;
+
+	/** Backend private state. */
+	void *priv;
+};
+
+/**
+ * Open the image file with the given backend.
+ *
+ * File size must be a non-zero multiple of the block size.
+ *
+ * @param bd            pointer to the block device to initialize.
+ * @param path          image file path.
+ * @param backend       backend name; NULL selects the default (mmap).
+ * @param cache_blocks  buffer cache size in blocks; 0 selects the default.
+ * @param direct        open the image with O_DIRECT; the default backend is
+ *                      then pread, and mmap can't be used.
+ * @return              true on success; false on failure.
+ */
+bool bdev_open(bdev *bd, const char *path, const char *backend,
+               size_t cache_blocks, bool direct);
+
+/**
+ * Flush all changes and close the image.
+ *
+ * @param bd  pointer to the block device to close.
+ */
+void bdev_close(bdev *bd);
+
+/**
+ * Make blocks [0, nblocks) of the image resident in memory and return a
+ * pointer to them. Can be called again with a larger count (e.g. once the
+ * superblock has been read); pointers returned by earlier calls become invalid.
+ * Resident blocks are written back by bdev_flush().
+ *
+ * @param bd       pointer to the block device.
+ * @param nblocks  number of blocks at the start of the image.
+ * @return         pointer to the first block; NULL on failure.
+ */
+void *bdev_map_meta(bdev *bd, vsfs_blk_t nblocks);
+
+/**
+ * Keep the CRC32C checksum of each of blocks [0, nblocks) in the table at
+ * table_blk (see vsfs.h). The resident metadata blocks are verified right
+ * away, and every other block the first time it is read with bdev_get().
+ * Checksums of modified blocks are recomputed lazily, by bdev_flush().
+ *
+ * @param bd         pointer to the block device; the metadata must be
+ *                   resident already.
+ * @param table_blk  first block of the checksum table.
+ * @param nblocks    number of blocks that have checksums.
+ * @return           true on success; false on I/O error or if the metadata
+ *                   doesn't match its checksums.
+ */
+bool bdev_csum_enable(bdev *bd, vsfs_blk_t table_blk, vsfs_blk_t nblocks);
+
+/**
+ * Get a pointer to the contents of a block. Must be paired with bdev_put().
+ *
+ * @param bd   pointer to the block device.
+ * @param blk  block number.
+ * @return     pointer to VSFS_BLOCK_SIZE bytes; NULL on I/O error, or if the
+ *             block doesn't match its checksum.
+ */
+void *bdev_get(bdev *bd, vsfs_blk_t blk);
+
+/**
+ * Same as bdev_get(), but the block is zeroed instead of being read. Used for
+ * newly allocated blocks and blocks that are about to be overwritten.
+ */
+void *bdev_get_zeroed(bdev *bd, vsfs_blk_t blk);
+
+/**
+ * Release a block obtained with bdev_get() or bdev_get_zeroed().
+ *
+ * @param bd     pointer to the block device.
+ * @param blk    block number.
+ * @param dirty  true if the contents of the block were modified.
+ */
+void bdev_put(bdev *bd, vsfs_blk_t blk, bool dirty);
+
+/**
+ * Start reading the given blocks, which are expected to be accessed soon.
+ * Block number 0 entries are ignored.
+ *
+ * @param bd    pointer to the block device.
+ * @param blks  block numbers.
+ * @param n     number of blocks.
+ */
+void bdev_readahead(bdev *bd, const vsfs_blk_t *blks, int n);
+
+/**
+ * Release blocks [blk, blk + n) to the host: they are punched out of the image
+ * file (which stays sparse) and read as zeros afterwards. Any cached contents
+ * are dropped. None of the blocks may be in use (obtained with bdev_get()).
+ *
+ * @param bd   pointer to the block device.
+ * @param blk  first block number.
+ * @param n    number of blocks.
+ * @return     true on success; false if the host file system doesn't support
+ *             punching holes (the blocks are then left as they are).
+ */
+bool bdev_discard(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n);
+
+/**
+ * Spread the block device over several images (see stripe.h), after the
+ * first one was opened with bdev_open(). The other images are opened the
+ * same way. The device size becomes that of the largest file system that
+ * fits into the images.
+ *
+ * Must be called before any data block is accessed; resident metadata
+ * should be mapped again, as it can move (with the mmap backend).
+ *
+ * @param bd     pointer to the block device.
+ * @param sl     layout; sl->count - 1 paths are given.
+ * @param paths  paths of the images after the first one, in order.
+ * @return       true on success; false on failure.
+ */
+bool bdev_stripe(bdev *bd, const stripe_layout *sl, const char *const *paths);
+
+/**
+ * Find where a block is stored.
+ *
+ * @param bd   pointer to the block device.
+ * @param blk  block number.
+ * @param off  set to the byte offset of the block in its image.
+ * @param run  set to the number of blocks from blk on that follow it in the
+ *             same image.
+ * @return     file descriptor of the image.
+ */
+static inline int bdev_locate(const bdev *bd, vsfs_blk_t blk, off_t *off,
+                              vsfs_blk_t *run)
+{
+	uint32_t img;
+	vsfs_blk_t b;
+	*run = stripe_locate(&bd->stripe, blk, &img, &b);
+	*off = (off_t)b * VSFS_BLOCK_SIZE;
+	return bd->fds[img];
+}
+
+/**
+ * Change the size of the image file. When shrinking, the cached contents of
+ * the blocks that are cut off are dropped; none of them may be in use. The
+ * resident metadata can move (with the mmap backend): pointers returned by
+ * bdev_map_meta() become invalid, and bd->meta points to it. If the image
+ * has checksums, the table must already have the right size for the new
+ * number of blocks. Not supported for striped devices.
+ *
+ * @param bd       pointer to the block device.
+ * @param nblocks  new image size in blocks.
+ * @return         true on success; false on failure (the size is then
+ *                 unchanged).
+ */
+bool bdev_resize(bdev *bd, vsfs_blk_t nblocks);
+
+/**
+ * Start a thread that writes back the modified data blocks in the background:
+ * every interval_ms milliseconds, those that haven't been modified since the
+ * previous interval (see bcache_writeback()). Only supported by the cached
+ * backends (pread, uring). Metadata is still only written by bdev_flush().
+ *
+ * Must be called after the last fork() of the process (e.g. once FUSE has
+ * detached from the terminal); the thread stops when the device is closed.
+ *
+ * @param bd           pointer to the block device.
+ * @param interval_ms  time between write-back passes in milliseconds.
+ * @return             true on success; false if not supported by the
+ *                     backend, or if the thread can't be started.
+ */
+bool bdev_writeback(bdev *bd, unsigned int interval_ms);
+
+/**
+ * Write all modified blocks to the image and wait for them to reach stable
+ * storage. The data is synced before the checksums and the metadata are
+ * written.
+ *
+ * @param bd  pointer to the block device.
+ * @return    true on success; false on I/O error.
+ */
+bool bdev_flush(bdev *bd);
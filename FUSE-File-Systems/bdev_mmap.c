@@ -0,0 +1,129 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - mmap block device backend.
+ *
+ * The whole image is mapped into memory; the kernel decides when modified
+ * pages are written back.
+ */
+
+// mremap()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bdev.h"
+#include "util.h"
+
+
+static bool mmap_open(bdev *bd)
+{
+	if (bd->direct) {
+		fprintf(stderr, "The mmap backend can't be used with O_DIRECT\n");
+		return false;
+	}
+
+	void *addr = mmap(NULL, bd->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                  bd->fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	assert(is_aligned((size_t)addr, VSFS_BLOCK_SIZE));
+
+	bd->meta = addr;
+	bd->mapped = true;
+	return true;
+}
+
+static void mmap_close(bdev *bd)
+{
+	munmap(bd->meta, bd->size);
+	bd->meta = NULL;
+}
+
+static void *mmap_get(bdev *bd, vsfs_blk_t blk, bool zero)
+{
+	void *data = bd->meta + (size_t)blk * VSFS_BLOCK_SIZE;
+	if (zero) {
+		memset(data, 0, VSFS_BLOCK_SIZE);
+	}
+	return data;
+}
+
+static void mmap_put(bdev *bd, vsfs_blk_t blk, bool dirty)
+{
+	(void)bd;
+	(void)blk;
+	(void)dirty;
+}
+
+static void mmap_readahead(bdev *bd, const vsfs_blk_t *blks, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		if (blks[i] != 0) {
+			madvise(bd->meta + (size_t)blks[i] * VSFS_BLOCK_SIZE,
+			        VSFS_BLOCK_SIZE, MADV_WILLNEED);
+		}
+	}
+}
+
+static bool mmap_flush(bdev *bd)
+{
+	if (msync(bd->meta, bd->size, MS_SYNC) < 0) {
+		perror("msync");
+		return false;
+	}
+	return true;
+}
+
+// Nothing is cached; punching a hole in the file also clears the mapping
+static void mmap_discard(bdev *bd, vsfs_blk_t blk, vsfs_blk_t n)
+{
+	(void)bd;
+	(void)blk;
+	(void)n;
+}
+
+// The mapping follows the file; it can move to a different address. A striped
+// device is mapped again from scratch, one run of blocks at a time.
+static bool mmap_resize(bdev *bd, size_t size)
+{
+	if (bd->stripe.count > 1) {
+		void *addr = stripe_mmap(&bd->stripe, bd->fds, size / VSFS_BLOCK_SIZE);
+		if (addr == NULL) {
+			return false;
+		}
+		munmap(bd->meta, bd->size);
+		bd->meta = addr;
+		return true;
+	}
+
+	void *addr = mremap(bd->meta, bd->size, size, MREMAP_MAYMOVE);
+	if (addr == MAP_FAILED) {
+		perror("mremap");
+		return false;
+	}
+	assert(is_aligned((size_t)addr, VSFS_BLOCK_SIZE));
+	bd->meta = addr;
+	return true;
+}
+
+const bdev_ops bdev_mmap_ops = {
+	"mmap", mmap_open, mmap_close, mmap_get, mmap_put, mmap_readahead,
+	mmap_flush, mmap_discard, mmap_resize, NULL
+};
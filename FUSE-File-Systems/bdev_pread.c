@@ -0,0 +1,82 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - pread/pwrite block device backend.
+ *
+ * Data blocks are kept in the buffer cache (see bcache.h). Runs of adjacent
+ * blocks are transferred with a single preadv()/pwritev() call.
+ */
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include "bcache.h"
+
+/** Maximum number of blocks transferred by one system call. */
+#define PREAD_MAX_IOV 256
+
+
+// Transfer bufs (sorted by block number) one run of adjacent blocks at a time.
+// On a striped device a run also ends where the stripe unit ends.
+static bool pread_rw(bdev *bd, bcache_buf **bufs, int n, bool write)
+{
+	struct iovec iov[PREAD_MAX_IOV];
+
+	for (int i = 0; i < n; ) {
+		off_t off;
+		vsfs_blk_t run;
+		int fd = bdev_locate(bd, bufs[i]->blk, &off, &run);
+		int cnt = 0;
+		do {
+			iov[cnt].iov_base = bufs[i + cnt]->data;
+			iov[cnt].iov_len = VSFS_BLOCK_SIZE;
+			++cnt;
+		} while (i + cnt < n && cnt < PREAD_MAX_IOV && (vsfs_blk_t)cnt < run &&
+		         bufs[i + cnt]->blk == bufs[i]->blk + cnt);
+
+		ssize_t len = (ssize_t)cnt * VSFS_BLOCK_SIZE;
+		ssize_t ret = write ? pwritev(fd, iov, cnt, off)
+		                    : preadv(fd, iov, cnt, off);
+		if (ret != len) {
+			perror(write ? "pwritev" : "preadv");
+			return false;
+		}
+		i += cnt;
+	}
+	return true;
+}
+
+static bool pread_read(bdev *bd, bcache_buf **bufs, int n)
+{
+	return pread_rw(bd, bufs, n, false);
+}
+
+static bool pread_write(bdev *bd, bcache_buf **bufs, int n)
+{
+	return pread_rw(bd, bufs, n, true);
+}
+
+static const bcache_io pread_io = { pread_read, pread_write };
+
+static bool pread_open(bdev *bd)
+{
+	return bcache_init(bd, &pread_io);
+}
+
+const bdev_ops bdev_pread_ops = {
+	"pread", pread_open, bcache_destroy, bcache_get, bcache_put,
+	bcache_readahead, bcache_flush, bcache_discard, bcache_resize,
+	bcache_writeback
+};
@@ -0,0 +1,275 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - io_uring block device backend.
+ *
+ * Same buffer cache as the pread backend (see bcache.h), but all the blocks
+ * of a batch (readahead, eviction write-back, flush) are submitted to the
+ * kernel with a single io_uring_enter() call, and the kernel can process
+ * them in parallel.
+ *
+ * We use the raw system calls rather than liburing to avoid an extra build
+ * dependency; see io_uring(7) for how the rings are shared with the kernel.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "bcache.h"
+
+/** Number of submission queue entries. */
+#define URING_ENTRIES 64
+
+
+/** Submission and completion rings shared with the kernel. */
+typedef struct uring {
+	int fd;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/** One iovec per submission queue entry. */
+	struct iovec iov[URING_ENTRIES];
+
+	/**
+	 * Set when io_uring_enter() fails. The rings may then hold entries the
+	 * kernel hasn't consumed, so all further I/O fails.
+	 */
+	bool broken;
+} uring;
+
+static void uring_free(uring *ring)
+{
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	free(ring);
+}
+
+static uring *uring_create(void)
+{
+	struct io_uring_params p;
+	uring *ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		perror("io_uring_setup");
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+	ring->cq_ring_size = p.cq_off.cqes +
+	                     p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_CQ_RING);
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+	    ring->sqes == MAP_FAILED)
+	{
+		perror("mmap");
+		if (ring->sq_ring == MAP_FAILED) ring->sq_ring = NULL;
+		if (ring->cq_ring == MAP_FAILED) ring->cq_ring = NULL;
+		if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+		uring_free(ring);
+		return NULL;
+	}
+
+	ring->sq_tail  = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask  = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->cq_head  = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail  = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask  = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes     = ring->cq_ring + p.cq_off.cqes;
+	return ring;
+}
+
+// Submit up to URING_ENTRIES block transfers and wait for all of them
+static bool uring_submit(bdev *bd, uring *ring, bcache_buf **bufs, int n,
+                         bool write)
+{
+	unsigned int tail = *ring->sq_tail;
+
+	for (int i = 0; i < n; ++i) {
+		unsigned int idx = tail & *ring->sq_mask;
+		struct io_uring_sqe *sqe = &ring->sqes[idx];
+		off_t off;
+		vsfs_blk_t run;
+		int fd = bdev_locate(bd, bufs[i]->blk, &off, &run);
+
+		ring->iov[i].iov_base = bufs[i]->data;
+		ring->iov[i].iov_len = VSFS_BLOCK_SIZE;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->fd = fd;
+		sqe->addr = (unsigned long)&ring->iov[i];
+		sqe->len = 1;
+		sqe->off = off;
+		sqe->user_data = i;
+		ring->sq_array[idx] = idx;
+		++tail;
+	}
+	// Make the entries visible to the kernel before the new tail
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	int submitted = 0;
+	while (submitted < n) {
+		int ret = syscall(__NR_io_uring_enter, ring->fd, n - submitted,
+		                  n - submitted, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("io_uring_enter");
+			// The entries already submitted are in flight and use our
+			// buffers; wait for them below before giving up
+			ring->broken = true;
+			break;
+		}
+		submitted += ret;
+	}
+
+	bool ok = true;
+	int completed = 0;
+	unsigned int head = *ring->cq_head;
+	while (completed < submitted) {
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			// Not done yet; wait for the rest. If we can't, the kernel
+			// still owns the buffers, so poll until it's done with them.
+			if (ring->broken) {
+				sched_yield();
+				continue;
+			}
+			int ret = syscall(__NR_io_uring_enter, ring->fd, 0,
+			                  submitted - completed,
+			                  IORING_ENTER_GETEVENTS, NULL, 0);
+			if (ret < 0 && errno != EINTR) {
+				perror("io_uring_enter");
+				ring->broken = true;
+			}
+			continue;
+		}
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		if (cqe->res != VSFS_BLOCK_SIZE) {
+			fprintf(stderr, "io_uring %s of block %u: %s\n",
+			        write ? "write" : "read", bufs[cqe->user_data]->blk,
+			        cqe->res < 0 ? strerror(-cqe->res) : "short transfer");
+			ok = false;
+		}
+		++head;
+		++completed;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return ok && !ring->broken;
+}
+
+static bool uring_rw(bdev *bd, bcache_buf **bufs, int n, bool write)
+{
+	uring *ring = (uring *)((bcache *)bd->priv)->io_priv;
+	bool ok = true;
+
+	if (ring->broken) {
+		fprintf(stderr, "io_uring %s: ring is unusable after an error\n",
+		        write ? "write" : "read");
+		return false;
+	}
+	for (int i = 0; i < n && !ring->broken; i += URING_ENTRIES) {
+		int cnt = (n - i < URING_ENTRIES) ? n - i : URING_ENTRIES;
+		if (!uring_submit(bd, ring, bufs + i, cnt, write)) {
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static bool uring_read(bdev *bd, bcache_buf **bufs, int n)
+{
+	return uring_rw(bd, bufs, n, false);
+}
+
+static bool uring_write(bdev *bd, bcache_buf **bufs, int n)
+{
+	return uring_rw(bd, bufs, n, true);
+}
+
+static const bcache_io uring_io = { uring_read, uring_write };
+
+static bool uring_open(bdev *bd)
+{
+	uring *ring = uring_create();
+	if (ring == NULL) {
+		return false;
+	}
+	if (!bcache_init(bd, &uring_io)) {
+		uring_free(ring);
+		return false;
+	}
+	((bcache *)bd->priv)->io_priv = ring;
+	return true;
+}
+
+static void uring_close(bdev *bd)
+{
+	// The write-back thread may still be using the ring until it's stopped
+	uring *ring = (uring *)((bcache *)bd->priv)->io_priv;
+	bcache_destroy(bd);
+	uring_free(ring);
+}
+
+const bdev_ops bdev_uring_ops = {
+	"uring", uring_open, uring_close, bcache_get, bcache_put,
+	bcache_readahead, bcache_flush, bcache_discard, bcache_resize,
+	bcache_writeback
+};
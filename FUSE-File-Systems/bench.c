@@ -0,0 +1,270 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block device backend benchmark.
+ *
+ * Compares the block device backends (see bdev.h) on a vsfs image:
+ * sequential reads with readahead, random reads, and random rewrites followed
+ * by a flush. Blocks are rewritten with their own contents, so the image is
+ * not modified, but it must not be mounted while the benchmark is running.
+ * Block checksums are verified and updated if the image has them.
+ *
+ * With -z, measures cluster compression (see compress.h) on the contents of
+ * any file instead: the space saved and the compression and decompression
+ * throughput.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bdev.h"
+#include "compress.h"
+
+/** Number of blocks read ahead in the sequential test (same as vsfs). */
+#define BENCH_READAHEAD 8
+
+static const char *all_backends[] = { "mmap", "pread", "uring" };
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_result(const char *backend, const char *test, size_t nops,
+                         double secs)
+{
+	double mib = (double)nops * VSFS_BLOCK_SIZE / (1024 * 1024);
+	printf("%-6s %-10s %8zu blocks %9.3f ms %10.1f MiB/s\n", backend, test,
+	       nops, secs * 1000, secs > 0 ? mib / secs : 0.0);
+}
+
+// Run all tests with one backend. Returns false on I/O error.
+static bool bench_backend(const char *path, const char *backend,
+                          size_t cache_blocks, bool direct, size_t nops)
+{
+	bdev bd;
+	if (!bdev_open(&bd, path, backend, cache_blocks, direct)) {
+		return false;
+	}
+
+	vsfs_superblock *sb = bdev_map_meta(&bd, 1);
+	if (sb == NULL || sb->magic != VSFS_MAGIC ||
+	    sb->data_region >= sb->num_blocks || sb->num_blocks > bd.nblocks) {
+		fprintf(stderr, "%s: not a vsfs image\n", path);
+		bdev_close(&bd);
+		return false;
+	}
+	vsfs_blk_t first = sb->data_region;
+	vsfs_blk_t count = sb->num_blocks - first;
+	sb = bdev_map_meta(&bd, first);
+	if (sb == NULL) {
+		bdev_close(&bd);
+		return false;
+	}
+	// Checksums are verified on first read, like in vsfs
+	if ((sb->features & VSFS_FEATURE_CSUM) &&
+	    (sb->csum_blk < first ||
+	     sb->csum_blk > sb->num_blocks - VSFS_CSUM_BLOCKS(sb->num_blocks) ||
+	     !bdev_csum_enable(&bd, sb->csum_blk, sb->num_blocks))) {
+		bdev_close(&bd);
+		return false;
+	}
+
+	bool ok = true;
+	volatile unsigned char sum = 0;
+	double start;
+
+	// Sequential reads, starting a readahead window every BENCH_READAHEAD
+	start = now();
+	size_t seq = (nops < count) ? nops : count;
+	for (size_t i = 0; i < seq && ok; ++i) {
+		if (i % BENCH_READAHEAD == 0) {
+			vsfs_blk_t ra[BENCH_READAHEAD];
+			int n = 0;
+			for (size_t j = i + 1; j < seq && n < BENCH_READAHEAD; ++j) {
+				ra[n++] = first + j;
+			}
+			bdev_readahead(&bd, ra, n);
+		}
+		unsigned char *data = bdev_get(&bd, first + i);
+		if (data == NULL) {
+			ok = false;
+			break;
+		}
+		sum += data[0];
+		bdev_put(&bd, first + i, false);
+	}
+	print_result(backend, "seq-read", seq, now() - start);
+
+	// Random reads
+	srand(369);
+	start = now();
+	for (size_t i = 0; i < nops && ok; ++i) {
+		vsfs_blk_t blk = first + rand() % count;
+		unsigned char *data = bdev_get(&bd, blk);
+		if (data == NULL) {
+			ok = false;
+			break;
+		}
+		sum += data[0];
+		bdev_put(&bd, blk, false);
+	}
+	print_result(backend, "rand-read", nops, now() - start);
+
+	// Random rewrites (contents unchanged) and a flush at the end
+	start = now();
+	for (size_t i = 0; i < nops && ok; ++i) {
+		vsfs_blk_t blk = first + rand() % count;
+		if (bdev_get(&bd, blk) == NULL) {
+			ok = false;
+			break;
+		}
+		bdev_put(&bd, blk, true);
+	}
+	if (ok && !bdev_flush(&bd)) {
+		ok = false;
+	}
+	print_result(backend, "rand-write", nops, now() - start);
+
+	bdev_close(&bd);
+	return ok;
+}
+
+// Compress and decompress every complete cluster of a file. Returns false
+// on error.
+static bool bench_compress(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+
+	static char raw[VSFS_CLUSTER_SIZE];
+	static char buf[(VSFS_CLUSTER_BLOCKS - 1) * VSFS_BLOCK_SIZE];
+	static char out[VSFS_CLUSTER_SIZE];
+	size_t nclusters = 0, ncompressed = 0, nblocks = 0;
+	double ctime = 0, dtime = 0;
+	bool ok = true;
+	ssize_t len;
+
+	while ((len = read(fd, raw, sizeof(raw))) == (ssize_t)sizeof(raw)) {
+		double start = now();
+		vsfs_blk_t n = cluster_compress(raw, buf);
+		ctime += now() - start;
+		nclusters++;
+		if (n == 0) {
+			nblocks += VSFS_CLUSTER_BLOCKS;
+			continue;
+		}
+		nblocks += n;
+		ncompressed++;
+
+		start = now();
+		bool dok = cluster_decompress(buf, n, out);
+		dtime += now() - start;
+		if (!dok || memcmp(raw, out, sizeof(raw)) != 0) {
+			fprintf(stderr, "%s: cluster %zu does not round-trip\n", path,
+			        nclusters - 1);
+			ok = false;
+			break;
+		}
+	}
+	if (len < 0) {
+		perror(path);
+		ok = false;
+	}
+	close(fd);
+
+	size_t raw_blocks = nclusters * VSFS_CLUSTER_BLOCKS;
+	printf("%zu clusters, %zu blocks stored in %zu (%.1f%%)\n", nclusters,
+	       raw_blocks, nblocks,
+	       raw_blocks > 0 ? 100.0 * nblocks / raw_blocks : 0.0);
+	double mib = (double)nclusters * VSFS_CLUSTER_SIZE / (1024 * 1024);
+	printf("compress   %9.3f ms %10.1f MiB/s\n", ctime * 1000,
+	       ctime > 0 ? mib / ctime : 0.0);
+	mib = (double)ncompressed * VSFS_CLUSTER_SIZE / (1024 * 1024);
+	printf("decompress %9.3f ms %10.1f MiB/s (%zu compressed clusters)\n",
+	       dtime * 1000, dtime > 0 ? mib / dtime : 0.0, ncompressed);
+	return ok;
+}
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, "Usage: %s [-b backend] [-c cache_blocks] [-d] [-n ops] "
+	           "image\n", progname);
+	fprintf(f, "       %s -z file\n", progname);
+	fprintf(f, "    -b backend       test only this backend "
+	           "(mmap, pread or uring; default: all)\n");
+	fprintf(f, "    -c cache_blocks  buffer cache size in blocks\n");
+	fprintf(f, "    -d               open the image with O_DIRECT "
+	           "(skips mmap)\n");
+	fprintf(f, "    -n ops           number of blocks per test "
+	           "(default: 16384)\n");
+	fprintf(f, "    -z file          benchmark cluster compression on the "
+	           "contents of file\n");
+	fprintf(f, "    -h               print help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *backend = NULL;
+	size_t cache_blocks = 0;
+	size_t nops = 16384;
+	const char *zfile = NULL;
+	bool direct = false;
+	char opt;
+
+	while ((opt = getopt(argc, argv, "b:c:dn:z:h")) != -1) {
+		switch (opt) {
+			case 'b': backend = optarg; break;
+			case 'c': cache_blocks = strtoul(optarg, NULL, 10); break;
+			case 'd': direct = true; break;
+			case 'n': nops = strtoul(optarg, NULL, 10); break;
+			case 'z': zfile = optarg; break;
+			case 'h': print_help(stdout, argv[0]); return 0;
+			default : print_help(stderr, argv[0]); return 1;
+		}
+	}
+	if (zfile != NULL && optind == argc) {
+		return bench_compress(zfile) ? 0 : 1;
+	}
+	if (optind != argc - 1 || nops == 0) {
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	const char *path = argv[optind];
+
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(all_backends) / sizeof(all_backends[0]);
+	     ++i) {
+		if (direct && backend == NULL &&
+		    strcmp(all_backends[i], "mmap") == 0) {
+			continue;
+		}
+		if (backend == NULL || strcmp(backend, all_backends[i]) == 0) {
+			ok = bench_backend(path, all_backends[i], cache_blocks,
+			                   direct, nops) && ok;
+		}
+	}
+	return ok ? 0 : 1;
+}
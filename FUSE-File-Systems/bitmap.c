@@ -77,6 +77,32 @@ int bitmap_alloc(bitmap_t *b, uint32_t nbits, uint32_t *index)
 	return -1;
 }
 
+// Find the first unused bit at or after index start, without marking it, and
+// return its index in *index. Returns 0 on success and -1 if there is none.
+int bitmap_find_free(bitmap_t *b, uint32_t nbits, uint32_t start,
+                     uint32_t *index)
+{
+	uint32_t max_idx = div_round_up(nbits, bits_per_word);
+	size_t *words = (size_t *)b;
+
+	for (uint32_t idx = start / bits_per_word; idx < max_idx; ++idx) {
+		// Ignore the bits before start in the first word
+		size_t used = words[idx];
+		if (idx == start / bits_per_word) {
+			used |= ((size_t)1 << (start % bits_per_word)) - 1;
+		}
+		if (used != word_all_bits) {
+			for (uint32_t offset = 0; offset < bits_per_word; ++offset) {
+				if ((used & ((size_t)1 << offset)) == 0) {
+					*index = (idx * bits_per_word) + offset;
+					return (*index < nbits) ? 0 : -1;
+				}
+			}
+		}
+	}
+	return -1;
+}
+
 // Marks the bit at the given index as available (0).
 // The supplied index must be less than the number of bits in the bitmap.
 // The bitmap at the supplied index must be marked allocated.
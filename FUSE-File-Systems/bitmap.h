@@ -41,6 +41,11 @@ int bitmap_init(bitmap_t *b, uint32_t nbits);
 // Returns 0 on success and -1 if all bits are already marked as in-use.
 int bitmap_alloc(bitmap_t *b, uint32_t nbits, uint32_t *index);
 
+// Find the first unused bit at or after index start, without marking it, and
+// return its index in *index. Returns 0 on success and -1 if there is none.
+int bitmap_find_free(bitmap_t *b, uint32_t nbits, uint32_t start,
+                     uint32_t *index);
+
 // Marks the bit at the given index as available (0).
 // The supplied index must be less than the number of bits in the bitmap.
 // The bitmap at the supplied index must be marked allocated.
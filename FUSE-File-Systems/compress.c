@@ -0,0 +1,106 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Cluster compression implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "lz.h"
+#include "util.h"
+
+
+vsfs_blk_t cluster_compress(const void *raw, void *buf)
+{
+	size_t cap = (VSFS_CLUSTER_BLOCKS - 1) * VSFS_BLOCK_SIZE;
+	vsfs_zheader *hdr = buf;
+
+	size_t size = lz_compress(raw, VSFS_CLUSTER_SIZE, hdr + 1,
+	                          cap - sizeof(*hdr));
+	if (size == 0) {
+		return 0;
+	}
+	hdr->z_size = size;
+	hdr->z_reserved = 0;
+
+	size_t total = sizeof(*hdr) + size;
+	vsfs_blk_t nblocks = div_round_up(total, VSFS_BLOCK_SIZE);
+	memset((char *)buf + total, 0, nblocks * VSFS_BLOCK_SIZE - total);
+	return nblocks;
+}
+
+bool cluster_decompress(const void *buf, vsfs_blk_t nblocks, void *raw)
+{
+	const vsfs_zheader *hdr = buf;
+	size_t cap = nblocks * VSFS_BLOCK_SIZE - sizeof(*hdr);
+
+	if (hdr->z_size > cap || hdr->z_reserved != 0) {
+		return false;
+	}
+	return lz_decompress(hdr + 1, hdr->z_size, raw, VSFS_CLUSTER_SIZE) ==
+	       VSFS_CLUSTER_SIZE;
+}
+
+
+bool zcache_init(zcache *zc)
+{
+	memset(zc, 0, sizeof(*zc));
+	zc->data = malloc((size_t)ZCACHE_ENTRIES * VSFS_CLUSTER_SIZE);
+	return zc->data != NULL;
+}
+
+void zcache_destroy(zcache *zc)
+{
+	free(zc->data);
+	zc->data = NULL;
+}
+
+void *zcache_lookup(zcache *zc, vsfs_blk_t blk)
+{
+	assert(blk != 0);
+	for (int i = 0; i < ZCACHE_ENTRIES; ++i) {
+		if (zc->blk[i] == blk) {
+			zc->used[i] = ++zc->clock;
+			return (char *)zc->data + (size_t)i * VSFS_CLUSTER_SIZE;
+		}
+	}
+	return NULL;
+}
+
+void *zcache_insert(zcache *zc, vsfs_blk_t blk)
+{
+	assert(blk != 0);
+	int victim = 0;
+	for (int i = 1; i < ZCACHE_ENTRIES; ++i) {
+		if (zc->used[i] < zc->used[victim]) {
+			victim = i;
+		}
+	}
+	zc->blk[victim] = blk;
+	zc->used[victim] = ++zc->clock;
+	return (char *)zc->data + (size_t)victim * VSFS_CLUSTER_SIZE;
+}
+
+void zcache_invalidate(zcache *zc, vsfs_blk_t blk)
+{
+	for (int i = 0; i < ZCACHE_ENTRIES; ++i) {
+		if (zc->blk[i] == blk) {
+			zc->blk[i] = 0;
+			zc->used[i] = 0;
+		}
+	}
+}
@@ -0,0 +1,109 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Cluster compression header file.
+ *
+ * Encoding of compressed clusters (see vsfs.h) and a small cache of
+ * decompressed clusters, so that reading a compressed file block by block
+ * decompresses each cluster once.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "vsfs.h"
+
+/** Size of a cluster in bytes. */
+#define VSFS_CLUSTER_SIZE (VSFS_CLUSTER_BLOCKS * VSFS_BLOCK_SIZE)
+
+/** Number of decompressed clusters kept in the cache. */
+#define ZCACHE_ENTRIES 16
+
+
+/**
+ * Compress a cluster.
+ *
+ * @param raw  VSFS_CLUSTER_SIZE bytes of cluster contents.
+ * @param buf  receives the encoded cluster (header and compressed data);
+ *             must be (VSFS_CLUSTER_BLOCKS - 1) blocks large.
+ * @return     number of blocks the encoded cluster takes (the rest of the
+ *             last block is zeroed); 0 if compression doesn't save a block.
+ */
+vsfs_blk_t cluster_compress(const void *raw, void *buf);
+
+/**
+ * Decompress a cluster.
+ *
+ * @param buf      encoded cluster.
+ * @param nblocks  number of blocks the encoded cluster takes.
+ * @param raw      receives VSFS_CLUSTER_SIZE bytes of cluster contents.
+ * @return         true on success; false if the data is corrupted.
+ */
+bool cluster_decompress(const void *buf, vsfs_blk_t nblocks, void *raw);
+
+
+/** Decompressed cluster cache. */
+typedef struct zcache {
+	/** First block of each cached compressed cluster; 0 if unused. */
+	vsfs_blk_t blk[ZCACHE_ENTRIES];
+	/** Last use time of each entry, for LRU replacement. */
+	unsigned long used[ZCACHE_ENTRIES];
+	unsigned long clock;
+	/** Decompressed contents of each entry. */
+	void *data;
+} zcache;
+
+/**
+ * Allocate the cache.
+ *
+ * @param zc  pointer to the cache to initialize.
+ * @return    true on success; false on failure.
+ */
+bool zcache_init(zcache *zc);
+
+/**
+ * Free the cache.
+ *
+ * @param zc  pointer to the cache.
+ */
+void zcache_destroy(zcache *zc);
+
+/**
+ * Find a cached cluster.
+ *
+ * @param zc   pointer to the cache.
+ * @param blk  first block of the compressed cluster.
+ * @return     decompressed contents; NULL if not cached.
+ */
+void *zcache_lookup(zcache *zc, vsfs_blk_t blk);
+
+/**
+ * Get an entry for a cluster, replacing the least recently used one. The
+ * caller must fill it in, or remove it with zcache_invalidate() on failure.
+ *
+ * @param zc   pointer to the cache.
+ * @param blk  first block of the compressed cluster.
+ * @return     buffer for the decompressed contents.
+ */
+void *zcache_insert(zcache *zc, vsfs_blk_t blk);
+
+/**
+ * Remove a cluster from the cache, e.g. when its first block is freed.
+ *
+ * @param zc   pointer to the cache.
+ * @param blk  first block of the compressed cluster.
+ */
+void zcache_invalidate(zcache *zc, vsfs_blk_t blk);
@@ -0,0 +1,191 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - CRC32C (Castagnoli) checksum implementation.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "crc32c.h"
+
+/** Reflected CRC32C polynomial. */
+#define CRC32C_POLY 0x82F63B78u
+
+/**
+ * Bytes per stream in each round of the hardware implementation. Three
+ * streams of this size fit in a 4K block (with a 16 byte tail).
+ */
+#define CRC32C_STRIDE 1360
+
+
+// Polynomials are in the reflected representation used by the CRC: bit 31
+// is the coefficient of x^0.
+
+// a * b modulo the CRC polynomial
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+// x^n modulo the CRC polynomial
+static uint32_t xnmodp(uint64_t n)
+{
+	uint32_t p = 1u << 31; // x^0
+	uint32_t sq = 1u << 30; // x^1, squared for each bit of n
+
+	for (; n > 0; n >>= 1) {
+		if (n & 1) {
+			p = multmodp(sq, p);
+		}
+		sq = multmodp(sq, sq);
+	}
+	return p;
+}
+
+
+// Table-driven implementation, 8 bytes at a time ("slicing by 8")
+static uint32_t sw_table[8][256];
+
+static void sw_init(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		sw_table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; ++i) {
+		for (int t = 1; t < 8; ++t) {
+			uint32_t prev = sw_table[t - 1][i];
+			sw_table[t][i] = (prev >> 8) ^ sw_table[0][prev & 0xff];
+		}
+	}
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		w ^= crc;
+		crc = sw_table[7][w & 0xff] ^ sw_table[6][(w >> 8) & 0xff] ^
+		      sw_table[5][(w >> 16) & 0xff] ^ sw_table[4][(w >> 24) & 0xff] ^
+		      sw_table[3][(w >> 32) & 0xff] ^ sw_table[2][(w >> 40) & 0xff] ^
+		      sw_table[1][(w >> 48) & 0xff] ^ sw_table[0][w >> 56];
+	}
+	for (; len > 0; ++p, --len) {
+		crc = (crc >> 8) ^ sw_table[0][(crc ^ *p) & 0xff];
+	}
+	return crc;
+}
+
+
+#if defined(__x86_64__)
+
+/**
+ * x^(8 * CRC32C_STRIDE - 33): multiplying a CRC by it with PCLMULQDQ and
+ * reducing the product with the crc32 instruction (which multiplies by x^32,
+ * and the reflected product is off by one more bit) shifts the CRC over
+ * CRC32C_STRIDE zero bytes.
+ */
+static uint64_t hw_shift_const;
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t hw_shift(uint32_t crc)
+{
+	__m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+	                                    _mm_cvtsi64_si128(hw_shift_const),
+	                                    0x00);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(prod));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	// The crc32 instruction has a latency of 3 cycles but can start every
+	// cycle, so three independent streams keep it busy
+	for (; len >= 3 * CRC32C_STRIDE;
+	     p += 3 * CRC32C_STRIDE, len -= 3 * CRC32C_STRIDE) {
+		uint64_t c0 = crc, c1 = 0, c2 = 0;
+		for (size_t i = 0; i < CRC32C_STRIDE; i += 8) {
+			uint64_t w0, w1, w2;
+			memcpy(&w0, p + i, 8);
+			memcpy(&w1, p + CRC32C_STRIDE + i, 8);
+			memcpy(&w2, p + 2 * CRC32C_STRIDE + i, 8);
+			c0 = _mm_crc32_u64(c0, w0);
+			c1 = _mm_crc32_u64(c1, w1);
+			c2 = _mm_crc32_u64(c2, w2);
+		}
+		crc = hw_shift(hw_shift(c0) ^ c1) ^ c2;
+	}
+
+	uint64_t c = crc;
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		c = _mm_crc32_u64(c, w);
+	}
+	crc = c;
+	for (; len > 0; ++p, --len) {
+		crc = _mm_crc32_u8(crc, *p);
+	}
+	return crc;
+}
+
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void)
+{
+	sw_init();
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+		hw_shift_const = xnmodp(8 * CRC32C_STRIDE - 33);
+		crc32c_impl = crc32c_hw;
+		return;
+	}
+#endif
+	crc32c_impl = crc32c_sw;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+	// fsck computes checksums from several threads
+	pthread_once(&crc32c_once, crc32c_init);
+	return ~crc32c_impl(~crc, data, len);
+}
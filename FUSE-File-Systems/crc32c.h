@@ -0,0 +1,38 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - CRC32C (Castagnoli) checksum header file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Compute the CRC32C of a buffer, or continue computing it.
+ *
+ * Uses the SSE4.2 crc32 instruction (three interleaved streams, combined
+ * with PCLMULQDQ) when the CPU supports it, and a table-driven
+ * implementation otherwise.
+ *
+ * @param crc   0 to start a new checksum, or the result for the preceding
+ *              data.
+ * @param data  pointer to the data.
+ * @param len   length of the data in bytes.
+ * @return      checksum of all the data so far.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
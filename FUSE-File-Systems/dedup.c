@@ -0,0 +1,145 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block deduplication index implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+
+
+// Multipliers from xxHash; any large odd constants would do
+#define FP_PRIME1 0x9E3779B185EBCA87ull
+#define FP_PRIME2 0xC2B2AE3D27D4EB4Full
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t block_fingerprint(const void *data)
+{
+	// Four independent lanes, so that the multiplies can overlap
+	uint64_t acc[4] = { FP_PRIME1, FP_PRIME2, 0, -FP_PRIME1 };
+	const unsigned char *p = data;
+
+	for (size_t i = 0; i < VSFS_BLOCK_SIZE; i += 4 * sizeof(uint64_t)) {
+		for (int lane = 0; lane < 4; ++lane) {
+			uint64_t w;
+			memcpy(&w, p + i + lane * sizeof(w), sizeof(w));
+			acc[lane] = rotl64(acc[lane] + w * FP_PRIME2, 31) * FP_PRIME1;
+		}
+	}
+
+	uint64_t h = rotl64(acc[0], 1) + rotl64(acc[1], 7) +
+	             rotl64(acc[2], 12) + rotl64(acc[3], 18);
+	h ^= h >> 33;
+	h *= FP_PRIME2;
+	h ^= h >> 29;
+	return (h != 0) ? h : 1;
+}
+
+
+bool dedup_init(dedup_index *di, vsfs_blk_t num_blocks)
+{
+	di->nslots = 16;
+	while (di->nslots < 2 * (size_t)num_blocks) {
+		di->nslots *= 2;
+	}
+	di->num_blocks = num_blocks;
+	di->slots = calloc(di->nslots, sizeof(*di->slots));
+	di->fps = calloc(num_blocks, sizeof(*di->fps));
+	if (di->slots == NULL || di->fps == NULL) {
+		dedup_destroy(di);
+		return false;
+	}
+	return true;
+}
+
+void dedup_destroy(dedup_index *di)
+{
+	free(di->slots);
+	free(di->fps);
+	di->slots = NULL;
+	di->fps = NULL;
+}
+
+static size_t slot_of(const dedup_index *di, uint64_t fp)
+{
+	return fp & (di->nslots - 1);
+}
+
+void dedup_insert(dedup_index *di, uint64_t fp, vsfs_blk_t blk)
+{
+	assert(blk != 0 && blk < di->num_blocks);
+	dedup_remove(di, blk);
+
+	// At most half of the slots are used, so there always is a free one
+	size_t i = slot_of(di, fp);
+	while (di->slots[i].blk != 0) {
+		i = (i + 1) & (di->nslots - 1);
+	}
+	di->slots[i] = (dedup_slot){ fp, blk };
+	di->fps[blk] = fp;
+}
+
+void dedup_remove(dedup_index *di, vsfs_blk_t blk)
+{
+	if (blk >= di->num_blocks || di->fps[blk] == 0) {
+		return;
+	}
+
+	size_t mask = di->nslots - 1;
+	size_t i = slot_of(di, di->fps[blk]);
+	while (di->slots[i].blk != blk) {
+		i = (i + 1) & mask;
+	}
+	di->fps[blk] = 0;
+
+	// Shift back the following entries that would no longer be reachable
+	// through the hole (no tombstones needed)
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (di->slots[j].blk == 0) {
+			break;
+		}
+		size_t home = slot_of(di, di->slots[j].fp);
+		// Can the entry at j move to i? Only if its home is not in (i, j]
+		bool stays = (i <= j) ? (home > i && home <= j)
+		                      : (home > i || home <= j);
+		if (!stays) {
+			di->slots[i] = di->slots[j];
+			i = j;
+		}
+	}
+	di->slots[i] = (dedup_slot){ 0, 0 };
+}
+
+vsfs_blk_t dedup_lookup(const dedup_index *di, uint64_t fp, size_t *pos)
+{
+	size_t mask = di->nslots - 1;
+	size_t i = (slot_of(di, fp) + *pos) & mask;
+
+	for (; di->slots[i].blk != 0; i = (i + 1) & mask) {
+		++*pos;
+		if (di->slots[i].fp == fp) {
+			return di->slots[i].blk;
+		}
+	}
+	return 0;
+}
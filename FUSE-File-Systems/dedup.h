@@ -0,0 +1,102 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Block deduplication index header file.
+ *
+ * Data blocks are identified by a 64-bit fingerprint of their contents. The
+ * index maps fingerprints to the blocks that are known to have them; it is
+ * only a hint, kept in memory and rebuilt as blocks are written, so a block
+ * found in it must still be compared with the new contents before it is
+ * shared.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vsfs.h"
+
+
+/**
+ * Compute the fingerprint of a block.
+ *
+ * @param data  VSFS_BLOCK_SIZE bytes of block contents.
+ * @return      fingerprint; never 0.
+ */
+uint64_t block_fingerprint(const void *data);
+
+
+/** An index entry. */
+typedef struct dedup_slot {
+	uint64_t fp;
+	/** 0 if the slot is empty. */
+	vsfs_blk_t blk;
+} dedup_slot;
+
+/** Fingerprint index. Each block is in it at most once. */
+typedef struct dedup_index {
+	/** Open addressing hash table with linear probing. */
+	dedup_slot *slots;
+	/** Number of slots; a power of 2, at least twice the number of blocks. */
+	size_t nslots;
+	/** Fingerprint of each block in the index, 0 for the other blocks. */
+	uint64_t *fps;
+	vsfs_blk_t num_blocks;
+} dedup_index;
+
+/**
+ * Allocate an empty index.
+ *
+ * @param di          pointer to the index to initialize.
+ * @param num_blocks  number of blocks in the file system.
+ * @return            true on success; false on failure.
+ */
+bool dedup_init(dedup_index *di, vsfs_blk_t num_blocks);
+
+/**
+ * Free the index.
+ *
+ * @param di  pointer to the index.
+ */
+void dedup_destroy(dedup_index *di);
+
+/**
+ * Add a block, replacing its previous fingerprint if it is already indexed.
+ *
+ * @param di   pointer to the index.
+ * @param fp   fingerprint of the block contents.
+ * @param blk  block number.
+ */
+void dedup_insert(dedup_index *di, uint64_t fp, vsfs_blk_t blk);
+
+/**
+ * Remove a block, e.g. because it is about to be modified or freed. Does
+ * nothing if the block is not indexed.
+ *
+ * @param di   pointer to the index.
+ * @param blk  block number.
+ */
+void dedup_remove(dedup_index *di, vsfs_blk_t blk);
+
+/**
+ * Iterate over the blocks with a fingerprint.
+ *
+ * @param di   pointer to the index.
+ * @param fp   fingerprint.
+ * @param pos  iteration state; must be 0 for the first call.
+ * @return     next block with the fingerprint; 0 if there are no more.
+ */
+vsfs_blk_t dedup_lookup(const dedup_index *di, uint64_t fp, size_t *pos);
@@ -0,0 +1,103 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Delayed allocation buffers implementation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "delalloc.h"
+
+
+void delalloc_init(delalloc *da)
+{
+	memset(da, 0, sizeof(*da));
+	for (int i = 0; i < DELALLOC_FILES; ++i) {
+		da->bufs[i].ino = VSFS_INO_MAX;
+	}
+}
+
+void delalloc_destroy(delalloc *da)
+{
+	for (int i = 0; i < DELALLOC_FILES; ++i) {
+		free(da->bufs[i].data);
+		da->bufs[i].data = NULL;
+		da->bufs[i].ino = VSFS_INO_MAX;
+	}
+	da->reserved = 0;
+}
+
+delalloc_buf *delalloc_find(delalloc *da, vsfs_ino_t ino)
+{
+	for (int i = 0; i < DELALLOC_FILES; ++i) {
+		if (da->bufs[i].ino == ino) {
+			da->bufs[i].used = ++da->clock;
+			return &da->bufs[i];
+		}
+	}
+	return NULL;
+}
+
+delalloc_buf *delalloc_victim(delalloc *da)
+{
+	delalloc_buf *victim = &da->bufs[0];
+	for (int i = 0; i < DELALLOC_FILES; ++i) {
+		delalloc_buf *b = &da->bufs[i];
+		if (b->ino == VSFS_INO_MAX) {
+			return b;
+		}
+		if (b->used < victim->used) {
+			victim = b;
+		}
+	}
+	return victim;
+}
+
+bool delalloc_start(delalloc *da, delalloc_buf *b, vsfs_ino_t ino,
+                    vsfs_blk_t first, uint64_t size)
+{
+	assert(b->ino == VSFS_INO_MAX);
+	if (b->data == NULL) {
+		b->data = malloc((size_t)DELALLOC_BLOCKS * VSFS_BLOCK_SIZE);
+		if (b->data == NULL) {
+			return false;
+		}
+	}
+	b->ino = ino;
+	b->first = first;
+	b->nblocks = 0;
+	b->reserved = 0;
+	b->size = size;
+	b->used = ++da->clock;
+	return true;
+}
+
+void delalloc_reserve(delalloc *da, delalloc_buf *b, vsfs_blk_t reserved)
+{
+	assert(b->ino != VSFS_INO_MAX);
+	da->reserved = da->reserved - b->reserved + reserved;
+	b->reserved = reserved;
+}
+
+void delalloc_drop(delalloc *da, delalloc_buf *b)
+{
+	assert(b->ino != VSFS_INO_MAX);
+	da->reserved -= b->reserved;
+	b->reserved = 0;
+	b->nblocks = 0;
+	b->ino = VSFS_INO_MAX;
+	b->used = 0;
+}
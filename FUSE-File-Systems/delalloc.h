@@ -0,0 +1,126 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Delayed allocation buffers header file.
+ *
+ * Writes past the allocated blocks of a file are kept in memory, in a buffer
+ * per file, until the file is flushed. The blocks are then allocated all at
+ * once, so that a file appended to in small pieces gets one contiguous run
+ * instead of one block at a time. Only a few files are buffered at a time;
+ * the least recently used one is flushed to make room for another.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vsfs.h"
+
+/** Number of files that can have buffered writes at the same time. */
+#define DELALLOC_FILES 8
+
+/** Maximum number of blocks buffered for a file. */
+#define DELALLOC_BLOCKS 64
+
+
+/** Buffered writes of a file. */
+typedef struct delalloc_buf {
+	/** Inode number; VSFS_INO_MAX if the buffer is unused. */
+	vsfs_ino_t ino;
+	/** File block index of the first buffered block (i_blocks of the inode). */
+	vsfs_blk_t first;
+	/** Number of buffered blocks; zero-filled where nothing was written. */
+	vsfs_blk_t nblocks;
+	/** Free blocks set aside for the buffered blocks (and the indirect). */
+	vsfs_blk_t reserved;
+	/** File size including the buffered writes. */
+	uint64_t size;
+	/** Last use time, for LRU replacement. */
+	unsigned long used;
+	/** Contents of the buffered blocks; DELALLOC_BLOCKS blocks large. */
+	char *data;
+} delalloc_buf;
+
+/** Delayed allocation state. */
+typedef struct delalloc {
+	delalloc_buf bufs[DELALLOC_FILES];
+	unsigned long clock;
+	/** Total number of free blocks set aside by the buffers. */
+	vsfs_blk_t reserved;
+} delalloc;
+
+/**
+ * Initialize the state; buffer memory is allocated when it is first needed.
+ *
+ * @param da  pointer to the state to initialize.
+ */
+void delalloc_init(delalloc *da);
+
+/**
+ * Free the buffers. Buffered writes are lost; flush them first.
+ *
+ * @param da  pointer to the state.
+ */
+void delalloc_destroy(delalloc *da);
+
+/**
+ * Find the buffer of a file.
+ *
+ * @param da   pointer to the state.
+ * @param ino  inode number.
+ * @return     the buffer; NULL if the file has no buffered writes.
+ */
+delalloc_buf *delalloc_find(delalloc *da, vsfs_ino_t ino);
+
+/**
+ * Get a buffer for a file that has none: an unused one, or else the least
+ * recently used one, which the caller must flush first.
+ *
+ * @param da  pointer to the state.
+ * @return    the buffer.
+ */
+delalloc_buf *delalloc_victim(delalloc *da);
+
+/**
+ * Start buffering writes of a file in an unused buffer.
+ *
+ * @param da     pointer to the state.
+ * @param b      unused buffer.
+ * @param ino    inode number.
+ * @param first  number of allocated blocks of the file.
+ * @param size   current file size.
+ * @return       true on success; false if out of memory.
+ */
+bool delalloc_start(delalloc *da, delalloc_buf *b, vsfs_ino_t ino,
+                    vsfs_blk_t first, uint64_t size);
+
+/**
+ * Set the number of free blocks set aside by a buffer.
+ *
+ * @param da        pointer to the state.
+ * @param b         buffer in use.
+ * @param reserved  new number of reserved blocks.
+ */
+void delalloc_reserve(delalloc *da, delalloc_buf *b, vsfs_blk_t reserved);
+
+/**
+ * Stop using a buffer, releasing its reserved blocks. The memory is kept for
+ * the next file.
+ *
+ * @param da  pointer to the state.
+ * @param b   buffer in use.
+ */
+void delalloc_drop(delalloc *da, delalloc_buf *b);
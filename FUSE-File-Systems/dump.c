@@ -0,0 +1,248 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Image dump tool.
+ *
+ * Writes the allocated blocks of a vsfs image to a file or to standard
+ * output, in the format described in dump.h, optionally compressed. The
+ * image is read in runs of allocated blocks, guided by the data bitmap. It
+ * must not be mounted while it is dumped.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "crc32c.h"
+#include "dump.h"
+#include "lz.h"
+
+/** Size of the stdio buffer of the output. */
+#define DUMP_BUFFER_SIZE (1 << 20)
+
+
+// Read len bytes at offset off. Returns false on error or end of file.
+static bool read_full(int fd, void *buf, size_t len, off_t off)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, (char *)buf + done, len - done, off + done);
+		if (n <= 0) {
+			if (n == 0) {
+				fprintf(stderr, "Unexpected end of image\n");
+			} else {
+				perror("pread");
+			}
+			return false;
+		}
+		done += n;
+	}
+	return true;
+}
+
+// Write one record of n blocks. Returns false on error.
+static bool write_record(FILE *out, vsfs_blk_t blk, vsfs_blk_t n,
+                         const void *data, bool compress, uint64_t *bytes)
+{
+	static char zbuf[DUMP_RECORD_BLOCKS * VSFS_BLOCK_SIZE];
+	size_t len = (size_t)n * VSFS_BLOCK_SIZE;
+	dump_record rec = {
+		.blk = blk,
+		.nblocks = n,
+		.len = len,
+		.crc = crc32c(0, data, len),
+	};
+	if (compress) {
+		// Only keep the compressed data if it is smaller
+		size_t zlen = lz_compress(data, len, zbuf, len - 1);
+		if (zlen > 0) {
+			rec.flags |= DUMP_RECORD_LZ;
+			rec.len = zlen;
+			data = zbuf;
+		}
+	}
+	if (fwrite(&rec, sizeof(rec), 1, out) != 1 ||
+	    fwrite(data, 1, rec.len, out) != rec.len) {
+		perror("Writing the dump failed");
+		return false;
+	}
+	*bytes += sizeof(rec) + rec.len;
+	return true;
+}
+
+// Dump all allocated blocks. Returns false on error.
+static bool dump(int fd, vsfs_superblock *sb, bitmap_t *dbmap, FILE *out,
+                 bool compress, uint64_t *bytes)
+{
+	vsfs_blk_t nb = sb->num_blocks;
+	dump_header hdr = {
+		.size = sb->size,
+		.num_blocks = nb,
+		.flags = compress ? DUMP_COMPRESSED : 0,
+	};
+	memcpy(hdr.magic, DUMP_MAGIC, sizeof(hdr.magic));
+	for (vsfs_blk_t blk = 0; blk < nb; blk++) {
+		hdr.blocks += bitmap_isset(dbmap, nb, blk);
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+		perror("Writing the dump failed");
+		return false;
+	}
+	*bytes = sizeof(hdr);
+
+	char *buf = malloc(DUMP_IO_BLOCKS * VSFS_BLOCK_SIZE);
+	if (buf == NULL) {
+		perror("malloc");
+		return false;
+	}
+	bool ok = true;
+	vsfs_blk_t blk = 0;
+	while (blk < nb && ok) {
+		if (!bitmap_isset(dbmap, nb, blk)) {
+			blk++;
+			continue;
+		}
+		// Read a run of allocated blocks and write it out in records
+		vsfs_blk_t n = 1;
+		while (blk + n < nb && n < DUMP_IO_BLOCKS &&
+		       bitmap_isset(dbmap, nb, blk + n)) {
+			n++;
+		}
+		if (!read_full(fd, buf, (size_t)n * VSFS_BLOCK_SIZE,
+		               (off_t)blk * VSFS_BLOCK_SIZE)) {
+			ok = false;
+			break;
+		}
+		for (vsfs_blk_t i = 0; i < n && ok; i += DUMP_RECORD_BLOCKS) {
+			vsfs_blk_t count = (n - i < DUMP_RECORD_BLOCKS) ?
+			                   n - i : DUMP_RECORD_BLOCKS;
+			ok = write_record(out, blk + i, count,
+			                  buf + (size_t)i * VSFS_BLOCK_SIZE, compress,
+			                  bytes);
+		}
+		blk += n;
+	}
+	free(buf);
+
+	dump_record end = {0};
+	if (ok && fwrite(&end, sizeof(end), 1, out) != 1) {
+		perror("Writing the dump failed");
+		ok = false;
+	}
+	*bytes += sizeof(end);
+	return ok;
+}
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, "Usage: %s [-z] image [dump]\n", progname);
+	fprintf(f, "Write the allocated blocks of a vsfs image to dump "
+	           "(default: standard output).\n");
+	fprintf(f, "    -z  compress the blocks\n");
+	fprintf(f, "    -h  print help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bool compress = false;
+	char opt;
+
+	while ((opt = getopt(argc, argv, "zh")) != -1) {
+		switch (opt) {
+			case 'z': compress = true; break;
+			case 'h': print_help(stdout, argv[0]); return 0;
+			default : print_help(stderr, argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 1 && optind != argc - 2) {
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	const char *img_path = argv[optind];
+	const char *out_path = (optind == argc - 2) ? argv[optind + 1] : NULL;
+
+	int fd = open(img_path, O_RDONLY);
+	if (fd < 0) {
+		perror(img_path);
+		return 1;
+	}
+	int ret = 1;
+	FILE *out = NULL;
+	static char sb_buf[VSFS_BLOCK_SIZE], dbmap_buf[VSFS_BLOCK_SIZE];
+	vsfs_superblock *sb = (vsfs_superblock *)sb_buf;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(img_path);
+		goto end;
+	}
+	if (!read_full(fd, sb_buf, VSFS_BLOCK_SIZE, 0) ||
+	    !read_full(fd, dbmap_buf, VSFS_BLOCK_SIZE,
+	               VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE)) {
+		goto end;
+	}
+	// The blocks of a striped file system are spread over several images
+	if (sb->magic == VSFS_MAGIC &&
+	    (sb->features & VSFS_FEATURE_STRIPE)) {
+		fprintf(stderr, "%s: striped file systems can't be dumped\n",
+		        img_path);
+		goto end;
+	}
+	if (sb->magic != VSFS_MAGIC || sb->num_blocks > VSFS_BLK_MAX ||
+	    sb->num_blocks < VSFS_BLK_MIN ||
+	    sb->size != (uint64_t)sb->num_blocks * VSFS_BLOCK_SIZE ||
+	    (uint64_t)st.st_size < sb->size) {
+		fprintf(stderr, "%s: not a vsfs image\n", img_path);
+		goto end;
+	}
+
+	if (out_path != NULL) {
+		out = fopen(out_path, "wb");
+		if (out == NULL) {
+			perror(out_path);
+			goto end;
+		}
+	} else if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not writing a dump to a terminal\n");
+		goto end;
+	} else {
+		out = stdout;
+	}
+	setvbuf(out, NULL, _IOFBF, DUMP_BUFFER_SIZE);
+
+	uint64_t bytes;
+	bool ok = dump(fd, sb, (bitmap_t *)dbmap_buf, out, compress, &bytes);
+	if (fclose(out) != 0) {
+		perror("Writing the dump failed");
+		ok = false;
+	}
+	out = NULL;
+	if (ok) {
+		fprintf(stderr, "%s: %lu bytes of dump for %lu bytes of image\n",
+		        img_path, bytes, sb->size);
+		ret = 0;
+	}
+
+ end:
+	if (out != NULL && out != stdout) {
+		fclose(out);
+	}
+	close(fd);
+	return ret;
+}
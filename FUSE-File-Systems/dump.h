@@ -0,0 +1,76 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Image dump format header file.
+ *
+ * vsfs-dump writes the allocated blocks of a vsfs image (those marked in the
+ * data bitmap, including all metadata) as a stream that vsfs-restore turns
+ * back into an image; free blocks are not stored and are restored as zeros.
+ *
+ * The stream is a dump_header followed by records in increasing block
+ * order. Each record is a dump_record and its data: 1 to DUMP_RECORD_BLOCKS
+ * consecutive blocks, stored as is or compressed with lz_compress() (see
+ * lz.h). A record with no blocks ends the stream. All fields are in host
+ * byte order.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "vsfs.h"
+
+/** First 8 bytes of a dump. */
+#define DUMP_MAGIC "VSFSDMP1"
+
+/** Maximum number of blocks in a record (lz_compress() takes < 64 KiB). */
+#define DUMP_RECORD_BLOCKS 8
+
+/** Number of blocks read or written at once. */
+#define DUMP_IO_BLOCKS 256
+
+/** Dump header flags. */
+#define DUMP_COMPRESSED 0x1u /* records may be compressed */
+
+/** Record flags. */
+#define DUMP_RECORD_LZ 0x1u /* record data is compressed */
+
+
+/** Start of a dump. */
+typedef struct dump_header {
+	char magic[8];
+	/** Image size in bytes. */
+	uint64_t size;
+	/** Number of blocks that follow. */
+	uint64_t blocks;
+	/** Image size in blocks. */
+	uint32_t num_blocks;
+	/** DUMP_ flags. */
+	uint32_t flags;
+} dump_header;
+
+/** Header of a run of blocks. */
+typedef struct dump_record {
+	/** First block. */
+	vsfs_blk_t blk;
+	/** Number of blocks; 0 in the record that ends the dump. */
+	uint16_t nblocks;
+	/** DUMP_RECORD_ flags. */
+	uint16_t flags;
+	/** Size of the data that follows. */
+	uint32_t len;
+	/** CRC32C of the blocks (uncompressed). */
+	uint32_t crc;
+} dump_record;
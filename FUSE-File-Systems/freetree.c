@@ -0,0 +1,223 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Free extent tree implementation.
+ */
+
+#include <stdlib.h>
+
+#include "freetree.h"
+
+
+// Summarize the free runs of a bitmap word (set bits are used blocks)
+static void leaf_summary(bitmap_t used, freetree_node *x)
+{
+	if (used == 0) {
+		x->prefix = x->suffix = x->longest = FREETREE_LEAF_BLOCKS;
+		return;
+	}
+	x->prefix = __builtin_ctzl(used);
+	x->suffix = __builtin_clzl(used);
+
+	// Each step shortens every run of free bits by one
+	bitmap_t free = ~used;
+	x->longest = 0;
+	while (free != 0) {
+		free &= free >> 1;
+		x->longest++;
+	}
+}
+
+// Combine the summaries of the two children of node i, each len blocks long
+static void combine(freetree *ft, size_t i, vsfs_blk_t len)
+{
+	const freetree_node *l = &ft->nodes[2 * i];
+	const freetree_node *r = &ft->nodes[2 * i + 1];
+	freetree_node *x = &ft->nodes[i];
+
+	x->prefix = (l->prefix == len) ? len + r->prefix : l->prefix;
+	x->suffix = (r->suffix == len) ? len + l->suffix : r->suffix;
+	x->longest = l->suffix + r->prefix;
+	if (l->longest > x->longest) {
+		x->longest = l->longest;
+	}
+	if (r->longest > x->longest) {
+		x->longest = r->longest;
+	}
+}
+
+bool freetree_init(freetree *ft, const bitmap_t *dbmap)
+{
+	ft->nodes = calloc(2 * FREETREE_LEAVES, sizeof(*ft->nodes));
+	if (ft->nodes == NULL) {
+		return false;
+	}
+	for (size_t w = 0; w < FREETREE_LEAVES; ++w) {
+		leaf_summary(dbmap[w], &ft->nodes[FREETREE_LEAVES + w]);
+	}
+	// Each level up covers twice as many blocks per node
+	vsfs_blk_t len = FREETREE_LEAF_BLOCKS;
+	for (size_t first = FREETREE_LEAVES / 2; first >= 1; first /= 2) {
+		for (size_t i = first; i < 2 * first; ++i) {
+			combine(ft, i, len);
+		}
+		len *= 2;
+	}
+	return true;
+}
+
+void freetree_destroy(freetree *ft)
+{
+	free(ft->nodes);
+	ft->nodes = NULL;
+}
+
+void freetree_update(freetree *ft, const bitmap_t *dbmap, vsfs_blk_t blk)
+{
+	size_t w = blk / FREETREE_LEAF_BLOCKS;
+	size_t i = FREETREE_LEAVES + w;
+	leaf_summary(dbmap[w], &ft->nodes[i]);
+
+	vsfs_blk_t len = FREETREE_LEAF_BLOCKS;
+	for (i /= 2; i >= 1; i /= 2) {
+		combine(ft, i, len);
+		len *= 2;
+	}
+}
+
+static bool is_used(const bitmap_t *dbmap, vsfs_blk_t blk)
+{
+	return (dbmap[blk / FREETREE_LEAF_BLOCKS] >>
+	        (blk % FREETREE_LEAF_BLOCKS)) & 1;
+}
+
+/* Search state, carried from left to right across the nodes. */
+typedef struct search {
+	const freetree *ft;
+	const bitmap_t *dbmap;
+	vsfs_blk_t from;
+	vsfs_blk_t n;
+	/** Length of the free run that ends where the current node starts. */
+	vsfs_blk_t carry;
+	/** Best run found so far (freetree_best() only). */
+	vsfs_blk_t best_len;
+	vsfs_blk_t best_start;
+} search;
+
+// Find the first run of s->n blocks at or after s->from in the range
+// [lo, lo + len) of node i, or one that starts before it (s->carry)
+static bool find_run(search *s, size_t i, vsfs_blk_t lo, vsfs_blk_t len,
+                     vsfs_blk_t *start)
+{
+	const freetree_node *x = &s->ft->nodes[i];
+
+	if (lo + len <= s->from) {
+		s->carry = 0;
+		return false;
+	}
+	if (lo >= s->from) {
+		if (s->carry + x->prefix >= s->n) {
+			*start = lo - s->carry;
+			return true;
+		}
+		if (x->longest < s->n) {
+			// Only a run that continues into the next node can be long
+			// enough
+			s->carry = (x->prefix == len) ? s->carry + len : x->suffix;
+			return false;
+		}
+	}
+
+	if (i >= FREETREE_LEAVES) {
+		for (vsfs_blk_t blk = lo; blk < lo + len; ++blk) {
+			if (blk < s->from || is_used(s->dbmap, blk)) {
+				s->carry = 0;
+			} else if (++s->carry == s->n) {
+				*start = blk + 1 - s->n;
+				return true;
+			}
+		}
+		return false;
+	}
+	return find_run(s, 2 * i, lo, len / 2, start) ||
+	       find_run(s, 2 * i + 1, lo + len / 2, len / 2, start);
+}
+
+bool freetree_find(const freetree *ft, const bitmap_t *dbmap, vsfs_blk_t from,
+                   vsfs_blk_t n, vsfs_blk_t *start)
+{
+	assert(n > 0);
+	search s = { .ft = ft, .dbmap = dbmap, .from = from, .n = n };
+	return find_run(&s, 1, 0, VSFS_BLK_MAX, start);
+}
+
+// A free run [start, start + len) ended; keep it if it fits better
+static void best_candidate(search *s, vsfs_blk_t start, vsfs_blk_t len)
+{
+	if (len >= s->n && len < s->best_len) {
+		s->best_len = len;
+		s->best_start = start;
+	}
+}
+
+// Look for the shortest run of at least s->n blocks in the range
+// [lo, lo + len) of node i
+static void best_run(search *s, size_t i, vsfs_blk_t lo, vsfs_blk_t len)
+{
+	const freetree_node *x = &s->ft->nodes[i];
+
+	if (s->best_len == s->n) {
+		return;// can't do better
+	}
+	if (x->prefix == len) {
+		s->carry += len;
+		return;
+	}
+	if (x->longest < s->n) {
+		// Only the runs that cross the edges of the range can be long
+		// enough
+		best_candidate(s, lo - s->carry, s->carry + x->prefix);
+		s->carry = x->suffix;
+		return;
+	}
+
+	if (i >= FREETREE_LEAVES) {
+		for (vsfs_blk_t blk = lo; blk < lo + len; ++blk) {
+			if (is_used(s->dbmap, blk)) {
+				best_candidate(s, blk - s->carry, s->carry);
+				s->carry = 0;
+			} else {
+				s->carry++;
+			}
+		}
+		return;
+	}
+	best_run(s, 2 * i, lo, len / 2);
+	best_run(s, 2 * i + 1, lo + len / 2, len / 2);
+}
+
+bool freetree_best(const freetree *ft, const bitmap_t *dbmap, vsfs_blk_t n,
+                   vsfs_blk_t *start)
+{
+	assert(n > 0);
+	search s = { .ft = ft, .dbmap = dbmap, .n = n, .best_len = UINT32_MAX };
+	best_run(&s, 1, 0, VSFS_BLK_MAX);
+	best_candidate(&s, VSFS_BLK_MAX - s.carry, s.carry);
+	if (s.best_len == UINT32_MAX) {
+		return false;
+	}
+	*start = s.best_start;
+	return true;
+}
@@ -0,0 +1,125 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Free extent tree header file.
+ *
+ * An index of the runs of free blocks in the data block bitmap, so that the
+ * allocator can find a run of a given length without scanning the bitmap.
+ * It is a complete binary tree over the bitmap words: each node holds the
+ * length of the free run at the start of its range, at the end of it, and
+ * the longest one in it. A leaf covers one bitmap word, which is scanned
+ * directly. The tree is built from the bitmap at mount time, and a leaf and
+ * its ancestors are updated whenever a bit of the bitmap changes.
+ *
+ * The tree covers the whole bitmap block (VSFS_BLK_MAX blocks); the bits past
+ * the end of the file system are always set (see mkfs.c), so no run found in
+ * it extends past the end.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "bitmap.h"
+#include "vsfs.h"
+
+/** Number of blocks covered by a leaf. */
+#define FREETREE_LEAF_BLOCKS (sizeof(bitmap_t) * CHAR_BIT)
+
+/** Number of leaves. */
+#define FREETREE_LEAVES (VSFS_BLK_MAX / FREETREE_LEAF_BLOCKS)
+
+static_assert((FREETREE_LEAVES & (FREETREE_LEAVES - 1)) == 0,
+              "the tree must be complete");
+
+
+/** Free runs in the range of a node. */
+typedef struct freetree_node {
+	/** Length of the run that starts at the start of the range. */
+	vsfs_blk_t prefix;
+	/** Length of the run that ends at the end of the range. */
+	vsfs_blk_t suffix;
+	/** Length of the longest run in the range. */
+	vsfs_blk_t longest;
+} freetree_node;
+
+/** Free extent tree. */
+typedef struct freetree {
+	/** Nodes in heap order: the root is node 1, the children of node i are
+	 *  2i and 2i + 1, and the leaf for bitmap word w is FREETREE_LEAVES + w. */
+	freetree_node *nodes;
+} freetree;
+
+/**
+ * Build the tree from the data block bitmap.
+ *
+ * @param ft     pointer to the tree to initialize.
+ * @param dbmap  data block bitmap.
+ * @return       true on success; false on failure.
+ */
+bool freetree_init(freetree *ft, const bitmap_t *dbmap);
+
+/**
+ * Free the tree.
+ *
+ * @param ft  pointer to the tree.
+ */
+void freetree_destroy(freetree *ft);
+
+/**
+ * Update the tree after a bit of the data block bitmap was changed.
+ *
+ * @param ft     pointer to the tree.
+ * @param dbmap  data block bitmap.
+ * @param blk    block number.
+ */
+void freetree_update(freetree *ft, const bitmap_t *dbmap, vsfs_blk_t blk);
+
+/**
+ * Find the first run of n free blocks that starts at or after block "from".
+ *
+ * @param ft     pointer to the tree.
+ * @param dbmap  data block bitmap.
+ * @param from   block number to search from.
+ * @param n      number of blocks; must be positive.
+ * @param start  pointer that receives the first block of the run.
+ * @return       true if a run was found; false if there is none.
+ */
+bool freetree_find(const freetree *ft, const bitmap_t *dbmap, vsfs_blk_t from,
+                   vsfs_blk_t n, vsfs_blk_t *start);
+
+/**
+ * Find the shortest free run that is at least n blocks long (the first one
+ * if there are several). Only the subtrees that hold such a run are visited.
+ *
+ * @param ft     pointer to the tree.
+ * @param dbmap  data block bitmap.
+ * @param n      number of blocks; must be positive.
+ * @param start  pointer that receives the first block of the run.
+ * @return       true if a run was found; false if there is none.
+ */
+bool freetree_best(const freetree *ft, const bitmap_t *dbmap, vsfs_blk_t n,
+                   vsfs_blk_t *start);
+
+/**
+ * Get the length of the longest free run.
+ *
+ * @param ft  pointer to the tree.
+ * @return    number of blocks; 0 if there are no free blocks.
+ */
+static inline vsfs_blk_t freetree_longest(const freetree *ft)
+{
+	return ft->nodes[1].longest;
+}
@@ -18,56 +18,143 @@
 
 #include "fs_ctx.h"
 
+/**
+ * Point the context at the resident image metadata, e.g. after the image
+ * was resized.
+ *
+ * @param fs     pointer to the context; fs->bd must have the metadata mapped.
+ */
+void fs_ctx_meta_moved(fs_ctx *fs)
+{
+	void *meta = fs->bd.meta;
+	fs->sb = (vsfs_superblock *)meta;
+
+	/** VSFS Inode bitmap pointer 
+	 *  The block number of the inode bitmap is VSFS_IMAP_BLKNUM; 
+	 *  we multiply by the block size to get the offset in bytes from the 
+	 *  start of the resident metadata.
+	 */ 
+	fs->ibmap = (bitmap_t *)(meta + VSFS_IMAP_BLKNUM * VSFS_BLOCK_SIZE);
+
+	/** VSFS Data block bitmap pointer
+	 *  Similar calculation as inode bitmap.
+	 */
+	fs->dbmap = (bitmap_t *)(meta + VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE);
+
+	/** VSFS Inode table pointer
+	 *  Similar calculation as for bitmaps.
+	 */
+	fs->itable = (vsfs_inode *)(meta + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE);
+}
+
 /**
  * Initialize file system context.
  * 
- * @param fs     pointer to the context to initialize.
- * @param image  pointer to the start of the image.
- * @param size   image size in bytes.
+ * @param fs     pointer to the context to initialize; fs->bd must be open.
  * @return       true on success; false on failure (e.g. invalid superblock).
  */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
+bool fs_ctx_init(fs_ctx *fs)
 {
 	// Check if the file system image can be mounted and initialize its
 	// runtime state.
 
-	fs->image = image;
-	fs->size = size;
-
-	/** VSFS Superblock is first block on disk, so the pointer to the 
-	 *  superblock is the same as the pointer to the start of the 
-	 *  mmap'd disk image.
+	/** VSFS Superblock is first block on disk. Read just that block first
+	 *  to find out how large the rest of the metadata is.
 	 */
-	fs->sb = (vsfs_superblock *)image;
+	fs->sb = (vsfs_superblock *)bdev_map_meta(&fs->bd, 1);
+	if (fs->sb == NULL) {
+		return false;
+	}
 
 	/** We're very trusting. If the magic number looks good, we'll go 
 	 *  ahead and mount the file system (and try to use it).
 	 *  You may want to add more sanity checking to make sure the disk
 	 *  image appears to be a valid VSFS file system.
 	 */
-	if (fs->sb->magic != VSFS_MAGIC) {
+	if (fs->sb->magic != VSFS_MAGIC ||
+	    fs->sb->data_region <= VSFS_ITBL_BLKNUM ||
+	    fs->sb->data_region >= fs->sb->num_blocks ||
+	    fs->sb->num_blocks > fs->bd.nblocks ||
+	    fs->sb->num_blocks > VSFS_BLK_MAX ||
+	    fs->sb->num_inodes > VSFS_INO_MAX ||
+	    (fs->sb->features & ~VSFS_FEATURES_ALL) != 0 ||
+	    vsfs_itbl_uninit(fs->sb, VSFS_ROOT_INO / VSFS_INODES_PER_BLOCK) ||
+	    ((fs->sb->features & VSFS_FEATURE_DEDUP)
+	     ? (fs->sb->refcount_blk < fs->sb->data_region ||
+	        fs->sb->refcount_blk > fs->sb->num_blocks -
+	                               VSFS_REFCOUNT_BLOCKS(fs->sb->num_blocks))
+	     : fs->sb->refcount_blk != 0) ||
+	    ((fs->sb->features & VSFS_FEATURE_CSUM)
+	     ? (fs->sb->csum_blk < fs->sb->data_region ||
+	        fs->sb->csum_blk > fs->sb->num_blocks -
+	                           VSFS_CSUM_BLOCKS(fs->sb->num_blocks))
+	     : fs->sb->csum_blk != 0) ||
+	    ((fs->sb->features & VSFS_FEATURE_STRIPE)
+	     ? (fs->sb->stripe_count != fs->bd.stripe.count ||
+	        fs->sb->stripe_unit != fs->bd.stripe.unit ||
+	        fs->sb->data_region != fs->bd.stripe.base)
+	     : fs->bd.stripe.count != 1)) {
+		fs->sb = NULL;
 		return false;
 	}
-	
-	/** VSFS Inode bitmap pointer 
-	 *  The block number of the inode bitmap is VSFS_IMAP_BLKNUM; 
-	 *  we multiply by the block size to get the offset in bytes from the 
-         *  start of the mmap'd disk image.
-	 */ 
-	fs->ibmap = (bitmap_t *)(image + VSFS_IMAP_BLKNUM * VSFS_BLOCK_SIZE);
 
-	/** VSFS Data block bitmap pointer
-	 *  Similar calculation as inode bitmap.
+	/** Everything before the data region (superblock, bitmaps and inode
+	 *  table) stays resident while the file system is mounted.
 	 */
-	fs->dbmap = (bitmap_t *)(image + VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE);
+	void *meta = bdev_map_meta(&fs->bd, fs->sb->data_region);
+	if (meta == NULL) {
+		fs->sb = NULL;
+		return false;
+	}
+	fs->sb = (vsfs_superblock *)meta;
 
-	/** VSFS Inode table pointer
-	 *  Similar calculation as for bitmaps.
+	/** With checksums, the metadata is verified before it is used.
 	 */
-	fs->itable = (vsfs_inode *)(image + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE);
+	if ((fs->sb->features & VSFS_FEATURE_CSUM) &&
+	    !bdev_csum_enable(&fs->bd, fs->sb->csum_blk, fs->sb->num_blocks)) {
+		fs->sb = NULL;
+		return false;
+	}
+
+	fs_ctx_meta_moved(fs);
 
 	// TODO: Initialize anything else that you add to the fs context.
-	
+	if (!zcache_init(&fs->zc)) {
+		fs->sb = NULL;
+		return false;
+	}
+	if (!dedup_init(&fs->dd, fs->sb->num_blocks)) {
+		zcache_destroy(&fs->zc);
+		fs->sb = NULL;
+		return false;
+	}
+	if (!freetree_init(&fs->ft, fs->dbmap)) {
+		dedup_destroy(&fs->dd);
+		zcache_destroy(&fs->zc);
+		fs->sb = NULL;
+		return false;
+	}
+	if (!mcache_init(&fs->mc, &fs->bd, &fs->itable[VSFS_ROOT_INO],
+	                 fs->sb->num_inodes)) {
+		freetree_destroy(&fs->ft);
+		dedup_destroy(&fs->dd);
+		zcache_destroy(&fs->zc);
+		fs->sb = NULL;
+		return false;
+	}
+	if (!heat_init(&fs->ht, fs->sb->num_inodes)) {
+		mcache_destroy(&fs->mc);
+		freetree_destroy(&fs->ft);
+		dedup_destroy(&fs->dd);
+		zcache_destroy(&fs->zc);
+		fs->sb = NULL;
+		return false;
+	}
+	static const char zeros[VSFS_BLOCK_SIZE];
+	fs->zero_fp = block_fingerprint(zeros);
+	delalloc_init(&fs->da);
+	prealloc_init(&fs->pa);
+
 	return true;
 }
 
@@ -81,5 +168,11 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
 void fs_ctx_destroy(fs_ctx *fs)
 {
 	//TODO: cleanup any other resources allocated in fs_ctx_init()
-	(void)fs;
+	notify_destroy(&fs->notify);
+	zcache_destroy(&fs->zc);
+	dedup_destroy(&fs->dd);
+	delalloc_destroy(&fs->da);
+	freetree_destroy(&fs->ft);
+	mcache_destroy(&fs->mc);
+	heat_destroy(&fs->ht);
 }
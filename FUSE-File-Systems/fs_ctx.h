@@ -25,23 +25,72 @@
 #include "options.h"
 #include "vsfs.h"
 #include "bitmap.h"
+#include "bdev.h"
+#include "notify.h"
+#include "compress.h"
+#include "dedup.h"
+#include "delalloc.h"
+#include "prealloc.h"
+#include "agroup.h"
+#include "freetree.h"
+#include "mcache.h"
+#include "heat.h"
+#include "stats.h"
+#include "trace.h"
 
 /**
  * Mounted file system runtime state - "fs context".
  */
 typedef struct fs_ctx {
-	/** Pointer to the start of the image. */
-	void *image;
-	/** Image size in bytes. */
-	size_t size;
-	/** Pointer to the superblock in the mmap'd disk image */
+	/** The disk image. */
+	bdev bd;
+	/** Pointer to the superblock in the resident image metadata */
 	vsfs_superblock *sb;
-	/** Pointer to the inode bitmap in the mmap'd disk image */
+	/** Pointer to the inode bitmap in the resident image metadata */
 	bitmap_t *ibmap;
-	/** Pointer to the data block bitmap in the mmap'd disk image */
+	/** Pointer to the data block bitmap in the resident image metadata */
 	bitmap_t *dbmap;
-	/** Pointer to the inode table in the mmap'd disk image */
+	/** Pointer to the inode table in the resident image metadata */
 	vsfs_inode *itable;
+	/** Mount options */
+	const vsfs_opts *opts;
+	/** Kernel cache invalidation state (used if cache_timeout is set) */
+	notify_ctx notify;
+	/** Release freed blocks to the host (discard option, if supported) */
+	bool discard;
+	/** Freed blocks not yet released to the host */
+	vsfs_blk_t discard_start;
+	vsfs_blk_t discard_count;
+	/** Compress clusters as they are completed (compress option) */
+	bool compress;
+	/** Recently decompressed clusters */
+	zcache zc;
+	/** Share identical blocks as they are written (dedup option) */
+	bool dedup;
+	/** Fingerprints of file data blocks, for dedup and VSFS_IOC_DEDUP */
+	dedup_index dd;
+	/** Fingerprint of a zero-filled block */
+	uint64_t zero_fp;
+	/** Buffer appends and allocate their blocks later (delalloc option) */
+	bool delalloc;
+	/** Buffered appends */
+	delalloc da;
+	/** Block that alloc_block() takes next if it is free; 0 if none */
+	vsfs_blk_t alloc_goal;
+	/** Set aside blocks for files that are appended to (prealloc option) */
+	bool prealloc;
+	/** Preallocation windows */
+	prealloc pa;
+	/** Runs of free data blocks */
+	freetree ft;
+	/** Root directory entries by name, and entries in use per block */
+	mcache mc;
+	/** Access counts of files, for VSFS_IOC_HOTZONE */
+	heat ht;
+	/** Operation statistics (stats option) */
+	vsfs_stats stats;
+	/** Call trace (trace option) */
+	vsfs_trace trace;
 	
 	//TODO: other useful runtime state of the mounted file system should be
 	//       cached here (NOT in global variables in vsfs.c)
@@ -51,11 +100,18 @@ typedef struct fs_ctx {
 /**
  * Initialize file system context.
  *
- * @param fs     pointer to the context to initialize.
- * @param size   image size in bytes.
+ * @param fs     pointer to the context to initialize; fs->bd must be open.
  * @return       true on success; false on failure (e.g. invalid superblock).
  */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
+bool fs_ctx_init(fs_ctx *fs);
+
+/**
+ * Point the context at the resident image metadata, e.g. after the image
+ * was resized (see bdev_resize()).
+ *
+ * @param fs     pointer to the context; fs->bd must have the metadata mapped.
+ */
+void fs_ctx_meta_moved(fs_ctx *fs);
 
 /**
  * Destroy file system context.
@@ -0,0 +1,1072 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - vsfs consistency checker.
+ *
+ * The checker runs in passes, like e2fsck (plus a pass 0 that verifies the
+ * block checksums, if the image has them, before anything is modified):
+ *   1. inodes and block pointers (parallel over the inode table)
+ *   2. directory entries (parallel over the root directory blocks)
+ *   3. link counts and unreferenced inodes
+ *   4. bitmaps, block reference counts and superblock counters
+ * Passes 1 and 2 only read shared state or write to state owned by the
+ * current inode/block; everything else is done in between by one thread.
+ * Repairs that change which blocks an inode owns are followed by another
+ * run of pass 1, so that later passes see a consistent block ownership.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vsfs.h"
+#include "bitmap.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "map.h"
+#include "stripe.h"
+#include "util.h"
+
+// Exit codes (same meaning as for e2fsck)
+#define FSCK_OK          0
+#define FSCK_CORRECTED   1
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR       8
+
+/** Number of inodes or directory blocks a thread claims at a time. */
+#define FSCK_CHUNK 256
+
+/** Number of times pass 1 is repeated after repairs before giving up. */
+#define FSCK_MAX_RETRIES 3
+
+/** Number of directory entries in a block. */
+#define DENTRIES_PER_BLOCK (VSFS_BLOCK_SIZE / sizeof(vsfs_dentry))
+
+
+/** Command line options. */
+typedef struct fsck_opts {
+	/** File system image file path. */
+	const char *img_path;
+	/** Number of threads; 0 means one per online CPU. */
+	unsigned int nthreads;
+	/** Other images of a striped file system; NULL if none. */
+	char *stripe;
+
+	/** Print help and exit. */
+	bool help;
+	/** Repair the problems found. */
+	bool repair;
+
+} fsck_opts;
+
+/** A block claimed by a second inode. */
+typedef struct dup_claim {
+	vsfs_ino_t ino;
+	vsfs_blk_t idx;
+	vsfs_blk_t blk;
+} dup_claim;
+
+/** Checker state. */
+typedef struct fsck_ctx {
+	const fsck_opts *opts;
+
+	/** The image and its metadata. */
+	void *image;
+	size_t size;
+	vsfs_superblock *sb;
+	bitmap_t *ibmap;
+	bitmap_t *dbmap;
+	vsfs_inode *itable;
+
+	/** Owner of each block (inode number + 1), or 0 if not referenced. */
+	uint32_t *owner;
+	/** Number of references to each block. */
+	uint32_t *refs;
+	/** Number of leading block pointers of each inode that are valid. */
+	vsfs_blk_t *valid;
+	/** Number of directory entries that refer to each inode. */
+	uint32_t *links;
+	/** Blocks claimed by more than one inode. */
+	dup_claim *dups;
+	size_t ndups;
+	size_t dups_cap;
+
+	/** Next unit of work for the threads of a parallel pass. */
+	uint32_t next;
+	/** Serializes messages and the dups array. */
+	pthread_mutex_t lock;
+
+	/** Number of problems found and of problems repaired. */
+	unsigned int problems;
+	unsigned int repaired;
+} fsck_ctx;
+
+/** Per-unit function of a parallel pass. */
+typedef void (*fsck_fn)(fsck_ctx *fc, uint32_t i);
+
+typedef struct fsck_worker {
+	fsck_ctx *fc;
+	fsck_fn fn;
+	uint32_t count;
+} fsck_worker;
+
+
+static const char *help_str = "\
+Usage: %s options image\n\
+\n\
+Check the consistency of a vsfs image. The image must not be mounted.\n\
+\n\
+Options:\n\
+    -n      check only, don't modify the image (default)\n\
+    -y      repair the problems found\n\
+    -j num  number of threads (default: one per CPU)\n\
+    -S list the other images of a striped file system, separated by ':',\n\
+            in the same order as given to mkfs.vsfs\n\
+    -h      print help and exit\n\
+\n\
+Exit status: 0 - no problems, 1 - problems repaired,\n\
+4 - problems left unrepaired, 8 - operational error.\n\
+";
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, help_str, progname);
+}
+
+
+static bool parse_args(int argc, char *argv[], fsck_opts *opts)
+{
+	char o;
+	while ((o = getopt(argc, argv, "nyj:S:h")) != -1) {
+		switch (o) {
+			case 'n': opts->repair = false; break;
+			case 'y': opts->repair = true; break;
+			case 'j': opts->nthreads = strtoul(optarg, NULL, 10); break;
+			case 'S': opts->stripe = optarg; break;
+
+			case 'h': opts->help = true; return true;// skip other arguments
+
+			case '?': return false;
+			default : assert(false);
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "Missing image path\n");
+		return false;
+	}
+	opts->img_path = argv[optind];
+	return true;
+}
+
+
+static bool vreport(fsck_ctx *fc, bool fixable, const char *fmt, va_list args)
+{
+	bool fix = fixable && fc->opts->repair;
+
+	pthread_mutex_lock(&fc->lock);
+	vprintf(fmt, args);
+	printf(fix ? " - fixed\n" : "\n");
+	fc->problems++;
+	if (fix) {
+		fc->repaired++;
+	}
+	pthread_mutex_unlock(&fc->lock);
+	return fix;
+}
+
+// Report a problem; returns true if it should be repaired
+static bool __attribute__((format(printf, 2, 3)))
+problem(fsck_ctx *fc, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	bool fix = vreport(fc, true, fmt, args);
+	va_end(args);
+	return fix;
+}
+
+// Report a problem that can't be repaired
+static void __attribute__((format(printf, 2, 3)))
+unfixable(fsck_ctx *fc, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vreport(fc, false, fmt, args);
+	va_end(args);
+}
+
+static void *worker_main(void *arg)
+{
+	fsck_worker *w = (fsck_worker *)arg;
+
+	for (;;) {
+		uint32_t start = __atomic_fetch_add(&w->fc->next, FSCK_CHUNK,
+		                                    __ATOMIC_RELAXED);
+		if (start >= w->count) {
+			break;
+		}
+		uint32_t end = (w->count - start < FSCK_CHUNK) ? w->count
+		                                                : start + FSCK_CHUNK;
+		for (uint32_t i = start; i < end; ++i) {
+			w->fn(w->fc, i);
+		}
+	}
+	return NULL;
+}
+
+// Call fn for each i in [0, count), in parallel
+static void run_parallel(fsck_ctx *fc, fsck_fn fn, uint32_t count)
+{
+	unsigned int n = fc->opts->nthreads;
+	pthread_t threads[n];
+	fsck_worker w = { fc, fn, count };
+
+	fc->next = 0;
+	unsigned int started = 0;
+	for (; started < n; ++started) {
+		if (pthread_create(&threads[started], NULL, worker_main, &w) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		// Fall back to doing all the work ourselves
+		worker_main(&w);
+	}
+	for (unsigned int i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+
+static bool inode_in_use(fsck_ctx *fc, vsfs_ino_t ino)
+{
+	// The inodes in uninitialized inode table blocks are free, whatever the
+	// blocks hold
+	return ino == VSFS_ROOT_INO ||
+	       (!vsfs_itbl_uninit(fc->sb, ino / VSFS_INODES_PER_BLOCK) &&
+	        fc->itable[ino].i_mode != 0);
+}
+
+// Is the block part of the checksum table?
+static bool in_csum_table(fsck_ctx *fc, vsfs_blk_t blk)
+{
+	return (fc->sb->features & VSFS_FEATURE_CSUM) &&
+	       blk >= fc->sb->csum_blk &&
+	       blk < fc->sb->csum_blk + VSFS_CSUM_BLOCKS(fc->sb->num_blocks);
+}
+
+// Is the block part of the reference count table?
+static bool in_refcount_table(fsck_ctx *fc, vsfs_blk_t blk)
+{
+	return (fc->sb->features & VSFS_FEATURE_DEDUP) &&
+	       blk >= fc->sb->refcount_blk &&
+	       blk < fc->sb->refcount_blk +
+	             VSFS_REFCOUNT_BLOCKS(fc->sb->num_blocks);
+}
+
+static bool block_ok(fsck_ctx *fc, vsfs_blk_t blk)
+{
+	return blk >= fc->sb->data_region && blk < fc->sb->num_blocks &&
+	       !in_refcount_table(fc, blk) && !in_csum_table(fc, blk);
+}
+
+// Can the block be shared by the inode (as a file data block)?
+static bool block_shareable(fsck_ctx *fc, vsfs_ino_t ino, vsfs_blk_t blk)
+{
+	vsfs_inode *inode = &fc->itable[ino];
+	return (fc->sb->features & VSFS_FEATURE_DEDUP) &&
+	       S_ISREG(inode->i_mode) &&
+	       !(inode->i_blocks > VSFS_NUM_DIRECT && inode->i_indirect == blk);
+}
+
+// Pointer to block "idx" of the inode; the indirect block must be valid
+static vsfs_blk_t *block_ptr(fsck_ctx *fc, vsfs_inode *inode, vsfs_blk_t idx)
+{
+	if (idx < VSFS_NUM_DIRECT) {
+		return &inode->i_direct[idx];
+	}
+	vsfs_blk_t *indirect = fc->image + (size_t)inode->i_indirect *
+	                                   VSFS_BLOCK_SIZE;
+	return &indirect[idx - VSFS_NUM_DIRECT];
+}
+
+// If the cluster that starts at block "first" of the inode is compressed,
+// return the number of blocks it is stored in; 0 if it isn't compressed, -1
+// if it is compressed but can't be decompressed
+static int check_cluster(fsck_ctx *fc, vsfs_inode *inode, vsfs_blk_t first,
+                         vsfs_blk_t nblocks)
+{
+	if (!S_ISREG(inode->i_mode) || first % VSFS_CLUSTER_BLOCKS != 0 ||
+	    first + VSFS_CLUSTER_BLOCKS > nblocks) {
+		return 0;
+	}
+	// An invalid indirect block is reported by the caller
+	if (first + VSFS_CLUSTER_BLOCKS > VSFS_NUM_DIRECT &&
+	    !block_ok(fc, inode->i_indirect)) {
+		return 0;
+	}
+	if (*block_ptr(fc, inode, first + VSFS_CLUSTER_BLOCKS - 1) != 0) {
+		return 0;
+	}
+
+	char buf[(VSFS_CLUSTER_BLOCKS - 1) * VSFS_BLOCK_SIZE];
+	char raw[VSFS_CLUSTER_SIZE];
+	vsfs_blk_t n = 0;
+	for (; n < VSFS_CLUSTER_BLOCKS; ++n) {
+		vsfs_blk_t blk = *block_ptr(fc, inode, first + n);
+		if (blk == 0) {
+			break;
+		}
+		if (!block_ok(fc, blk)) {
+			return -1;
+		}
+		memcpy(buf + n * VSFS_BLOCK_SIZE,
+		       fc->image + (size_t)blk * VSFS_BLOCK_SIZE, VSFS_BLOCK_SIZE);
+	}
+	// Only the pointers after the compressed data may be 0
+	for (vsfs_blk_t i = n; i < VSFS_CLUSTER_BLOCKS; ++i) {
+		if (*block_ptr(fc, inode, first + i) != 0) {
+			return -1;
+		}
+	}
+	if (n == 0 || !cluster_decompress(buf, n, raw)) {
+		return -1;
+	}
+	return n;
+}
+
+// Record that the inode uses block blk (as its block "idx")
+static void claim_block(fsck_ctx *fc, vsfs_ino_t ino, vsfs_blk_t idx,
+                        vsfs_blk_t blk)
+{
+	uint32_t expected = 0;
+	__atomic_add_fetch(&fc->refs[blk], 1, __ATOMIC_RELAXED);
+	if (__atomic_compare_exchange_n(&fc->owner[blk], &expected, ino + 1,
+	                                false, __ATOMIC_RELAXED,
+	                                __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	pthread_mutex_lock(&fc->lock);
+	if (fc->ndups == fc->dups_cap) {
+		size_t cap = fc->dups_cap ? fc->dups_cap * 2 : 64;
+		dup_claim *dups = realloc(fc->dups, cap * sizeof(*dups));
+		if (dups == NULL) {
+			// Not fatal; the block is reported again on the next run
+			pthread_mutex_unlock(&fc->lock);
+			return;
+		}
+		fc->dups = dups;
+		fc->dups_cap = cap;
+	}
+	fc->dups[fc->ndups++] = (dup_claim){ ino, idx, blk };
+	pthread_mutex_unlock(&fc->lock);
+}
+
+static uint32_t *csum_table(fsck_ctx *fc)
+{
+	return fc->image + (size_t)fc->sb->csum_blk * VSFS_BLOCK_SIZE;
+}
+
+// Pass 0: check the checksum of a block that is in use
+static void check_csum(fsck_ctx *fc, uint32_t blk)
+{
+	if (!bitmap_isset(fc->dbmap, fc->sb->num_blocks, blk) ||
+	    in_csum_table(fc, blk)) {
+		return;
+	}
+	uint32_t crc = crc32c(0, fc->image + (size_t)blk * VSFS_BLOCK_SIZE,
+	                      VSFS_BLOCK_SIZE);
+	if (crc != csum_table(fc)[blk]) {
+		// The block is repaired, if it needs to be, by the later passes;
+		// the checksum is recomputed at the end
+		problem(fc, "Block %u checksum mismatch: stored %08x, computed %08x",
+		        blk, csum_table(fc)[blk], crc);
+	}
+}
+
+static void pass0(fsck_ctx *fc)
+{
+	if (fc->sb->features & VSFS_FEATURE_CSUM) {
+		printf("Pass 0: Checking block checksums\n");
+		run_parallel(fc, check_csum, fc->sb->num_blocks);
+	}
+}
+
+// Recompute the checksums of all blocks after repairs
+static void update_csums(fsck_ctx *fc)
+{
+	for (vsfs_blk_t blk = 0; blk < fc->sb->num_blocks; ++blk) {
+		if (!in_csum_table(fc, blk)) {
+			csum_table(fc)[blk] = crc32c(0, fc->image +
+			                                (size_t)blk * VSFS_BLOCK_SIZE,
+			                             VSFS_BLOCK_SIZE);
+		}
+	}
+}
+
+// Pass 1: validate block pointers of an inode and claim its blocks
+static void check_inode(fsck_ctx *fc, uint32_t ino)
+{
+	vsfs_inode *inode = &fc->itable[ino];
+	vsfs_blk_t idx = 0;
+
+	fc->valid[ino] = 0;
+	if (!inode_in_use(fc, ino)) {
+		return;
+	}
+	// Inodes with an invalid mode are cleared; don't claim anything
+	if (ino == VSFS_ROOT_INO ? !S_ISDIR(inode->i_mode)
+	                         : !S_ISREG(inode->i_mode)) {
+		return;
+	}
+
+	vsfs_blk_t nblocks = inode->i_blocks;
+	if (nblocks > VSFS_MAX_FILE_BLOCKS) {
+		nblocks = VSFS_MAX_FILE_BLOCKS;
+	}
+	// Block pointers before this one may be 0 (compressed cluster tail)
+	vsfs_blk_t zero_end = 0;
+	for (; idx < nblocks; ++idx) {
+		if (idx == VSFS_NUM_DIRECT) {
+			if (!block_ok(fc, inode->i_indirect)) {
+				break;
+			}
+			claim_block(fc, ino, idx, inode->i_indirect);
+		}
+		int n = check_cluster(fc, inode, idx, nblocks);
+		if (n < 0) {
+			break;
+		}
+		if (n > 0) {
+			zero_end = idx + VSFS_CLUSTER_BLOCKS;
+		}
+		vsfs_blk_t blk = *block_ptr(fc, inode, idx);
+		if (blk == 0 && idx < zero_end) {
+			continue;
+		}
+		if (!block_ok(fc, blk)) {
+			break;
+		}
+		claim_block(fc, ino, idx, blk);
+	}
+	fc->valid[ino] = idx;
+}
+
+// Drop all blocks of the inode from block "idx" on
+static void truncate_blocks(fsck_ctx *fc, vsfs_inode *inode, vsfs_blk_t idx)
+{
+	vsfs_blk_t nblocks = inode->i_blocks;
+	if (nblocks > VSFS_MAX_FILE_BLOCKS) {
+		nblocks = VSFS_MAX_FILE_BLOCKS;
+	}
+	// A compressed cluster can only be dropped as a whole
+	vsfs_blk_t first = idx - idx % VSFS_CLUSTER_BLOCKS;
+	if (idx < nblocks && check_cluster(fc, inode, first, nblocks) > 0) {
+		idx = first;
+	}
+	bool indirect_ok = block_ok(fc, inode->i_indirect);
+	for (vsfs_blk_t i = idx; i < nblocks; ++i) {
+		if (i >= VSFS_NUM_DIRECT && !indirect_ok) {
+			break;
+		}
+		*block_ptr(fc, inode, i) = 0;
+	}
+	if (idx <= VSFS_NUM_DIRECT) {
+		inode->i_indirect = 0;
+	}
+	inode->i_blocks = idx;
+	if (inode->i_size > (uint64_t)idx * VSFS_BLOCK_SIZE) {
+		inode->i_size = (uint64_t)idx * VSFS_BLOCK_SIZE;
+	}
+}
+
+// Fix the problems found by pass 1; returns true if block ownership changed
+static bool fix_inodes(fsck_ctx *fc)
+{
+	bool changed = false;
+
+	for (vsfs_ino_t ino = 0; ino < fc->sb->num_inodes; ++ino) {
+		vsfs_inode *inode = &fc->itable[ino];
+		if (!inode_in_use(fc, ino)) {
+			continue;
+		}
+
+		if (ino == VSFS_ROOT_INO && !S_ISDIR(inode->i_mode)) {
+			if (problem(fc, "Root inode is not a directory (mode %o)",
+			            inode->i_mode)) {
+				inode->i_mode = S_IFDIR | 0777;
+				changed = true;
+			}
+			continue;
+		}
+		if (ino != VSFS_ROOT_INO && !S_ISREG(inode->i_mode)) {
+			if (problem(fc, "Inode %u has invalid mode %o", ino,
+			            inode->i_mode)) {
+				memset(inode, 0, sizeof(*inode));
+				changed = true;
+			}
+			continue;
+		}
+
+		if (fc->valid[ino] < inode->i_blocks) {
+			if (problem(fc, "Inode %u: block %u of %u is invalid", ino,
+			            fc->valid[ino], inode->i_blocks)) {
+				truncate_blocks(fc, inode, fc->valid[ino]);
+				changed = true;
+			}
+			continue;
+		}
+
+		// Size must match the number of blocks
+		if (S_ISDIR(inode->i_mode)) {
+			if (inode->i_size != (uint64_t)inode->i_blocks * VSFS_BLOCK_SIZE &&
+			    problem(fc, "Directory inode %u: size %lu, %u blocks", ino,
+			            (unsigned long)inode->i_size, inode->i_blocks)) {
+				inode->i_size = (uint64_t)inode->i_blocks * VSFS_BLOCK_SIZE;
+			}
+		} else if (div_round_up(inode->i_size, VSFS_BLOCK_SIZE) !=
+		           inode->i_blocks) {
+			if (problem(fc, "Inode %u: size %lu, %u blocks", ino,
+			            (unsigned long)inode->i_size, inode->i_blocks)) {
+				if (inode->i_size >
+				    (uint64_t)inode->i_blocks * VSFS_BLOCK_SIZE) {
+					inode->i_size = (uint64_t)inode->i_blocks *
+					                VSFS_BLOCK_SIZE;
+				} else {
+					truncate_blocks(fc, inode,
+					                div_round_up(inode->i_size,
+					                             VSFS_BLOCK_SIZE));
+					changed = true;
+				}
+			}
+		}
+	}
+
+	// A block claimed twice stays with the inode with the lower number
+	for (size_t i = 0; i < fc->ndups; ++i) {
+		dup_claim *d = &fc->dups[i];
+		vsfs_ino_t other = fc->owner[d->blk] - 1;
+		// File data blocks can be shared on dedup images
+		if (block_shareable(fc, other, d->blk) &&
+		    block_shareable(fc, d->ino, d->blk)) {
+			continue;
+		}
+		vsfs_ino_t victim = (other > d->ino) ? other : d->ino;
+		vsfs_blk_t idx = d->idx;
+
+		if (victim != d->ino) {
+			// Find the block in the other inode
+			vsfs_inode *inode = &fc->itable[victim];
+			for (idx = 0; idx < fc->valid[victim]; ++idx) {
+				if ((idx == VSFS_NUM_DIRECT &&
+				     inode->i_indirect == d->blk) ||
+				    *block_ptr(fc, inode, idx) == d->blk) {
+					break;
+				}
+			}
+		}
+		if (problem(fc, "Block %u is used by inodes %u and %u", d->blk,
+		            other, d->ino)) {
+			vsfs_inode *inode = &fc->itable[victim];
+			if (idx < inode->i_blocks) {
+				truncate_blocks(fc, inode, idx);
+			}
+			changed = true;
+		}
+	}
+	fc->ndups = 0;
+	return changed;
+}
+
+// Pass 1, repeated until the repairs don't change block ownership
+static void pass1(fsck_ctx *fc)
+{
+	printf("Pass 1: Checking inodes and blocks\n");
+	for (int i = 0; i <= FSCK_MAX_RETRIES; ++i) {
+		memset(fc->owner, 0, fc->sb->num_blocks * sizeof(*fc->owner));
+		memset(fc->refs, 0, fc->sb->num_blocks * sizeof(*fc->refs));
+		run_parallel(fc, check_inode, fc->sb->num_inodes);
+		if (!fix_inodes(fc)) {
+			return;
+		}
+	}
+	// Ownership is still inconsistent; the bitmap pass will report it
+	fprintf(stderr, "Block ownership did not converge\n");
+}
+
+
+// Pass 2: check the entries in one root directory block
+static void check_dir_block(fsck_ctx *fc, uint32_t idx)
+{
+	vsfs_inode *root = &fc->itable[VSFS_ROOT_INO];
+	vsfs_blk_t blk = *block_ptr(fc, root, idx);
+	vsfs_dentry *dentry = fc->image + (size_t)blk * VSFS_BLOCK_SIZE;
+
+	for (uint32_t j = 0; j < DENTRIES_PER_BLOCK; ++j) {
+		vsfs_dentry *d = &dentry[j];
+		if (d->ino == VSFS_INO_MAX) {
+			continue;
+		}
+
+		const char *err = NULL;
+		bool dot = strncmp(d->name, ".", VSFS_NAME_MAX) == 0 ||
+		           strncmp(d->name, "..", VSFS_NAME_MAX) == 0;
+		if (memchr(d->name, '\0', VSFS_NAME_MAX) == NULL) {
+			err = "name is not terminated";
+		} else if (d->name[0] == '\0' || strchr(d->name, '/') != NULL) {
+			err = "invalid name";
+		} else if (d->ino >= fc->sb->num_inodes ||
+		           !inode_in_use(fc, d->ino)) {
+			err = "unused inode";
+		} else if (dot != (d->ino == VSFS_ROOT_INO)) {
+			err = "wrong inode";
+		}
+
+		if (err != NULL) {
+			if (problem(fc, "Directory block %u entry %u (inode %u): %s",
+			            blk, j, d->ino, err)) {
+				d->ino = VSFS_INO_MAX;
+				memset(d->name, 0, VSFS_NAME_MAX);
+			}
+			continue;
+		}
+		__atomic_fetch_add(&fc->links[d->ino], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void pass2(fsck_ctx *fc)
+{
+	printf("Pass 2: Checking directory entries\n");
+	memset(fc->links, 0, fc->sb->num_inodes * sizeof(*fc->links));
+	run_parallel(fc, check_dir_block, fc->valid[VSFS_ROOT_INO]);
+}
+
+
+// Find the first directory entry for the inode (VSFS_INO_MAX finds a free
+// entry). If remove_extra, all the other entries for it are removed.
+static vsfs_dentry *dir_scan(fsck_ctx *fc, vsfs_ino_t ino, bool remove_extra)
+{
+	vsfs_inode *root = &fc->itable[VSFS_ROOT_INO];
+	vsfs_dentry *first = NULL;
+
+	for (vsfs_blk_t i = 0; i < fc->valid[VSFS_ROOT_INO]; ++i) {
+		vsfs_dentry *dentry = fc->image + (size_t)*block_ptr(fc, root, i) *
+		                                  VSFS_BLOCK_SIZE;
+		for (uint32_t j = 0; j < DENTRIES_PER_BLOCK; ++j) {
+			if (dentry[j].ino != ino) {
+				continue;
+			}
+			if (first == NULL) {
+				first = &dentry[j];
+				if (!remove_extra) {
+					return first;
+				}
+			} else {
+				dentry[j].ino = VSFS_INO_MAX;
+				memset(dentry[j].name, 0, VSFS_NAME_MAX);
+			}
+		}
+	}
+	return first;
+}
+
+// Pass 3: link counts and inodes that are not in the directory
+static void pass3(fsck_ctx *fc)
+{
+	printf("Pass 3: Checking link counts\n");
+
+	for (vsfs_ino_t ino = 0; ino < fc->sb->num_inodes; ++ino) {
+		vsfs_inode *inode = &fc->itable[ino];
+		if (!inode_in_use(fc, ino)) {
+			continue;
+		}
+
+		uint32_t links = fc->links[ino];
+		if (ino == VSFS_ROOT_INO) {
+			// "." and ".."
+			if (inode->i_nlink != 2 &&
+			    problem(fc, "Root inode link count is %u, should be 2",
+			            inode->i_nlink)) {
+				inode->i_nlink = 2;
+			}
+			continue;
+		}
+
+		if (links == 0) {
+			vsfs_dentry *d = dir_scan(fc, VSFS_INO_MAX, false);
+			if (d == NULL) {
+				unfixable(fc, "Inode %u is not in the directory, which is "
+				          "full", ino);
+				continue;
+			}
+			if (problem(fc, "Inode %u is not in the directory; "
+			            "reconnecting as #%u", ino, ino)) {
+				d->ino = ino;
+				snprintf(d->name, VSFS_NAME_MAX, "#%u", ino);
+			}
+		} else if (links > 1) {
+			if (problem(fc, "Inode %u has %u directory entries", ino,
+			            links)) {
+				dir_scan(fc, ino, true);
+			}
+		}
+		if (inode->i_nlink != 1 &&
+		    problem(fc, "Inode %u link count is %u, should be 1", ino,
+		            inode->i_nlink)) {
+			inode->i_nlink = 1;
+		}
+	}
+}
+
+
+// Number of references to the block beyond the first one (see vsfs.h)
+static vsfs_refs_t extra_refs(fsck_ctx *fc, vsfs_blk_t blk)
+{
+	uint32_t refs = fc->refs[blk];
+	if (refs <= 1) {
+		return 0;
+	}
+	return (refs - 1 < VSFS_REFS_MAX) ? refs - 1 : VSFS_REFS_MAX;
+}
+
+// Pass 4: bitmaps, reference counts and superblock counters
+static void pass4(fsck_ctx *fc)
+{
+	vsfs_superblock *sb = fc->sb;
+	uint32_t used_inodes = 0, used_blocks = 0;
+	uint32_t idiff = 0, bdiff = 0;
+
+	printf("Pass 4: Checking bitmaps and counters\n");
+
+	for (vsfs_ino_t ino = 0; ino < sb->num_inodes; ++ino) {
+		bool used = inode_in_use(fc, ino);
+		used_inodes += used;
+		if (bitmap_isset(fc->ibmap, sb->num_inodes, ino) != used) {
+			idiff++;
+		}
+	}
+	if (idiff > 0 &&
+	    problem(fc, "Inode bitmap differences: %u inodes", idiff)) {
+		for (vsfs_ino_t ino = 0; ino < sb->num_inodes; ++ino) {
+			bitmap_set(fc->ibmap, sb->num_inodes, ino,
+			           inode_in_use(fc, ino));
+		}
+	}
+
+	for (vsfs_blk_t blk = 0; blk < sb->num_blocks; ++blk) {
+		bool used = blk < sb->data_region || fc->owner[blk] != 0 ||
+		            in_refcount_table(fc, blk) || in_csum_table(fc, blk);
+		used_blocks += used;
+		if (bitmap_isset(fc->dbmap, sb->num_blocks, blk) != used) {
+			bdiff++;
+		}
+	}
+	if (bdiff > 0 &&
+	    problem(fc, "Block bitmap differences: %u blocks", bdiff)) {
+		for (vsfs_blk_t blk = 0; blk < sb->num_blocks; ++blk) {
+			bitmap_set(fc->dbmap, sb->num_blocks, blk,
+			           blk < sb->data_region || fc->owner[blk] != 0 ||
+			           in_refcount_table(fc, blk) ||
+			           in_csum_table(fc, blk));
+		}
+	}
+
+	if (sb->features & VSFS_FEATURE_DEDUP) {
+		vsfs_refs_t *table = fc->image + (size_t)sb->refcount_blk *
+		                                 VSFS_BLOCK_SIZE;
+		uint32_t rdiff = 0;
+		for (vsfs_blk_t blk = 0; blk < sb->num_blocks; ++blk) {
+			rdiff += table[blk] != extra_refs(fc, blk);
+		}
+		if (rdiff > 0 &&
+		    problem(fc, "Reference count differences: %u blocks", rdiff)) {
+			for (vsfs_blk_t blk = 0; blk < sb->num_blocks; ++blk) {
+				table[blk] = extra_refs(fc, blk);
+			}
+		}
+	}
+
+	if (sb->free_inodes != sb->num_inodes - used_inodes &&
+	    problem(fc, "Free inodes count is %u, should be %u",
+	            sb->free_inodes, sb->num_inodes - used_inodes)) {
+		sb->free_inodes = sb->num_inodes - used_inodes;
+	}
+	if (sb->free_blocks != sb->num_blocks - used_blocks &&
+	    problem(fc, "Free blocks count is %u, should be %u",
+	            sb->free_blocks, sb->num_blocks - used_blocks)) {
+		sb->free_blocks = sb->num_blocks - used_blocks;
+	}
+
+	printf("%s: %u/%u inodes, %u/%u blocks\n", fc->opts->img_path,
+	       used_inodes, sb->num_inodes, used_blocks, sb->num_blocks);
+}
+
+
+// Check the superblock fields that everything else depends on
+static bool check_superblock(fsck_ctx *fc)
+{
+	vsfs_superblock *sb = fc->sb;
+	uint32_t inodes_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_inode);
+
+	if (sb->magic != VSFS_MAGIC) {
+		fprintf(stderr, "%s: not a vsfs image\n", fc->opts->img_path);
+		return false;
+	}
+	if ((sb->features & ~VSFS_FEATURES_ALL) != 0) {
+		fprintf(stderr, "%s: unsupported features %#x\n", fc->opts->img_path,
+		        sb->features & ~VSFS_FEATURES_ALL);
+		return false;
+	}
+
+	// mkfs sets both the size and the block count; trust the size if the
+	// block count disagrees with it and it is plausible
+	vsfs_blk_t size_blocks = sb->size / VSFS_BLOCK_SIZE;
+	if (sb->num_blocks != size_blocks && sb->size % VSFS_BLOCK_SIZE == 0 &&
+	    sb->size <= fc->size && size_blocks >= VSFS_BLK_MIN &&
+	    size_blocks <= VSFS_BLK_MAX) {
+		if (!problem(fc, "Block count is %u, should be %u",
+		             sb->num_blocks, size_blocks)) {
+			return false;
+		}
+		sb->num_blocks = size_blocks;
+	}
+
+	if (sb->num_blocks < VSFS_BLK_MIN || sb->num_blocks > VSFS_BLK_MAX ||
+	    (size_t)sb->num_blocks * VSFS_BLOCK_SIZE > fc->size) {
+		fprintf(stderr, "Invalid number of blocks: %u\n", sb->num_blocks);
+		return false;
+	}
+	if (sb->num_inodes == 0 || sb->num_inodes >= VSFS_INO_MAX) {
+		fprintf(stderr, "Invalid number of inodes: %u\n", sb->num_inodes);
+		return false;
+	}
+	if (sb->data_region != VSFS_ITBL_BLKNUM +
+	                       div_round_up(sb->num_inodes, inodes_per_block) ||
+	    sb->data_region >= sb->num_blocks) {
+		fprintf(stderr, "Invalid data region start: %u\n", sb->data_region);
+		return false;
+	}
+
+	if ((sb->features & VSFS_FEATURE_DEDUP) &&
+	    (sb->refcount_blk < sb->data_region ||
+	     sb->refcount_blk > sb->num_blocks -
+	                        VSFS_REFCOUNT_BLOCKS(sb->num_blocks))) {
+		fprintf(stderr, "Invalid reference count table start: %u\n",
+		        sb->refcount_blk);
+		return false;
+	}
+	if ((sb->features & VSFS_FEATURE_CSUM) &&
+	    (sb->csum_blk < sb->data_region ||
+	     sb->csum_blk > sb->num_blocks - VSFS_CSUM_BLOCKS(sb->num_blocks))) {
+		fprintf(stderr, "Invalid checksum table start: %u\n", sb->csum_blk);
+		return false;
+	}
+	if (!(sb->features & VSFS_FEATURE_CSUM) && sb->csum_blk != 0 &&
+	    problem(fc, "Checksum table at %u without checksum feature",
+	            sb->csum_blk)) {
+		sb->csum_blk = 0;
+	}
+	if (!(sb->features & VSFS_FEATURE_DEDUP) && sb->refcount_blk != 0 &&
+	    problem(fc, "Reference count table at %u without dedup feature",
+	            sb->refcount_blk)) {
+		sb->refcount_blk = 0;
+	}
+
+	// Only the inode table blocks after the first one can be uninitialized
+	if (sb->features & VSFS_FEATURE_LAZY_ITABLE) {
+		uint32_t itbl_blocks = sb->data_region - VSFS_ITBL_BLKNUM;
+		uint32_t bad = 0;
+		for (uint32_t i = 0; i < VSFS_ITBL_FLAG_WORDS * 64; ++i) {
+			bad += (i == 0 || i >= itbl_blocks) && vsfs_itbl_uninit(sb, i);
+		}
+		if (bad > 0 &&
+		    problem(fc, "Invalid inode table initialization flags: %u",
+		            bad)) {
+			for (uint32_t i = 0; i < VSFS_ITBL_FLAG_WORDS * 64; ++i) {
+				if (i == 0 || i >= itbl_blocks) {
+					vsfs_itbl_set_init(sb, i);
+				}
+			}
+		}
+	}
+
+	if (sb->size != (uint64_t)sb->num_blocks * VSFS_BLOCK_SIZE &&
+	    problem(fc, "Superblock size is %lu, should be %lu",
+	            (unsigned long)sb->size,
+	            (unsigned long)sb->num_blocks * VSFS_BLOCK_SIZE)) {
+		sb->size = (uint64_t)sb->num_blocks * VSFS_BLOCK_SIZE;
+	}
+	return true;
+}
+
+
+/**
+ * Map a striped file system into memory as a single image, replacing the
+ * mapping of its first image.
+ */
+static bool map_stripes(fsck_ctx *fc)
+{
+	const vsfs_superblock *sb = (vsfs_superblock *)fc->image;
+	bool striped = sb->magic == VSFS_MAGIC &&
+	               (sb->features & VSFS_FEATURE_STRIPE);
+	if (striped != (fc->opts->stripe != NULL)) {
+		fprintf(stderr, striped
+		        ? "%s: striped file system; use -S to give the other images\n"
+		        : "%s: not a striped file system\n", fc->opts->img_path);
+		return false;
+	}
+	if (!striped) {
+		return true;
+	}
+
+	const char *paths[STRIPE_MAX_IMAGES] = { fc->opts->img_path };
+	int n = stripe_split(fc->opts->stripe, paths + 1, STRIPE_MAX_IMAGES - 1);
+	stripe_layout sl = { sb->stripe_count, sb->stripe_unit, sb->data_region };
+	if (!stripe_valid(&sl)) {
+		return false;
+	}
+	if (n < 0 || (uint32_t)n + 1 != sl.count) {
+		fprintf(stderr, "%s: striped over %u images\n", fc->opts->img_path,
+		        sl.count);
+		return false;
+	}
+
+	void *addr = NULL;
+	int fds[STRIPE_MAX_IMAGES];
+	vsfs_blk_t blocks[STRIPE_MAX_IMAGES];
+	uint32_t opened = 0;
+	for (; opened < sl.count; ++opened) {
+		fds[opened] = open(paths[opened], O_RDWR);
+		struct stat s;
+		if (fds[opened] < 0 || fstat(fds[opened], &s) < 0) {
+			perror(paths[opened]);
+			if (fds[opened] >= 0) {
+				++opened;
+			}
+			goto end;
+		}
+		blocks[opened] = s.st_size / VSFS_BLOCK_SIZE;
+	}
+
+	// Blocks past what fits into the images are reported by
+	// check_superblock(), as for a single image that is too small
+	vsfs_blk_t nblocks = stripe_fit(&sl, blocks);
+	if (nblocks == 0) {
+		fprintf(stderr, "%s: striped images are too small\n",
+		        fc->opts->img_path);
+		goto end;
+	}
+	addr = stripe_mmap(&sl, fds, nblocks);
+	if (addr != NULL) {
+		munmap(fc->image, fc->size);
+		fc->image = addr;
+		fc->size = (size_t)nblocks * VSFS_BLOCK_SIZE;
+	}
+
+end:
+	for (uint32_t i = 0; i < opened; ++i) {
+		close(fds[i]);
+	}
+	return addr != NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	fsck_opts opts = {0}; // options; defaults are all 0
+	fsck_ctx fc = {0};
+	int ret = FSCK_ERROR;
+
+	if (!parse_args(argc, argv, &opts)) {
+		// Invalid arguments, print help to stderr
+		print_help(stderr, argv[0]);
+		return FSCK_ERROR;
+	}
+	if (opts.help) {
+		// Help requested, print it to stdout
+		print_help(stdout, argv[0]);
+		return FSCK_OK;
+	}
+	if (opts.nthreads == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		opts.nthreads = (ncpus > 0) ? ncpus : 1;
+	}
+	fc.opts = &opts;
+	pthread_mutex_init(&fc.lock, NULL);
+
+	// Map disk image file into memory
+	fc.image = map_file(opts.img_path, VSFS_BLOCK_SIZE, &fc.size);
+	if (fc.image == NULL) {
+		return FSCK_ERROR;
+	}
+	if (!map_stripes(&fc)) {
+		munmap(fc.image, fc.size);
+		return FSCK_ERROR;
+	}
+	fc.sb = (vsfs_superblock *)fc.image;
+	fc.ibmap = (bitmap_t *)(fc.image + VSFS_IMAP_BLKNUM * VSFS_BLOCK_SIZE);
+	fc.dbmap = (bitmap_t *)(fc.image + VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE);
+	fc.itable = (vsfs_inode *)(fc.image + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE);
+
+	if (!check_superblock(&fc)) {
+		ret = FSCK_UNCORRECTED;
+		goto end;
+	}
+
+	fc.owner = calloc(fc.sb->num_blocks, sizeof(*fc.owner));
+	fc.refs = calloc(fc.sb->num_blocks, sizeof(*fc.refs));
+	fc.valid = calloc(fc.sb->num_inodes, sizeof(*fc.valid));
+	fc.links = calloc(fc.sb->num_inodes, sizeof(*fc.links));
+	if (fc.owner == NULL || fc.refs == NULL || fc.valid == NULL ||
+	    fc.links == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto end;
+	}
+
+	pass0(&fc);
+	pass1(&fc);
+	pass2(&fc);
+	pass3(&fc);
+	pass4(&fc);
+	if ((fc.sb->features & VSFS_FEATURE_CSUM) && fc.repaired > 0) {
+		update_csums(&fc);
+	}
+
+	if (fc.problems == 0) {
+		ret = FSCK_OK;
+	} else if (fc.repaired == fc.problems) {
+		ret = FSCK_CORRECTED;
+	} else {
+		ret = FSCK_UNCORRECTED;
+	}
+
+end:
+	free(fc.owner);
+	free(fc.refs);
+	free(fc.valid);
+	free(fc.links);
+	free(fc.dups);
+	pthread_mutex_destroy(&fc.lock);
+	munmap(fc.image, fc.size);
+	return ret;
+}
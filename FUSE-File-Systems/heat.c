@@ -0,0 +1,69 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - File access heat implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heat.h"
+
+
+bool heat_init(heat *h, uint32_t num_inodes)
+{
+	h->counts = calloc(num_inodes, sizeof(heat_count));
+	if (h->counts == NULL) {
+		fprintf(stderr, "Failed to allocate access counts\n");
+		return false;
+	}
+	h->num_inodes = num_inodes;
+	h->epoch = 0;
+	h->accesses = 0;
+	return true;
+}
+
+void heat_destroy(heat *h)
+{
+	free(h->counts);
+	h->counts = NULL;
+}
+
+uint32_t heat_get(const heat *h, vsfs_ino_t ino)
+{
+	assert(ino < h->num_inodes);
+	const heat_count *c = &h->counts[ino];
+	uint32_t age = h->epoch - c->epoch;
+	return (age < 32) ? c->count >> age : 0;
+}
+
+void heat_access(heat *h, vsfs_ino_t ino)
+{
+	uint32_t count = heat_get(h, ino);
+	h->counts[ino].count = (count < UINT32_MAX) ? count + 1 : count;
+	h->counts[ino].epoch = h->epoch;
+
+	if (++h->accesses == HEAT_HALF_LIFE) {
+		h->accesses = 0;
+		h->epoch++;
+	}
+}
+
+void heat_reset(heat *h, vsfs_ino_t ino)
+{
+	assert(ino < h->num_inodes);
+	h->counts[ino].count = 0;
+	h->counts[ino].epoch = h->epoch;
+}
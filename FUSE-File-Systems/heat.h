@@ -0,0 +1,92 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - File access heat header file.
+ *
+ * Counts the reads and writes of each file. All the counts are halved every
+ * HEAT_HALF_LIFE accesses (lazily, when a count is next used), so a file
+ * that was busy a long time ago cools down. The hottest files can then be
+ * moved close to the metadata (see VSFS_IOC_HOTZONE), keeping the working
+ * set in a small, dense part of the image. Counts only exist in memory.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vsfs.h"
+
+/** Number of accesses (to any file) after which all counts are halved. */
+#define HEAT_HALF_LIFE 4096
+
+
+/** Access count of a file. */
+typedef struct heat_count {
+	/** Count as of epoch. */
+	uint32_t count;
+	uint32_t epoch;
+} heat_count;
+
+/** Access counts of all files. */
+typedef struct heat {
+	heat_count *counts;
+	uint32_t num_inodes;
+	/** Number of half-lives so far. */
+	uint32_t epoch;
+	/** Number of accesses in the current half-life. */
+	uint32_t accesses;
+} heat;
+
+/**
+ * Initialize the counts, all 0.
+ *
+ * @param h           pointer to the counts.
+ * @param num_inodes  number of inodes in the file system.
+ * @return            true on success; false if out of memory.
+ */
+bool heat_init(heat *h, uint32_t num_inodes);
+
+/**
+ * Free the counts.
+ *
+ * @param h  pointer to the counts.
+ */
+void heat_destroy(heat *h);
+
+/**
+ * Count an access (read or write call) to a file.
+ *
+ * @param h    pointer to the counts.
+ * @param ino  inode number.
+ */
+void heat_access(heat *h, vsfs_ino_t ino);
+
+/**
+ * Get the current (decayed) access count of a file.
+ *
+ * @param h    pointer to the counts.
+ * @param ino  inode number.
+ * @return     the count; 0 if the file is cold.
+ */
+uint32_t heat_get(const heat *h, vsfs_ino_t ino);
+
+/**
+ * Reset the count of a file, e.g. when its inode is reused.
+ *
+ * @param h    pointer to the counts.
+ * @param ino  inode number.
+ */
+void heat_reset(heat *h, vsfs_ino_t ino);
@@ -0,0 +1,190 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - LZ compression implementation.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/** Minimum match length. */
+#define LZ_MIN_MATCH 4
+/** Maximum match offset. */
+#define LZ_MAX_OFFSET 65535
+/** Number of hash table entries (log2). */
+#define LZ_HASH_BITS 12
+/** Matches are not searched for in the last few bytes of the input. */
+#define LZ_TAIL 8
+
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Write a length that didn't fit into a token nibble
+static uint8_t *put_length(uint8_t *op, uint8_t *end, size_t len)
+{
+	for (; len >= 255; len -= 255) {
+		if (op == end) return NULL;
+		*op++ = 255;
+	}
+	if (op == end) return NULL;
+	*op++ = len;
+	return op;
+}
+
+// Write one sequence; match_len is 0 for the last (literals only) one
+static uint8_t *put_sequence(uint8_t *op, uint8_t *end, const uint8_t *lit,
+                             size_t lit_len, size_t offset, size_t match_len)
+{
+	size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+	if (op == end) return NULL;
+	uint8_t *token = op++;
+	*token = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+	if (lit_len >= 15 && !(op = put_length(op, end, lit_len - 15))) {
+		return NULL;
+	}
+	if ((size_t)(end - op) < lit_len) return NULL;
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len == 0) {
+		return op;
+	}
+	if (end - op < 2) return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	if (ml >= 15 && !(op = put_length(op, end, ml - 15))) {
+		return NULL;
+	}
+	return op;
+}
+
+size_t lz_compress(const void *src, size_t src_len, void *dst, size_t dst_cap)
+{
+	const uint8_t *in = src;
+	uint8_t *op = dst;
+	uint8_t *end = op + dst_cap;
+	// Positions of recent 4-byte sequences (+1, so that 0 means none)
+	uint16_t table[1 << LZ_HASH_BITS];
+	size_t ip = 0, anchor = 0;
+
+	if (src_len > LZ_MAX_OFFSET) {
+		return 0;
+	}
+	memset(table, 0, sizeof(table));
+
+	while (src_len >= LZ_TAIL && ip < src_len - LZ_TAIL) {
+		uint32_t seq = read32(in + ip);
+		uint32_t h = hash32(seq);
+		size_t ref = table[h];
+		table[h] = ip + 1;
+
+		if (ref == 0 || read32(in + ref - 1) != seq) {
+			// Skip faster through data that doesn't compress
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		ref--;
+
+		size_t len = LZ_MIN_MATCH;
+		while (ip + len < src_len && in[ref + len] == in[ip + len]) {
+			len++;
+		}
+		op = put_sequence(op, end, in + anchor, ip - anchor, ip - ref, len);
+		if (op == NULL) {
+			return 0;
+		}
+		ip += len;
+		anchor = ip;
+	}
+
+	op = put_sequence(op, end, in + anchor, src_len - anchor, 0, 0);
+	return op ? (size_t)(op - (uint8_t *)dst) : 0;
+}
+
+// Read a length that didn't fit into a token nibble
+static const uint8_t *get_length(const uint8_t *ip, const uint8_t *end,
+                                 size_t *len)
+{
+	uint8_t b;
+	do {
+		if (ip == end) return NULL;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+	return ip;
+}
+
+long lz_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *in_end = ip + src_len;
+	uint8_t *op = dst;
+	uint8_t *out_end = op + dst_cap;
+
+	for (;;) {
+		if (ip == in_end) return -1;
+		uint8_t token = *ip++;
+
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && !(ip = get_length(ip, in_end, &lit_len))) {
+			return -1;
+		}
+		if ((size_t)(in_end - ip) < lit_len ||
+		    (size_t)(out_end - op) < lit_len) {
+			return -1;
+		}
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		// The last sequence has no match
+		if (ip == in_end) {
+			break;
+		}
+
+		if (in_end - ip < 2) return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t match_len = token & 15;
+		if (match_len == 15 && !(ip = get_length(ip, in_end, &match_len))) {
+			return -1;
+		}
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst) ||
+		    (size_t)(out_end - op) < match_len) {
+			return -1;
+		}
+		// Byte by byte: the match may overlap the output
+		const uint8_t *ref = op - offset;
+		for (size_t i = 0; i < match_len; i++) {
+			op[i] = ref[i];
+		}
+		op += match_len;
+	}
+	return op - (uint8_t *)dst;
+}
@@ -0,0 +1,54 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - LZ compression header file.
+ *
+ * A small and fast LZ77 codec using the LZ4 block format: a sequence of
+ * (literals, match) pairs, each starting with a token byte whose high and
+ * low nibbles hold the literal length and match length - 4 (15 means more
+ * length bytes follow), then the literals, then a 2-byte little-endian match
+ * offset. The last sequence has literals only.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+
+/**
+ * Compress a buffer.
+ *
+ * @param src      data to compress.
+ * @param src_len  number of bytes in src (less than 64 KiB).
+ * @param dst      output buffer.
+ * @param dst_cap  size of the output buffer.
+ * @return         compressed size; 0 if it doesn't fit into dst_cap bytes.
+ */
+size_t lz_compress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+/**
+ * Decompress a buffer produced by lz_compress().
+ *
+ * The input is fully validated; corrupted data never causes accesses outside
+ * of the buffers.
+ *
+ * @param src      compressed data.
+ * @param src_len  compressed size.
+ * @param dst      output buffer.
+ * @param dst_cap  size of the output buffer.
+ * @return         decompressed size; -1 if the data is corrupted or doesn't
+ *                 fit into dst_cap bytes.
+ */
+long lz_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap);
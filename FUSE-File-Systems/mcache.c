@@ -0,0 +1,191 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Directory metadata cache implementation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mcache.h"
+
+
+// 64-bit FNV-1a
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME  0x100000001B3ull
+
+uint64_t mcache_name_hash(const char *name)
+{
+	uint64_t h = FNV_OFFSET;
+	for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+		h = (h ^ *p) * FNV_PRIME;
+	}
+	return (h != 0) ? h : 1;
+}
+
+
+// Add the entries of directory block "idx" to the cache
+static bool add_block(mcache *mc, const vsfs_dentry *dentry, vsfs_blk_t idx,
+                      size_t *count)
+{
+	mcache_add_block(mc);
+	for (uint32_t j = 0; j < DENTRIES_PER_BLOCK; ++j) {
+		if (dentry[j].ino == VSFS_INO_MAX) {
+			continue;
+		}
+		// Keep the table at most half full
+		if (++*count > mc->nslots / 2) {
+			fprintf(stderr, "Too many directory entries\n");
+			return false;
+		}
+		mcache_insert(mc, mcache_name_hash(dentry[j].name),
+		              idx * DENTRIES_PER_BLOCK + j);
+	}
+	return true;
+}
+
+bool mcache_init(mcache *mc, bdev *bd, const vsfs_inode *dir,
+                 uint32_t num_inodes)
+{
+	// Every entry but "." and ".." has its own inode
+	mc->nslots = 16;
+	while (mc->nslots < 2 * ((size_t)num_inodes + 2)) {
+		mc->nslots *= 2;
+	}
+	mc->nblocks = 0;
+	mc->slots = calloc(mc->nslots, sizeof(*mc->slots));
+	if (mc->slots == NULL) {
+		return false;
+	}
+	if (dir->i_blocks > VSFS_MAX_FILE_BLOCKS) {
+		mcache_destroy(mc);
+		return false;
+	}
+
+	const vsfs_blk_t *indirect = NULL;
+	size_t count = 0;
+	bool ok = true;
+	for (vsfs_blk_t i = 0; i < dir->i_blocks && ok; ++i) {
+		vsfs_blk_t blk;
+		if (i < VSFS_NUM_DIRECT) {
+			blk = dir->i_direct[i];
+		} else {
+			if (indirect == NULL) {
+				indirect = bdev_get(bd, dir->i_indirect);
+				if (indirect == NULL) {
+					ok = false;
+					break;
+				}
+			}
+			blk = indirect[i - VSFS_NUM_DIRECT];
+		}
+
+		const vsfs_dentry *dentry = bdev_get(bd, blk);
+		if (dentry == NULL) {
+			ok = false;
+			break;
+		}
+		ok = add_block(mc, dentry, i, &count);
+		bdev_put(bd, blk, false);
+	}
+	if (indirect != NULL) {
+		bdev_put(bd, dir->i_indirect, false);
+	}
+	if (!ok) {
+		mcache_destroy(mc);
+	}
+	return ok;
+}
+
+void mcache_destroy(mcache *mc)
+{
+	free(mc->slots);
+	mc->slots = NULL;
+	mc->nblocks = 0;
+}
+
+static size_t slot_of(const mcache *mc, uint64_t hash)
+{
+	return hash & (mc->nslots - 1);
+}
+
+void mcache_insert(mcache *mc, uint64_t hash, uint32_t pos)
+{
+	vsfs_blk_t idx = pos / DENTRIES_PER_BLOCK;
+	assert(idx < mc->nblocks && mc->used[idx] < DENTRIES_PER_BLOCK);
+	mc->used[idx]++;
+
+	// At most half of the slots are used, so there always is a free one
+	size_t i = slot_of(mc, hash);
+	while (mc->slots[i].hash != 0) {
+		i = (i + 1) & (mc->nslots - 1);
+	}
+	mc->slots[i] = (mcache_slot){ hash, pos };
+}
+
+void mcache_remove(mcache *mc, uint64_t hash, uint32_t pos)
+{
+	vsfs_blk_t idx = pos / DENTRIES_PER_BLOCK;
+	assert(idx < mc->nblocks && mc->used[idx] > 0);
+	mc->used[idx]--;
+
+	size_t mask = mc->nslots - 1;
+	size_t i = slot_of(mc, hash);
+	while (mc->slots[i].hash != hash || mc->slots[i].pos != pos) {
+		assert(mc->slots[i].hash != 0);
+		i = (i + 1) & mask;
+	}
+
+	// Shift back the following entries that would no longer be reachable
+	// through the hole (same as dedup_remove())
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (mc->slots[j].hash == 0) {
+			break;
+		}
+		size_t home = slot_of(mc, mc->slots[j].hash);
+		bool stays = (i <= j) ? (home > i && home <= j)
+		                      : (home > i || home <= j);
+		if (!stays) {
+			mc->slots[i] = mc->slots[j];
+			i = j;
+		}
+	}
+	mc->slots[i] = (mcache_slot){ 0, 0 };
+}
+
+uint32_t mcache_lookup(const mcache *mc, uint64_t hash, size_t *iter)
+{
+	size_t mask = mc->nslots - 1;
+	size_t i = (slot_of(mc, hash) + *iter) & mask;
+
+	for (; mc->slots[i].hash != 0; i = (i + 1) & mask) {
+		++*iter;
+		if (mc->slots[i].hash == hash) {
+			return mc->slots[i].pos;
+		}
+	}
+	return MCACHE_NONE;
+}
+
+vsfs_blk_t mcache_free_block(const mcache *mc)
+{
+	vsfs_blk_t idx = 0;
+	while (idx < mc->nblocks && mc->used[idx] == DENTRIES_PER_BLOCK) {
+		++idx;
+	}
+	return idx;
+}
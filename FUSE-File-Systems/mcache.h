@@ -0,0 +1,140 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Directory metadata cache header file.
+ *
+ * Built from the root directory when the file system is mounted and kept up
+ * to date by create and unlink, so that directory operations don't have to
+ * read every directory block:
+ *  - an index of the entries by name hash, so that a lookup reads only the
+ *    block(s) holding entries whose name has the same hash;
+ *  - the number of entries in use in each directory block, so that create
+ *    goes straight to a block with a free entry, and readdir skips empty
+ *    blocks.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vsfs.h"
+#include "bdev.h"
+
+
+/** Number of directory entries in a block. */
+#define DENTRIES_PER_BLOCK (VSFS_BLOCK_SIZE / sizeof(vsfs_dentry))
+
+/** Returned by mcache_lookup() when there are no more entries. */
+#define MCACHE_NONE UINT32_MAX
+
+
+/**
+ * Compute the hash of an entry name.
+ *
+ * @param name  NUL-terminated name.
+ * @return      hash; never 0.
+ */
+uint64_t mcache_name_hash(const char *name);
+
+
+/** An index entry. */
+typedef struct mcache_slot {
+	/** 0 if the slot is empty. */
+	uint64_t hash;
+	/** Entry position: directory block index * DENTRIES_PER_BLOCK + slot. */
+	uint32_t pos;
+} mcache_slot;
+
+/** Metadata cache of the root directory. */
+typedef struct mcache {
+	/** Open addressing hash table with linear probing. */
+	mcache_slot *slots;
+	/** Number of slots; a power of 2, at least twice the number of entries
+	 *  the directory can have. */
+	size_t nslots;
+	/** Number of entries in use in each directory block. */
+	uint16_t used[VSFS_MAX_FILE_BLOCKS];
+	/** Number of directory blocks. */
+	vsfs_blk_t nblocks;
+} mcache;
+
+/**
+ * Build the cache by reading all the blocks of a directory.
+ *
+ * @param mc          pointer to the cache to initialize.
+ * @param bd          the disk image.
+ * @param dir         the directory inode.
+ * @param num_inodes  number of inodes in the file system.
+ * @return            true on success; false on failure (out of memory, I/O
+ *                    error, or more entries than there are inodes).
+ */
+bool mcache_init(mcache *mc, bdev *bd, const vsfs_inode *dir,
+                 uint32_t num_inodes);
+
+/**
+ * Free the cache.
+ *
+ * @param mc  pointer to the cache.
+ */
+void mcache_destroy(mcache *mc);
+
+/**
+ * Record an entry that was added to the directory.
+ *
+ * @param mc    pointer to the cache.
+ * @param hash  hash of the entry name.
+ * @param pos   entry position.
+ */
+void mcache_insert(mcache *mc, uint64_t hash, uint32_t pos);
+
+/**
+ * Record an entry that was removed from the directory.
+ *
+ * @param mc    pointer to the cache.
+ * @param hash  hash of the entry name.
+ * @param pos   entry position.
+ */
+void mcache_remove(mcache *mc, uint64_t hash, uint32_t pos);
+
+/**
+ * Iterate over the entries whose name has a hash. Different names can have
+ * the same hash, so the name of each entry must still be compared.
+ *
+ * @param mc    pointer to the cache.
+ * @param hash  hash of the name.
+ * @param iter  iteration state; must be 0 for the first call.
+ * @return      position of the next entry; MCACHE_NONE if there are no more.
+ */
+uint32_t mcache_lookup(const mcache *mc, uint64_t hash, size_t *iter);
+
+/**
+ * Find a directory block with an unused entry.
+ *
+ * @param mc  pointer to the cache.
+ * @return    index of the first such block; mc->nblocks if all are full.
+ */
+vsfs_blk_t mcache_free_block(const mcache *mc);
+
+/**
+ * Record a (still empty) block that was appended to the directory.
+ *
+ * @param mc  pointer to the cache.
+ */
+static inline void mcache_add_block(mcache *mc)
+{
+	assert(mc->nblocks < VSFS_MAX_FILE_BLOCKS);
+	mc->used[mc->nblocks++] = 0;
+}
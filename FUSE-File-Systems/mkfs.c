@@ -16,15 +16,22 @@
  * CSC369 Assignment 5 - vsfs formatting tool.
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include "vsfs.h"
 #include "bitmap.h"
+#include "crc32c.h"
 #include "map.h"
+#include "stripe.h"
 
 /** Command line options. */
 typedef struct mkfs_opts {
@@ -39,6 +46,16 @@ typedef struct mkfs_opts {
 	bool force;
 	/** Zero out image contents. */
 	bool zero;
+	/** Store block checksums. */
+	bool csum;
+	/** Host directory to copy files from; NULL if none. */
+	const char *dir;
+	/** Other images to stripe the file system over; NULL if none. */
+	char *stripe;
+	/** Stripe unit in blocks. */
+	vsfs_blk_t stripe_unit;
+	/** Number of images, including the first one (set by map_stripes()). */
+	uint32_t stripe_count;
 
 } mkfs_opts;
 
@@ -52,25 +69,42 @@ Options:\n\
     -i num  number of inodes; required argument\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing vsfs file system\n\
-    -z      zero out image contents\n\
+    -z      zero out image contents (by default, only the metadata is\n\
+            written; free blocks and unused inode table blocks are\n\
+            left as they are)\n\
+    -c      store a CRC32C checksum of every block, verified by vsfs\n\
+    -d dir  copy the regular files in host directory dir into the root\n\
+            directory, each one in contiguous blocks (vsfs has no\n\
+            subdirectories; anything else in dir is skipped)\n\
+    -S list stripe the file system over the image and the other images\n\
+            in list, separated by ':' (up to %d in total); the metadata\n\
+            stays on the first one. The same list must be given to vsfs\n\
+            (-o stripe=list) and fsck.vsfs (-S list)\n\
+    -u num  stripe unit in blocks (default: %d)\n\
 ";
 
 static void print_help(FILE *f, const char *progname)
 {
-	fprintf(f, help_str, progname, VSFS_BLOCK_SIZE);
+	fprintf(f, help_str, progname, VSFS_BLOCK_SIZE, STRIPE_MAX_IMAGES,
+	        STRIPE_DEFAULT_UNIT);
 }
 
 
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
 	char o;
-	while ((o = getopt(argc, argv, "i:hfvz")) != -1) {
+	opts->stripe_unit = STRIPE_DEFAULT_UNIT;
+	while ((o = getopt(argc, argv, "i:hfvzcd:S:u:")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
 
 			case 'h': opts->help  = true; return true;// skip other arguments
 			case 'f': opts->force = true; break;
 			case 'z': opts->zero  = true; break;
+			case 'c': opts->csum  = true; break;
+			case 'd': opts->dir   = optarg; break;
+			case 'S': opts->stripe = optarg; break;
+			case 'u': opts->stripe_unit = strtoul(optarg, NULL, 10); break;
 
 			case '?': return false;
 			default : assert(false);
@@ -124,8 +158,9 @@ static bool vsfs_is_present(void *image)
  */
 static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 {
-	// clear the disk when mounting
-	memset(image, 0, size);
+	// Only the blocks written below are cleared; the rest of the image is
+	// either free or lazily initialized (see vsfs_itbl_uninit())
+	memset(image, 0, VSFS_BLOCK_SIZE);
 	//TODO: initialize the superblock and create an empty root directory
 	//NOTE: the mode of the root directory inode should be set
 	//      to S_IFDIR | 0777
@@ -199,6 +234,7 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 
 	// 2. Initialize fields of root dir inode (the mtime is done for you)
 	itable = (vsfs_inode *)(image + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE);	
+	memset(itable, 0, VSFS_BLOCK_SIZE);
 	root_ino = &itable[VSFS_ROOT_INO];
 	
 	if (clock_gettime(CLOCK_REALTIME, &(root_ino->i_mtime)) != 0) {
@@ -212,6 +248,17 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	root_ino->i_size = VSFS_BLOCK_SIZE;
 
 	
+	// The other inode table blocks are zeroed when first used, unless the
+	// whole image has been zeroed already
+	if (!opts->zero) {
+		for (uint64_t i = 1; i < num_inode_blocks; i++) {
+			sb->itbl_uninit[i / 64] |= (uint64_t)1 << (i % 64);
+		}
+		if (num_inode_blocks > 1) {
+			sb->features |= VSFS_FEATURE_LAZY_ITABLE;
+		}
+	}
+
 	// 3. Allocate a data block for root directory; record it in root inode
 	for (uint64_t i = 0; i < num_inode_blocks; i++){
 		bitmap_set(dbmap, nblks, VSFS_ITBL_BLKNUM + i, true);
@@ -219,6 +266,7 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	bitmap_set(dbmap, nblks, sb->data_region, true);
 
 	root_entries = (vsfs_dentry *) (image + (VSFS_ITBL_BLKNUM + num_inode_blocks) * VSFS_BLOCK_SIZE);
+	memset(root_entries, 0, VSFS_BLOCK_SIZE);
 	root_entries[0].ino = VSFS_ROOT_INO;
 	root_entries[1].ino = VSFS_ROOT_INO;
 	// start of data region
@@ -248,15 +296,394 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	vsfs_blk_t occupied_blocks = VSFS_ITBL_BLKNUM + num_inode_blocks;
 	sb->free_blocks =  (size / VSFS_BLOCK_SIZE) - occupied_blocks - 1;
 
+	// The checksum table follows the root directory block; it is filled in
+	// last, when everything else is in place (see write_csums())
+	if (opts->csum) {
+		vsfs_blk_t csum_blocks = VSFS_CSUM_BLOCKS(nblks);
+		if (sb->data_region + 1 + csum_blocks > nblks) {
+			goto out;
+		}
+		sb->csum_blk = sb->data_region + 1;
+		memset(image + (size_t)sb->csum_blk * VSFS_BLOCK_SIZE, 0,
+		       (size_t)csum_blocks * VSFS_BLOCK_SIZE);
+		for (vsfs_blk_t i = 0; i < csum_blocks; i++) {
+			bitmap_set(dbmap, nblks, sb->csum_blk + i, true);
+		}
+		sb->free_blocks -= csum_blocks;
+		sb->features |= VSFS_FEATURE_CSUM;
+	}
+
+	if (opts->stripe_count > 1) {
+		sb->stripe_count = opts->stripe_count;
+		sb->stripe_unit = opts->stripe_unit;
+		sb->features |= VSFS_FEATURE_STRIPE;
+	}
+
 	ret = true;
  out:
 	return ret;
 }
 
+/**
+ * Compute the checksums of all used blocks, if the image has them. The
+ * checksums of free blocks are not checked, so they are left as 0.
+ */
+static void write_csums(void *image)
+{
+	vsfs_superblock *sb = (vsfs_superblock *)image;
+	if (!(sb->features & VSFS_FEATURE_CSUM)) {
+		return;
+	}
+	bitmap_t *dbmap = image + VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE;
+	vsfs_blk_t csum_blocks = VSFS_CSUM_BLOCKS(sb->num_blocks);
+	uint32_t *csums = image + (size_t)sb->csum_blk * VSFS_BLOCK_SIZE;
+	for (vsfs_blk_t blk = 0; blk < sb->num_blocks; blk++) {
+		if (bitmap_isset(dbmap, sb->num_blocks, blk) &&
+		    (blk < sb->csum_blk || blk >= sb->csum_blk + csum_blocks)) {
+			csums[blk] = crc32c(0, image + (size_t)blk * VSFS_BLOCK_SIZE,
+			                    VSFS_BLOCK_SIZE);
+		}
+	}
+}
+
+
+/** A file to copy into the image. */
+typedef struct host_file {
+	char name[VSFS_NAME_MAX];
+	struct stat st;
+} host_file;
+
+/** Image being populated. */
+typedef struct populate_ctx {
+	void *image;
+	vsfs_superblock *sb;
+	bitmap_t *dbmap;
+	vsfs_inode *itable;
+	/** Next block to allocate; all blocks after it are free. */
+	vsfs_blk_t next;
+} populate_ctx;
+
+// Number of blocks needed to store n data blocks, with the indirect block.
+static vsfs_blk_t blocks_with_indirect(vsfs_blk_t n)
+{
+	return n + ((n > VSFS_NUM_DIRECT) ? 1 : 0);
+}
+
+// Get a pointer to the contents of a block of the image.
+static void *block_data(populate_ctx *ctx, vsfs_blk_t blk)
+{
+	return ctx->image + (size_t)blk * VSFS_BLOCK_SIZE;
+}
+
+// Get a pointer to the block pointer of block idx of an inode.
+static vsfs_blk_t *block_ptr(populate_ctx *ctx, vsfs_inode *inode,
+                             vsfs_blk_t idx)
+{
+	if (idx < VSFS_NUM_DIRECT) {
+		return &inode->i_direct[idx];
+	}
+	vsfs_blk_t *indirect = block_data(ctx, inode->i_indirect);
+	return &indirect[idx - VSFS_NUM_DIRECT];
+}
+
+// Take the next block and zero it (free blocks are not zeroed by mkfs).
+// The caller has checked that there are enough.
+static vsfs_blk_t take_block(populate_ctx *ctx)
+{
+	vsfs_blk_t blk = ctx->next++;
+	assert(!bitmap_isset(ctx->dbmap, ctx->sb->num_blocks, blk));
+	bitmap_set(ctx->dbmap, ctx->sb->num_blocks, blk, true);
+	memset(block_data(ctx, blk), 0, VSFS_BLOCK_SIZE);
+	ctx->sb->free_blocks--;
+	return blk;
+}
+
+// Give inode n more blocks, in one run followed by the indirect block if it
+// needs one. Returns the first block of the run.
+static vsfs_blk_t extend_inode(populate_ctx *ctx, vsfs_inode *inode,
+                               vsfs_blk_t n)
+{
+	vsfs_blk_t first = ctx->next;
+	vsfs_blk_t old = inode->i_blocks;
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		take_block(ctx);
+	}
+	if (old + n > VSFS_NUM_DIRECT && inode->i_indirect == 0) {
+		inode->i_indirect = take_block(ctx);
+	}
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		*block_ptr(ctx, inode, old + i) = first + i;
+	}
+	inode->i_blocks = old + n;
+	return first;
+}
+
+// Copy the contents of a host file into contiguous blocks starting at dst.
+static bool copy_file(const char *dir, const host_file *f, void *dst)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, f->name);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	// Read the whole file straight into the image mapping
+	size_t done = 0;
+	while (done < (size_t)f->st.st_size) {
+		ssize_t len = read(fd, dst + done, f->st.st_size - done);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			if (len == 0) {
+				fprintf(stderr, "%s: file shrank while being copied\n", path);
+			} else {
+				perror(path);
+			}
+			close(fd);
+			return false;
+		}
+		done += len;
+	}
+	close(fd);
+	return true;
+}
+
+// Find the regular files at the top of a host directory. Returns the number
+// of files, or -1 on error; *files must be freed by the caller.
+static int list_files(const char *dir, host_file **files)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		perror(dir);
+		return -1;
+	}
+	int n = 0, cap = 0;
+	*files = NULL;
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+			continue;
+		}
+		struct stat st;
+		if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			perror(de->d_name);
+			goto err;
+		}
+		if (!S_ISREG(st.st_mode)) {
+			fprintf(stderr, "Skipping %s/%s: not a regular file\n", dir,
+			        de->d_name);
+			continue;
+		}
+		if (strlen(de->d_name) >= VSFS_NAME_MAX) {
+			fprintf(stderr, "%s/%s: name is too long\n", dir, de->d_name);
+			goto err;
+		}
+		if ((uint64_t)st.st_size > VSFS_MAX_FILE_SIZE) {
+			fprintf(stderr, "%s/%s: file is too large\n", dir, de->d_name);
+			goto err;
+		}
+		if (n == cap) {
+			cap = (cap > 0) ? cap * 2 : 64;
+			host_file *f = realloc(*files, cap * sizeof(**files));
+			if (f == NULL) {
+				perror("realloc");
+				goto err;
+			}
+			*files = f;
+		}
+		strcpy((*files)[n].name, de->d_name);
+		(*files)[n].st = st;
+		n++;
+	}
+	closedir(d);
+	return n;
+
+ err:
+	closedir(d);
+	free(*files);
+	*files = NULL;
+	return -1;
+}
+
+/**
+ * Copy the regular files at the top of a host directory into the root
+ * directory of a freshly formatted image.
+ *
+ * The image is built directly, in one pass: the root directory blocks come
+ * first, then the data of each file in a contiguous run of blocks (followed
+ * by its indirect block if it has one), read from the host file in one go.
+ *
+ * @param image  pointer to the formatted image.
+ * @param dir    host directory path.
+ * @return       true on success; false on error.
+ */
+static bool populate(void *image, const char *dir)
+{
+	host_file *files;
+	int n = list_files(dir, &files);
+	if (n < 0) {
+		return false;
+	}
+
+	populate_ctx ctx = {
+		.image = image,
+		.sb = (vsfs_superblock *)image,
+		.dbmap = image + VSFS_DMAP_BLKNUM * VSFS_BLOCK_SIZE,
+		.itable = image + VSFS_ITBL_BLKNUM * VSFS_BLOCK_SIZE,
+	};
+	vsfs_superblock *sb = ctx.sb;
+	bitmap_t *ibmap = image + VSFS_IMAP_BLKNUM * VSFS_BLOCK_SIZE;
+	vsfs_inode *root = &ctx.itable[VSFS_ROOT_INO];
+	const vsfs_blk_t dentries_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_dentry);
+	bool ret = false;
+
+	// mkfs only takes blocks at the start; everything after them is free
+	ctx.next = sb->data_region;
+	while (ctx.next < sb->num_blocks &&
+	       bitmap_isset(ctx.dbmap, sb->num_blocks, ctx.next)) {
+		ctx.next++;
+	}
+
+	// Check that everything fits before changing anything
+	vsfs_blk_t dir_blocks = (n + 2 + dentries_per_block - 1) /
+	                        dentries_per_block;
+	uint64_t needed = blocks_with_indirect(dir_blocks) - root->i_blocks;
+	for (int i = 0; i < n; i++) {
+		vsfs_blk_t blocks = (files[i].st.st_size + VSFS_BLOCK_SIZE - 1) /
+		                    VSFS_BLOCK_SIZE;
+		needed += blocks_with_indirect(blocks);
+	}
+	if ((uint64_t)n > sb->free_inodes) {
+		fprintf(stderr, "%s: %d files, but only %u free inodes\n", dir, n,
+		        sb->free_inodes);
+		goto out;
+	}
+	if (dir_blocks > VSFS_MAX_FILE_BLOCKS || needed > sb->free_blocks ||
+	    needed > sb->num_blocks - ctx.next) {
+		fprintf(stderr, "%s: needs %lu blocks, but only %u are free\n", dir,
+		        needed, sb->free_blocks);
+		goto out;
+	}
+
+	// Root directory: the first block holds "." and ".."
+	vsfs_blk_t old_blocks = root->i_blocks;
+	extend_inode(&ctx, root, dir_blocks - old_blocks);
+	for (vsfs_blk_t i = old_blocks; i < dir_blocks; i++) {
+		vsfs_dentry *entries = block_data(&ctx, *block_ptr(&ctx, root, i));
+		for (vsfs_blk_t j = 0; j < dentries_per_block; j++) {
+			entries[j].ino = VSFS_INO_MAX;
+		}
+	}
+	root->i_size = (uint64_t)root->i_blocks * VSFS_BLOCK_SIZE;
+
+	for (int i = 0; i < n; i++) {
+		host_file *f = &files[i];
+		vsfs_ino_t ino = i + 1;
+		bitmap_set(ibmap, sb->num_inodes, ino, true);
+		sb->free_inodes--;
+
+		vsfs_inode *inode = &ctx.itable[ino];
+		uint32_t itbl_blk = ino / VSFS_INODES_PER_BLOCK;
+		if (vsfs_itbl_uninit(sb, itbl_blk)) {
+			memset(&ctx.itable[itbl_blk * VSFS_INODES_PER_BLOCK], 0,
+			       VSFS_BLOCK_SIZE);
+			vsfs_itbl_set_init(sb, itbl_blk);
+		}
+		memset(inode, 0, sizeof(*inode));
+		inode->i_mode = S_IFREG | (f->st.st_mode & 0777);
+		inode->i_nlink = 1;
+		inode->i_size = f->st.st_size;
+		inode->i_mtime = f->st.st_mtim;
+		vsfs_blk_t blocks = (f->st.st_size + VSFS_BLOCK_SIZE - 1) /
+		                    VSFS_BLOCK_SIZE;
+		if (blocks > 0) {
+			vsfs_blk_t first = extend_inode(&ctx, inode, blocks);
+			if (!copy_file(dir, f, block_data(&ctx, first))) {
+				goto out;
+			}
+		}
+
+		vsfs_blk_t slot = i + 2;
+		vsfs_dentry *entries = block_data(&ctx,
+			*block_ptr(&ctx, root, slot / dentries_per_block));
+		entries[slot % dentries_per_block].ino = ino;
+		strcpy(entries[slot % dentries_per_block].name, f->name);
+	}
+	clock_gettime(CLOCK_REALTIME, &root->i_mtime);
+	ret = true;
+
+ out:
+	free(files);
+	return ret;
+}
+
+
+/**
+ * Map the images of a striped file system into memory as a single image.
+ *
+ * @param opts  command line options; opts->stripe_count is set.
+ * @param size  pointer to the variable that will be set to the size of the
+ *              file system.
+ * @return      pointer to the mapping on success; NULL on failure.
+ */
+static void *map_stripes(mkfs_opts *opts, size_t *size)
+{
+	const char *paths[STRIPE_MAX_IMAGES] = { opts->img_path };
+	int n = stripe_split(opts->stripe, paths + 1, STRIPE_MAX_IMAGES - 1);
+	if (n <= 0) {
+		fprintf(stderr, "Invalid list of striped images\n");
+		return NULL;
+	}
+
+	// The metadata blocks stay on the first image; see mkfs()
+	uint32_t inodes_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_inode);
+	stripe_layout sl = {
+		n + 1, opts->stripe_unit, VSFS_ITBL_BLKNUM +
+		(opts->n_inodes + inodes_per_block - 1) / inodes_per_block
+	};
+	if (!stripe_valid(&sl)) {
+		return NULL;
+	}
+
+	void *addr = NULL;
+	int fds[STRIPE_MAX_IMAGES];
+	vsfs_blk_t blocks[STRIPE_MAX_IMAGES];
+	uint32_t opened = 0;
+	for (; opened < sl.count; ++opened) {
+		fds[opened] = open(paths[opened], O_RDWR);
+		struct stat s;
+		if (fds[opened] < 0 || fstat(fds[opened], &s) < 0) {
+			perror(paths[opened]);
+			if (fds[opened] >= 0) {
+				++opened;
+			}
+			goto end;
+		}
+		blocks[opened] = s.st_size / VSFS_BLOCK_SIZE;
+	}
+
+	vsfs_blk_t nblocks = stripe_fit(&sl, blocks);
+	if (nblocks == 0) {
+		fprintf(stderr, "Striped images are too small\n");
+		goto end;
+	}
+	addr = stripe_mmap(&sl, fds, nblocks);
+	*size = (size_t)nblocks * VSFS_BLOCK_SIZE;
+	opts->stripe_count = sl.count;
+
+end:
+	// The mapping keeps references to the files
+	for (uint32_t i = 0; i < opened; ++i) {
+		close(fds[i]);
+	}
+	return addr;
+}
 
 int main(int argc, char *argv[])
 {
-	int ret; // return value; 0 on success, 1 on failure
+	int ret = 1; // return value; 0 on success, 1 on failure
 	size_t fsize; // size of disk image file 
 	void *image;  // pointer to mmap'd disk image file
 	mkfs_opts opts = {0}; // options; defaults are all 0
@@ -273,8 +700,12 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
-	// Map disk image file into memory
-	image = map_file(opts.img_path, VSFS_BLOCK_SIZE, &fsize);
+	// Map disk image file (or files) into memory
+	if (opts.stripe != NULL) {
+		image = map_stripes(&opts, &fsize);
+	} else {
+		image = map_file(opts.img_path, VSFS_BLOCK_SIZE, &fsize);
+	}
 	if (image == NULL) {
 		return 1;
 	}
@@ -294,6 +725,11 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Failed to format the image\n");
 		goto end;
 	}
+	if (opts.dir != NULL && !populate(image, opts.dir)) {
+		fprintf(stderr, "Failed to copy files into the image\n");
+		goto end;
+	}
+	write_csums(image);
 
 	ret = 0;
 	
@@ -0,0 +1,148 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Kernel cache invalidation implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+
+#include "notify.h"
+
+
+// Helper thread: send queued invalidations until asked to stop
+static void *notify_thread(void *arg)
+{
+	notify_ctx *nc = (notify_ctx *)arg;
+
+	pthread_mutex_lock(&nc->lock);
+	while (!nc->stop) {
+		if (nc->head == NULL) {
+			pthread_cond_wait(&nc->cond, &nc->lock);
+			continue;
+		}
+		notify_entry *e = nc->head;
+		nc->head = e->next;
+		if (nc->head == NULL) {
+			nc->tail = NULL;
+		}
+
+		// The kernel may block this call until the callback that queued
+		// the entry has replied, so don't hold the lock while waiting
+		pthread_mutex_unlock(&nc->lock);
+		int ret = fuse_lowlevel_notify_inval_entry(nc->ch, FUSE_ROOT_ID,
+		                                           e->name, strlen(e->name));
+		// ENOENT just means that the kernel didn't have it cached
+		if (ret != 0 && ret != -ENOENT) {
+			fprintf(stderr, "notify_inval_entry(%s): %s\n",
+			        e->name, strerror(-ret));
+		}
+		free(e);
+		pthread_mutex_lock(&nc->lock);
+	}
+	pthread_mutex_unlock(&nc->lock);
+	return NULL;
+}
+
+bool notify_init(notify_ctx *nc)
+{
+	memset(nc, 0, sizeof(*nc));
+	pthread_mutex_init(&nc->lock, NULL);
+	pthread_cond_init(&nc->cond, NULL);
+
+	if (pthread_create(&nc->thread, NULL, notify_thread, nc) != 0) {
+		perror("pthread_create");
+		pthread_cond_destroy(&nc->cond);
+		pthread_mutex_destroy(&nc->lock);
+		return false;
+	}
+	nc->running = true;
+	return true;
+}
+
+void notify_destroy(notify_ctx *nc)
+{
+	if (!nc->running) {
+		return;
+	}
+
+	pthread_mutex_lock(&nc->lock);
+	nc->stop = true;
+	pthread_cond_signal(&nc->cond);
+	pthread_mutex_unlock(&nc->lock);
+	pthread_join(nc->thread, NULL);
+
+	while (nc->head != NULL) {
+		notify_entry *e = nc->head;
+		nc->head = e->next;
+		free(e);
+	}
+	nc->tail = NULL;
+	pthread_cond_destroy(&nc->cond);
+	pthread_mutex_destroy(&nc->lock);
+	nc->running = false;
+}
+
+void notify_inval_entry(notify_ctx *nc, const char *name)
+{
+	// Tools that run vsfs in-process (see replay.c) have no FUSE session,
+	// and no kernel caches to invalidate
+	struct fuse *f = fuse_get_context()->fuse;
+	if (!nc->running || f == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&nc->lock);
+	// The channel is only reachable from within a callback; remember it
+	// for the helper thread
+	if (nc->ch == NULL) {
+		struct fuse_session *se = fuse_get_session(f);
+		nc->ch = fuse_session_next_chan(se, NULL);
+	}
+
+	// A single invalidation covers any number of changes to the same entry
+	for (notify_entry *e = nc->head; e != NULL; e = e->next) {
+		if (strcmp(e->name, name) == 0) {
+			pthread_mutex_unlock(&nc->lock);
+			return;
+		}
+	}
+
+	notify_entry *e = malloc(sizeof(*e));
+	if (e == NULL) {
+		// Nothing we can do; the entry will expire after cache_timeout
+		pthread_mutex_unlock(&nc->lock);
+		fprintf(stderr, "notify_inval_entry(%s): out of memory\n", name);
+		return;
+	}
+	strncpy(e->name, name, VSFS_NAME_MAX - 1);
+	e->name[VSFS_NAME_MAX - 1] = '\0';
+	e->next = NULL;
+	if (nc->tail != NULL) {
+		nc->tail->next = e;
+	} else {
+		nc->head = e;
+	}
+	nc->tail = e;
+	pthread_cond_signal(&nc->cond);
+	pthread_mutex_unlock(&nc->lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Kernel cache invalidation header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "vsfs.h"
+
+struct fuse_chan;
+
+// When the kernel is allowed to cache attributes and directory entries for a
+// long time (see the cache_timeout mount option), vsfs must tell it when an
+// entry changes. The kernel holds the parent directory lock while it waits for
+// our reply to create() or unlink(), so sending the notification from the
+// callback itself would deadlock. Instead, invalidations are queued and sent
+// by a helper thread once the callback has returned. Cached file data is
+// not invalidated here; the kernel drops it when it sees a new mtime or size
+// on open (auto_cache).
+
+/** A directory entry waiting to be invalidated. */
+typedef struct notify_entry {
+	struct notify_entry *next;
+	char name[VSFS_NAME_MAX];
+} notify_entry;
+
+/** Kernel cache invalidation state. */
+typedef struct notify_ctx {
+	/** True if the helper thread is running. */
+	bool running;
+	/** Set to make the helper thread exit. */
+	bool stop;
+	/** FUSE channel the notifications are written to. */
+	struct fuse_chan *ch;
+	/** Pending invalidations, oldest first. */
+	notify_entry *head;
+	notify_entry *tail;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} notify_ctx;
+
+/**
+ * Start the helper thread that sends invalidations to the kernel. Must be
+ * called after FUSE has forked into the background (e.g. from the init
+ * callback); until then, the state must be zeroed, so that nothing is queued
+ * and notify_destroy() does nothing.
+ *
+ * @param nc  pointer to the state to initialize.
+ * @return    true on success; false on failure.
+ */
+bool notify_init(notify_ctx *nc);
+
+/**
+ * Stop the helper thread. Pending invalidations are dropped, since the kernel
+ * caches go away with the mount anyway.
+ *
+ * @param nc  pointer to the state to clean up.
+ */
+void notify_destroy(notify_ctx *nc);
+
+/**
+ * Queue an invalidation of the given root directory entry (and the attributes
+ * of the root directory). Must be called from a FUSE callback. Does nothing if
+ * kernel caching is not enabled, or if there is no FUSE session.
+ *
+ * @param nc    pointer to the invalidation state.
+ * @param name  name of the entry in the root directory.
+ */
+void notify_inval_entry(notify_ctx *nc, const char *name);
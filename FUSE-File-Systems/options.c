@@ -31,6 +31,20 @@
 static const struct fuse_opt opt_spec[] = {
 	VSFS_OPT("-h"    , help),
 	VSFS_OPT("--help", help),
+	VSFS_OPT("cache_timeout=%u", cache_timeout),
+	VSFS_OPT("readdirplus"     , readdirplus),
+	VSFS_OPT("backend=%s"      , backend),
+	VSFS_OPT("cache_blocks=%u" , cache_blocks),
+	VSFS_OPT("writeback=%u"    , writeback),
+	VSFS_OPT("odirect"         , odirect),
+	VSFS_OPT("discard"         , discard),
+	VSFS_OPT("compress"        , compress),
+	VSFS_OPT("dedup"           , dedup),
+	VSFS_OPT("delalloc"        , delalloc),
+	VSFS_OPT("prealloc"        , prealloc),
+	VSFS_OPT("stats"           , stats),
+	VSFS_OPT("trace=%s"        , trace),
+	VSFS_OPT("stripe=%s"       , stripe),
 	FUSE_OPT_END
 };
 
@@ -44,6 +58,42 @@ general options:\n\
     -o opt,[opt...]        mount options\n\
     -h   --help            print help\n\
 \n\
+vsfs options:\n\
+    -o cache_timeout=SECS  let the kernel cache attributes and entries for\n\
+                           SECS seconds, and file data until the file changes\n\
+                           (default: 0, no caching)\n\
+    -o readdirplus         return entry attributes together with names\n\
+    -o backend=NAME        image I/O backend: mmap (default), pread or uring\n\
+    -o cache_blocks=N      buffer cache size in blocks for pread and uring\n\
+                           (default: 2048)\n\
+    -o writeback=MSECS     with pread and uring, write modified blocks back\n\
+                           in the background once they have been dirty for\n\
+                           MSECS milliseconds (default: only on eviction,\n\
+                           fsync and unmount)\n\
+    -o odirect             open the image with O_DIRECT, so that its blocks\n\
+                           are only cached by vsfs (default backend: pread)\n\
+    -o discard             punch freed blocks out of the image file, keeping\n\
+                           it sparse, instead of zeroing them\n\
+    -o compress            compress file data written sequentially, in\n\
+                           clusters of 4 blocks (compressed clusters are\n\
+                           always readable, with or without this option)\n\
+    -o dedup               share identical file data blocks (whole-block\n\
+                           writes and zero-filled blocks) between files\n\
+    -o delalloc            buffer appends in memory and allocate their\n\
+                           blocks in one run when the file is flushed\n\
+                           (on fsync, unmount, or when buffers run out)\n\
+    -o prealloc            set aside free blocks near the end of each file\n\
+                           that is appended to, until it is closed, so that\n\
+                           files written at the same time stay contiguous\n\
+    -o stats               count and time all operations; read the results\n\
+                           from /.vsfs_stats, printed again on unmount\n\
+                           (with cache_timeout, its size shown by stat()\n\
+                           may be out of date; reads are not)\n\
+    -o trace=FILE          record every call (operation, path, offset, size,\n\
+                           timing) in FILE, for vsfs-replay\n\
+    -o stripe=IMG[:IMG...] the other images of a file system striped with\n\
+                           mkfs.vsfs -S, in the same order\n\
+\n\
 ";
 
 // Callback for fuse_opt_parse()
@@ -82,5 +132,18 @@ bool vsfs_opt_parse(struct fuse_args *args, vsfs_opts *opts)
 	fuse_opt_add_arg(args, "-o");
 	fuse_opt_add_arg(args, "max_write=4096");
 
+	// Kernel caching; vsfs invalidates entries it changes (see notify.h).
+	// The data of a file that vsfs changes itself (e.g. with
+	// VSFS_IOC_COPY_RANGE) can't be invalidated through the high-level API,
+	// so it is only kept as long as the file's mtime and size don't change.
+	if (opts->cache_timeout > 0) {
+		char buf[128];
+		snprintf(buf, sizeof(buf),
+		         "attr_timeout=%u,entry_timeout=%u,auto_cache",
+		         opts->cache_timeout, opts->cache_timeout);
+		fuse_opt_add_arg(args, "-o");
+		fuse_opt_add_arg(args, buf);
+	}
+
 	return true;
 }
@@ -29,6 +29,40 @@ typedef struct vsfs_opts {
 	const char *img_path;
 	/** Print help and exit. FUSE option. */
 	int help;
+	/**
+	 * How long (in seconds) the kernel may cache attributes and directory
+	 * entries. 0 (default) disables kernel caching.
+	 */
+	unsigned int cache_timeout;
+	/** Return full attributes of each entry from readdir(). */
+	int readdirplus;
+	/** Block device backend name (see bdev.h); NULL for the default. */
+	char *backend;
+	/** Buffer cache size in blocks for the cached backends; 0 for default. */
+	unsigned int cache_blocks;
+	/**
+	 * Write back buffers that have been dirty for this many milliseconds in
+	 * a background thread. 0 (default) leaves them until eviction or flush.
+	 */
+	unsigned int writeback;
+	/** Open the image with O_DIRECT, bypassing the host page cache. */
+	int odirect;
+	/** Punch freed blocks out of the image file instead of zeroing them. */
+	int discard;
+	/** Compress file data in clusters of VSFS_CLUSTER_BLOCKS blocks. */
+	int compress;
+	/** Share identical file data blocks as they are written. */
+	int dedup;
+	/** Buffer appends in memory and allocate their blocks in batches. */
+	int delalloc;
+	/** Set aside a run of free blocks for each file that is appended to. */
+	int prealloc;
+	/** Count and time operations; see stats.h. */
+	int stats;
+	/** Record every call in this file; see trace.h. */
+	char *trace;
+	/** Other images of a striped file system, separated by ':'. */
+	char *stripe;
 
 } vsfs_opts;
 
@@ -0,0 +1,80 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Preallocation windows implementation.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "prealloc.h"
+
+
+void prealloc_init(prealloc *pa)
+{
+	memset(pa, 0, sizeof(*pa));
+	for (int i = 0; i < PREALLOC_WINDOWS; ++i) {
+		pa->w[i].ino = VSFS_INO_MAX;
+	}
+}
+
+prealloc_window *prealloc_find(prealloc *pa, vsfs_ino_t ino)
+{
+	for (int i = 0; i < PREALLOC_WINDOWS; ++i) {
+		if (pa->w[i].ino == ino) {
+			pa->w[i].used = ++pa->clock;
+			return &pa->w[i];
+		}
+	}
+	return NULL;
+}
+
+vsfs_blk_t prealloc_skip(const prealloc *pa, vsfs_blk_t blk)
+{
+	for (int i = 0; i < PREALLOC_WINDOWS; ++i) {
+		const prealloc_window *w = &pa->w[i];
+		if (w->ino != VSFS_INO_MAX && blk >= w->next && blk < w->end) {
+			return w->end;
+		}
+	}
+	return blk;
+}
+
+prealloc_window *prealloc_add(prealloc *pa, vsfs_ino_t ino, vsfs_blk_t start,
+                              vsfs_blk_t n)
+{
+	assert(n > 0);
+	prealloc_window *victim = &pa->w[0];
+	for (int i = 0; i < PREALLOC_WINDOWS; ++i) {
+		assert(pa->w[i].ino != ino);
+		if (pa->w[i].used < victim->used) {
+			victim = &pa->w[i];
+		}
+	}
+	victim->ino = ino;
+	victim->next = start;
+	victim->end = start + n;
+	victim->used = ++pa->clock;
+	return victim;
+}
+
+void prealloc_release(prealloc *pa, vsfs_ino_t ino)
+{
+	prealloc_window *w = prealloc_find(pa, ino);
+	if (w != NULL) {
+		w->ino = VSFS_INO_MAX;
+		w->used = 0;
+	}
+}
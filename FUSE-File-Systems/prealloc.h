@@ -0,0 +1,100 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Preallocation windows header file.
+ *
+ * A regular file that is appended to gets a window: a run of free blocks
+ * near its last block, which its next blocks are taken from, in order.
+ * Other allocations avoid the windows of other files (unless there is no
+ * other free space), so files appended to at the same time don't interleave
+ * their blocks. Windows only exist in memory; their blocks stay free in the
+ * bitmap until they are actually allocated.
+ */
+
+#pragma once
+
+#include "vsfs.h"
+
+/** Number of windows; the least recently used one is replaced. */
+#define PREALLOC_WINDOWS 16
+
+/** Window size range; a window is about as large as the file so far. */
+#define PREALLOC_MIN_BLOCKS 8
+#define PREALLOC_MAX_BLOCKS 64
+
+
+/** A window: the blocks [next, end) are set aside for a file. */
+typedef struct prealloc_window {
+	/** Inode number; VSFS_INO_MAX if the window is unused. */
+	vsfs_ino_t ino;
+	/** Block that the file takes next. */
+	vsfs_blk_t next;
+	vsfs_blk_t end;
+	/** Last use time, for LRU replacement. */
+	unsigned long used;
+} prealloc_window;
+
+/** Preallocation windows of all files. */
+typedef struct prealloc {
+	prealloc_window w[PREALLOC_WINDOWS];
+	unsigned long clock;
+} prealloc;
+
+/**
+ * Initialize the windows, all unused.
+ *
+ * @param pa  pointer to the windows.
+ */
+void prealloc_init(prealloc *pa);
+
+/**
+ * Find the window of a file.
+ *
+ * @param pa   pointer to the windows.
+ * @param ino  inode number.
+ * @return     the window; NULL if the file has none.
+ */
+prealloc_window *prealloc_find(prealloc *pa, vsfs_ino_t ino);
+
+/**
+ * Skip the window that contains a block.
+ *
+ * @param pa   pointer to the windows.
+ * @param blk  block number.
+ * @return     the first block after the window that contains blk; blk itself
+ *             if it is not in any window.
+ */
+vsfs_blk_t prealloc_skip(const prealloc *pa, vsfs_blk_t blk);
+
+/**
+ * Set aside a run of blocks for a file that has no window, replacing the
+ * least recently used window if all of them are in use.
+ *
+ * @param pa     pointer to the windows.
+ * @param ino    inode number.
+ * @param start  first block of the run.
+ * @param n      number of blocks in the run.
+ * @return       the new window.
+ */
+prealloc_window *prealloc_add(prealloc *pa, vsfs_ino_t ino, vsfs_blk_t start,
+                              vsfs_blk_t n);
+
+/**
+ * Release the window of a file, if it has one.
+ *
+ * @param pa   pointer to the windows.
+ * @param ino  inode number.
+ */
+void prealloc_release(prealloc *pa, vsfs_ino_t ino);
@@ -0,0 +1,379 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Trace replay tool.
+ *
+ * Runs the calls recorded in a trace (see trace.h) against a vsfs image,
+ * in-process: the image is mounted with vsfs_init() and the vsfs_ops
+ * callbacks are called directly, without FUSE or the kernel in the way.
+ * Writes use pseudo-random data of the recorded size. Reports throughput,
+ * the mean latency of each operation next to the recorded one, and the
+ * number of calls whose result differs from the recorded result (e.g. when
+ * the image is not the one the trace was recorded on).
+ *
+ * ioctl calls are skipped: the trace records only the command, not its
+ * argument, and a made-up argument could do real work (e.g. a defrag that
+ * moves blocks) and throw the results off.
+ *
+ * With -j N, the calls are split between N threads by path, so the calls on
+ * each file stay in order. vsfs is single-threaded (see options.c), so the
+ * calls themselves are serialized with a lock; only their interleaving
+ * differs from the trace.
+ *
+ * The image is modified, and must not be mounted while it is replayed.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "vsfs.h"
+#include "vsfs_ops.h"
+
+/** Maximum number of threads. */
+#define REPLAY_THREADS_MAX 64
+
+
+/** A recorded call. */
+typedef struct replay_call {
+	trace_rec rec;
+	char *path;
+	/** Thread that replays the call. */
+	unsigned int thread;
+} replay_call;
+
+/** Results of a thread. */
+typedef struct replay_result {
+	uint64_t calls[STATS_NOPS];
+	uint64_t ns[STATS_NOPS];
+	/** Bytes read and written. */
+	uint64_t bytes;
+	/** Calls whose result differs from the recorded one. */
+	uint64_t mismatches;
+} replay_result;
+
+/** A replay thread. */
+typedef struct replay_thread {
+	pthread_t tid;
+	unsigned int index;
+	replay_result res;
+} replay_thread;
+
+static replay_call *calls;
+static size_t ncalls;
+/** ioctl calls in the trace, which are not replayed. */
+static size_t nskipped;
+/** Largest read or write size in the trace. */
+static size_t max_size;
+
+static fs_ctx fs;
+static struct fuse_context context = { .private_data = &fs };
+/** Serializes calls into vsfs. */
+static pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// The callbacks find the file system context with fuse_get_context(). There
+// is no FUSE session here, so this definition takes the place of libfuse's.
+struct fuse_context *fuse_get_context(void)
+{
+	return &context;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Hash a path to pick the thread that replays calls on it (FNV-1a)
+static unsigned int path_thread(const char *path, unsigned int nthreads)
+{
+	uint32_t h = 2166136261u;
+	for (const char *p = path; *p != '\0'; ++p) {
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	}
+	return h % nthreads;
+}
+
+// Read all records of a trace file. Returns false on error.
+static bool load_trace(const char *path, unsigned int nthreads)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+	if (!trace_read_header(f)) {
+		fprintf(stderr, "%s: not a vsfs trace\n", path);
+		fclose(f);
+		return false;
+	}
+
+	size_t cap = 0;
+	trace_rec rec;
+	char name[VSFS_PATH_MAX];
+	while (trace_read(f, &rec, name)) {
+		if (rec.op == STATS_IOCTL) {
+			nskipped++;
+			continue;
+		}
+		if (ncalls == cap) {
+			cap = (cap > 0) ? cap * 2 : 4096;
+			replay_call *c = realloc(calls, cap * sizeof(*calls));
+			if (c == NULL) {
+				perror("realloc");
+				fclose(f);
+				return false;
+			}
+			calls = c;
+		}
+		replay_call *c = &calls[ncalls];
+		c->rec = rec;
+		c->path = strdup(name);
+		if (c->path == NULL) {
+			perror("strdup");
+			fclose(f);
+			return false;
+		}
+		c->thread = path_thread(name, nthreads);
+		if ((rec.op == STATS_READ || rec.op == STATS_WRITE) &&
+		    rec.arg > max_size) {
+			max_size = rec.arg;
+		}
+		ncalls++;
+	}
+	if (!feof(f)) {
+		fprintf(stderr, "%s: trace is truncated after %zu calls\n", path,
+		        ncalls + nskipped);
+	}
+	fclose(f);
+	return true;
+}
+
+static int count_filler(void *buf, const char *name, const struct stat *st,
+                        off_t off)
+{
+	(void)buf;
+	(void)name;
+	(void)st;
+	(void)off;
+	return 0;
+}
+
+// Make a recorded call; buf must fit max_size bytes.
+static int replay_one(const replay_call *c, char *buf)
+{
+	const trace_rec *r = &c->rec;
+	struct fuse_file_info fi = {0};
+	switch (r->op) {
+		case STATS_STATFS: {
+			struct statvfs st;
+			return vsfs_ops.statfs(c->path, &st);
+		}
+		case STATS_GETATTR: {
+			struct stat st;
+			return vsfs_ops.getattr(c->path, &st);
+		}
+		case STATS_READDIR:
+			return vsfs_ops.readdir(c->path, NULL, count_filler, r->offset,
+			                        &fi);
+		case STATS_MKDIR:
+			return vsfs_ops.mkdir(c->path, r->arg);
+		case STATS_RMDIR:
+			return vsfs_ops.rmdir(c->path);
+		case STATS_CREATE:
+			return vsfs_ops.create(c->path, r->arg, &fi);
+		case STATS_UNLINK:
+			return vsfs_ops.unlink(c->path);
+		case STATS_UTIMENS: {
+			struct timespec times[2] = {
+				{ .tv_nsec = UTIME_NOW }, { .tv_nsec = UTIME_NOW }
+			};
+			return vsfs_ops.utimens(c->path, times);
+		}
+		case STATS_TRUNCATE:
+			return vsfs_ops.truncate(c->path, r->offset);
+		case STATS_READ:
+			return vsfs_ops.read(c->path, buf, r->arg, r->offset, &fi);
+		case STATS_WRITE:
+			return vsfs_ops.write(c->path, buf, r->arg, r->offset, &fi);
+		case STATS_OPEN:
+			return vsfs_ops.open(c->path, &fi);
+		case STATS_RELEASE:
+			return vsfs_ops.release(c->path, &fi);
+		case STATS_FSYNC:
+			return vsfs_ops.fsync(c->path, r->arg, &fi);
+		default:
+			return -ENOSYS;
+	}
+}
+
+static void *replay_thread_main(void *arg)
+{
+	replay_thread *t = (replay_thread*)arg;
+	char *buf = malloc(max_size + 1);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	unsigned int seed = t->index + 1;
+	for (size_t i = 0; i < max_size; ++i) {
+		buf[i] = rand_r(&seed);
+	}
+
+	for (size_t i = 0; i < ncalls; ++i) {
+		const replay_call *c = &calls[i];
+		if (c->thread != t->index) {
+			continue;
+		}
+		pthread_mutex_lock(&fs_lock);
+		uint64_t start = now_ns();
+		int ret = replay_one(c, buf);
+		uint64_t end = now_ns();
+		pthread_mutex_unlock(&fs_lock);
+
+		t->res.calls[c->rec.op]++;
+		t->res.ns[c->rec.op] += end - start;
+		if ((c->rec.op == STATS_READ || c->rec.op == STATS_WRITE) &&
+		    ret > 0) {
+			t->res.bytes += ret;
+		}
+		if (ret != c->rec.result) {
+			t->res.mismatches++;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static void print_results(const replay_thread *threads, unsigned int nthreads,
+                          uint64_t elapsed_ns)
+{
+	replay_result total = {0};
+	uint64_t traced_ns[STATS_NOPS] = {0};
+	for (unsigned int t = 0; t < nthreads; ++t) {
+		for (int op = 0; op < STATS_NOPS; ++op) {
+			total.calls[op] += threads[t].res.calls[op];
+			total.ns[op] += threads[t].res.ns[op];
+		}
+		total.bytes += threads[t].res.bytes;
+		total.mismatches += threads[t].res.mismatches;
+	}
+	for (size_t i = 0; i < ncalls; ++i) {
+		traced_ns[calls[i].rec.op] += calls[i].rec.dur_ns;
+	}
+
+	double secs = elapsed_ns / 1e9;
+	printf("%zu calls in %.3f ms with %u thread%s: %.0f calls/s, "
+	       "%.1f MiB/s\n", ncalls, secs * 1000, nthreads,
+	       (nthreads == 1) ? "" : "s", secs > 0 ? ncalls / secs : 0.0,
+	       secs > 0 ? total.bytes / (1024.0 * 1024.0) / secs : 0.0);
+	if (nskipped > 0) {
+		printf("%zu ioctl calls skipped (their arguments are not in the "
+		       "trace)\n", nskipped);
+	}
+	printf("%lu results differ from the trace\n", total.mismatches);
+	printf("%-10s %10s %14s %14s\n", "op", "calls", "mean us",
+	       "traced us");
+	for (int op = 0; op < STATS_NOPS; ++op) {
+		uint64_t n = total.calls[op];
+		if (n == 0) {
+			continue;
+		}
+		printf("%-10s %10lu %14.3f %14.3f\n", stats_op_name(op), n,
+		       total.ns[op] / 1e3 / n, traced_ns[op] / 1e3 / n);
+	}
+}
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, "Usage: %s [-j threads] [-o options] image trace\n",
+	        progname);
+	fprintf(f, "    -j threads  replay with this many threads "
+	           "(default: 1)\n");
+	fprintf(f, "    -o options  vsfs mount options (see vsfs --help)\n");
+	fprintf(f, "    -h          print help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nthreads = 1;
+	char *mount_opts = NULL;
+	char opt;
+
+	while ((opt = getopt(argc, argv, "j:o:h")) != -1) {
+		switch (opt) {
+			case 'j': nthreads = strtoul(optarg, NULL, 10); break;
+			case 'o': mount_opts = optarg; break;
+			case 'h': print_help(stdout, argv[0]); return 0;
+			default : print_help(stderr, argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 2 || nthreads == 0 ||
+	    nthreads > REPLAY_THREADS_MAX) {
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+
+	// Parse the mount options the same way vsfs does
+	char *vsfs_argv[] = { argv[0], argv[optind], "-o", mount_opts };
+	struct fuse_args args =
+		FUSE_ARGS_INIT((mount_opts != NULL) ? 4 : 2, vsfs_argv);
+	vsfs_opts opts = {0};
+	if (!vsfs_opt_parse(&args, &opts) || opts.help) {
+		return 1;
+	}
+	fuse_opt_free_args(&args);
+
+	if (!load_trace(argv[optind + 1], nthreads)) {
+		return 1;
+	}
+	if (!vsfs_init(&fs, &opts)) {
+		fprintf(stderr, "Failed to mount the file system\n");
+		return 1;
+	}
+	vsfs_ops.init(NULL);
+
+	static replay_thread threads[REPLAY_THREADS_MAX];
+	uint64_t start = now_ns();
+	for (unsigned int t = 0; t < nthreads; ++t) {
+		threads[t].index = t;
+		if (pthread_create(&threads[t].tid, NULL, replay_thread_main,
+		                   &threads[t]) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (unsigned int t = 0; t < nthreads; ++t) {
+		pthread_join(threads[t].tid, NULL);
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	// Unmounting flushes everything the calls left buffered
+	vsfs_ops.destroy(&fs);
+	print_results(threads, nthreads, elapsed);
+
+	for (size_t i = 0; i < ncalls; ++i) {
+		free(calls[i].path);
+	}
+	free(calls);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Image restore tool.
+ *
+ * Creates a vsfs image from a dump written by vsfs-dump (see dump.h), read
+ * from a file or from standard input. Consecutive blocks are collected and
+ * written in order, up to DUMP_IO_BLOCKS blocks at a time; free blocks are
+ * left as holes in the image file, which read as zeros.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "dump.h"
+#include "lz.h"
+
+/** Size of the stdio buffer of the input. */
+#define RESTORE_BUFFER_SIZE (1 << 20)
+
+
+/** Blocks waiting to be written. */
+typedef struct pending {
+	int fd;
+	char *buf;
+	vsfs_blk_t start;
+	vsfs_blk_t n;
+} pending;
+
+// Write the pending blocks. Returns false on error.
+static bool flush_pending(pending *p)
+{
+	size_t len = (size_t)p->n * VSFS_BLOCK_SIZE;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pwrite(p->fd, p->buf + done, len - done,
+		                   (off_t)p->start * VSFS_BLOCK_SIZE + done);
+		if (n < 0) {
+			perror("pwrite");
+			return false;
+		}
+		done += n;
+	}
+	p->n = 0;
+	return true;
+}
+
+// Get the space for n blocks starting at blk, writing out the pending blocks
+// first unless these ones follow them. Returns NULL on error.
+static char *pending_space(pending *p, vsfs_blk_t blk, vsfs_blk_t n)
+{
+	if (p->n > 0 && (blk != p->start + p->n ||
+	                 p->n + n > DUMP_IO_BLOCKS)) {
+		if (!flush_pending(p)) {
+			return NULL;
+		}
+	}
+	if (p->n == 0) {
+		p->start = blk;
+	}
+	char *data = p->buf + (size_t)p->n * VSFS_BLOCK_SIZE;
+	p->n += n;
+	return data;
+}
+
+// Read all records and write their blocks. Returns false on error.
+static bool restore(FILE *in, const dump_header *hdr, pending *p)
+{
+	static char zbuf[DUMP_RECORD_BLOCKS * VSFS_BLOCK_SIZE];
+	uint64_t blocks = 0;
+	vsfs_blk_t next = 0;// records must not go back
+	dump_record rec;
+
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		if (rec.nblocks == 0) {
+			if (blocks != hdr->blocks) {
+				fprintf(stderr, "Dump has %lu blocks instead of %lu\n",
+				        blocks, hdr->blocks);
+				return false;
+			}
+			return flush_pending(p);
+		}
+
+		size_t len = (size_t)rec.nblocks * VSFS_BLOCK_SIZE;
+		bool lz = rec.flags & DUMP_RECORD_LZ;
+		if (rec.nblocks > DUMP_RECORD_BLOCKS || rec.blk < next ||
+		    rec.blk > hdr->num_blocks - rec.nblocks ||
+		    (lz ? rec.len >= len : rec.len != len)) {
+			fprintf(stderr, "Invalid record for block %u\n", rec.blk);
+			return false;
+		}
+		char *data = pending_space(p, rec.blk, rec.nblocks);
+		if (data == NULL) {
+			return false;
+		}
+		if (fread(lz ? zbuf : data, 1, rec.len, in) != rec.len) {
+			break;
+		}
+		if (lz && lz_decompress(zbuf, rec.len, data, len) != (long)len) {
+			fprintf(stderr, "Record for block %u is corrupted\n", rec.blk);
+			return false;
+		}
+		if (crc32c(0, data, len) != rec.crc) {
+			fprintf(stderr, "Checksum mismatch in record for block %u\n",
+			        rec.blk);
+			return false;
+		}
+		next = rec.blk + rec.nblocks;
+		blocks += rec.nblocks;
+	}
+
+	if (ferror(in)) {
+		perror("Reading the dump failed");
+	} else {
+		fprintf(stderr, "Dump is truncated\n");
+	}
+	return false;
+}
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, "Usage: %s [-f] dump image\n", progname);
+	fprintf(f, "Create a vsfs image from a dump written by vsfs-dump; "
+	           "dump can be - for\nstandard input.\n");
+	fprintf(f, "    -f  overwrite the image file if it exists\n");
+	fprintf(f, "    -h  print help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bool force = false;
+	char opt;
+
+	while ((opt = getopt(argc, argv, "fh")) != -1) {
+		switch (opt) {
+			case 'f': force = true; break;
+			case 'h': print_help(stdout, argv[0]); return 0;
+			default : print_help(stderr, argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 2) {
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	const char *in_path = argv[optind];
+	const char *img_path = argv[optind + 1];
+
+	FILE *in = stdin;
+	if (strcmp(in_path, "-") != 0) {
+		in = fopen(in_path, "rb");
+		if (in == NULL) {
+			perror(in_path);
+			return 1;
+		}
+	}
+	setvbuf(in, NULL, _IOFBF, RESTORE_BUFFER_SIZE);
+
+	int ret = 1;
+	pending p = { .fd = -1 };
+	dump_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, DUMP_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.num_blocks > VSFS_BLK_MAX || hdr.num_blocks < VSFS_BLK_MIN ||
+	    hdr.size != (uint64_t)hdr.num_blocks * VSFS_BLOCK_SIZE ||
+	    hdr.blocks > hdr.num_blocks) {
+		fprintf(stderr, "%s: not a vsfs dump\n", in_path);
+		goto end;
+	}
+
+	p.buf = malloc(DUMP_IO_BLOCKS * VSFS_BLOCK_SIZE);
+	if (p.buf == NULL) {
+		perror("malloc");
+		goto end;
+	}
+	p.fd = open(img_path, O_WRONLY | O_CREAT | (force ? O_TRUNC : O_EXCL),
+	            0644);
+	if (p.fd < 0) {
+		perror(img_path);
+		goto end;
+	}
+	if (ftruncate(p.fd, hdr.size) != 0) {
+		perror(img_path);
+	} else if (restore(in, &hdr, &p)) {
+		if (fsync(p.fd) != 0) {
+			perror(img_path);
+		} else {
+			ret = 0;
+		}
+	}
+	close(p.fd);
+	if (ret != 0) {
+		// Don't leave an incomplete image behind
+		unlink(img_path);
+	}
+
+ end:
+	free(p.buf);
+	if (in != stdin) {
+		fclose(in);
+	}
+	return ret;
+}
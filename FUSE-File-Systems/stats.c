@@ -0,0 +1,110 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Operation statistics implementation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+
+static const char *const op_names[STATS_NOPS] = {
+	[STATS_STATFS]   = "statfs",
+	[STATS_GETATTR]  = "getattr",
+	[STATS_READDIR]  = "readdir",
+	[STATS_MKDIR]    = "mkdir",
+	[STATS_RMDIR]    = "rmdir",
+	[STATS_CREATE]   = "create",
+	[STATS_UNLINK]   = "unlink",
+	[STATS_UTIMENS]  = "utimens",
+	[STATS_TRUNCATE] = "truncate",
+	[STATS_READ]     = "read",
+	[STATS_WRITE]    = "write",
+	[STATS_RELEASE]  = "release",
+	[STATS_FSYNC]    = "fsync",
+	[STATS_IOCTL]    = "ioctl",
+	[STATS_OPEN]     = "open",
+};
+
+const char *stats_op_name(stats_op op)
+{
+	return op_names[op];
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_init(vsfs_stats *st, bool enabled)
+{
+	memset(st, 0, sizeof(*st));
+	st->enabled = enabled;
+	st->start_ticks = stats_ticks();
+	st->start_ns = now_ns();
+}
+
+// Append formatted text to the buffer, keeping track of the length
+#define APPEND(...)                                                    \
+	do {                                                               \
+		int n_ = snprintf(buf + len, (len < size) ? size - len : 0,    \
+		                  __VA_ARGS__);                                \
+		len += (n_ > 0) ? (size_t)n_ : 0;                              \
+	} while (0)
+
+size_t stats_format(const vsfs_stats *st, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	// Ticks per nanosecond, measured since the statistics were initialized
+	uint64_t ticks = stats_ticks() - st->start_ticks;
+	uint64_t ns = now_ns() - st->start_ns;
+	double ns_per_tick = (ticks > 0 && ns > 0) ? (double)ns / ticks : 1.0;
+
+	APPEND("%-10s %12s %14s %12s\n", "# op", "calls", "bytes", "avg_ns");
+	for (int op = 0; op < STATS_NOPS; ++op) {
+		const stats_op_data *d = &st->ops[op];
+		if (d->calls == 0) {
+			continue;
+		}
+		APPEND("%-10s %12lu %14lu %12.0f\n", op_names[op], d->calls, d->bytes,
+		       d->ticks * ns_per_tick / d->calls);
+	}
+
+	APPEND("# latency histograms: <upper bound in ns>:<calls> ...\n");
+	for (int op = 0; op < STATS_NOPS; ++op) {
+		const stats_op_data *d = &st->ops[op];
+		if (d->calls == 0) {
+			continue;
+		}
+		APPEND("%-10s", op_names[op]);
+		for (int i = 0; i < STATS_BUCKETS; ++i) {
+			if (d->hist[i] != 0) {
+				APPEND(" %.0f:%lu", (double)(2ul << i) * ns_per_tick,
+				       d->hist[i]);
+			}
+		}
+		APPEND("\n");
+	}
+
+	APPEND("dentries_scanned %lu\n", st->dentries_scanned);
+	APPEND("bitmap_words     %lu\n", st->bitmap_words);
+	APPEND("blocks_zeroed    %lu\n", st->blocks_zeroed);
+	return (len < size) ? len : size - 1;
+}
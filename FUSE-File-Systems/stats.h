@@ -0,0 +1,169 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Operation statistics header file.
+ *
+ * With the stats option, every file system callback is counted and timed,
+ * and a few internal events (directory entries compared by path lookups,
+ * bitmap words scanned by the allocators, blocks zeroed) are counted. The
+ * statistics can be read from the VSFS_STATS_PATH file of the mounted file
+ * system, and are printed when it is unmounted. The file is read with direct
+ * I/O, so reads are always current, but with cache_timeout its size as shown
+ * by stat() may be out of date (the 2.9 high-level API can't give one file a
+ * shorter attribute timeout).
+ *
+ * Latencies are measured in CPU timestamp counter ticks on x86-64 (a few
+ * nanoseconds to read) and converted to nanoseconds only when the
+ * statistics are formatted.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/** Path of the read-only statistics file. Not listed by readdir(). */
+#define VSFS_STATS_PATH "/.vsfs_stats"
+
+/** Number of latency histogram buckets; bucket i counts [2^i, 2^(i+1)). */
+#define STATS_BUCKETS 48
+
+/** Maximum size of the formatted statistics. */
+#define STATS_TEXT_MAX 16384
+
+
+/** Instrumented operations. */
+typedef enum stats_op {
+	STATS_STATFS,
+	STATS_GETATTR,
+	STATS_READDIR,
+	STATS_MKDIR,
+	STATS_RMDIR,
+	STATS_CREATE,
+	STATS_UNLINK,
+	STATS_UTIMENS,
+	STATS_TRUNCATE,
+	STATS_READ,
+	STATS_WRITE,
+	STATS_RELEASE,
+	STATS_FSYNC,
+	STATS_IOCTL,
+	STATS_OPEN,// after the others, which traces already use
+	STATS_NOPS
+} stats_op;
+
+/** Statistics of an operation. */
+typedef struct stats_op_data {
+	uint64_t calls;
+	/** Bytes read or written. */
+	uint64_t bytes;
+	/** Total time, in ticks. */
+	uint64_t ticks;
+	/** Number of calls by log2 of their time in ticks. */
+	uint64_t hist[STATS_BUCKETS];
+} stats_op_data;
+
+/** Statistics of a mounted file system. */
+typedef struct vsfs_stats {
+	bool enabled;
+	stats_op_data ops[STATS_NOPS];
+	/** Directory entries compared by path lookups. */
+	uint64_t dentries_scanned;
+	/** Bitmap words scanned to find free blocks and inodes. */
+	uint64_t bitmap_words;
+	/** Blocks zeroed when they were allocated or freed. */
+	uint64_t blocks_zeroed;
+	/** Start time, in ticks and nanoseconds, to convert between them. */
+	uint64_t start_ticks;
+	uint64_t start_ns;
+} vsfs_stats;
+
+/**
+ * Initialize the statistics, all zero.
+ *
+ * @param st       pointer to the statistics.
+ * @param enabled  whether operations are timed.
+ */
+void stats_init(vsfs_stats *st, bool enabled);
+
+/** Get the current time in ticks. */
+static inline uint64_t stats_ticks(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Start timing an operation.
+ *
+ * @param st  pointer to the statistics.
+ * @return    start time to pass to stats_end().
+ */
+static inline uint64_t stats_begin(const vsfs_stats *st)
+{
+	return st->enabled ? stats_ticks() : 0;
+}
+
+/**
+ * Count a finished operation.
+ *
+ * @param st     pointer to the statistics.
+ * @param op     operation.
+ * @param start  value returned by stats_begin().
+ * @param bytes  bytes read or written.
+ */
+static inline void stats_end(vsfs_stats *st, stats_op op, uint64_t start,
+                             uint64_t bytes)
+{
+	if (!st->enabled) {
+		return;
+	}
+	uint64_t t = stats_ticks() - start;
+	int bucket = 63 - __builtin_clzll(t | 1);
+	stats_op_data *d = &st->ops[op];
+	d->calls++;
+	d->bytes += bytes;
+	d->ticks += t;
+	d->hist[(bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1]++;
+}
+
+/**
+ * Get the name of an operation.
+ *
+ * @param op  operation.
+ * @return    name of the operation, e.g. "read".
+ */
+const char *stats_op_name(stats_op op);
+
+/**
+ * Format the statistics as text.
+ *
+ * @param st    pointer to the statistics.
+ * @param buf   buffer that receives the text (null-terminated).
+ * @param size  buffer size; STATS_TEXT_MAX is enough.
+ * @return      length of the text.
+ */
+size_t stats_format(const vsfs_stats *st, char *buf, size_t size);
@@ -0,0 +1,125 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Striped images implementation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "stripe.h"
+
+
+bool stripe_valid(const stripe_layout *sl)
+{
+	if (sl->count < 1 || sl->count > STRIPE_MAX_IMAGES) {
+		fprintf(stderr, "Invalid number of striped images: %u\n", sl->count);
+		return false;
+	}
+	if (sl->count > 1 && (sl->unit == 0 || sl->unit > VSFS_BLK_MAX)) {
+		fprintf(stderr, "Invalid stripe unit: %u blocks\n", sl->unit);
+		return false;
+	}
+	return true;
+}
+
+vsfs_blk_t stripe_image_blocks(const stripe_layout *sl, vsfs_blk_t nblocks,
+                               uint32_t img)
+{
+	if (sl->count <= 1) {
+		return nblocks;
+	}
+	if (nblocks <= sl->base) {
+		return (img == 0) ? nblocks : 0;
+	}
+
+	// Whole stripe units, and the last partial one
+	vsfs_blk_t data = nblocks - sl->base;
+	vsfs_blk_t units = data / sl->unit;
+	vsfs_blk_t n = (units / sl->count + (img < units % sl->count)) * sl->unit;
+	if (units % sl->count == img) {
+		n += data % sl->unit;
+	}
+	return n + ((img == 0) ? sl->base : 0);
+}
+
+vsfs_blk_t stripe_fit(const stripe_layout *sl, const vsfs_blk_t *blocks)
+{
+	// The size needed by each image grows with the file system size, so
+	// the largest size that fits is found with a binary search
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < sl->count; ++i) {
+		total += blocks[i];
+	}
+	vsfs_blk_t lo = 0;
+	vsfs_blk_t hi = (total < VSFS_BLK_MAX) ? total : VSFS_BLK_MAX;
+	while (lo < hi) {
+		vsfs_blk_t mid = hi - (hi - lo) / 2;
+		bool fits = true;
+		for (uint32_t i = 0; i < sl->count && fits; ++i) {
+			fits = stripe_image_blocks(sl, mid, i) <= blocks[i];
+		}
+		if (fits) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return (lo > sl->base || sl->count <= 1) ? lo : 0;
+}
+
+int stripe_split(char *list, const char **paths, int max)
+{
+	int n = 0;
+	for (char *p = strtok(list, ":"); p != NULL; p = strtok(NULL, ":")) {
+		if (n == max) {
+			return -1;
+		}
+		paths[n++] = p;
+	}
+	return n;
+}
+
+void *stripe_mmap(const stripe_layout *sl, const int *fds, vsfs_blk_t nblocks)
+{
+	size_t size = (size_t)nblocks * VSFS_BLOCK_SIZE;
+
+	// Reserve the address range, then map each run of blocks over it
+	void *addr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+	                  -1, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	for (vsfs_blk_t blk = 0; blk < nblocks; ) {
+		uint32_t img;
+		vsfs_blk_t off;
+		vsfs_blk_t n = stripe_locate(sl, blk, &img, &off);
+		if (n > nblocks - blk) {
+			n = nblocks - blk;
+		}
+		if (mmap(addr + (size_t)blk * VSFS_BLOCK_SIZE,
+		         (size_t)n * VSFS_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+		         MAP_SHARED | MAP_FIXED, fds[img],
+		         (off_t)off * VSFS_BLOCK_SIZE) == MAP_FAILED) {
+			perror("mmap");
+			munmap(addr, size);
+			return NULL;
+		}
+		blk += n;
+	}
+	return addr;
+}
@@ -0,0 +1,136 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Striped images header file.
+ *
+ * A file system can be spread over several image files (e.g. on different
+ * disks), so that large transfers are split between them. The metadata
+ * blocks [0, base) stay on the first image, at the same offsets as in a
+ * single image. The data blocks after them are split into stripe units of
+ * "unit" consecutive blocks, which are assigned to the images in turn; on
+ * the first image, they follow the metadata.
+ *
+ * The layout is recorded in the superblock (VSFS_FEATURE_STRIPE), with base
+ * being the first data block. The other images have no header of their own;
+ * they are given, in order, to each tool that opens the file system.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "vsfs.h"
+
+/** Maximum number of images a file system can be striped over. */
+#define STRIPE_MAX_IMAGES 16
+
+/** Default stripe unit in blocks (64 KiB). */
+#define STRIPE_DEFAULT_UNIT 16
+
+
+/** Layout of a file system over its images. */
+typedef struct stripe_layout {
+	/** Number of images; 1 if the file system is not striped. */
+	uint32_t count;
+	/** Stripe unit in blocks. */
+	vsfs_blk_t unit;
+	/** Number of leading blocks that stay on the first image. */
+	vsfs_blk_t base;
+} stripe_layout;
+
+/**
+ * Find where a block is stored.
+ *
+ * @param sl   pointer to the layout.
+ * @param blk  block number in the file system.
+ * @param img  set to the image the block is stored in.
+ * @param off  set to the block number within that image.
+ * @return     number of blocks from blk on that are stored consecutively
+ *             in the same image (at least 1).
+ */
+static inline vsfs_blk_t stripe_locate(const stripe_layout *sl,
+                                       vsfs_blk_t blk, uint32_t *img,
+                                       vsfs_blk_t *off)
+{
+	if (sl->count <= 1) {
+		*img = 0;
+		*off = blk;
+		return VSFS_BLK_MAX;
+	}
+	if (blk < sl->base) {
+		*img = 0;
+		*off = blk;
+		return sl->base - blk;
+	}
+	vsfs_blk_t d = blk - sl->base;
+	vsfs_blk_t s = d / sl->unit;
+	*img = s % sl->count;
+	*off = ((*img == 0) ? sl->base : 0) + s / sl->count * sl->unit +
+	       d % sl->unit;
+	return sl->unit - d % sl->unit;
+}
+
+/**
+ * Check that a layout is valid.
+ *
+ * @param sl  pointer to the layout.
+ * @return    true if the layout can be used; false otherwise (a message is
+ *            printed).
+ */
+bool stripe_valid(const stripe_layout *sl);
+
+/**
+ * Get the number of blocks an image must have to hold its part of a file
+ * system.
+ *
+ * @param sl       pointer to the layout.
+ * @param nblocks  file system size in blocks.
+ * @param img      image index.
+ * @return         minimum image size in blocks.
+ */
+vsfs_blk_t stripe_image_blocks(const stripe_layout *sl, vsfs_blk_t nblocks,
+                               uint32_t img);
+
+/**
+ * Get the size of the largest file system that fits into the images.
+ *
+ * @param sl      pointer to the layout.
+ * @param blocks  size of each of the sl->count images in blocks.
+ * @return        file system size in blocks, at most VSFS_BLK_MAX; 0 if even
+ *                the metadata doesn't fit.
+ */
+vsfs_blk_t stripe_fit(const stripe_layout *sl, const vsfs_blk_t *blocks);
+
+/**
+ * Split a list of image paths separated with ':' (modified in place).
+ *
+ * @param list   the list.
+ * @param paths  array that receives the paths.
+ * @param max    size of the paths array.
+ * @return       number of paths; -1 if there are more than max.
+ */
+int stripe_split(char *list, const char **paths, int max);
+
+/**
+ * Map the blocks [0, nblocks) of a file system into memory at consecutive
+ * addresses, for reading and writing, as if it were a single image.
+ *
+ * @param sl       pointer to the layout.
+ * @param fds      open file descriptors of the sl->count images.
+ * @param nblocks  file system size in blocks.
+ * @return         address of the mapping (munmap() releases all of it) on
+ *                 success; NULL on failure.
+ */
+void *stripe_mmap(const stripe_layout *sl, const int *fds, vsfs_blk_t nblocks);
@@ -0,0 +1,97 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Operation trace implementation.
+ */
+
+#include <string.h>
+
+#include "trace.h"
+#include "vsfs.h"
+
+/** Size of the stdio buffer of the trace file. */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+
+bool trace_open(vsfs_trace *t, const char *path)
+{
+	t->f = fopen(path, "wb");
+	if (t->f == NULL) {
+		perror(path);
+		return false;
+	}
+	setvbuf(t->f, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+	if (fwrite(TRACE_MAGIC, 8, 1, t->f) != 1) {
+		perror(path);
+		fclose(t->f);
+		t->f = NULL;
+		return false;
+	}
+	t->start_ns = trace_now();
+	return true;
+}
+
+void trace_close(vsfs_trace *t)
+{
+	if (t->f != NULL) {
+		if (fclose(t->f) != 0) {
+			perror("Writing the trace failed");
+		}
+		t->f = NULL;
+	}
+}
+
+void trace_end(vsfs_trace *t, stats_op op, const char *path, uint64_t offset,
+               uint32_t arg, int result, uint64_t start)
+{
+	if (t->f == NULL) {
+		return;
+	}
+	uint64_t now = trace_now();
+	size_t len = strnlen(path, VSFS_PATH_MAX - 1);
+	trace_rec rec = {
+		.start_ns = start - t->start_ns,
+		.offset = offset,
+		.dur_ns = (now - start > UINT32_MAX) ? UINT32_MAX : now - start,
+		.arg = arg,
+		.result = result,
+		.op = op,
+		.path_len = len,
+	};
+	if (fwrite(&rec, sizeof(rec), 1, t->f) != 1 ||
+	    fwrite(path, 1, len, t->f) != len) {
+		perror("Writing the trace failed; stopping");
+		fclose(t->f);
+		t->f = NULL;
+	}
+}
+
+bool trace_read_header(FILE *f)
+{
+	char magic[8];
+	return fread(magic, sizeof(magic), 1, f) == 1 &&
+	       memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool trace_read(FILE *f, trace_rec *rec, char *path)
+{
+	if (fread(rec, sizeof(*rec), 1, f) != 1 || rec->op >= STATS_NOPS ||
+	    rec->path_len >= VSFS_PATH_MAX ||
+	    fread(path, 1, rec->path_len, f) != rec->path_len) {
+		return false;
+	}
+	path[rec->path_len] = '\0';
+	return true;
+}
@@ -0,0 +1,136 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - Operation trace header file.
+ *
+ * With the trace option, vsfs records every file system call in a binary
+ * trace file, which vsfs-replay can run against an image to reproduce the
+ * workload. The file starts with TRACE_MAGIC and continues with records: a
+ * trace_rec followed by rec.path_len bytes of path (not null-terminated).
+ * Data that is written is not recorded, only its size. All fields are in
+ * host byte order.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+/** First 8 bytes of a trace file. */
+#define TRACE_MAGIC "VSFSTRC1"
+
+
+/** A recorded call. */
+typedef struct trace_rec {
+	/** Start time in nanoseconds since the trace was opened. */
+	uint64_t start_ns;
+	/**
+	 * Offset for read, write and readdir; new size for truncate.
+	 */
+	uint64_t offset;
+	/** Duration in nanoseconds. */
+	uint32_t dur_ns;
+	/**
+	 * Size for read and write; mode for create and mkdir; datasync for
+	 * fsync; command for ioctl.
+	 */
+	uint32_t arg;
+	/** Return value of the call. */
+	int32_t result;
+	/** Operation (stats_op). */
+	uint16_t op;
+	/** Length of the path that follows. */
+	uint16_t path_len;
+} trace_rec;
+
+/** Trace being recorded. */
+typedef struct vsfs_trace {
+	/** Trace file; NULL if not tracing. */
+	FILE *f;
+	/** Time the trace was opened. */
+	uint64_t start_ns;
+} vsfs_trace;
+
+/** Get the current time in nanoseconds. */
+static inline uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Create a trace file and start recording.
+ *
+ * @param t     pointer to the trace to initialize.
+ * @param path  trace file path.
+ * @return      true on success; false on failure.
+ */
+bool trace_open(vsfs_trace *t, const char *path);
+
+/**
+ * Stop recording and close the trace file. Does nothing if not tracing.
+ *
+ * @param t  pointer to the trace.
+ */
+void trace_close(vsfs_trace *t);
+
+/**
+ * Start timing a call.
+ *
+ * @param t  pointer to the trace.
+ * @return   start time to pass to trace_end().
+ */
+static inline uint64_t trace_begin(const vsfs_trace *t)
+{
+	return (t->f != NULL) ? trace_now() : 0;
+}
+
+/**
+ * Record a finished call. Does nothing if not tracing.
+ *
+ * @param t       pointer to the trace.
+ * @param op      operation.
+ * @param path    path argument of the call.
+ * @param offset  see trace_rec.
+ * @param arg     see trace_rec.
+ * @param result  return value of the call.
+ * @param start   value returned by trace_begin().
+ */
+void trace_end(vsfs_trace *t, stats_op op, const char *path, uint64_t offset,
+               uint32_t arg, int result, uint64_t start);
+
+/**
+ * Check the header of a trace file.
+ *
+ * @param f  trace file, positioned at the start.
+ * @return   true if it is a trace file.
+ */
+bool trace_read_header(FILE *f);
+
+/**
+ * Read the next record of a trace file.
+ *
+ * @param f     trace file.
+ * @param rec   receives the record.
+ * @param path  receives the null-terminated path; VSFS_PATH_MAX bytes.
+ * @return      true on success; false at the end of the file or if the
+ *              record is invalid.
+ */
+bool trace_read(FILE *f, trace_rec *rec, char *path);
@@ -20,7 +20,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 
 // Using 2.9.x FUSE API
 #define FUSE_USE_VERSION 29
@@ -31,7 +30,11 @@
 #include "options.h"
 #include "util.h"
 #include "bitmap.h"
-#include "map.h"
+#include "bdev.h"
+#include "vsfs_ioctl.h"
+#include "vsfs_ops.h"
+
+static int delalloc_flush_all(fs_ctx *fs);
 
 //NOTE: All path arguments are absolute paths within the vsfs file system and
 // start with a '/' that corresponds to the vsfs root directory.
@@ -45,6 +48,50 @@
 // FUSE callbacks as "/dir".
 
 
+// HELPER: spread the block device over the images of a striped file system,
+// as recorded in its superblock
+static bool open_stripes(fs_ctx *fs, vsfs_opts *opts)
+{
+	const vsfs_superblock *sb = bdev_map_meta(&fs->bd, 1);
+	if (sb == NULL) {
+		return false;
+	}
+	// Anything else is checked when the superblock is validated
+	if (sb->magic != VSFS_MAGIC) {
+		return true;
+	}
+	bool striped = sb->features & VSFS_FEATURE_STRIPE;
+	if (striped != (opts->stripe != NULL)) {
+		fprintf(stderr, striped
+		        ? "The file system is striped; use -o stripe to give the "
+		          "other images\n"
+		        : "The file system is not striped\n");
+		return false;
+	}
+	if (!striped) {
+		return true;
+	}
+
+	// Split a copy, so that the options can be used for another mount
+	char *list = strdup(opts->stripe);
+	if (list == NULL) {
+		return false;
+	}
+	const char *paths[STRIPE_MAX_IMAGES];
+	int n = stripe_split(list, paths, STRIPE_MAX_IMAGES - 1);
+	bool ret = false;
+	if (n < 0 || (uint32_t)n + 1 != sb->stripe_count) {
+		fprintf(stderr, "The file system is striped over %u images\n",
+		        sb->stripe_count);
+	} else {
+		stripe_layout sl = { sb->stripe_count, sb->stripe_unit,
+		                     sb->data_region };
+		ret = bdev_stripe(&fs->bd, &sl, paths);
+	}
+	free(list);
+	return ret;
+}
+
 /**
  * Initialize the file system.
  *
@@ -56,23 +103,81 @@
  * @param opts  command line options.
  * @return      true on success; false on failure.
  */
-static bool vsfs_init(fs_ctx *fs, vsfs_opts *opts)
+bool vsfs_init(fs_ctx *fs, vsfs_opts *opts)
 {
-	size_t size;
-	void *image;
-	
 	// Nothing to initialize if only printing help
 	if (opts->help) {
 		return true;
 	}
 
-	// Map the disk image file into memory
-	image = map_file(opts->img_path, VSFS_BLOCK_SIZE, &size);
-	if (image == NULL) {
+	// Open the disk image file with the selected I/O backend
+	if (!bdev_open(&fs->bd, opts->img_path, opts->backend,
+	               opts->cache_blocks, opts->odirect)) {
+		return false;
+	}
+
+	if (!open_stripes(fs, opts) || !fs_ctx_init(fs)) {
+		bdev_close(&fs->bd);
+		return false;
+	}
+	// The write-back thread itself is started by vsfs_start()
+	if (opts->writeback > 0 && fs->bd.ops->writeback == NULL) {
+		fprintf(stderr, "The writeback option needs the pread or uring "
+		        "backend\n");
+		fs_ctx_destroy(fs);
+		bdev_close(&fs->bd);
 		return false;
 	}
+	fs->opts = opts;
+	fs->discard = opts->discard;
+	fs->compress = opts->compress;
+	fs->dedup = opts->dedup;
+	fs->delalloc = opts->delalloc;
+	fs->prealloc = opts->prealloc;
+	stats_init(&fs->stats, opts->stats);
+	if (opts->trace != NULL && !trace_open(&fs->trace, opts->trace)) {
+		fs_ctx_destroy(fs);
+		bdev_close(&fs->bd);
+		return false;
+	}
+	return true;
+}
 
-	return fs_ctx_init(fs, image, size);
+/**
+ * Start the file system's background threads: the one that invalidates kernel
+ * cache entries (with cache_timeout) and the write-back one (with writeback).
+ *
+ * Called when the file system is mounted, after FUSE has detached from the
+ * terminal (threads started before that, in vsfs_init(), would not survive
+ * the fork). Tools that run vsfs in-process call it after vsfs_init().
+ *
+ * @param conn  FUSE connection parameters (unused).
+ * @return      the file system context, which stays the private data.
+ */
+static void *vsfs_start(struct fuse_conn_info *conn)
+{
+	(void)conn;// unused
+	struct fuse_context *ctx = fuse_get_context();
+	fs_ctx *fs = (fs_ctx*)ctx->private_data;
+	if (fs->sb == NULL) {
+		return fs;
+	}
+	// Long-lived kernel caches must be told about the entries we change;
+	// without that, the file system can't be used safely (vsfs_destroy()
+	// still cleans up)
+	if (fs->opts->cache_timeout > 0 && !notify_init(&fs->notify)) {
+		fprintf(stderr, "Failed to start the invalidation thread\n");
+		if (ctx->fuse != NULL) {
+			fuse_exit(ctx->fuse);
+		}
+		return fs;
+	}
+	// Without background write-back, buffers are still written back on
+	// eviction and flush; carry on
+	if (fs->opts->writeback > 0) {
+		bdev_writeback(&fs->bd, fs->opts->writeback);
+	}
+	return fs;
 }
 
 /**
@@ -84,9 +189,16 @@ static bool vsfs_init(fs_ctx *fs, vsfs_opts *opts)
 static void vsfs_destroy(void *ctx)
 {
 	fs_ctx *fs = (fs_ctx*)ctx;
-	if (fs->image) {
-		munmap(fs->image, fs->size);
+	if (fs->sb) {
+		delalloc_flush_all(fs);
+		if (fs->stats.enabled) {
+			char text[STATS_TEXT_MAX];
+			stats_format(&fs->stats, text, sizeof(text));
+			fprintf(stderr, "%s", text);
+		}
+		trace_close(&fs->trace);
 		fs_ctx_destroy(fs);
+		bdev_close(&fs->bd);
 	}
 }
 
@@ -96,17 +208,6 @@ static fs_ctx *get_fs(void)
 	return (fs_ctx*)fuse_get_context()->private_data;
 }
 
-// HELPER: find pointer to inode given inode number
-vsfs_inode * inode_location(vsfs_ino_t ino){
-	fs_ctx *fs = get_fs();
-	return &(fs->itable[ino]);
-}
-
-vsfs_dentry * dentry_location(unsigned long block_num){
-	fs_ctx *fs = get_fs();
-	return (vsfs_dentry *) (fs->image + block_num * VSFS_BLOCK_SIZE);
-}
-
 // uint32_t dentry_block_num(vsfs_dentry * dentry){
 // 	fs_ctx *fs = get_fs();
 // 	return (dentry - (vsfs_dentry *)(fs->image)) / VSFS_BLOCK_SIZE;
@@ -118,925 +219,3081 @@ vsfs_dentry * dentry_location(unsigned long block_num){
 // 	return (fs->sb->data_region <= block_num) && bitmap_isset(fs->dbmap, nblks, block_num);
 // }
 
+/** Number of file blocks to read ahead when a file is read sequentially. */
+#define VSFS_READAHEAD 8
 
-/* Returns the inode number for the element at the end of the path
- * if it exists.  If there is any error, return -1.
- * Possible errors include:
- *   - The path is not an absolute path
- *   - An element on the path cannot be found
- */
-static int path_lookup(const char *path, vsfs_inode **ino, vsfs_dentry **den) {
-	if(path[0] != '/') {
-		fprintf(stderr, "Not an absolute path\n");
-		return -ENOSYS;
-	} 
+/** Location of a directory entry: directory data block and slot in it. */
+typedef struct dentry_pos {
+	vsfs_blk_t blk;
+	uint32_t slot;
+	/** Index of the block in the directory */
+	vsfs_blk_t idx;
+} dentry_pos;
 
-	// TODO: complete this function and any helper functions
-	if (strcmp(path, "/") == 0) {
-		*ino = inode_location(VSFS_ROOT_INO);
-		*den = dentry_location(0);
-		return 0;
+// HELPER: find the data block number of block "idx" of the inode.
+// Returns 0 (the superblock, never a data block) on I/O error.
+static vsfs_blk_t inode_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t idx)
+{
+	assert(idx < inode->i_blocks);
+	if (idx < VSFS_NUM_DIRECT) {
+		return inode->i_direct[idx];
 	}
 
-	fs_ctx *fs = get_fs();
-	(void) fs;
-
-	// root directory i node
-	vsfs_inode * root = inode_location(VSFS_ROOT_INO);
-	// default return value
+	vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+	if (indirect == NULL) {
+		return 0;
+	}
+	vsfs_blk_t blk = indirect[idx - VSFS_NUM_DIRECT];
+	bdev_put(&fs->bd, inode->i_indirect, false);
+	return blk;
+}
 
-	vsfs_dentry * dentry;
-	// # of dentries per block
-	int dentry_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_dentry);
+// HELPER: release the pending range of freed blocks to the host
+static void discard_flush(fs_ctx *fs)
+{
+	if (fs->discard_count > 0 &&
+	    !bdev_discard(&fs->bd, fs->discard_start, fs->discard_count)) {
+		fprintf(stderr, "Punching holes failed; disabling discard\n");
+		fs->discard = false;
+	}
+	fs->discard_count = 0;
+}
 
-	// for each i_direct in root inode, try all dentries in the block
+// HELPER: get the number of free blocks that are not set aside for buffered
+// writes (see delalloc.h)
+static vsfs_blk_t avail_blocks(fs_ctx *fs)
+{
+	return fs->sb->free_blocks - fs->da.reserved;
+}
 
+// HELPER: mark a data block used or free in the bitmap and the free extent
+// tree, and count it in the free blocks of the file system
+static void dbmap_set(fs_ctx *fs, vsfs_blk_t blk, bool used)
+{
+	assert(bitmap_isset(fs->dbmap, fs->sb->num_blocks, blk) != used);
+	bitmap_set(fs->dbmap, fs->sb->num_blocks, blk, used);
+	freetree_update(&fs->ft, fs->dbmap, blk);
+	if (used) {
+		fs->sb->free_blocks--;
+	} else {
+		fs->sb->free_blocks++;
+	}
+}
 
-	uint32_t * indirect_base = (uint32_t *) (fs->image + root->i_indirect * VSFS_BLOCK_SIZE);
+// HELPER: get the first block of the home allocation group of an inode (see
+// agroup.h); inodes are spread over the groups in turn
+static vsfs_blk_t inode_home(fs_ctx *fs, vsfs_inode *inode)
+{
+	uint32_t g = (inode - fs->itable) % agroup_count(fs->sb->num_blocks);
+	vsfs_blk_t start = agroup_start(g);
+	return (start < fs->sb->data_region) ? fs->sb->data_region : start;
+}
 
-	for (vsfs_blk_t i = 0; i < root->i_blocks; i++){
-		if (i < VSFS_NUM_DIRECT){
-			// direct case
-			dentry = dentry_location(root->i_direct[i]);
-			for (int j = 0; j < dentry_per_block; j++){
-				if (strcmp(dentry[j].name, path + 1) == 0){
-					*ino = inode_location(dentry[j].ino);
-					*den = &(dentry[j]);
-					return dentry[j].ino;
-				}
-			}
-		} else{
-			// indirect case
-			dentry = dentry_location(indirect_base[i - VSFS_NUM_DIRECT]);
-			for (int j = 0; j < dentry_per_block; j++){
-				if (strcmp(dentry[j].name, path + 1) == 0){
-					*ino = inode_location(dentry[j].ino);
-					*den = &(dentry[j]);
-					return dentry[j].ino;
-				}	
-			}
+// HELPER: bitmap_find_free() on the data bitmap (up to block "end"), counting
+// the words scanned
+static int dbmap_find_free(fs_ctx *fs, vsfs_blk_t end, uint32_t start,
+                           uint32_t *index)
+{
+	static const uint32_t bits_per_word = sizeof(bitmap_t) * CHAR_BIT;
+	int ret = bitmap_find_free(fs->dbmap, end, start, index);
+	uint32_t last = (ret == 0) ? *index : end;
+	if (last >= start) {
+		fs->stats.bitmap_words += last / bits_per_word - start / bits_per_word
+		                          + 1;
+	}
+	return ret;
+}
 
+// HELPER: find the first run of n free data blocks at or after block "from"
+// (see freetree.h), optionally skipping the preallocation windows (see
+// prealloc.h)
+static int find_run_from(fs_ctx *fs, vsfs_blk_t from, vsfs_blk_t n,
+                         bool skip_windows, vsfs_blk_t *start)
+{
+	while (freetree_find(&fs->ft, fs->dbmap, from, n, start)) {
+		vsfs_blk_t blk = *start;
+		while (blk < *start + n &&
+		       (!skip_windows || prealloc_skip(&fs->pa, blk) == blk)) {
+			blk++;
+		}
+		if (blk == *start + n) {
+			return 0;
 		}
+		// Search again past the window
+		from = prealloc_skip(&fs->pa, blk);
 	}
-	// find inode block fo the indirect data pointer, 
-	//and do pass for all inodes in this block
+	return -ENOSPC;
+}
 
-	return -ENOSYS;
+// HELPER: find a run of n free data blocks outside preallocation windows,
+// searching from block "near" to the end and then from the start
+static int find_window_run(fs_ctx *fs, vsfs_blk_t near, vsfs_blk_t n,
+                           vsfs_blk_t *start)
+{
+	vsfs_blk_t first = fs->sb->data_region;
 
+	if (near < first || near >= fs->sb->num_blocks) {
+		near = first;
+	}
+	if (find_run_from(fs, near, n, true, start) == 0) {
+		return 0;
+	}
+	return find_run_from(fs, first, n, true, start);
 }
 
-/**
- * Get file system statistics.
- *
- * Implements the statvfs() system call. See "man 2 statvfs" for details.
- * The f_bfree and f_bavail fields should be set to the same value.
- * The f_ffree and f_favail fields should be set to the same value.
- * The following fields can be ignored: f_fsid, f_flag.
- * All remaining fields are required.
- *
- * Errors: none
- *
- * @param path  path to any file in the file system. Can be ignored.
- * @param st    pointer to the struct statvfs that receives the result.
- * @return      0 on success; -errno on error.
- */
-static int vsfs_statfs(const char *path, struct statvfs *st)
+// HELPER: allocate a zero-filled data block for the inode: the first free
+// one from the start of its home allocation group, wrapping around to the
+// start of the data region; fs->alloc_goal, if it is set and free, is taken
+// first. Blocks in preallocation windows are only taken as a last resort.
+static int alloc_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t *blk)
 {
-	(void)path;// unused
-	fs_ctx *fs = get_fs();
-	vsfs_superblock *sb = fs->sb; /* Get ptr to superblock from context */
-	
-	memset(st, 0, sizeof(*st));
-	st->f_bsize   = VSFS_BLOCK_SIZE;   /* Filesystem block size */
-	st->f_frsize  = VSFS_BLOCK_SIZE;   /* Fragment size */
-	// The rest of required fields are filled based on the information 
-	// stored in the superblock.
-	st->f_blocks = sb->num_blocks;     /* Size of fs in f_frsize units */
-	st->f_bfree  = sb->free_blocks;    /* Number of free blocks */
-	st->f_bavail = sb->free_blocks;    /* Free blocks for unpriv users */
-	st->f_files  = sb->num_inodes;     /* Number of inodes */
-	st->f_ffree  = sb->free_inodes;    /* Number of free inodes */
-	st->f_favail = sb->free_inodes;    /* Free inodes for unpriv users */
+	uint32_t index;
 
-	st->f_namemax = VSFS_NAME_MAX;     /* Maximum filename length */
+	// A pending discard must not punch out a block after it is reused
+	discard_flush(fs);
+	if (avail_blocks(fs) == 0) {
+		return -ENOSPC;
+	}
+	if (fs->alloc_goal != 0 && fs->alloc_goal < fs->sb->num_blocks &&
+	    !bitmap_isset(fs->dbmap, fs->sb->num_blocks, fs->alloc_goal)) {
+		index = fs->alloc_goal++;
+	} else if (find_window_run(fs, inode_home(fs, inode), 1, &index) != 0 &&
+	           find_run_from(fs, 0, 1, false, &index) != 0) {
+		return -ENOSPC;
+	}
+	dbmap_set(fs, index, true);
 
+	if (bdev_get_zeroed(&fs->bd, index) == NULL) {
+		dbmap_set(fs, index, false);
+		return -EIO;
+	}
+	bdev_put(&fs->bd, index, true);
+	fs->stats.blocks_zeroed++;
+	*blk = index;
 	return 0;
 }
 
-/**
- * Get file or directory attributes.
- *
- * Implements the lstat() system call. See "man 2 lstat" for details.
- * The following fields can be ignored: st_dev, st_ino, st_uid, st_gid, st_rdev,
- *                                      st_blksize, st_atim, st_ctim.
- * All remaining fields are required.
- *
- * NOTE: the st_blocks field is measured in 512-byte units (disk sectors);
- *       it should include any metadata blocks that are allocated to the 
- *       inode (for vsfs, that is the indirect block). 
- *
- * NOTE2: the st_mode field must be set correctly for files and directories.
- *
- * Errors:
- *   ENAMETOOLONG  the path or one of its components is too long.
- *   ENOENT        a component of the path does not exist.
- *   ENOTDIR       a component of the path prefix is not a directory.
- *
- * @param path  path to a file or directory.
- * @param st    pointer to the struct stat that receives the result.
- * @return      0 on success; -errno on error;
- */
-static int vsfs_getattr(const char *path, struct stat *st)
+// HELPER: find the shortest run of at least n free data blocks, preferring
+// one that doesn't overlap preallocation windows
+static int find_free_run(fs_ctx *fs, vsfs_blk_t n, vsfs_blk_t *start)
 {
-	if (strlen(path) >= VSFS_PATH_MAX) return -ENAMETOOLONG;
-	fs_ctx *fs = get_fs();
-	(void) fs;
-
-	memset(st, 0, sizeof(*st));
+	if (n > avail_blocks(fs) ||
+	    !freetree_best(&fs->ft, fs->dbmap, n, start)) {
+		return -ENOSPC;
+	}
+	for (vsfs_blk_t blk = *start; blk < *start + n; blk++) {
+		if (prealloc_skip(&fs->pa, blk) != blk) {
+			// Take the first run clear of the windows instead, if any
+			vsfs_blk_t other;
+			if (find_run_from(fs, fs->sb->data_region, n, true,
+			                  &other) == 0) {
+				*start = other;
+			}
+			break;
+		}
+	}
+	return 0;
+}
 
-	//NOTE: This is just a placeholder that allows the file system to be 
-	//      mounted without errors.
-	//      You should remove this from your implementation.
-	// create a inode to store the inode corresponding to the path
+// HELPER: get the number of references to a data block beyond the first one
+// (see vsfs.h). An I/O error is reported as VSFS_REFS_MAX, so that the block
+// is neither modified nor freed.
+static vsfs_refs_t block_refs(fs_ctx *fs, vsfs_blk_t blk)
+{
+	if (fs->sb->refcount_blk == 0) {
+		return 0;
+	}
+	vsfs_blk_t tblk = fs->sb->refcount_blk + blk / VSFS_REFS_PER_BLOCK;
+	vsfs_refs_t *table = bdev_get(&fs->bd, tblk);
+	if (table == NULL) {
+		return VSFS_REFS_MAX;
+	}
+	vsfs_refs_t refs = table[blk % VSFS_REFS_PER_BLOCK];
+	bdev_put(&fs->bd, tblk, false);
+	return refs;
+}
 
-	vsfs_inode * res_inode;
-	vsfs_dentry * res_dentry;
-	// find such inode and return the inode number
-	int res_inode_num = path_lookup(path, &res_inode, &res_dentry);
-	(void) res_dentry;
-	if (res_inode_num < 0){
-		return -ENOENT;
+// HELPER: add delta (e.g. +1 or -1) to the number of references to a data
+// block; the reference count table must exist
+static bool block_refs_add(fs_ctx *fs, vsfs_blk_t blk, int delta)
+{
+	assert(fs->sb->refcount_blk != 0);
+	vsfs_blk_t tblk = fs->sb->refcount_blk + blk / VSFS_REFS_PER_BLOCK;
+	vsfs_refs_t *table = bdev_get(&fs->bd, tblk);
+	if (table == NULL) {
+		return false;
 	}
+	table[blk % VSFS_REFS_PER_BLOCK] += delta;
+	bdev_put(&fs->bd, tblk, true);
+	return true;
+}
 
-	st->st_mode = res_inode->i_mode;
-	st->st_nlink = res_inode->i_nlink;
-	st->st_size = res_inode->i_size;
-	st->st_blocks = res_inode->i_blocks * VSFS_BLOCK_SIZE / 512;
-	st->st_mtim = res_inode->i_mtime;
+// HELPER: create the reference count table, the first time a block is shared
+static int refcount_init(fs_ctx *fs)
+{
+	vsfs_blk_t n = VSFS_REFCOUNT_BLOCKS(fs->sb->num_blocks);
+	vsfs_blk_t start;
 
-	if (res_inode->i_blocks > VSFS_NUM_DIRECT){
-		st->st_blocks += (VSFS_BLOCK_SIZE / 512);
+	if (fs->sb->refcount_blk != 0) {
+		return 0;
 	}
-
+	// A pending discard must not punch out the table
+	discard_flush(fs);
+	int ret = find_free_run(fs, n, &start);
+	if (ret < 0) {
+		return ret;
+	}
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		if (bdev_get_zeroed(&fs->bd, start + i) == NULL) {
+			return -EIO;
+		}
+		bdev_put(&fs->bd, start + i, true);
+		fs->stats.blocks_zeroed++;
+	}
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		dbmap_set(fs, start + i, true);
+	}
+	fs->sb->refcount_blk = start;
+	fs->sb->features |= VSFS_FEATURE_DEDUP;
 	return 0;
 }
 
-/**
- * Read a directory.
- *
- * Implements the readdir() system call. Should call filler(buf, name, NULL, 0)
- * for each directory entry. See fuse.h in libfuse source code for details.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
- *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a filler() call failed).
- *
- * @param path    path to the directory.
- * @param buf     buffer that receives the result.
- * @param filler  function that needs to be called for each directory entry.
- *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
- * @param offset  unused.
- * @param fi      unused.
- * @return        0 on success; -errno on error.
- */
-static int vsfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                        off_t offset, struct fuse_file_info *fi)
+// HELPER: find a data block with the given contents that can take another
+// reference; 0 if there is none
+static vsfs_blk_t dedup_find(fs_ctx *fs, uint64_t fp, const void *contents)
 {
-	(void)offset;// unused
-	(void)fi;// unused
-	fs_ctx *fs = get_fs();
+	size_t pos = 0;
+	vsfs_blk_t blk;
 
-	vsfs_inode * root = inode_location(VSFS_ROOT_INO);
-	// default return value
+	while ((blk = dedup_lookup(&fs->dd, fp, &pos)) != 0) {
+		if (block_refs(fs, blk) == VSFS_REFS_MAX) {
+			continue;
+		}
+		void *data = bdev_get(&fs->bd, blk);
+		if (data == NULL) {
+			continue;
+		}
+		bool same = memcmp(data, contents, VSFS_BLOCK_SIZE) == 0;
+		bdev_put(&fs->bd, blk, false);
+		if (same) {
+			return blk;
+		}
+	}
+	return 0;
+}
 
-	vsfs_dentry * dentry;
-	// # of dentries per block
-	int dentry_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_dentry);
+// HELPER: free a data block, zeroing its contents. With discard, adjacent
+// freed blocks are collected into one range that is released to the host by
+// discard_flush() at the end of the operation instead.
+static void free_block(fs_ctx *fs, vsfs_blk_t blk)
+{
+	// A shared block only loses a reference
+	vsfs_refs_t refs = block_refs(fs, blk);
+	if (refs > 0) {
+		if (refs == VSFS_REFS_MAX || !block_refs_add(fs, blk, -1)) {
+			fprintf(stderr, "Can't update the reference count of block "
+			        "%u; leaking it\n", blk);
+		}
+		return;
+	}
+	dedup_remove(&fs->dd, blk);
 
-	// for each i_direct in root inode, try all dentries in the block
+	if (!fs->discard) {
+		if (bdev_get_zeroed(&fs->bd, blk) != NULL) {
+			bdev_put(&fs->bd, blk, true);
+			fs->stats.blocks_zeroed++;
+		}
+	} else if (fs->discard_count > 0 && blk + 1 == fs->discard_start) {
+		// Files are freed from the last block down
+		fs->discard_start--;
+		fs->discard_count++;
+	} else if (fs->discard_count > 0 &&
+	           blk == fs->discard_start + fs->discard_count) {
+		fs->discard_count++;
+	} else {
+		discard_flush(fs);
+		fs->discard_start = blk;
+		fs->discard_count = 1;
+	}
+	zcache_invalidate(&fs->zc, blk);
+	dbmap_set(fs, blk, false);
+}
 
+// HELPER: allocate a zero-filled data block for the inode. With dedup, files
+// share a single zero-filled block until they write to it.
+static int alloc_data_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t *blk)
+{
+	static const char zeros[VSFS_BLOCK_SIZE];
+	bool share = fs->dedup && S_ISREG(inode->i_mode);
+
+	if (share) {
+		vsfs_blk_t zero = dedup_find(fs, fs->zero_fp, zeros);
+		if (zero != 0 && refcount_init(fs) == 0 &&
+		    block_refs_add(fs, zero, 1)) {
+			*blk = zero;
+			return 0;
+		}
+	}
+	int ret = alloc_block(fs, inode, blk);
+	if (ret == 0 && share) {
+		dedup_insert(&fs->dd, fs->zero_fp, *blk);
+	}
+	return ret;
+}
 
-	uint32_t * indirect_base = (uint32_t *) (fs->image + root->i_indirect * VSFS_BLOCK_SIZE);
+// HELPER: allocate the next data block of a file that is being appended to.
+// With prealloc, regular files take it from their preallocation window (see
+// prealloc.h), which is set aside near the end of the file when needed.
+static int alloc_append_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t *blk)
+{
+	// A batch of blocks being allocated already has its own run
+	if (!fs->prealloc || !S_ISREG(inode->i_mode) || fs->alloc_goal != 0) {
+		return alloc_data_block(fs, inode, blk);
+	}
 
-	for (vsfs_blk_t i = 0; i < root->i_blocks; i++){
-		if (i < VSFS_NUM_DIRECT){
-			// direct case
-			dentry = dentry_location(root->i_direct[i]);
-			for (int j = 0; j < dentry_per_block; j++){
-				if (dentry[j].ino == VSFS_INO_MAX){
-					continue;
-				}
-				if (filler(buf, dentry[j].name, NULL, 0) != 0){
-					return -ENOMEM;
-				}	
-			}
-		} else{
-			// indirect case
-			dentry = dentry_location(indirect_base[i - VSFS_NUM_DIRECT]);
-			for (int j = 0; j < dentry_per_block; j++){
-				if (dentry[j].ino == VSFS_INO_MAX){
-					continue;
-				}
-				if (filler(buf, dentry[j].name, NULL, 0) != 0){
-					return -ENOMEM;
-				}	
+	vsfs_ino_t ino = inode - fs->itable;
+	prealloc_window *w = prealloc_find(&fs->pa, ino);
+	if (w != NULL &&
+	    bitmap_isset(fs->dbmap, fs->sb->num_blocks, w->next)) {
+		// Taken by another file when there was no other free space
+		prealloc_release(&fs->pa, ino);
+		w = NULL;
+	}
+	if (w == NULL) {
+		vsfs_blk_t near = 0;
+		if (inode->i_blocks > 0) {
+			near = inode_block(fs, inode, inode->i_blocks - 1) + 1;
+		}
+		vsfs_blk_t n = inode->i_blocks;
+		n = (n < PREALLOC_MIN_BLOCKS) ? PREALLOC_MIN_BLOCKS :
+		    (n > PREALLOC_MAX_BLOCKS) ? PREALLOC_MAX_BLOCKS : n;
+		if (n > VSFS_MAX_FILE_BLOCKS - inode->i_blocks) {
+			n = VSFS_MAX_FILE_BLOCKS - inode->i_blocks;
+		}
+		vsfs_blk_t start;
+		for (; n > 1; n /= 2) {
+			if (find_window_run(fs, near, n, &start) == 0) {
+				w = prealloc_add(&fs->pa, ino, start, n);
+				break;
 			}
+		}
+	}
+	if (w == NULL) {
+		return alloc_data_block(fs, inode, blk);
+	}
+
+	fs->alloc_goal = w->next;
+	int ret = alloc_data_block(fs, inode, blk);
+	fs->alloc_goal = 0;
+	if (ret == 0 && *blk == w->next && ++w->next == w->end) {
+		prealloc_release(&fs->pa, ino);
+	}
+	return ret;
+}
 
+// HELPER: add a new zero-filled block at the end of the inode, allocating the
+// indirect block first if this is the first block that needs it
+static int inode_append_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t *blk)
+{
+	vsfs_blk_t idx = inode->i_blocks;
+	int ret;
+
+	if (idx >= VSFS_MAX_FILE_BLOCKS) {
+		return -EFBIG;
+	}
+	if (idx < VSFS_NUM_DIRECT) {
+		ret = alloc_append_block(fs, inode, blk);
+		if (ret < 0) {
+			return ret;
 		}
+		inode->i_direct[idx] = *blk;
+		inode->i_blocks++;
+		return 0;
 	}
 
-	(void) path;
-	//TODO: lookup the directory inode for given path and iterate through its
-	// directory entries
+	if (idx == VSFS_NUM_DIRECT) {
+		ret = alloc_block(fs, inode, &inode->i_indirect);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+	ret = (indirect != NULL) ? alloc_append_block(fs, inode, blk) : -EIO;
+	if (ret < 0) {
+		if (indirect != NULL) {
+			bdev_put(&fs->bd, inode->i_indirect, false);
+		}
+		if (idx == VSFS_NUM_DIRECT) {
+			free_block(fs, inode->i_indirect);
+			inode->i_indirect = 0;
+		}
+		return ret;
+	}
+	indirect[idx - VSFS_NUM_DIRECT] = *blk;
+	bdev_put(&fs->bd, inode->i_indirect, true);
+	inode->i_blocks++;
 	return 0;
 }
 
+// HELPER: free the last block of the inode, and the indirect block once it
+// is no longer needed
+static void inode_pop_block(fs_ctx *fs, vsfs_inode *inode)
+{
+	assert(inode->i_blocks > 0);
+	vsfs_blk_t idx = inode->i_blocks - 1;
 
-/**
- * Create a directory.
- *
- * Implements the mkdir() system call.
- *
- * You do NOT need to implement this function. 
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" doesn't exist.
- *   The parent directory of "path" exists and is a directory.
- *   "path" and its components are not too long.
- *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
- *
- * @param path  path to the directory to create.
- * @param mode  file mode bits.
- * @return      0 on success; -errno on error.
+	// A 0 pointer is the tail of a compressed cluster; nothing to free
+	if (idx < VSFS_NUM_DIRECT) {
+		if (inode->i_direct[idx] != 0) {
+			free_block(fs, inode->i_direct[idx]);
+		}
+		inode->i_direct[idx] = 0;
+	} else {
+		vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+		if (indirect != NULL) {
+			if (indirect[idx - VSFS_NUM_DIRECT] != 0) {
+				free_block(fs, indirect[idx - VSFS_NUM_DIRECT]);
+			}
+			indirect[idx - VSFS_NUM_DIRECT] = 0;
+			bdev_put(&fs->bd, inode->i_indirect, true);
+		}
+		if (idx == VSFS_NUM_DIRECT) {
+			free_block(fs, inode->i_indirect);
+			inode->i_indirect = 0;
+		}
+	}
+	inode->i_blocks--;
+}
+
+// HELPER: get the block numbers of blocks [first, first + n) of the inode
+static int inode_get_range(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t first,
+                           vsfs_blk_t n, vsfs_blk_t *blks)
+{
+	vsfs_blk_t i = first;
+
+	assert(first + n <= inode->i_blocks);
+	for (; i < first + n && i < VSFS_NUM_DIRECT; i++) {
+		*blks++ = inode->i_direct[i];
+	}
+	if (i < first + n) {
+		vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+		if (indirect == NULL) {
+			return -EIO;
+		}
+		memcpy(blks, indirect + (i - VSFS_NUM_DIRECT),
+		       (first + n - i) * sizeof(vsfs_blk_t));
+		bdev_put(&fs->bd, inode->i_indirect, false);
+	}
+	return 0;
+}
+
+// HELPER: set block "idx" of the inode (which must exist) to blk
+static int inode_set_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t idx,
+                           vsfs_blk_t blk)
+{
+	assert(idx < inode->i_blocks);
+	if (idx < VSFS_NUM_DIRECT) {
+		inode->i_direct[idx] = blk;
+		return 0;
+	}
+
+	vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+	if (indirect == NULL) {
+		return -EIO;
+	}
+	indirect[idx - VSFS_NUM_DIRECT] = blk;
+	bdev_put(&fs->bd, inode->i_indirect, true);
+	return 0;
+}
+
+// HELPER: prepare block "idx" of the inode to be modified in place, and get
+// its block number. A shared block is replaced with a private copy first;
+// the copy is left zero-filled if the whole block is about to be overwritten.
+static int inode_own_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t idx,
+                           bool overwrite, vsfs_blk_t *blk)
+{
+	vsfs_blk_t old = inode_block(fs, inode, idx);
+	if (old == 0) {
+		return -EIO;
+	}
+	if (block_refs(fs, old) == 0) {
+		// The contents are about to change
+		dedup_remove(&fs->dd, old);
+		*blk = old;
+		return 0;
+	}
+
+	vsfs_blk_t new;
+	int ret = alloc_block(fs, inode, &new);
+	if (ret < 0) {
+		return ret;
+	}
+	if (!overwrite) {
+		char *src = bdev_get(&fs->bd, old);
+		char *dst = (src != NULL) ? bdev_get(&fs->bd, new) : NULL;
+		if (dst == NULL) {
+			if (src != NULL) {
+				bdev_put(&fs->bd, old, false);
+			}
+			free_block(fs, new);
+			return -EIO;
+		}
+		memcpy(dst, src, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, new, true);
+		bdev_put(&fs->bd, old, false);
+	}
+	ret = inode_set_block(fs, inode, idx, new);
+	if (ret < 0) {
+		free_block(fs, new);
+		return ret;
+	}
+	free_block(fs, old);
+	*blk = new;
+	return 0;
+}
+
+// HELPER: make block "idx" of the inode refer to an existing block with the
+// given contents (and fingerprint fp), if there is one. Returns 1 if it does
+// now, 0 if there is no such block (or it already did).
+static int dedup_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t idx,
+                       const void *contents, uint64_t fp)
+{
+	vsfs_blk_t blk = dedup_find(fs, fp, contents);
+	if (blk == 0) {
+		return 0;
+	}
+	vsfs_blk_t old = inode_block(fs, inode, idx);
+	if (old == 0) {
+		return -EIO;
+	}
+	if (old == blk) {
+		return 0;
+	}
+
+	int ret = refcount_init(fs);
+	if (ret < 0) {
+		return ret;
+	}
+	if (!block_refs_add(fs, blk, 1)) {
+		return -EIO;
+	}
+	ret = inode_set_block(fs, inode, idx, blk);
+	if (ret < 0) {
+		block_refs_add(fs, blk, -1);
+		return ret;
+	}
+	free_block(fs, old);
+	return 1;
+}
+
+// HELPER: if cluster c of the inode is compressed, get the blocks that hold
+// it and return their number; return 0 if it isn't compressed
+static int cluster_compressed(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t c,
+                              vsfs_blk_t *blks)
+{
+	vsfs_blk_t first = c * VSFS_CLUSTER_BLOCKS;
+
+	// Only complete clusters are ever compressed
+	if (first + VSFS_CLUSTER_BLOCKS > inode->i_blocks) {
+		return 0;
+	}
+	int ret = inode_get_range(fs, inode, first, VSFS_CLUSTER_BLOCKS, blks);
+	if (ret < 0) {
+		return ret;
+	}
+
+	int n = 0;
+	while (n < VSFS_CLUSTER_BLOCKS && blks[n] != 0) {
+		n++;
+	}
+	return (n < VSFS_CLUSTER_BLOCKS) ? n : 0;
+}
+
+// HELPER: get the decompressed contents of a compressed cluster stored in
+// the given n blocks
+static void *cluster_data(fs_ctx *fs, const vsfs_blk_t *blks, int n)
+{
+	void *raw = zcache_lookup(&fs->zc, blks[0]);
+	if (raw != NULL) {
+		return raw;
+	}
+
+	char buf[(VSFS_CLUSTER_BLOCKS - 1) * VSFS_BLOCK_SIZE];
+	for (int i = 0; i < n; i++) {
+		void *data = bdev_get(&fs->bd, blks[i]);
+		if (data == NULL) {
+			return NULL;
+		}
+		memcpy(buf + i * VSFS_BLOCK_SIZE, data, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, blks[i], false);
+	}
+
+	raw = zcache_insert(&fs->zc, blks[0]);
+	if (!cluster_decompress(buf, n, raw)) {
+		fprintf(stderr, "Compressed cluster at block %u is corrupted\n",
+		        blks[0]);
+		zcache_invalidate(&fs->zc, blks[0]);
+		return NULL;
+	}
+	return raw;
+}
+
+// HELPER: replace the old_n blocks of cluster c with n new blocks that hold
+// the given contents, and make the block pointers [n, VSFS_CLUSTER_BLOCKS)
+// of the cluster 0. The contents are written to the new blocks before the
+// pointers are switched, and the old blocks are freed last.
+static int cluster_replace(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t c,
+                           const vsfs_blk_t *old, int old_n,
+                           const void *contents, int n)
+{
+	vsfs_blk_t first = c * VSFS_CLUSTER_BLOCKS;
+	vsfs_blk_t blks[VSFS_CLUSTER_BLOCKS];
+	int ret = 0;
+	int i;
+
+	if (avail_blocks(fs) < (vsfs_blk_t)n) {
+		return -ENOSPC;
+	}
+	for (i = 0; i < n; i++) {
+		ret = alloc_block(fs, inode, &blks[i]);
+		char *data = (ret == 0) ? bdev_get(&fs->bd, blks[i]) : NULL;
+		if (data == NULL) {
+			if (ret == 0) {
+				free_block(fs, blks[i]);
+				ret = -EIO;
+			}
+			break;
+		}
+		memcpy(data, (const char *)contents + i * VSFS_BLOCK_SIZE,
+		       VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, blks[i], true);
+	}
+	if (ret < 0) {
+		while (i-- > 0) {
+			free_block(fs, blks[i]);
+		}
+		return ret;
+	}
+
+	for (i = 0; i < VSFS_CLUSTER_BLOCKS; i++) {
+		ret = inode_set_block(fs, inode, first + i, (i < n) ? blks[i] : 0);
+		if (ret < 0) {
+			// Only the indirect block can fail, before anything changed
+			// in it; the direct pointers are restored
+			for (int j = 0; j < i; j++) {
+				inode_set_block(fs, inode, first + j, old[j]);
+			}
+			for (int j = 0; j < n; j++) {
+				free_block(fs, blks[j]);
+			}
+			return ret;
+		}
+	}
+	for (i = 0; i < old_n; i++) {
+		free_block(fs, old[i]);
+	}
+	return 0;
+}
+
+// HELPER: if cluster c of the inode is compressed, store it uncompressed, so
+// that its blocks can be modified in place
+static int expand_cluster(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t c)
+{
+	vsfs_blk_t old[VSFS_CLUSTER_BLOCKS];
+	int n = cluster_compressed(fs, inode, c, old);
+	if (n <= 0) {
+		return n;
+	}
+
+	char raw[VSFS_CLUSTER_SIZE];
+	void *data = cluster_data(fs, old, n);
+	if (data == NULL) {
+		return -EIO;
+	}
+	// The cache entry goes away when the old blocks are freed
+	memcpy(raw, data, VSFS_CLUSTER_SIZE);
+	return cluster_replace(fs, inode, c, old, n, raw, VSFS_CLUSTER_BLOCKS);
+}
+
+// HELPER: store cluster c of the inode compressed if it is complete and
+// compression saves at least one block
+static int compress_cluster(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t c)
+{
+	vsfs_blk_t first = c * VSFS_CLUSTER_BLOCKS;
+	vsfs_blk_t old[VSFS_CLUSTER_BLOCKS];
+	char raw[VSFS_CLUSTER_SIZE];
+	char buf[(VSFS_CLUSTER_BLOCKS - 1) * VSFS_BLOCK_SIZE];
+	int ret;
+
+	if (first + VSFS_CLUSTER_BLOCKS > inode->i_blocks) {
+		return 0;
+	}
+	ret = inode_get_range(fs, inode, first, VSFS_CLUSTER_BLOCKS, old);
+	if (ret < 0) {
+		return ret;
+	}
+	if (old[VSFS_CLUSTER_BLOCKS - 1] == 0) {
+		// Already compressed
+		return 0;
+	}
+	for (int i = 0; i < VSFS_CLUSTER_BLOCKS; i++) {
+		if (block_refs(fs, old[i]) > 0) {
+			// Shared blocks save more space as they are
+			return 0;
+		}
+	}
+	for (int i = 0; i < VSFS_CLUSTER_BLOCKS; i++) {
+		void *data = bdev_get(&fs->bd, old[i]);
+		if (data == NULL) {
+			return -EIO;
+		}
+		memcpy(raw + i * VSFS_BLOCK_SIZE, data, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, old[i], false);
+	}
+
+	vsfs_blk_t n = cluster_compress(raw, buf);
+	if (n == 0) {
+		return 0;
+	}
+	ret = cluster_replace(fs, inode, c, old, VSFS_CLUSTER_BLOCKS, buf, n);
+	if (ret < 0) {
+		return ret;
+	}
+	fs->sb->features |= VSFS_FEATURE_COMPRESS;
+
+	// Likely to be read back soon (e.g. a log that is being tailed)
+	vsfs_blk_t blk;
+	if (inode_get_range(fs, inode, first, 1, &blk) == 0) {
+		memcpy(zcache_insert(&fs->zc, blk), raw, VSFS_CLUSTER_SIZE);
+	}
+	return 0;
+}
+
+// HELPER: zero the rest of the block that contains byte "offset" of the file
+static int zero_tail(fs_ctx *fs, vsfs_inode *inode, uint64_t offset)
+{
+	vsfs_blk_t idx = offset / VSFS_BLOCK_SIZE;
+	size_t pos = offset % VSFS_BLOCK_SIZE;
+
+	if (pos == 0 || idx >= inode->i_blocks) {
+		return 0;
+	}
+	int ret = expand_cluster(fs, inode, idx / VSFS_CLUSTER_BLOCKS);
+	if (ret < 0) {
+		return ret;
+	}
+	vsfs_blk_t blk;
+	ret = inode_own_block(fs, inode, idx, false, &blk);
+	if (ret < 0) {
+		return ret;
+	}
+	char *data = bdev_get(&fs->bd, blk);
+	if (data == NULL) {
+		return -EIO;
+	}
+	memset(data + pos, 0, VSFS_BLOCK_SIZE - pos);
+	bdev_put(&fs->bd, blk, true);
+	return 0;
+}
+
+
+/* Returns the inode number for the element at the end of the path
+ * if it exists, and sets *ino to point to the inode. If pos is not NULL,
+ * it receives the location of the directory entry (not for the root).
+ * If there is any error, return -errno.
+ * Possible errors include:
+ *   - The path is not an absolute path
+ *   - The path component is too long
+ *   - An element on the path cannot be found
+ *   - The directory can't be read
+ */
+static int path_lookup(const char *path, vsfs_inode **ino, dentry_pos *pos) {
+	if(path[0] != '/') {
+		fprintf(stderr, "Not an absolute path\n");
+		return -ENOSYS;
+	} 
+
+	fs_ctx *fs = get_fs();
+	if (strcmp(path, "/") == 0) {
+		*ino = &fs->itable[VSFS_ROOT_INO];
+		return VSFS_ROOT_INO;
+	}
+	if (strlen(path + 1) >= VSFS_NAME_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	// The statistics file can only be read (see vsfs_getattr/vsfs_read)
+	if (fs->stats.enabled && strcmp(path, VSFS_STATS_PATH) == 0) {
+		return -EACCES;
+	}
+	// root directory i node
+	vsfs_inode *root = &fs->itable[VSFS_ROOT_INO];
+
+	// only the entries whose name has the same hash are compared (see
+	// mcache.h)
+	size_t iter = 0;
+	uint64_t hash = mcache_name_hash(path + 1);
+	uint32_t p;
+	while ((p = mcache_lookup(&fs->mc, hash, &iter)) != MCACHE_NONE) {
+		vsfs_blk_t i = p / DENTRIES_PER_BLOCK;
+		uint32_t j = p % DENTRIES_PER_BLOCK;
+		vsfs_blk_t blk = inode_block(fs, root, i);
+		vsfs_dentry *dentry = (blk != 0) ? bdev_get(&fs->bd, blk) : NULL;
+		if (dentry == NULL) {
+			return -EIO;
+		}
+
+		fs->stats.dentries_scanned++;
+		if (strcmp(dentry[j].name, path + 1) == 0) {
+			vsfs_ino_t res = dentry[j].ino;
+			bdev_put(&fs->bd, blk, false);
+			*ino = &fs->itable[res];
+			if (pos != NULL) {
+				pos->blk = blk;
+				pos->slot = j;
+				pos->idx = i;
+			}
+			return res;
+		}
+		bdev_put(&fs->bd, blk, false);
+	}
+	return -ENOENT;
+}
+
+/**
+ * Get file system statistics.
+ *
+ * Implements the statvfs() system call. See "man 2 statvfs" for details.
+ * The f_bfree and f_bavail fields should be set to the same value.
+ * The f_ffree and f_favail fields should be set to the same value.
+ * The following fields can be ignored: f_fsid, f_flag.
+ * All remaining fields are required.
+ *
+ * Errors: none
+ *
+ * @param path  path to any file in the file system. Can be ignored.
+ * @param st    pointer to the struct statvfs that receives the result.
+ * @return      0 on success; -errno on error.
+ */
+static int vsfs_statfs(const char *path, struct statvfs *st)
+{
+	(void)path;// unused
+	fs_ctx *fs = get_fs();
+	vsfs_superblock *sb = fs->sb; /* Get ptr to superblock from context */
+	
+	memset(st, 0, sizeof(*st));
+	st->f_bsize   = VSFS_BLOCK_SIZE;   /* Filesystem block size */
+	st->f_frsize  = VSFS_BLOCK_SIZE;   /* Fragment size */
+	// The rest of required fields are filled based on the information 
+	// stored in the superblock.
+	st->f_blocks = sb->num_blocks;     /* Size of fs in f_frsize units */
+	st->f_bfree  = avail_blocks(fs);   /* Number of free blocks */
+	st->f_bavail = avail_blocks(fs);   /* Free blocks for unpriv users */
+	st->f_files  = sb->num_inodes;     /* Number of inodes */
+	st->f_ffree  = sb->free_inodes;    /* Number of free inodes */
+	st->f_favail = sb->free_inodes;    /* Free inodes for unpriv users */
+
+	st->f_namemax = VSFS_NAME_MAX;     /* Maximum filename length */
+
+	return 0;
+}
+
+// Fill in the attributes of the given inode for getattr() and readdir();
+// buffered writes count as if they were already done
+static void fill_stat(fs_ctx *fs, vsfs_ino_t ino, struct stat *st)
+{
+	vsfs_inode *inode = &fs->itable[ino];
+	delalloc_buf *b = delalloc_find(&fs->da, ino);
+	vsfs_blk_t blocks = (b != NULL) ? b->first + b->nblocks : inode->i_blocks;
+
+	st->st_ino = ino;
+	st->st_mode = inode->i_mode;
+	st->st_nlink = inode->i_nlink;
+	st->st_size = (b != NULL) ? b->size : inode->i_size;
+	st->st_blocks = blocks * VSFS_BLOCK_SIZE / 512;
+	st->st_mtim = inode->i_mtime;
+
+	if (blocks > VSFS_NUM_DIRECT){
+		st->st_blocks += (VSFS_BLOCK_SIZE / 512);
+	}
+}
+
+/**
+ * Get file or directory attributes.
+ *
+ * Implements the lstat() system call. See "man 2 lstat" for details.
+ * The following fields can be ignored: st_dev, st_ino, st_uid, st_gid, st_rdev,
+ *                                      st_blksize, st_atim, st_ctim.
+ * All remaining fields are required.
+ *
+ * NOTE: the st_blocks field is measured in 512-byte units (disk sectors);
+ *       it should include any metadata blocks that are allocated to the 
+ *       inode (for vsfs, that is the indirect block). 
+ *
+ * NOTE2: the st_mode field must be set correctly for files and directories.
+ *
+ * Errors:
+ *   ENAMETOOLONG  the path or one of its components is too long.
+ *   ENOENT        a component of the path does not exist.
+ *   ENOTDIR       a component of the path prefix is not a directory.
+ *
+ * @param path  path to a file or directory.
+ * @param st    pointer to the struct stat that receives the result.
+ * @return      0 on success; -errno on error;
+ */
+static int vsfs_getattr(const char *path, struct stat *st)
+{
+	if (strlen(path) >= VSFS_PATH_MAX) return -ENAMETOOLONG;
+
+	memset(st, 0, sizeof(*st));
+
+	// The statistics file is as large as the statistics are now
+	fs_ctx *fs = get_fs();
+	if (fs->stats.enabled && strcmp(path, VSFS_STATS_PATH) == 0) {
+		char text[STATS_TEXT_MAX];
+		st->st_mode = S_IFREG | 0444;
+		st->st_nlink = 1;
+		st->st_size = stats_format(&fs->stats, text, sizeof(text));
+		clock_gettime(CLOCK_REALTIME, &st->st_mtim);
+		return 0;
+	}
+
+	vsfs_inode * res_inode;
+	// find such inode and return the inode number
+	int res_inode_num = path_lookup(path, &res_inode, NULL);
+	if (res_inode_num < 0){
+		return res_inode_num;
+	}
+
+	fill_stat(fs, res_inode_num, st);
+	return 0;
+}
+
+/**
+ * Read a directory.
+ *
+ * Implements the readdir() system call. Calls filler(buf, name, st, off) for
+ * each directory entry starting at the given offset, and stops when filler()
+ * reports that the buffer is full. See fuse.h in libfuse source code for
+ * details.
+ *
+ * If the readdirplus mount option is given, st points to the full attributes
+ * of the entry; otherwise it is NULL.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   EIO     the directory can't be read.
+ *
+ * @param path    path to the directory.
+ * @param buf     buffer that receives the result.
+ * @param filler  function that needs to be called for each directory entry.
+ * @param offset  cursor returned with the last entry of the previous call,
+ *                or 0 to start from the beginning.
+ * @param fi      unused.
+ * @return        0 on success; -errno on error.
+ */
+static int vsfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                        off_t offset, struct fuse_file_info *fi)
+{
+	(void)path;// only the root directory is supported
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	vsfs_inode *root = &fs->itable[VSFS_ROOT_INO];
+	struct stat st;
+
+	for (vsfs_blk_t i = offset / DENTRIES_PER_BLOCK; i < root->i_blocks; i++) {
+		// Blocks whose entries are all unused are not read
+		if (fs->mc.used[i] == 0) {
+			continue;
+		}
+		vsfs_blk_t blk = inode_block(fs, root, i);
+		vsfs_dentry *dentry = (blk != 0) ? bdev_get(&fs->bd, blk) : NULL;
+		if (dentry == NULL) {
+			return -EIO;
+		}
+
+		uint32_t first = (i == offset / DENTRIES_PER_BLOCK)
+		                 ? offset % DENTRIES_PER_BLOCK : 0;
+		for (uint32_t j = first; j < DENTRIES_PER_BLOCK; j++) {
+			if (dentry[j].ino == VSFS_INO_MAX) {
+				continue;
+			}
+
+			struct stat *stp = NULL;
+			if (fs->opts->readdirplus) {
+				memset(&st, 0, sizeof(st));
+				fill_stat(fs, dentry[j].ino, &st);
+				stp = &st;
+			}
+			off_t next = (off_t)i * DENTRIES_PER_BLOCK + j + 1;
+			if (filler(buf, dentry[j].name, stp, next) != 0) {
+				// Buffer is full; the kernel will call us again with
+				// the offset of the last entry it accepted
+				bdev_put(&fs->bd, blk, false);
+				return 0;
+			}
+		}
+		bdev_put(&fs->bd, blk, false);
+	}
+	return 0;
+}
+
+
+/**
+ * Create a directory.
+ *
+ * Implements the mkdir() system call.
+ *
+ * You do NOT need to implement this function. 
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the directory to create.
+ * @param mode  file mode bits.
+ * @return      0 on success; -errno on error.
+ */
+static int vsfs_mkdir(const char *path, mode_t mode)
+{
+	mode = mode | S_IFDIR;
+	fs_ctx *fs = get_fs();
+
+	//OMIT: create a directory at given path with given mode
+	(void)path;
+	(void)mode;
+	(void)fs;
+	return -ENOSYS;
+}
+
+/**
+ * Remove a directory.
+ *
+ * Implements the rmdir() system call.
+ *
+ * You do NOT need to implement this function. 
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOTEMPTY  the directory is not empty.
+ *
+ * @param path  path to the directory to remove.
+ * @return      0 on success; -errno on error.
+ */
+static int vsfs_rmdir(const char *path)
+{
+	fs_ctx *fs = get_fs();
+
+	//OMIT: remove the directory at given path (only if it's empty)
+	(void)path;
+	(void)fs;
+	return -ENOSYS;
+}
+
+// HELPER: zero the inode table block that holds inode ino, if mkfs left it
+// uninitialized (see vsfs_itbl_uninit())
+static void itable_init_block(fs_ctx *fs, vsfs_ino_t ino)
+{
+	uint32_t i = ino / VSFS_INODES_PER_BLOCK;
+	if (vsfs_itbl_uninit(fs->sb, i)) {
+		memset(&fs->itable[i * VSFS_INODES_PER_BLOCK], 0, VSFS_BLOCK_SIZE);
+		vsfs_itbl_set_init(fs->sb, i);
+	}
+}
+
+// HELPER: find an unused entry in the directory, adding a block to it if all
+// entries are in use
+static int dir_find_free(fs_ctx *fs, vsfs_inode *dir, dentry_pos *pos)
+{
+	// the cache knows which existing data block has an empty dentry
+	vsfs_blk_t i = mcache_free_block(&fs->mc);
+	if (i < dir->i_blocks) {
+		vsfs_blk_t blk = inode_block(fs, dir, i);
+		vsfs_dentry *dentry = (blk != 0) ? bdev_get(&fs->bd, blk) : NULL;
+		if (dentry == NULL) {
+			return -EIO;
+		}
+
+		for (uint32_t j = 0; j < DENTRIES_PER_BLOCK; j++){
+			if (dentry[j].ino == VSFS_INO_MAX){
+				bdev_put(&fs->bd, blk, false);
+				pos->blk = blk;
+				pos->slot = j;
+				pos->idx = i;
+				return 0;
+			}
+		}
+		bdev_put(&fs->bd, blk, false);
+		assert(false);// the cache is out of date
+		return -EIO;
+	}
+
+	// allocate new datablock if all existing data block full
+	vsfs_blk_t blk;
+	int ret = inode_append_block(fs, dir, &blk);
+	if (ret < 0) {
+		// all dentry full
+		return (ret == -EFBIG) ? -ENOSPC : ret;
+	}
+	vsfs_dentry *dentry = bdev_get(&fs->bd, blk);
+	if (dentry == NULL) {
+		return -EIO;
+	}
+	for (uint32_t j = 0; j < DENTRIES_PER_BLOCK; j++){
+		dentry[j].ino = VSFS_INO_MAX;
+	}
+	bdev_put(&fs->bd, blk, true);
+	dir->i_size += VSFS_BLOCK_SIZE;
+	mcache_add_block(&fs->mc);
+
+	pos->blk = blk;
+	pos->slot = 0;
+	pos->idx = dir->i_blocks - 1;
+	return 0;
+}
+
+/**
+ * Create a file.
+ *
+ * Implements the open()/creat() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" doesn't exist.
+ *   The parent directory of "path" exists and is a directory.
+ *   "path" and its components are not too long.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *
+ * @param path  path to the file to create.
+ * @param mode  file mode bits.
+ * @param fi    unused.
+ * @return      0 on success; -errno on error.
+ */
+static int vsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	assert(S_ISREG(mode));
+	fs_ctx *fs = get_fs();
+	vsfs_inode *root = &fs->itable[VSFS_ROOT_INO];
+	dentry_pos pos;
+	uint32_t ino_index;
+
+	if (fs->sb->free_inodes == 0){
+		// no more inodes == free_inodes = 0
+		return -ENOSPC;
+	}
+
+	// find empty dentry (before taking the inode, so there is nothing to
+	// undo if the directory is full)
+	int ret = dir_find_free(fs, root, &pos);
+	if (ret < 0) {
+		return ret;
+	}
+	vsfs_dentry *dentry = bdev_get(&fs->bd, pos.blk);
+	if (dentry == NULL) {
+		return -EIO;
+	}
+
+	// find first unused inode and update sb
+	if (bitmap_alloc(fs->ibmap, fs->sb->num_inodes, &ino_index) != 0) {
+		bdev_put(&fs->bd, pos.blk, false);
+		return -ENOSPC;
+	}
+	fs->stats.bitmap_words += ino_index / (sizeof(bitmap_t) * CHAR_BIT) + 1;
+	fs->sb->free_inodes --;
+	itable_init_block(fs, ino_index);
+	heat_reset(&fs->ht, ino_index);
+
+	dentry[pos.slot].ino = ino_index;
+	strncpy(dentry[pos.slot].name, path + 1, VSFS_NAME_MAX);
+	bdev_put(&fs->bd, pos.blk, true);
+	mcache_insert(&fs->mc, mcache_name_hash(path + 1),
+	              pos.idx * DENTRIES_PER_BLOCK + pos.slot);
+	
+	// find location of new inode and initialize
+	vsfs_inode * new = &fs->itable[ino_index];
+	memset(new, 0, sizeof(vsfs_inode));
+	new->i_mode = mode;
+	new->i_nlink = 1;
+	new->i_blocks = 0;
+	new->i_size = 0;
+	clock_gettime(CLOCK_REALTIME, &(new->i_mtime));
+	clock_gettime(CLOCK_REALTIME, &(root->i_mtime));
+	notify_inval_entry(&fs->notify, path + 1);
+	return 0;
+}
+
+/**
+ * Remove a file.
+ *
+ * Implements the unlink() system call.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors: none
+ *
+ * @param path  path to the file to remove.
+ * @return      0 on success; -errno on error.
  */
-static int vsfs_mkdir(const char *path, mode_t mode)
+static int vsfs_unlink(const char *path)
 {
-	mode = mode | S_IFDIR;
 	fs_ctx *fs = get_fs();
 
-	//OMIT: create a directory at given path with given mode
-	(void)path;
-	(void)mode;
-	(void)fs;
-	return -ENOSYS;
+	// IMPORTANT: WE ALSO WANT TO KNOW THE DENTRY OF TEH PATH INODE
+	vsfs_inode * res_inode;
+	dentry_pos pos;
+	int res_inode_num = path_lookup(path, &res_inode, &pos);
+	if (res_inode_num < 0) {
+		return res_inode_num;
+	}
+
+	// clear dentry of root
+	vsfs_dentry *dentry = bdev_get(&fs->bd, pos.blk);
+	if (dentry == NULL) {
+		return -EIO;
+	}
+	dentry[pos.slot].ino = VSFS_INO_MAX;
+	memset(dentry[pos.slot].name, 0, VSFS_NAME_MAX);
+	bdev_put(&fs->bd, pos.blk, true);
+	mcache_remove(&fs->mc, mcache_name_hash(path + 1),
+	              pos.idx * DENTRIES_PER_BLOCK + pos.slot);
+
+	// buffered writes are dropped; free all data blocks (and the indirect
+	// block)
+	delalloc_buf *b = delalloc_find(&fs->da, res_inode_num);
+	if (b != NULL) {
+		delalloc_drop(&fs->da, b);
+	}
+	prealloc_release(&fs->pa, res_inode_num);
+	while (res_inode->i_blocks > 0) {
+		inode_pop_block(fs, res_inode);
+	}
+	discard_flush(fs);
+
+	// clear inode
+	bitmap_free(fs->ibmap, fs->sb->num_inodes, res_inode_num);
+	fs->sb->free_inodes ++;
+	memset(res_inode, 0, sizeof(vsfs_inode));
+
+	vsfs_inode * root = &fs->itable[VSFS_ROOT_INO];
+	clock_gettime(CLOCK_REALTIME, &(root->i_mtime));
+
+	notify_inval_entry(&fs->notify, path + 1);
+	return 0;
+}
+
+
+/**
+ * Change the modification time of a file or directory.
+ *
+ * Implements the utimensat() system call. See "man 2 utimensat" for details.
+ *
+ * NOTE: You only need to implement the setting of modification time (mtime).
+ *       Timestamp modifications are not recursive. 
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists.
+ *
+ * Errors: none
+ *
+ * @param path   path to the file or directory.
+ * @param times  timestamps array. See "man 2 utimensat" for details.
+ * @return       0 on success; -errno on failure.
+ */
+static int vsfs_utimens(const char *path, const struct timespec times[2])
+{
+	vsfs_inode *ino = NULL;
+	
+	// 0. Check if there is actually anything to be done.
+	if (times[1].tv_nsec == UTIME_OMIT) {
+		// Nothing to do.
+		return 0;
+	}
+
+	// 1. Find the inode for the final component in path
+	int ret = path_lookup(path, &ino, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+	
+	// 2. Update the mtime for that inode.
+	if (times[1].tv_nsec == UTIME_NOW) {
+		if (clock_gettime(CLOCK_REALTIME, &(ino->i_mtime)) != 0) {
+			// clock_gettime should not fail, unless you give it a
+			// bad pointer to a timespec.
+			assert(false);
+		}
+	} else {
+		ino->i_mtime = times[1];
+	}
+
+	return 0;
+}
+
+// HELPER: get the number of blocks needed to extend an inode from old_count
+// to new_count blocks, including the indirect block if it becomes needed
+static vsfs_blk_t extend_cost(vsfs_blk_t old_count, vsfs_blk_t new_count)
+{
+	vsfs_blk_t needed = new_count - old_count;
+	if (old_count <= VSFS_NUM_DIRECT && new_count > VSFS_NUM_DIRECT) {
+		needed++;
+	}
+	return needed;
+}
+
+// Set the size of the file. Shared by truncate() and by writes that extend
+// the file; the kernel already knows about the latter.
+static int resize_inode(fs_ctx *fs, vsfs_inode *inode, off_t size)
+{
+	if ((uint64_t)size > VSFS_MAX_FILE_SIZE){
+		return -EFBIG;
+	}
+	if (size == (off_t) inode->i_size){
+		return 0;
+	}
+
+	vsfs_blk_t old_block_count = inode->i_blocks;
+	vsfs_blk_t new_block_count = div_round_up(size, VSFS_BLOCK_SIZE);
+	vsfs_blk_t needed = 0;
+	int ret;
+
+	if (new_block_count > old_block_count) {
+		// need more new blocks (and maybe the indirect block); check that
+		// there is enough space up front so we never undo half an extension
+		needed = extend_cost(old_block_count, new_block_count);
+		if (needed > avail_blocks(fs)) {
+			return -ENOSPC;
+		}
+	}
+
+	// Bytes past the end of file in its last block must read as zeros
+	ret = zero_tail(fs, inode, (size < (off_t)inode->i_size) ? (uint64_t)size
+	                                                          : inode->i_size);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// A compressed cluster that loses some of its blocks is expanded first
+	if (new_block_count < old_block_count &&
+	    new_block_count % VSFS_CLUSTER_BLOCKS != 0) {
+		ret = expand_cluster(fs, inode,
+		                     new_block_count / VSFS_CLUSTER_BLOCKS);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	// shrink
+	while (inode->i_blocks > new_block_count) {
+		inode_pop_block(fs, inode);
+	}
+	discard_flush(fs);
+	// extend; new blocks are zero-filled, and taken from one free run if
+	// there is one large enough
+	vsfs_blk_t goal;
+	if (needed > 1 && find_free_run(fs, needed, &goal) == 0) {
+		fs->alloc_goal = goal;
+	}
+	while (inode->i_blocks < new_block_count) {
+		vsfs_blk_t blk;
+		ret = inode_append_block(fs, inode, &blk);
+		if (ret < 0) {
+			fs->alloc_goal = 0;
+			while (inode->i_blocks > old_block_count) {
+				inode_pop_block(fs, inode);
+			}
+			discard_flush(fs);
+			return ret;
+		}
+	}
+	fs->alloc_goal = 0;
+
+	inode->i_size = size;
+	clock_gettime(CLOCK_REALTIME, &(inode->i_mtime));
+	return 0;
+}
+
+// HELPER: write data to an existing byte range of a file, within one block
+static int write_block(fs_ctx *fs, vsfs_inode *inode, const char *buf,
+                       size_t size, off_t offset)
+{
+	vsfs_blk_t block_idx = offset / VSFS_BLOCK_SIZE;
+	size_t block_pos = offset % VSFS_BLOCK_SIZE;
+	assert(block_pos + size <= VSFS_BLOCK_SIZE);
+
+	// compressed clusters are modified in place only after expanding them
+	int ret = expand_cluster(fs, inode, block_idx / VSFS_CLUSTER_BLOCKS);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// A whole block with the same contents as an existing one is shared
+	// instead of written. Sharing is only an optimization, so errors fall
+	// back to a regular write.
+	bool dedup = fs->dedup && size == VSFS_BLOCK_SIZE;
+	uint64_t fp = dedup ? block_fingerprint(buf) : 0;
+	if (dedup && dedup_block(fs, inode, block_idx, buf, fp) > 0) {
+		return 0;
+	}
+
+	// find actual data block number (a private copy if it is shared)
+	vsfs_blk_t block_num;
+	ret = inode_own_block(fs, inode, block_idx, size == VSFS_BLOCK_SIZE,
+	                      &block_num);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// write; no need to read a block that is completely overwritten
+	char *data = (size == VSFS_BLOCK_SIZE) ? bdev_get_zeroed(&fs->bd, block_num)
+	                                       : bdev_get(&fs->bd, block_num);
+	if (data == NULL) {
+		return -EIO;
+	}
+	memcpy(data + block_pos, buf, size);
+	bdev_put(&fs->bd, block_num, true);
+	if (dedup) {
+		dedup_insert(&fs->dd, fp, block_num);
+	}
+
+	// A sequential writer has just completed a cluster. Compression is only
+	// an optimization, so the write succeeds even if it fails.
+	if (fs->compress && (offset + size) % VSFS_CLUSTER_SIZE == 0) {
+		compress_cluster(fs, inode, block_idx / VSFS_CLUSTER_BLOCKS);
+	}
+	return 0;
+}
+
+// HELPER: allocate the blocks for the buffered writes of a file (see
+// delalloc.h) in one batch, write them, and release the buffer. The
+// reserved blocks guarantee that the allocation succeeds.
+static int delalloc_flush(fs_ctx *fs, delalloc_buf *b)
+{
+	vsfs_inode *inode = &fs->itable[b->ino];
+	struct timespec mtime = inode->i_mtime;
+
+	delalloc_reserve(&fs->da, b, 0);
+	int ret = resize_inode(fs, inode, b->size);
+	for (vsfs_blk_t i = 0; ret == 0 && i < b->nblocks; i++) {
+		off_t offset = (off_t)(b->first + i) * VSFS_BLOCK_SIZE;
+		size_t size = VSFS_BLOCK_SIZE;
+		if (offset + size > b->size) {
+			size = b->size - offset;
+		}
+		ret = write_block(fs, inode, b->data + (size_t)i * VSFS_BLOCK_SIZE,
+		                  size, offset);
+	}
+	// The file was last modified by the buffered writes, not now
+	inode->i_mtime = mtime;
+	delalloc_drop(&fs->da, b);
+	return ret;
+}
+
+// HELPER: flush the buffered writes of a file, if it has any
+static int delalloc_flush_inode(fs_ctx *fs, vsfs_inode *inode)
+{
+	delalloc_buf *b = delalloc_find(&fs->da, inode - fs->itable);
+	return (b != NULL) ? delalloc_flush(fs, b) : 0;
+}
+
+// HELPER: flush the buffered writes of all files
+static int delalloc_flush_all(fs_ctx *fs)
+{
+	int ret = 0;
+	for (int i = 0; i < DELALLOC_FILES; i++) {
+		delalloc_buf *b = &fs->da.bufs[i];
+		if (b->ino != VSFS_INO_MAX) {
+			int r = delalloc_flush(fs, b);
+			if (ret == 0) {
+				ret = r;
+			}
+		}
+	}
+	return ret;
+}
+
+// HELPER: buffer a write that is past the allocated blocks of the file.
+// Returns 1 if it was buffered; 0 if it must be written directly (after
+// flushing the buffer), e.g. because it would leave too large a hole.
+static int delalloc_write(fs_ctx *fs, vsfs_inode *inode, const char *buf,
+                          size_t size, off_t offset)
+{
+	vsfs_ino_t ino = inode - fs->itable;
+	vsfs_blk_t idx = offset / VSFS_BLOCK_SIZE;
+	int ret;
+
+	if (!S_ISREG(inode->i_mode) || idx < inode->i_blocks ||
+	    offset + size > VSFS_MAX_FILE_SIZE) {
+		return 0;
+	}
+
+	// A full buffer is flushed, and the file continues in a new one
+	delalloc_buf *b = delalloc_find(&fs->da, ino);
+	if (b != NULL && idx >= b->first + DELALLOC_BLOCKS) {
+		ret = delalloc_flush(fs, b);
+		if (ret < 0) {
+			return ret;
+		}
+		b = NULL;
+	}
+	if (b == NULL) {
+		if (idx >= inode->i_blocks + DELALLOC_BLOCKS) {
+			return 0;
+		}
+		b = delalloc_victim(&fs->da);
+		if (b->ino != VSFS_INO_MAX) {
+			ret = delalloc_flush(fs, b);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+		if (!delalloc_start(&fs->da, b, ino, inode->i_blocks, inode->i_size)) {
+			return 0;
+		}
+	}
+
+	// Set aside the blocks that the flush will need
+	vsfs_blk_t nblocks = b->nblocks;
+	if (idx - b->first >= nblocks) {
+		nblocks = idx - b->first + 1;
+	}
+	vsfs_blk_t needed = extend_cost(b->first, b->first + nblocks);
+	if (needed > b->reserved) {
+		if (needed - b->reserved > avail_blocks(fs)) {
+			return 0;
+		}
+		delalloc_reserve(&fs->da, b, needed);
+	}
+	if (nblocks > b->nblocks) {
+		memset(b->data + (size_t)b->nblocks * VSFS_BLOCK_SIZE, 0,
+		       (size_t)(nblocks - b->nblocks) * VSFS_BLOCK_SIZE);
+		b->nblocks = nblocks;
+	}
+
+	memcpy(b->data + (size_t)(idx - b->first) * VSFS_BLOCK_SIZE
+	       + offset % VSFS_BLOCK_SIZE, buf, size);
+	if (offset + size > b->size) {
+		b->size = offset + size;
+	}
+	clock_gettime(CLOCK_REALTIME, &(inode->i_mtime));
+	return 1;
+}
+
+/**
+ * Change the size of a file.
+ *
+ * Implements the truncate() system call. Supports both extending and shrinking.
+ * If the file is extended, the new uninitialized range at the end must be
+ * filled with zeros.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *   EFBIG   write would exceed the maximum file size. 
+ *
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
+ * @return      0 on success; -errno on error.
+ */
+static int vsfs_truncate(const char *path, off_t size)
+{
+	fs_ctx *fs = get_fs();
+	vsfs_inode *file_inode;
+
+	int ret = path_lookup(path, &file_inode, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = delalloc_flush_inode(fs, file_inode);
+	if (ret < 0) {
+		return ret;
+	}
+	// The file is no longer growing sequentially
+	prealloc_release(&fs->pa, file_inode - fs->itable);
+	ret = resize_inode(fs, file_inode, size);
+	if (ret == 0) {
+		notify_inval_entry(&fs->notify, path + 1);
+	}
+	return ret;
+}
+
+/**
+ * Open a file.
+ *
+ * Implements the open() system call. Files have no per-open state, so there
+ * is nothing to do, except that the statistics file is opened for direct
+ * I/O: its contents change all the time, and with cache_timeout the kernel
+ * would otherwise keep serving the pages (and the size) it read first.
+ *
+ * Errors: none
+ *
+ * @param path  path to the file.
+ * @param fi    file information; direct_io is set for the statistics file.
+ * @return      0 on success.
+ */
+static int vsfs_open(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+	if (fs->stats.enabled && strcmp(path, VSFS_STATS_PATH) == 0) {
+		fi->direct_io = 1;
+	}
+	return 0;
+}
+
+/**
+ * Read data from a file.
+ *
+ * Implements the pread() system call. Must return exactly the number of bytes
+ * requested except on EOF (end of file). Reads from file ranges that have not
+ * been written to must return ranges filled with zeros. You can assume that the
+ * byte range from offset to offset + size is contained within a single block.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors: none
+ *
+ * @param path    path to the file to read from.
+ * @param buf     pointer to the buffer that receives the data.
+ * @param size    buffer size (number of bytes requested).
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      unused.
+ * @return        number of bytes read on success; 0 if offset is beyond EOF;
+ *                -errno on error.
+ */
+static int vsfs_read(const char *path, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
+
+	// The statistics file is formatted anew for each read
+	if (fs->stats.enabled && strcmp(path, VSFS_STATS_PATH) == 0) {
+		char text[STATS_TEXT_MAX];
+		size_t len = stats_format(&fs->stats, text, sizeof(text));
+		if ((size_t)offset >= len) {
+			return 0;
+		}
+		size = (size < len - offset) ? size : len - offset;
+		memcpy(buf, text + offset, size);
+		return size;
+	}
+
+	vsfs_inode * file_inode;
+	int ret = path_lookup(path, &file_inode, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+	heat_access(&fs->ht, ret);
+
+	// the file may be longer with its buffered writes
+	delalloc_buf *b = delalloc_find(&fs->da, ret);
+	uint64_t file_size = (b != NULL) ? b->size : file_inode->i_size;
+
+	// start of read later than end of file --> 0 bytes read
+	if (offset >= (off_t) file_size){
+		return 0;
+	}
+
+	vsfs_blk_t block_idx = offset / VSFS_BLOCK_SIZE;
+	size_t block_pos = offset % VSFS_BLOCK_SIZE;
+
+	// read less than size if reach EOF (or the end of the block)
+	size_t read_length = size;
+	if (read_length > file_size - offset) {
+		read_length = file_size - offset;
+	}
+	if (read_length > VSFS_BLOCK_SIZE - block_pos) {
+		read_length = VSFS_BLOCK_SIZE - block_pos;
+	}
+
+	// blocks that are not allocated yet are read from the buffer
+	if (b != NULL && block_idx >= b->first) {
+		memcpy(buf, b->data + (size_t)(block_idx - b->first) * VSFS_BLOCK_SIZE
+		            + block_pos, read_length);
+		return read_length;
+	}
+
+	// Sequential reads start the next window of blocks early
+	if (block_pos == 0 && block_idx % VSFS_READAHEAD == 0) {
+		vsfs_blk_t ra[VSFS_READAHEAD];
+		int n = 0;
+		for (vsfs_blk_t i = block_idx + 1;
+		     i < file_inode->i_blocks && n < VSFS_READAHEAD; i++) {
+			vsfs_blk_t blk = inode_block(fs, file_inode, i);
+			if (blk != 0) {
+				ra[n++] = blk;
+			}
+		}
+		bdev_readahead(&fs->bd, ra, n);
+	}
+
+	// compressed clusters are read through the decompressed cluster cache
+	vsfs_blk_t zblks[VSFS_CLUSTER_BLOCKS];
+	ret = cluster_compressed(fs, file_inode, block_idx / VSFS_CLUSTER_BLOCKS,
+	                         zblks);
+	if (ret < 0) {
+		return ret;
+	}
+	if (ret > 0) {
+		char *raw = cluster_data(fs, zblks, ret);
+		if (raw == NULL) {
+			return -EIO;
+		}
+		memcpy(buf, raw + (block_idx % VSFS_CLUSTER_BLOCKS) * VSFS_BLOCK_SIZE
+		            + block_pos, read_length);
+		return read_length;
+	}
+
+	// find actual data block number
+	vsfs_blk_t block_num = inode_block(fs, file_inode, block_idx);
+	if (block_num == 0) {
+		return -EIO;
+	}
+
+	// read
+	char *data = bdev_get(&fs->bd, block_num);
+	if (data == NULL) {
+		return -EIO;
+	}
+	memcpy(buf, data + block_pos, read_length);
+	bdev_put(&fs->bd, block_num, false);
+	return read_length;
 }
 
 /**
- * Remove a directory.
- *
- * Implements the rmdir() system call.
+ * Write data to a file.
  *
- * You do NOT need to implement this function. 
+ * Implements the pwrite() system call. Must return exactly the number of bytes
+ * requested except on error. If the offset is beyond EOF (end of file), the
+ * file must be extended. If the write creates a "hole" of uninitialized data,
+ * the new uninitialized range must filled with zeros. You can assume that the
+ * byte range from offset to offset + size is contained within a single block.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a directory.
+ *   "path" exists and is a file.
  *
  * Errors:
- *   ENOTEMPTY  the directory is not empty.
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *   EFBIG   write would exceed the maximum file size 
  *
- * @param path  path to the directory to remove.
- * @return      0 on success; -errno on error.
+ * @param path    path to the file to write to.
+ * @param buf     pointer to the buffer containing the data.
+ * @param size    buffer size (number of bytes requested).
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      unused.
+ * @return        number of bytes written on success; -errno on error.
  */
-static int vsfs_rmdir(const char *path)
+static int vsfs_write(const char *path, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
 {
+	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//OMIT: remove the directory at given path (only if it's empty)
-	(void)path;
-	(void)fs;
-	return -ENOSYS;
+	vsfs_inode * file_inode;
+	int ret = path_lookup(path, &file_inode, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+	heat_access(&fs->ht, ret);
+
+	// Appends are buffered with delalloc; blocks are allocated later
+	if (fs->delalloc) {
+		ret = delalloc_write(fs, file_inode, buf, size, offset);
+		if (ret != 0) {
+			return (ret < 0) ? ret : (int)size;
+		}
+	}
+	ret = delalloc_flush_inode(fs, file_inode);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// file offset too large to write
+	if (size + offset > file_inode->i_size){
+		ret = resize_inode(fs, file_inode, size + offset);
+		if (ret < 0){
+			return ret;
+		}
+	}
+
+	clock_gettime(CLOCK_REALTIME, &(file_inode->i_mtime));
+
+	ret = write_block(fs, file_inode, buf, size, offset);
+	return (ret < 0) ? ret : (int)size;
 }
 
 /**
- * Create a file.
- *
- * Implements the open()/creat() system call.
+ * Release an open file.
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" doesn't exist.
- *   The parent directory of "path" exists and is a directory.
- *   "path" and its components are not too long.
+ * Called when the last file descriptor of an open file is closed. Releases
+ * the preallocation window of the file; a file that is appended to again
+ * after it is reopened gets a new one.
  *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
+ * Errors: none
  *
- * @param path  path to the file to create.
- * @param mode  file mode bits.
+ * @param path  path to the file.
  * @param fi    unused.
  * @return      0 on success; -errno on error.
  */
-static int vsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+static int vsfs_release(const char *path, struct fuse_file_info *fi)
 {
 	(void)fi;// unused
-	assert(S_ISREG(mode));
 	fs_ctx *fs = get_fs();
 
-	//TODO: create a file at given path with given mode
-	(void) path;
-	// find first unused inode --> break if all inodes full
-	uint32_t nblks = fs->size / VSFS_BLOCK_SIZE;
-	uint32_t ino_index;
-	if (fs->sb->free_inodes == 0){
-		// no more inodes == free_inodes = 0
-		return -ENOSPC;
+	vsfs_inode *inode;
+	int ret = path_lookup(path, &inode, NULL);
+	if (ret < 0) {
+		return ret;
 	}
-	bitmap_alloc(fs->ibmap, nblks, &ino_index);
+	prealloc_release(&fs->pa, ret);
+	return 0;
+}
 
-	// find empty dentry
+/**
+ * Synchronize file contents.
+ *
+ * Implements the fsync() system call. Writes all modified blocks of the file
+ * system, not just the ones of this file, to the image.
+ *
+ * Errors:
+ *   EIO  the image can't be written.
+ *
+ * @param path      path to the file.
+ * @param datasync  unused.
+ * @param fi        unused.
+ * @return          0 on success; -errno on error.
+ */
+static int vsfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	(void)datasync;// unused
+	(void)fi;// unused
+	fs_ctx *fs = get_fs();
 
-	vsfs_inode * root = inode_location(VSFS_ROOT_INO);
-	// default return value
+	int ret = delalloc_flush_all(fs);
+	if (ret < 0) {
+		return ret;
+	}
+	return bdev_flush(&fs->bd) ? 0 : -EIO;
+}
 
-	vsfs_dentry * dentry;
-	// # of dentries per block
-	int dentry_per_block = VSFS_BLOCK_SIZE / sizeof(vsfs_dentry);
+// HELPER: copy the nonzero block numbers (i.e. leave out the tails of
+// compressed clusters) from blks to out; returns their number
+static vsfs_blk_t pack_blocks(const vsfs_blk_t *blks, vsfs_blk_t n,
+                              vsfs_blk_t *out)
+{
+	vsfs_blk_t m = 0;
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		if (blks[i] != 0) {
+			out[m++] = blks[i];
+		}
+	}
+	return m;
+}
 
-	// for existing data blocks, try to find empty dentries
+// HELPER: compute the fragmentation of a list of blocks
+static void get_frag(const vsfs_blk_t *blks, vsfs_blk_t n, vsfs_frag *frag)
+{
+	frag->blocks = n;
+	frag->extents = (n > 0) ? 1 : 0;
+	for (vsfs_blk_t i = 1; i < n; i++) {
+		if (blks[i] != blks[i - 1] + 1) {
+			frag->extents++;
+		}
+	}
+	frag->score = (n > 1) ? 100 * (frag->extents - 1) / (n - 1) : 0;
+}
 
-	uint32_t * indirect_base = (uint32_t *) (fs->image + root->i_indirect * VSFS_BLOCK_SIZE);
+// HELPER: move the data blocks of the inode into one contiguous run: the
+// shortest free run that fits (for a fragmented file), or, if "low" is set,
+// the first one from the start of the data region (if that brings all of the
+// file closer to it). Returns 1 if the blocks were moved.
+//
+// The contents are copied and written to the image before the block pointers
+// are switched over (all at once), so that a crash at any point leaves the
+// file pointing at either the old or the new copy. Shared blocks get a
+// private copy, like on a write.
+static int move_inode(fs_ctx *fs, vsfs_inode *inode, bool low,
+                      vsfs_defrag *res)
+{
+	vsfs_blk_t ptrs[VSFS_MAX_FILE_BLOCKS];
+	vsfs_blk_t old[VSFS_MAX_FILE_BLOCKS];
+	vsfs_blk_t start;
+	int ret;
+
+	ret = inode_get_range(fs, inode, 0, inode->i_blocks, ptrs);
+	if (ret < 0) {
+		return ret;
+	}
+	// Only the blocks that hold data move; compressed clusters stay so
+	vsfs_blk_t n = pack_blocks(ptrs, inode->i_blocks, old);
+	get_frag(old, n, &res->before);
+	res->after = res->before;
+	if (res->before.extents == 0 || (!low && res->before.extents <= 1)) {
+		return 0;
+	}
 
-	for (vsfs_blk_t i = 0; i < root->i_blocks; i++){
-		if (i < VSFS_NUM_DIRECT){
-			// direct case
-			dentry = dentry_location(root->i_direct[i]);
-			for (int j = 0; j < dentry_per_block; j++){
-				//fprintf(stderr, "path_lookup: i = %d, j = %d, ino = %d\n", i, j, dentry[j].ino);	
-				if (dentry[j].ino == VSFS_INO_MAX){
-					dentry[j].ino = ino_index;
-					strncpy(dentry[j].name, path + 1, VSFS_NAME_MAX);
-					goto allocated;
-				}	
-			}
-		} else{
-			// indirect case
-			dentry = dentry_location(indirect_base[i - VSFS_NUM_DIRECT]);
-			for (int j = 0; j < dentry_per_block; j++){
-				//fprintf(stderr, "path_lookup indirect: i = %d, j = %d, ino = %d\n", i, j, dentry[j].ino);	
-				if (dentry[j].ino == VSFS_INO_MAX){
-					dentry[j].ino = ino_index;
-					strncpy(dentry[j].name, path + 1, VSFS_NAME_MAX);
-					goto allocated;
-				}	
-			}
+	// A pending discard must not punch out the new run
+	discard_flush(fs);
+	if (low) {
+		vsfs_blk_t last = 0;
+		for (vsfs_blk_t i = 0; i < n; i++) {
+			last = (old[i] > last) ? old[i] : last;
+		}
+		if (find_run_from(fs, fs->sb->data_region, n, true, &start) != 0 ||
+		    start + n > last) {
+			return 0;
+		}
+	} else {
+		ret = find_free_run(fs, n, &start);
+		if (ret < 0) {
+			return ret;
 		}
 	}
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		dbmap_set(fs, start + i, true);
+	}
 
-	// allocate new datablock if all existing data block full
-	uint32_t dentry_index;	
-	if (root->i_blocks < VSFS_NUM_DIRECT){
-		// search in direct blocks
-		// if curr node full, go to next node
-		// new block direct
-		if (bitmap_alloc(fs->dbmap, nblks, &dentry_index) != 0){
-			return -ENOSPC;
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		char *src = bdev_get(&fs->bd, old[i]);
+		char *dst = (src != NULL) ? bdev_get_zeroed(&fs->bd, start + i)
+		                          : NULL;
+		if (dst == NULL) {
+			if (src != NULL) {
+				bdev_put(&fs->bd, old[i], false);
+			}
+			ret = -EIO;
+			break;
 		}
-		bitmap_set(fs->dbmap, nblks, dentry_index, true);
-		root->i_direct[root->i_blocks] = dentry_index;
-		dentry = dentry_location(dentry_index);
-		dentry[0].ino = ino_index;
-		strncpy(dentry[0].name, path + 1, VSFS_NAME_MAX);	
-
-	}else if (root->i_blocks == VSFS_NUM_DIRECT){
-		// new block indirect
-		uint32_t indirect_block_index;
-		if (bitmap_alloc(fs->dbmap, nblks, &indirect_block_index) != 0){
-			return -ENOSPC;
+		memcpy(dst, src, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, start + i, true);
+		bdev_put(&fs->bd, old[i], false);
+	}
+	// The new copy must be in the image before anything points to it
+	if (ret == 0 && !bdev_flush(&fs->bd)) {
+		ret = -EIO;
+	}
+	if (ret < 0) {
+		for (vsfs_blk_t i = 0; i < n; i++) {
+			dbmap_set(fs, start + i, false);
 		}
+		return ret;
+	}
 
-		if (bitmap_alloc(fs->dbmap, nblks, &dentry_index) != 0){
-			return -ENOSPC;
+	for (vsfs_blk_t i = 0, k = 0; i < inode->i_blocks; i++) {
+		if (ptrs[i] != 0) {
+			ptrs[i] = start + k++;
 		}
-		bitmap_set(fs->dbmap, nblks, indirect_block_index, true);
-		bitmap_set(fs->dbmap, nblks, dentry_index, true);
-		memset(fs->image + indirect_block_index * VSFS_BLOCK_SIZE, 0 , VSFS_BLOCK_SIZE);
-
-		root->i_indirect = indirect_block_index;
-		uint32_t * indirect_base = (uint32_t *) (fs->image + root->i_indirect * VSFS_BLOCK_SIZE);
-		indirect_base[0] = dentry_index;
+	}
+	if (inode->i_blocks > VSFS_NUM_DIRECT) {
+		vsfs_blk_t *indirect = bdev_get(&fs->bd, inode->i_indirect);
+		if (indirect == NULL) {
+			return -EIO;
+		}
+		memcpy(indirect, ptrs + VSFS_NUM_DIRECT,
+		       (inode->i_blocks - VSFS_NUM_DIRECT) * sizeof(vsfs_blk_t));
+		bdev_put(&fs->bd, inode->i_indirect, true);
+	}
+	for (vsfs_blk_t i = 0; i < inode->i_blocks && i < VSFS_NUM_DIRECT; i++) {
+		inode->i_direct[i] = ptrs[i];
+	}
 
-		dentry = dentry_location(dentry_index);
-		dentry[0].ino = ino_index;
-		strncpy(dentry[0].name, path + 1, VSFS_NAME_MAX);	
-		fs->sb->free_blocks --;	
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		free_block(fs, old[i]);
+	}
+	discard_flush(fs);
 
-	} else if (root->i_blocks < 1029){
-		//search in indirect blocks
-		uint32_t * indirect_base = (uint32_t *) (fs->image + root->i_indirect * VSFS_BLOCK_SIZE);
-		if (bitmap_alloc(fs->dbmap, nblks, &dentry_index) != 0){
-			return -ENOSPC;
-		};
-		bitmap_set(fs->dbmap, nblks, dentry_index, true);
+	res->after.extents = 1;
+	res->after.score = 0;
+	return 1;
+}
 
-		// update linkage in indirect block
-		indirect_base[root->i_blocks - VSFS_NUM_DIRECT] = dentry_index;
+// HELPER: move the data blocks of the inode into one contiguous run
+static int defrag_inode(fs_ctx *fs, vsfs_inode *inode, vsfs_defrag *res)
+{
+	int ret = move_inode(fs, inode, false, res);
+	return (ret < 0) ? ret : 0;
+}
 
+// HELPER: share each data block of the inode with an identical block seen
+// before, and remember the blocks that have no such match
+static int dedup_inode(fs_ctx *fs, vsfs_inode *inode, vsfs_dedup *res)
+{
+	char contents[VSFS_BLOCK_SIZE];
+	int ret = 0;
+
+	res->blocks = 0;
+	res->shared = 0;
+	for (vsfs_blk_t idx = 0; idx < inode->i_blocks; idx++) {
+		// Compressed clusters are left alone
+		if (idx % VSFS_CLUSTER_BLOCKS == 0) {
+			vsfs_blk_t zblks[VSFS_CLUSTER_BLOCKS];
+			ret = cluster_compressed(fs, inode, idx / VSFS_CLUSTER_BLOCKS,
+			                         zblks);
+			if (ret < 0) {
+				break;
+			}
+			if (ret > 0) {
+				idx += VSFS_CLUSTER_BLOCKS - 1;
+				continue;
+			}
+		}
 
-		dentry = dentry_location(dentry_index);
-		dentry[0].ino = ino_index;
-		strncpy(dentry[0].name, path + 1, VSFS_NAME_MAX);
+		vsfs_blk_t blk = inode_block(fs, inode, idx);
+		void *data = (blk != 0) ? bdev_get(&fs->bd, blk) : NULL;
+		if (data == NULL) {
+			ret = -EIO;
+			break;
+		}
+		memcpy(contents, data, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, blk, false);
 
-	} else{
-		// all dentry full
-		return -ENOSPC;
+		uint64_t fp = block_fingerprint(contents);
+		ret = dedup_block(fs, inode, idx, contents, fp);
+		if (ret < 0) {
+			break;
+		}
+		if (ret > 0) {
+			res->shared++;
+		} else {
+			dedup_insert(&fs->dd, fp, blk);
+		}
+		res->blocks++;
 	}
+	discard_flush(fs);
+	return (ret < 0) ? ret : 0;
+}
 
-	for (int i = 1; i < dentry_per_block; i++){
-		dentry[i].ino = VSFS_INO_MAX;
+// HELPER: get the contents of block "idx" of the inode (which must exist)
+static int inode_read_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t idx,
+                            char *buf)
+{
+	vsfs_blk_t zblks[VSFS_CLUSTER_BLOCKS];
+	int n = cluster_compressed(fs, inode, idx / VSFS_CLUSTER_BLOCKS, zblks);
+	if (n < 0) {
+		return n;
+	}
+	if (n > 0) {
+		char *raw = cluster_data(fs, zblks, n);
+		if (raw == NULL) {
+			return -EIO;
+		}
+		memcpy(buf, raw + (idx % VSFS_CLUSTER_BLOCKS) * VSFS_BLOCK_SIZE,
+		       VSFS_BLOCK_SIZE);
+		return 0;
 	}
 
-	//update info if new block
-	root->i_blocks ++;
-	root->i_size += VSFS_BLOCK_SIZE;
-	fs->sb->free_blocks --;
-
-allocated:
-
-	// mark that block as allocated, and update sb
-	bitmap_set(fs->ibmap, nblks, ino_index, true);
-	fs->sb->free_inodes --;
-	
-	// find location of new inode and initialize
-	vsfs_inode * new = inode_location(ino_index);
-	memset(new, 0, sizeof(vsfs_inode));
-	new->i_mode = mode;
-	new->i_nlink = 1;
-	new->i_blocks = 0;
-	new->i_size = 0;
-	clock_gettime(CLOCK_REALTIME, &(new->i_mtime));
-	clock_gettime(CLOCK_REALTIME, &(root->i_mtime));
+	vsfs_blk_t blk = inode_block(fs, inode, idx);
+	char *data = (blk != 0) ? bdev_get(&fs->bd, blk) : NULL;
+	if (data == NULL) {
+		return -EIO;
+	}
+	memcpy(buf, data, VSFS_BLOCK_SIZE);
+	bdev_put(&fs->bd, blk, false);
 	return 0;
 }
 
-/**
- * Remove a file.
- *
- * Implements the unlink() system call.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * Errors: none
- *
- * @param path  path to the file to remove.
- * @return      0 on success; -errno on error.
- */
-static int vsfs_unlink(const char *path)
+// HELPER: add an existing data block at the end of the inode, allocating the
+// indirect block first if this is the first block that needs it
+static int inode_push_block(fs_ctx *fs, vsfs_inode *inode, vsfs_blk_t blk)
 {
-	fs_ctx *fs = get_fs();
-
-	//TODO: remove the file at given path
-	(void)path;
-	(void)fs;
+	vsfs_blk_t idx = inode->i_blocks;
+	int ret;
 
-	// IMPORTANT: WE ALSO WANT TO KNOW THE DENTRY OF TEH PATH INODE
-	vsfs_inode * res_inode;
-	vsfs_dentry * target_dentry;
-	int res_inode_num = path_lookup(path, &res_inode, &target_dentry);
-	// must be a valid inode with the path
-	assert(res_inode_num >= 0);
+	if (idx >= VSFS_MAX_FILE_BLOCKS) {
+		return -EFBIG;
+	}
+	if (idx == VSFS_NUM_DIRECT) {
+		ret = alloc_block(fs, inode, &inode->i_indirect);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	inode->i_blocks++;
+	ret = inode_set_block(fs, inode, idx, blk);
+	if (ret < 0) {
+		inode->i_blocks--;
+		if (idx == VSFS_NUM_DIRECT) {
+			free_block(fs, inode->i_indirect);
+			inode->i_indirect = 0;
+		}
+	}
+	return ret;
+}
 
+// Any path within the file system fits into the source path of a copy
+static_assert(1 + VSFS_NAME_MAX <= VSFS_IOC_PATH_MAX, "Path too long");
 
-	uint32_t * indirect_base = (uint32_t *) (fs->image + res_inode->i_indirect * VSFS_BLOCK_SIZE);
+// HELPER: check the ranges of a copy from src to dst, and limit its length
+// to the end of the source file
+static int check_copy_range(vsfs_inode *src, vsfs_inode *dst,
+                            vsfs_copy_range *res)
+{
+	if (res->src_offset >= src->i_size) {
+		res->length = 0;
+		return 0;
+	}
+	uint64_t left = src->i_size - res->src_offset;
+	if (res->length == 0 || res->length > left) {
+		res->length = left;
+	}
+	if (res->dst_offset > VSFS_MAX_FILE_SIZE ||
+	    res->length > VSFS_MAX_FILE_SIZE - res->dst_offset) {
+		return -EFBIG;
+	}
+	// Both ranges in the same file must not overlap
+	if (src == dst && res->src_offset < res->dst_offset + res->length &&
+	    res->dst_offset < res->src_offset + res->length) {
+		return -EINVAL;
+	}
+	return 0;
+}
 
-	uint32_t nblks = fs->size / VSFS_BLOCK_SIZE;
+// HELPER: copy a range of the src inode into the dst inode, one piece within
+// a source and a destination block at a time. The data goes through the
+// regular write path, so it is deduplicated and compressed as it is written.
+static int copy_range(fs_ctx *fs, vsfs_inode *src, vsfs_inode *dst,
+                      vsfs_copy_range *res)
+{
+	int ret = check_copy_range(src, dst, res);
+	if (ret < 0 || res->length == 0) {
+		return ret;
+	}
+	uint64_t len = res->length;
+	res->length = 0;
+	res->shared = 0;
 
-	for (vsfs_blk_t i = 0; i < res_inode->i_blocks; i++){
-		if (i < VSFS_NUM_DIRECT){
-			// direct case
-			memset(fs->image + res_inode->i_direct[i] * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-			fs->sb->free_blocks ++;
-			bitmap_free(fs->dbmap, nblks, res_inode->i_direct[i]);
-		} else{
-			// indirect case
-			memset(fs->image + indirect_base[i - VSFS_NUM_DIRECT] * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-			fs->sb->free_blocks ++;
-			bitmap_free(fs->dbmap, nblks, indirect_base[i - VSFS_NUM_DIRECT]);
+	if (res->dst_offset + len > dst->i_size) {
+		ret = resize_inode(fs, dst, res->dst_offset + len);
+		if (ret < 0) {
+			return ret;
 		}
 	}
 
-	if (res_inode->i_blocks > 5){
-		memset(fs->image + res_inode->i_indirect * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-		fs->sb->free_blocks ++;
-		bitmap_free(fs->dbmap, nblks, res_inode->i_indirect);
+	char buf[VSFS_BLOCK_SIZE];
+	vsfs_blk_t cur = VSFS_BLK_MAX;
+	while (res->length < len) {
+		uint64_t s = res->src_offset + res->length;
+		uint64_t d = res->dst_offset + res->length;
+		size_t n = VSFS_BLOCK_SIZE - s % VSFS_BLOCK_SIZE;
+		if (n > VSFS_BLOCK_SIZE - d % VSFS_BLOCK_SIZE) {
+			n = VSFS_BLOCK_SIZE - d % VSFS_BLOCK_SIZE;
+		}
+		if (n > len - res->length) {
+			n = len - res->length;
+		}
+
+		if (s / VSFS_BLOCK_SIZE != cur) {
+			cur = s / VSFS_BLOCK_SIZE;
+			ret = inode_read_block(fs, src, cur, buf);
+			if (ret < 0) {
+				break;
+			}
+		}
+		ret = write_block(fs, dst, buf + s % VSFS_BLOCK_SIZE, n, d);
+		if (ret < 0) {
+			break;
+		}
+		res->length += n;
 	}
+	clock_gettime(CLOCK_REALTIME, &(dst->i_mtime));
+	discard_flush(fs);
+	return ret;
+}
 
-	// clear inode
-	bitmap_set(fs->ibmap, nblks, res_inode_num, false);
-	fs->sb->free_inodes ++;
-	memset(inode_location(res_inode_num), 0, sizeof(vsfs_inode));
-	
-	// find location of new inode and initialize
+// HELPER: make a range of the dst inode share the data blocks of a range of
+// the src inode (see VSFS_IOC_CLONE_RANGE). Only block pointers and reference
+// counts are updated; a block that can't take another reference is copied.
+static int clone_range(fs_ctx *fs, vsfs_inode *src, vsfs_inode *dst,
+                       vsfs_copy_range *res)
+{
+	if (res->src_offset % VSFS_BLOCK_SIZE != 0 ||
+	    res->dst_offset % VSFS_BLOCK_SIZE != 0) {
+		return -EINVAL;
+	}
+	int ret = check_copy_range(src, dst, res);
+	if (ret < 0 || res->length == 0) {
+		return ret;
+	}
+	// A partial last block must be the last one of both files
+	if (res->length % VSFS_BLOCK_SIZE != 0 &&
+	    (res->src_offset + res->length != src->i_size ||
+	     res->dst_offset + res->length < dst->i_size)) {
+		return -EINVAL;
+	}
+	uint64_t len = res->length;
+	res->length = 0;
+	res->shared = 0;
 
-	vsfs_inode * root = inode_location(VSFS_ROOT_INO);
-	clock_gettime(CLOCK_REALTIME, &(root->i_mtime));
+	vsfs_blk_t s = res->src_offset / VSFS_BLOCK_SIZE;
+	vsfs_blk_t d = res->dst_offset / VSFS_BLOCK_SIZE;
+	vsfs_blk_t n = div_round_up(len, VSFS_BLOCK_SIZE);
 
-	// clear dentry of root
-	target_dentry->ino = VSFS_INO_MAX;
-	memset(target_dentry->name, 0, VSFS_NAME_MAX);
+	ret = refcount_init(fs);
+	if (ret < 0) {
+		return ret;
+	}
+	// A gap before the range is filled with zeros, as for a write
+	if (res->dst_offset > dst->i_size) {
+		ret = resize_inode(fs, dst, res->dst_offset);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	if (d + n > dst->i_blocks &&
+	    extend_cost(dst->i_blocks, d + n) - (d + n - dst->i_blocks) >
+	    avail_blocks(fs)) {
+		return -ENOSPC;
+	}
 
-	return 0;
-}
+	// Compressed clusters are only shared whole, at the same position in a
+	// cluster of the destination; others are expanded first
+	vsfs_blk_t c = VSFS_CLUSTER_BLOCKS;
+	for (vsfs_blk_t i = s / c; ret == 0 && i <= (s + n - 1) / c; i++) {
+		if (s % c != d % c || i * c < s || (i + 1) * c > s + n) {
+			ret = expand_cluster(fs, src, i);
+		}
+	}
+	if (ret == 0 && d % c != 0 && d < dst->i_blocks) {
+		ret = expand_cluster(fs, dst, d / c);
+	}
+	if (ret == 0 && (d + n) % c != 0 && d + n < dst->i_blocks) {
+		ret = expand_cluster(fs, dst, (d + n) / c);
+	}
+	if (ret < 0) {
+		return ret;
+	}
 
+	vsfs_blk_t blks[VSFS_MAX_FILE_BLOCKS];
+	ret = inode_get_range(fs, src, s, n, blks);
+	for (vsfs_blk_t i = 0; ret == 0 && i < n; i++) {
+		// 0 is the tail of a compressed cluster, which is shared whole
+		vsfs_blk_t blk = blks[i];
+		bool shared = false;
+		if (blk != 0 && block_refs(fs, blk) != VSFS_REFS_MAX &&
+		    block_refs_add(fs, blk, 1)) {
+			shared = true;
+		} else if (blk != 0) {
+			char *from = bdev_get(&fs->bd, blk);
+			if (from == NULL) {
+				ret = -EIO;
+				break;
+			}
+			ret = alloc_block(fs, dst, &blk);
+			char *to = (ret == 0) ? bdev_get(&fs->bd, blk) : NULL;
+			if (to != NULL) {
+				memcpy(to, from, VSFS_BLOCK_SIZE);
+				bdev_put(&fs->bd, blk, true);
+			} else if (ret == 0) {
+				free_block(fs, blk);
+				ret = -EIO;
+			}
+			bdev_put(&fs->bd, blks[i], false);
+			if (ret < 0) {
+				break;
+			}
+		}
 
-/**
- * Change the modification time of a file or directory.
- *
- * Implements the utimensat() system call. See "man 2 utimensat" for details.
- *
- * NOTE: You only need to implement the setting of modification time (mtime).
- *       Timestamp modifications are not recursive. 
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists.
- *
- * Errors: none
- *
- * @param path   path to the file or directory.
- * @param times  timestamps array. See "man 2 utimensat" for details.
- * @return       0 on success; -errno on failure.
- */
-static int vsfs_utimens(const char *path, const struct timespec times[2])
-{
-	fs_ctx *fs = get_fs();
-	vsfs_inode *ino = NULL;
-	
-	//TODO: update the modification timestamp (mtime) in the inode for given
-	// path with either the time passed as argument or the current time,
-	// according to the utimensat man page
-	(void)path;
-	(void)fs;
-	(void)ino;
-	
-	// 0. Check if there is actually anything to be done.
-	if (times[1].tv_nsec == UTIME_OMIT) {
-		// Nothing to do.
-		return 0;
+		vsfs_blk_t old = 0;
+		if (d + i < dst->i_blocks) {
+			ret = inode_get_range(fs, dst, d + i, 1, &old);
+			if (ret == 0) {
+				ret = inode_set_block(fs, dst, d + i, blk);
+			}
+		} else {
+			ret = inode_push_block(fs, dst, blk);
+		}
+		if (ret < 0) {
+			if (blk != 0) {
+				free_block(fs, blk);
+			}
+			break;
+		}
+		if (old != 0) {
+			free_block(fs, old);
+		}
+		res->shared += shared;
+		res->length = ((uint64_t)(i + 1) * VSFS_BLOCK_SIZE < len)
+		              ? (uint64_t)(i + 1) * VSFS_BLOCK_SIZE : len;
 	}
 
-	// 1. TODO: Find the inode for the final component in path
-	vsfs_dentry * res_dentry;
-	path_lookup(path, &ino, &res_dentry);
-	(void) res_dentry;
+	if (res->dst_offset + res->length > dst->i_size) {
+		dst->i_size = res->dst_offset + res->length;
+	}
+	clock_gettime(CLOCK_REALTIME, &(dst->i_mtime));
+	discard_flush(fs);
+	return ret;
+}
 
-	
-	// 2. Update the mtime for that inode.
-	//    This code is commented out to avoid failure until you have set
-	//    'ino' to point to the inode structure for the inode to update.
-	if (times[1].tv_nsec == UTIME_NOW) {
-		if (clock_gettime(CLOCK_REALTIME, &(ino->i_mtime)) != 0) {
-			// clock_gettime should not fail, unless you give it a
-			// bad pointer to a timespec.
-			assert(false);
+// HELPER: rebuild the fingerprint index for a file system of n blocks. Blocks
+// past the end are dropped, unless they were moved: block "blk" >= "first"
+// to moved[blk - first] (moved is NULL if nothing moved).
+static void dedup_rebuild(fs_ctx *fs, dedup_index *dd, vsfs_blk_t first,
+                          const vsfs_blk_t *moved)
+{
+	for (vsfs_blk_t blk = fs->sb->data_region; blk < fs->dd.num_blocks;
+	     blk++) {
+		uint64_t fp = fs->dd.fps[blk];
+		if (fp == 0) {
+			continue;
+		}
+		if (blk < first) {
+			dedup_insert(dd, fp, blk);
+		} else if (moved != NULL && moved[blk - first] != 0) {
+			dedup_insert(dd, fp, moved[blk - first]);
 		}
-	} else {
-		ino->i_mtime = times[1];
 	}
+}
 
-	return 0;
+// HELPER: find a run of n data blocks before block "end" that are free, or
+// past the end of the file system (i.e. about to be added by growing it)
+static int find_resize_run(fs_ctx *fs, vsfs_blk_t end, vsfs_blk_t n,
+                           vsfs_blk_t *start)
+{
+	vsfs_blk_t run = 0;
+	for (vsfs_blk_t blk = fs->sb->data_region; blk < end; blk++) {
+		if (blk < fs->sb->num_blocks &&
+		    bitmap_isset(fs->dbmap, fs->sb->num_blocks, blk)) {
+			run = 0;
+		} else if (++run == n) {
+			*start = blk + 1 - n;
+			return 0;
+		}
+	}
+	return -ENOSPC;
 }
 
-/**
- * Change the size of a file.
- *
- * Implements the truncate() system call. Supports both extending and shrinking.
- * If the file is extended, the new uninitialized range at the end must be
- * filled with zeros.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * Errors:
- *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
- *   EFBIG   write would exceed the maximum file size. 
- *
- * @param path  path to the file to set the size.
- * @param size  new file size in bytes.
- * @return      0 on success; -errno on error.
- */
-static int vsfs_truncate(const char *path, off_t size)
+// HELPER: copy the reference count table, resized to n blocks (zero-filled
+// past its current end), to blocks [start, start + n) and write it to the
+// image. The table only switches over to the copy in refcount_switch().
+static int refcount_copy(fs_ctx *fs, vsfs_blk_t start, vsfs_blk_t n)
 {
-	fs_ctx *fs = get_fs();
+	vsfs_blk_t old_n = VSFS_REFCOUNT_BLOCKS(fs->sb->num_blocks);
 
-	//TODO: set new file size, possibly "zeroing out" the uninitialized range
-	if (size > VSFS_BLOCK_SIZE * 1029){
-		return -EFBIG;
+	for (vsfs_blk_t i = 0; i < n; i++) {
+		char *dst = bdev_get_zeroed(&fs->bd, start + i);
+		if (dst == NULL) {
+			return -EIO;
+		}
+		if (i < old_n) {
+			char *src = bdev_get(&fs->bd, fs->sb->refcount_blk + i);
+			if (src == NULL) {
+				bdev_put(&fs->bd, start + i, false);
+				return -EIO;
+			}
+			memcpy(dst, src, VSFS_BLOCK_SIZE);
+			bdev_put(&fs->bd, fs->sb->refcount_blk + i, false);
+		}
+		bdev_put(&fs->bd, start + i, true);
 	}
+	return bdev_flush(&fs->bd) ? 0 : -EIO;
+}
 
-	uint32_t nblks = fs->size / VSFS_BLOCK_SIZE;
-	vsfs_inode * file_inode;
-	vsfs_dentry * file_dentry;
-	path_lookup(path, &file_inode, &file_dentry);
-	(void) file_dentry;
-
-	if (size == (off_t) file_inode->i_size){
-		return 0;
+// HELPER: switch the reference count table over to the copy at block
+// "start", which is already marked used, and free the old_n blocks of the
+// old table (those before block "end"; the rest are being cut off)
+static void refcount_switch(fs_ctx *fs, vsfs_blk_t start, vsfs_blk_t old_n,
+                            vsfs_blk_t end)
+{
+	vsfs_blk_t old = fs->sb->refcount_blk;
+	fs->sb->refcount_blk = start;
+	for (vsfs_blk_t blk = old; blk < old + old_n && blk < end; blk++) {
+		dbmap_set(fs, blk, false);
 	}
+}
 
-	unsigned long old_block_count = file_inode->i_blocks;
-	unsigned long old_block_end_pos = (file_inode->i_size - 1) % VSFS_BLOCK_SIZE;
-	if (file_inode->i_size == 0){
-		old_block_end_pos = -1;
+// HELPER: grow the file system to n blocks; the new blocks are free. If the
+// reference count table needs more blocks, it moves to a free run.
+static int grow_fs(fs_ctx *fs, vsfs_blk_t n)
+{
+	vsfs_blk_t old = fs->sb->num_blocks;
+	vsfs_blk_t old_tbl = VSFS_REFCOUNT_BLOCKS(old);
+	vsfs_blk_t new_tbl = VSFS_REFCOUNT_BLOCKS(n);
+	bool move_tbl = fs->sb->refcount_blk != 0 && new_tbl > old_tbl;
+	vsfs_blk_t tbl_start = 0;
+	dedup_index dd;
+	int ret;
+
+	if (move_tbl) {
+		ret = find_resize_run(fs, n, new_tbl, &tbl_start);
+		if (ret < 0) {
+			return ret;
+		}
 	}
+	if (!dedup_init(&dd, n)) {
+		return -ENOMEM;
+	}
+	if (!bdev_resize(&fs->bd, n)) {
+		ret = -EIO;
+		goto out;
+	}
+	fs_ctx_meta_moved(fs);
 
-	// same as div_round_up
-	unsigned long new_block_count = (unsigned long) ((size + VSFS_BLOCK_SIZE - 1) / VSFS_BLOCK_SIZE);
+	// If this fails, the image is only larger than the file system
+	if (move_tbl) {
+		ret = refcount_copy(fs, tbl_start, new_tbl);
+		if (ret < 0) {
+			goto out;
+		}
+	}
 
-	unsigned long new_block_end_pos = (size - 1) % VSFS_BLOCK_SIZE;
+	// Bits past the end of the file system are set (see mkfs.c)
+	for (vsfs_blk_t blk = old; blk < n; blk++) {
+		if (bitmap_isset(fs->dbmap, n, blk)) {
+			bitmap_set(fs->dbmap, n, blk, false);
+			freetree_update(&fs->ft, fs->dbmap, blk);
+		}
+	}
+	fs->sb->free_blocks += n - old;
+	fs->sb->num_blocks = n;
+	fs->sb->size = (uint64_t)n * VSFS_BLOCK_SIZE;
+	dedup_rebuild(fs, &dd, old, NULL);
+	dedup_destroy(&fs->dd);
+	fs->dd = dd;
+
+	if (move_tbl) {
+		for (vsfs_blk_t i = 0; i < new_tbl; i++) {
+			dbmap_set(fs, tbl_start + i, true);
+		}
+		refcount_switch(fs, tbl_start, old_tbl, n);
+	}
+	return 0;
 
+out:
+	dedup_destroy(&dd);
+	return ret;
+}
 
+// HELPER: where remap_blocks() moves block "blk": to map[blk - lo] if it is
+// in [lo, hi) and that is not 0; otherwise it stays where it is
+static vsfs_blk_t remap_block(vsfs_blk_t blk, vsfs_blk_t lo, vsfs_blk_t hi,
+                              const vsfs_blk_t *map)
+{
+	return (blk >= lo && blk < hi && map[blk - lo] != 0) ? map[blk - lo]
+	                                                      : blk;
+}
 
-	// fprintf(stderr, "old_count = %ld, old_end_pos = %ld, new_count = %ld, new_end_pos = %ld\n", old_block_count, old_block_end_pos, new_block_count, new_block_end_pos);
-	// fprintf(stderr, "freeblocks  = %d\n", fs->sb->free_blocks);
-	
-	if (size < (off_t) file_inode->i_size){
-		// shrink
-		for (unsigned long i = 0; i < old_block_count; i++){
-			if (i < VSFS_NUM_DIRECT){
-				// direct case
-				if (i < new_block_count - 1){
-					continue;
-				} else if (i < new_block_count){
-					// zero out some
-					memset(fs->image + file_inode->i_direct[i] * VSFS_BLOCK_SIZE + new_block_end_pos + 1, 0, VSFS_BLOCK_SIZE - new_block_end_pos - 1);
-				} else{
-					// de allocate all
-					memset(fs->image + file_inode->i_direct[i] * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-					fs->sb->free_blocks ++;
-					bitmap_free(fs->dbmap, nblks, file_inode->i_direct[i]);
-					file_inode->i_direct[i] = 0;
-				}
-			} else{
-				// indirect case
-				uint32_t * indirect_base = (uint32_t *) (fs->image + file_inode->i_indirect * VSFS_BLOCK_SIZE);
-				if (i < new_block_count - 1){
-					continue;
-				} else if (i < new_block_count){
-					// zero out some
-					memset(fs->image + indirect_base[i - VSFS_NUM_DIRECT] * VSFS_BLOCK_SIZE + new_block_end_pos + 1, 0, VSFS_BLOCK_SIZE - new_block_end_pos - 1);
-				} else{
-					// de allocate all
-					memset(fs->image + indirect_base[i - VSFS_NUM_DIRECT] * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-					fs->sb->free_blocks ++;
-					bitmap_free(fs->dbmap, nblks, indirect_base[i - VSFS_NUM_DIRECT]);
-					indirect_base[i- VSFS_NUM_DIRECT] = 0;
-				}	
+// HELPER: update the block pointers of inodes [*ino, end), and of their
+// indirect blocks, to blocks that were moved (see remap_block()). *ino is
+// advanced past each inode that is done; on error, it is left at the inode
+// that failed, which is unchanged.
+//
+// An indirect block that moves is updated at its new location, so mapping
+// the blocks back undoes the update.
+static int remap_blocks(fs_ctx *fs, vsfs_blk_t lo, vsfs_blk_t hi,
+                        const vsfs_blk_t *map, vsfs_ino_t *ino,
+                        vsfs_ino_t end)
+{
+	for (; *ino < end; (*ino)++) {
+		if (!bitmap_isset(fs->ibmap, fs->sb->num_inodes, *ino)) {
+			continue;
+		}
+		vsfs_inode *inode = &fs->itable[*ino];
+		// Read the indirect block before changing anything
+		vsfs_blk_t ind = 0;
+		vsfs_blk_t *indirect = NULL;
+		if (inode->i_blocks > VSFS_NUM_DIRECT) {
+			ind = remap_block(inode->i_indirect, lo, hi, map);
+			indirect = bdev_get(&fs->bd, ind);
+			if (indirect == NULL) {
+				return -EIO;
 			}
 		}
-		if (old_block_count > 5 && new_block_count <= 5){
-			memset(fs->image + file_inode->i_indirect * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-			fs->sb->free_blocks ++;
-			bitmap_free(fs->dbmap, nblks,  file_inode->i_indirect );
-			file_inode->i_indirect  = 0;		
+
+		for (vsfs_blk_t i = 0; i < inode->i_blocks && i < VSFS_NUM_DIRECT;
+		     i++) {
+			inode->i_direct[i] = remap_block(inode->i_direct[i], lo, hi,
+			                                 map);
+		}
+		if (indirect == NULL) {
+			continue;
 		}
-		
-	} else{
-		// extend
+		inode->i_indirect = ind;
+		bool dirty = false;
+		for (vsfs_blk_t i = 0; i < inode->i_blocks - VSFS_NUM_DIRECT; i++) {
+			vsfs_blk_t blk = remap_block(indirect[i], lo, hi, map);
+			dirty |= blk != indirect[i];
+			indirect[i] = blk;
+		}
+		bdev_put(&fs->bd, ind, dirty);
+	}
+	return 0;
+}
 
-		// need more new blocks, so no space
-		if ((new_block_count - old_block_count + 1 > fs->sb->free_blocks) && old_block_count <= 5 && new_block_count > 5){
-			return -ENOSPC;
-		} else if (new_block_count - old_block_count > fs->sb->free_blocks){
+// HELPER: move "refs" extra references from block "from" to block "to",
+// which has none; all or nothing
+static bool move_refs(fs_ctx *fs, vsfs_blk_t from, vsfs_blk_t to,
+                      vsfs_refs_t refs)
+{
+	if (refs == VSFS_REFS_MAX || !block_refs_add(fs, to, refs)) {
+		return false;
+	}
+	if (!block_refs_add(fs, from, -refs)) {
+		block_refs_add(fs, to, -refs);
+		return false;
+	}
+	return true;
+}
+
+// HELPER: copy the data blocks in use past block n to free blocks before it,
+// recording the new locations in moved. The blocks of the reference count
+// table are left out.
+static int move_tail(fs_ctx *fs, vsfs_blk_t n, vsfs_blk_t *moved)
+{
+	vsfs_blk_t old = fs->sb->num_blocks;
+	vsfs_blk_t tbl = fs->sb->refcount_blk;
+	vsfs_blk_t tbl_end = tbl + ((tbl != 0) ? VSFS_REFCOUNT_BLOCKS(old) : 0);
+	uint32_t index = fs->sb->data_region;
+
+	for (vsfs_blk_t blk = n; blk < old; blk++) {
+		if (!bitmap_isset(fs->dbmap, old, blk) ||
+		    (blk >= tbl && blk < tbl_end)) {
+			continue;
+		}
+		if (dbmap_find_free(fs, n, index, &index) != 0) {
 			return -ENOSPC;
 		}
-
-		if (file_inode->i_size == 0){
-			uint32_t index;
-			assert(bitmap_alloc(fs->dbmap, nblks, &index) == 0);
-			bitmap_set(fs->dbmap, nblks, index, true);
-			file_inode->i_direct[0] = index;
-			fs->sb->free_blocks --;
-			// memset 0 for entire block
-			memset(fs->image + index * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
+		dbmap_set(fs, index, true);
+		moved[blk - n] = index;
+
+		char *src = bdev_get(&fs->bd, blk);
+		char *dst = (src != NULL) ? bdev_get_zeroed(&fs->bd, index) : NULL;
+		if (dst == NULL) {
+			if (src != NULL) {
+				bdev_put(&fs->bd, blk, false);
+			}
+			return -EIO;
 		}
+		memcpy(dst, src, VSFS_BLOCK_SIZE);
+		bdev_put(&fs->bd, index, true);
+		bdev_put(&fs->bd, blk, false);
+	}
+	// The copies must be in the image before anything points to them
+	return bdev_flush(&fs->bd) ? 0 : -EIO;
+}
 
-		for (unsigned long i = 0; i < nblks; i++){
-			if (!bitmap_isset(fs->dbmap, nblks, i)){
-				memset(fs->image + i * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-			}
+// HELPER: shrink the file system to n blocks, moving the blocks in use past
+// the new end into free blocks before it (and the reference count table into
+// a free run, if it doesn't fit).
+//
+// Like in defrag_inode(), the copies are written to the image before any
+// pointers are switched over to them. The blocks that were cut off are left
+// marked as used in the bitmap, like the bits past the end of a new file
+// system. On error, the switch-over is undone and the copies are freed.
+static int shrink_fs(fs_ctx *fs, vsfs_blk_t n, uint32_t *nmoved)
+{
+	vsfs_blk_t old = fs->sb->num_blocks;
+	vsfs_blk_t tbl = fs->sb->refcount_blk;
+	vsfs_blk_t old_tbl = (tbl != 0) ? VSFS_REFCOUNT_BLOCKS(old) : 0;
+	vsfs_blk_t new_tbl = (tbl != 0) ? VSFS_REFCOUNT_BLOCKS(n) : 0;
+	bool move_tbl = tbl != 0 && tbl + new_tbl > n;
+	vsfs_blk_t tbl_start = 0;
+	vsfs_blk_t tail_free = 0;
+	vsfs_blk_t tail_tbl = 0;
+	vsfs_blk_t blk = n;
+	vsfs_ino_t ino = 0;
+	int ret;
+
+	// The checksum table can't move
+	if (fs->sb->csum_blk != 0 &&
+	    fs->sb->csum_blk + VSFS_CSUM_BLOCKS(old) > n) {
+		return -EBUSY;
+	}
+	for (vsfs_blk_t blk = n; blk < old; blk++) {
+		tail_free += !bitmap_isset(fs->dbmap, old, blk);
+		tail_tbl += blk >= tbl && blk < tbl + old_tbl;
+	}
+	vsfs_blk_t tail_used = old - n - tail_free - tail_tbl;
+	if (tail_used + (move_tbl ? new_tbl : 0) >
+	    fs->sb->free_blocks - tail_free) {
+		return -ENOSPC;
+	}
+	if (move_tbl) {
+		ret = find_resize_run(fs, n, new_tbl, &tbl_start);
+		if (ret < 0) {
+			return ret;
 		}
+		for (vsfs_blk_t i = 0; i < new_tbl; i++) {
+			dbmap_set(fs, tbl_start + i, true);
+		}
+	}
 
+	vsfs_blk_t *moved = calloc(old - n, sizeof(*moved));
+	// Where each copy came from, to switch back on error
+	vsfs_blk_t *unmoved = calloc(n, sizeof(*unmoved));
+	dedup_index dd;
+	if (moved == NULL || unmoved == NULL) {
+		ret = -ENOMEM;
+		goto out_alloc;
+	}
+	if (!dedup_init(&dd, n)) {
+		ret = -ENOMEM;
+		goto out_alloc;
+	}
+	ret = move_tail(fs, n, moved);
+	if (ret < 0) {
+		goto out_copies;
+	}
 
-		bool indirect_initialized = false;
-		if (old_block_count > 5){
-			indirect_initialized = true;
-		}
-		for (unsigned long i = 0; i < new_block_count; i++){
-			if (i < VSFS_NUM_DIRECT){
-				// direct case
-				if (i < old_block_count - 1){
-					continue;
-				} else if (i < old_block_count){
-					// memset 0 latter portion
-					memset(fs->image + file_inode->i_direct[i] * VSFS_BLOCK_SIZE + old_block_end_pos + 1, 0, VSFS_BLOCK_SIZE - old_block_end_pos - 1);
-				} else{
-					// set bit map and connect
-					if (i == 0 && file_inode->i_size == 0){
-						continue;
-					}
-					uint32_t index;
-					assert(bitmap_alloc(fs->dbmap, nblks, &index) == 0);
-					bitmap_set(fs->dbmap, nblks, index, true);
-					file_inode->i_direct[i] = index;
-					fs->sb->free_blocks --;
-					// memset 0 for entire block
-					memset(fs->image + index * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-				}
-			} else{
-				// indirect case
-				if (!indirect_initialized){
-					uint32_t new_indirect_block;
-					assert(bitmap_alloc(fs->dbmap, nblks, &new_indirect_block) == 0);
-					bitmap_set(fs->dbmap, nblks, new_indirect_block, true);
-					file_inode->i_indirect = new_indirect_block;
-					fs->sb->free_blocks --;
-					indirect_initialized = true;
-				}
-
-				uint32_t * indirect_base = (uint32_t *) (fs->image + file_inode->i_indirect * VSFS_BLOCK_SIZE);
-				if (i < old_block_count - 1){
-					continue;
-				} else if (i < old_block_count){
-					// memset 0 latter portion
-					memset(fs->image + indirect_base[i - VSFS_NUM_DIRECT] * VSFS_BLOCK_SIZE + old_block_end_pos + 1, 0, VSFS_BLOCK_SIZE - old_block_end_pos - 1);
-				} else{
-					// set bit map and connect
-					uint32_t index;
-					assert(bitmap_alloc(fs->dbmap, nblks, &index) == 0);
-					bitmap_set(fs->dbmap, nblks, index, true);
-					indirect_base[i - VSFS_NUM_DIRECT] = index;
-					fs->sb->free_blocks --;
-					// memset 0 for entire block
-					memset(fs->image + index * VSFS_BLOCK_SIZE, 0, VSFS_BLOCK_SIZE);
-				}	
-			}
+	// Switch everything over to the copies
+	for (; blk < old; blk++) {
+		vsfs_blk_t to = moved[blk - n];
+		if (to == 0) {
+			continue;
+		}
+		unmoved[to] = blk;
+		vsfs_refs_t refs = block_refs(fs, blk);
+		if (refs > 0 && !move_refs(fs, blk, to, refs)) {
+			ret = -EIO;
+			goto out_refs;
+		}
+		zcache_invalidate(&fs->zc, blk);
+		(*nmoved)++;
+	}
+	ret = remap_blocks(fs, n, old, moved, &ino, fs->sb->num_inodes);
+	if (ret == 0 && move_tbl) {
+		ret = refcount_copy(fs, tbl_start, new_tbl);
+	}
+	if (ret < 0) {
+		goto out_remap;
+	}
+	if (move_tbl) {
+		refcount_switch(fs, tbl_start, old_tbl, n);
+	} else {
+		for (vsfs_blk_t blk = tbl + new_tbl; blk < tbl + old_tbl && blk < n;
+		     blk++) {
+			dbmap_set(fs, blk, false);
 		}
 	}
 
-	file_inode->i_size = size;
-	file_inode->i_blocks = new_block_count;
-	clock_gettime(CLOCK_REALTIME, &(file_inode->i_mtime));
+	for (vsfs_blk_t blk = n; blk < old; blk++) {
+		if (!bitmap_isset(fs->dbmap, old, blk)) {
+			dbmap_set(fs, blk, true);
+		}
+	}
+	fs->sb->num_blocks = n;
+	fs->sb->size = (uint64_t)n * VSFS_BLOCK_SIZE;
+	dedup_rebuild(fs, &dd, n, moved);
+	dedup_destroy(&fs->dd);
+	fs->dd = dd;
+	free(unmoved);
+	free(moved);
+
+	// The file system already fits the image if this fails
+	if (!bdev_resize(&fs->bd, n)) {
+		return -EIO;
+	}
+	fs_ctx_meta_moved(fs);
 	return 0;
-}
 
+out_remap:
+	// Undo in reverse order; the blocks past n are still intact
+	for (vsfs_ino_t i = 0; remap_blocks(fs, 0, n, unmoved, &i, ino) < 0;
+	     i++) {
+		fprintf(stderr, "Can't switch inode %u back to its blocks\n", i);
+	}
+out_refs:
+	while (blk-- > n) {
+		vsfs_blk_t to = moved[blk - n];
+		vsfs_refs_t refs = (to != 0) ? block_refs(fs, to) : 0;
+		if (refs > 0 && !move_refs(fs, to, blk, refs)) {
+			fprintf(stderr, "Can't restore the reference count of "
+			        "block %u\n", blk);
+		}
+	}
+	*nmoved = 0;
+out_copies:
+	for (vsfs_blk_t i = 0; i < old - n; i++) {
+		if (moved[i] != 0) {
+			dbmap_set(fs, moved[i], false);
+		}
+	}
+	dedup_destroy(&dd);
+out_alloc:
+	free(unmoved);
+	free(moved);
+	if (move_tbl) {
+		for (vsfs_blk_t i = 0; i < new_tbl; i++) {
+			dbmap_set(fs, tbl_start + i, false);
+		}
+	}
+	return ret;
+}
 
-/**
- * Read data from a file.
- *
- * Implements the pread() system call. Must return exactly the number of bytes
- * requested except on EOF (end of file). Reads from file ranges that have not
- * been written to must return ranges filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
- *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
- *
- * Errors: none
- *
- * @param path    path to the file to read from.
- * @param buf     pointer to the buffer that receives the data.
- * @param size    buffer size (number of bytes requested).
- * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
- * @return        number of bytes read on success; 0 if offset is beyond EOF;
- *                -errno on error.
- */
-static int vsfs_read(const char *path, char *buf, size_t size, off_t offset,
-                     struct fuse_file_info *fi)
+// HELPER: grow or shrink the file system and its image file
+static int resize_fs(fs_ctx *fs, vsfs_resize *res)
 {
-	(void)fi;// unused
-	fs_ctx *fs = get_fs();
-
-	//TODO: read data from the file at given offset into the buffer
+	if (res->size % VSFS_BLOCK_SIZE != 0 ||
+	    res->size / VSFS_BLOCK_SIZE <= fs->sb->data_region) {
+		return -EINVAL;
+	}
+	// A single data bitmap block covers at most VSFS_BLK_MAX blocks
+	if (res->size / VSFS_BLOCK_SIZE > VSFS_BLK_MAX) {
+		return -EFBIG;
+	}
+	vsfs_blk_t n = res->size / VSFS_BLOCK_SIZE;
+	vsfs_blk_t old = fs->sb->num_blocks;
 
-	vsfs_inode * file_inode;
-	vsfs_dentry * file_dentry;
-	path_lookup(path, &file_inode, &file_dentry);
+	// The images of a striped file system are laid out together by mkfs
+	if (fs->bd.stripe.count > 1) {
+		return -EOPNOTSUPP;
+	}
+	// The checksum table is set up by mkfs for a fixed number of blocks
+	if (fs->sb->csum_blk != 0 &&
+	    VSFS_CSUM_BLOCKS(n) != VSFS_CSUM_BLOCKS(old)) {
+		return -EOPNOTSUPP;
+	}
 
-	// start of read later than end of file --> 0 bytes read
-	if (offset >= (off_t) file_inode->i_size){
+	res->old_size = (uint64_t)old * VSFS_BLOCK_SIZE;
+	res->moved = 0;
+	res->pad = 0;
+	if (n == old) {
 		return 0;
 	}
 
-	unsigned long block_idx = (unsigned long) offset / VSFS_BLOCK_SIZE;
-	unsigned long block_pos = offset % VSFS_BLOCK_SIZE;
+	// Nothing may refer to blocks past the end: buffered writes get their
+	// blocks, freed blocks are released and the windows are dropped
+	int ret = delalloc_flush_all(fs);
+	if (ret < 0) {
+		return ret;
+	}
+	discard_flush(fs);
+	prealloc_init(&fs->pa);
+	fs->alloc_goal = 0;
 
-	// read less than size if reach EOF
-	unsigned long read_length = (unsigned long) size;
-	if ((block_idx + 1 == file_inode->i_blocks) && (VSFS_BLOCK_SIZE - block_pos < read_length)){
-		// last block AND leftover < bufsize
-		read_length = VSFS_BLOCK_SIZE - block_pos;
+	ret = (n > old) ? grow_fs(fs, n) : shrink_fs(fs, n, &res->moved);
+	if (ret == 0 && !bdev_flush(&fs->bd)) {
+		ret = -EIO;
 	}
+	return ret;
+}
 
-	// find actual data block number
-	unsigned long block_num;
-	if (block_idx < VSFS_NUM_DIRECT){
-		// data in direct block
-		block_num = file_inode->i_direct[block_idx];
-	} else{
-		// data in indirect block
-		uint32_t * indirect_base = (uint32_t *) (fs->image + file_inode->i_indirect * VSFS_BLOCK_SIZE);
-		block_num = (unsigned long) indirect_base[block_idx - VSFS_NUM_DIRECT];
+/** A file to move by hotzone_fs(), with its access count. */
+typedef struct hot_file {
+	uint32_t count;
+	vsfs_ino_t ino;
+} hot_file;
+
+// HELPER: order files by decreasing access count
+static int hot_file_cmp(const void *a, const void *b)
+{
+	const hot_file *x = a;
+	const hot_file *y = b;
+	if (x->count != y->count) {
+		return (x->count < y->count) ? 1 : -1;
 	}
+	return (x->ino > y->ino) - (x->ino < y->ino);
+}
 
-	// read
-	char * read_start = fs->image + block_num * VSFS_BLOCK_SIZE + block_pos;
-	memcpy(buf, read_start, read_length);
-	(void) file_dentry;
-	return read_length;
+// HELPER: move the files accessed most (see heat.h) as close to the start of
+// the data region as they fit, the hottest first, so that they get the
+// closest runs
+static int hotzone_fs(fs_ctx *fs, vsfs_hotzone *res)
+{
+	// Buffered appends have no blocks yet
+	int ret = delalloc_flush_all(fs);
+	if (ret < 0) {
+		return ret;
+	}
+
+	hot_file *files = malloc(fs->sb->num_inodes * sizeof(hot_file));
+	if (files == NULL) {
+		return -ENOMEM;
+	}
+	uint32_t n = 0;
+	for (vsfs_ino_t ino = 0; ino < fs->sb->num_inodes; ino++) {
+		uint32_t count = heat_get(&fs->ht, ino);
+		if (count > 0 && bitmap_isset(fs->ibmap, fs->sb->num_inodes, ino) &&
+		    S_ISREG(fs->itable[ino].i_mode)) {
+			files[n].count = count;
+			files[n].ino = ino;
+			n++;
+		}
+	}
+	qsort(files, n, sizeof(hot_file), hot_file_cmp);
+
+	res->hot_files = n;
+	res->moved = 0;
+	res->blocks = 0;
+	if (res->max_files != 0 && n > res->max_files) {
+		n = res->max_files;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		vsfs_defrag d;
+		ret = move_inode(fs, &fs->itable[files[i].ino], true, &d);
+		if (ret < 0) {
+			break;
+		}
+		if (ret > 0) {
+			res->moved++;
+			res->blocks += d.after.blocks;
+		}
+		ret = 0;
+	}
+	free(files);
+	return ret;
 }
 
 /**
- * Write data to a file.
- *
- * Implements the pwrite() system call. Must return exactly the number of bytes
- * requested except on error. If the offset is beyond EOF (end of file), the
- * file must be extended. If the write creates a "hole" of uninitialized data,
- * the new uninitialized range must filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * Control operations on a file (see vsfs_ioctl.h).
  *
- * Assumptions (already verified by FUSE using getattr() calls):
- *   "path" exists and is a file.
+ * Implements the ioctl() system call on files in vsfs.
  *
  * Errors:
+ *   ENOTTY  unknown command.
+ *   ENOSPC  no free run of blocks large enough to defragment the file (or
+ *           for the reference count table), not enough free space to
+ *           move the blocks in use (and the reference count table) out of
+ *           the part of the file system that is cut off by shrinking it,
+ *           or not enough free space to copy a range.
+ *   EINVAL  new size is not a multiple of the block size, or leaves no data
+ *           blocks; the source of a copy is not a regular file, or its
+ *           range overlaps the destination range in the same file; a clone
+ *           range is not aligned to blocks (see VSFS_IOC_CLONE_RANGE).
+ *   ENOENT  the source of a copy doesn't exist.
+ *   EFBIG   new size is larger than the data bitmap can cover, or a copy
+ *           would exceed the maximum file size.
+ *   EBUSY   shrinking would cut off the checksum table.
+ *   EOPNOTSUPP  resizing would change the size of the checksum table, or
+ *               the file system is striped.
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
- *   ENOSPC  not enough free space in the file system.
- *   EFBIG   write would exceed the maximum file size 
+ *   EIO     the image can't be read or written.
  *
- * @param path    path to the file to write to.
- * @param buf     pointer to the buffer containing the data.
- * @param size    buffer size (number of bytes requested).
- * @param offset  offset from the beginning of the file to write to.
- * @param fi      unused.
- * @return        number of bytes written on success; -errno on error.
+ * @param path   path to the file (any path for VSFS_IOC_RESIZE and
+ *               VSFS_IOC_HOTZONE).
+ * @param cmd    ioctl command.
+ * @param arg    unused (the argument is passed in data).
+ * @param fi     unused.
+ * @param flags  FUSE_IOCTL_* flags.
+ * @param data   argument of the command, _IOC_SIZE(cmd) bytes.
+ * @return       0 on success; -errno on error.
  */
-static int vsfs_write(const char *path, const char *buf, size_t size,
-                      off_t offset, struct fuse_file_info *fi)
+static int vsfs_ioctl(const char *path, int cmd, void *arg,
+                      struct fuse_file_info *fi, unsigned int flags, void *data)
 {
+	(void)arg;// unused
 	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
-	//TODO: write data from the buffer into the file at given offset, possibly
-	// "zeroing out" the uninitialized range
+	// The argument structures have the same layout for 32-bit processes, so
+	// FUSE_IOCTL_COMPAT needs no special handling. Resizing and moving the
+	// hottest files apply to the whole file system, so they can be issued
+	// on any file or directory.
+	if ((unsigned int)cmd == VSFS_IOC_RESIZE) {
+		return resize_fs(fs, (vsfs_resize *)data);
+	}
+	if ((unsigned int)cmd == VSFS_IOC_HOTZONE) {
+		return hotzone_fs(fs, (vsfs_hotzone *)data);
+	}
 
-	vsfs_inode * file_inode;
-	vsfs_dentry * file_dentry;
-	path_lookup(path, &file_inode, &file_dentry);
-	(void) file_dentry;
+	// Other commands only apply to regular files
+	if (flags & FUSE_IOCTL_DIR) {
+		return -ENOTTY;
+	}
 
-	// file offset too large to write
-	if (size + offset > file_inode->i_size){
-		int ret = vsfs_truncate(path, size + offset);
-		if (ret < 0){
+	vsfs_inode *inode;
+	int ret = path_lookup(path, &inode, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = delalloc_flush_inode(fs, inode);
+	if (ret < 0) {
+		return ret;
+	}
+
+	switch ((unsigned int)cmd) {
+		case VSFS_IOC_GETFRAG: {
+			vsfs_blk_t blks[VSFS_MAX_FILE_BLOCKS];
+			ret = inode_get_range(fs, inode, 0, inode->i_blocks, blks);
+			if (ret == 0) {
+				vsfs_blk_t n = pack_blocks(blks, inode->i_blocks, blks);
+				get_frag(blks, n, (vsfs_frag *)data);
+			}
+			return ret;
+		}
+		case VSFS_IOC_DEFRAG:
+			return defrag_inode(fs, inode, (vsfs_defrag *)data);
+		case VSFS_IOC_DEDUP:
+			return dedup_inode(fs, inode, (vsfs_dedup *)data);
+		case VSFS_IOC_COPY_RANGE:
+		case VSFS_IOC_CLONE_RANGE: {
+			vsfs_copy_range *res = (vsfs_copy_range *)data;
+			vsfs_inode *src;
+			if (memchr(res->src_path, '\0', sizeof(res->src_path)) == NULL) {
+				return -EINVAL;
+			}
+			ret = path_lookup(res->src_path, &src, NULL);
+			if (ret < 0) {
+				return ret;
+			}
+			if (!S_ISREG(src->i_mode)) {
+				return -EINVAL;
+			}
+			ret = delalloc_flush_inode(fs, src);
+			if (ret < 0) {
+				return ret;
+			}
+			// The destination is no longer growing sequentially
+			prealloc_release(&fs->pa, inode - fs->itable);
+			ret = ((unsigned int)cmd == VSFS_IOC_COPY_RANGE)
+			      ? copy_range(fs, src, inode, res)
+			      : clone_range(fs, src, inode, res);
+			notify_inval_entry(&fs->notify, path + 1);
 			return ret;
 		}
+		default:
+			return -ENOTTY;
 	}
+}
 
-	clock_gettime(CLOCK_REALTIME, &(file_inode->i_mtime));
 
-	unsigned long block_idx = (unsigned long) offset / VSFS_BLOCK_SIZE;
-	unsigned long block_pos = offset % VSFS_BLOCK_SIZE;
+/*
+ * Timed callbacks. Each one calls the vsfs_ callback of the same name and,
+ * with the stats option, counts and times the call (see stats.h); with the
+ * trace option, it also records the call (see trace.h). The offset and arg
+ * arguments of TIMED() are recorded as described for trace_rec.
+ */
+#define TIMED(op, path, offset, arg, call, bytes)                       \
+	do {                                                                \
+		fs_ctx *fs_ = get_fs();                                         \
+		uint64_t start_ = stats_begin(&fs_->stats);                     \
+		uint64_t tstart_ = trace_begin(&fs_->trace);                    \
+		int ret_ = (call);                                              \
+		stats_end(&fs_->stats, (op), start_,                            \
+		          ((bytes) && ret_ > 0) ? ret_ : 0);                    \
+		trace_end(&fs_->trace, (op), (path), (offset), (arg), ret_,     \
+		          tstart_);                                             \
+		return ret_;                                                    \
+	} while (0)
+
+static int timed_statfs(const char *path, struct statvfs *st)
+{
+	TIMED(STATS_STATFS, path, 0, 0, vsfs_statfs(path, st), false);
+}
+
+static int timed_getattr(const char *path, struct stat *st)
+{
+	TIMED(STATS_GETATTR, path, 0, 0, vsfs_getattr(path, st), false);
+}
 
-	// find actual data block number
-	unsigned long block_num;
-	if (block_idx < VSFS_NUM_DIRECT){
-		// data in direct block
-		block_num = file_inode->i_direct[block_idx];
-	} else{
-		// data in indirect block
-		uint32_t * indirect_base = (uint32_t *) (fs->image + file_inode->i_indirect * VSFS_BLOCK_SIZE);
-		block_num = (unsigned long) indirect_base[block_idx - VSFS_NUM_DIRECT];
-	}
+static int timed_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi)
+{
+	TIMED(STATS_READDIR, path, offset, 0,
+	      vsfs_readdir(path, buf, filler, offset, fi), false);
+}
+
+static int timed_mkdir(const char *path, mode_t mode)
+{
+	TIMED(STATS_MKDIR, path, 0, mode, vsfs_mkdir(path, mode), false);
+}
+
+static int timed_rmdir(const char *path)
+{
+	TIMED(STATS_RMDIR, path, 0, 0, vsfs_rmdir(path), false);
+}
+
+static int timed_create(const char *path, mode_t mode,
+                        struct fuse_file_info *fi)
+{
+	TIMED(STATS_CREATE, path, 0, mode, vsfs_create(path, mode, fi), false);
+}
+
+static int timed_unlink(const char *path)
+{
+	TIMED(STATS_UNLINK, path, 0, 0, vsfs_unlink(path), false);
+}
+
+static int timed_utimens(const char *path, const struct timespec times[2])
+{
+	TIMED(STATS_UTIMENS, path, 0, 0, vsfs_utimens(path, times), false);
+}
+
+static int timed_truncate(const char *path, off_t size)
+{
+	TIMED(STATS_TRUNCATE, path, size, 0, vsfs_truncate(path, size), false);
+}
+
+static int timed_open(const char *path, struct fuse_file_info *fi)
+{
+	TIMED(STATS_OPEN, path, 0, 0, vsfs_open(path, fi), false);
+}
+
+static int timed_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+	TIMED(STATS_READ, path, offset, size,
+	      vsfs_read(path, buf, size, offset, fi), true);
+}
+
+static int timed_write(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+	TIMED(STATS_WRITE, path, offset, size,
+	      vsfs_write(path, buf, size, offset, fi), true);
+}
+
+static int timed_release(const char *path, struct fuse_file_info *fi)
+{
+	TIMED(STATS_RELEASE, path, 0, 0, vsfs_release(path, fi), false);
+}
 
-	// write
-	char * write_start = fs->image + block_num * VSFS_BLOCK_SIZE + block_pos;
-	memcpy(write_start, buf, size);
+static int timed_fsync(const char *path, int datasync,
+                       struct fuse_file_info *fi)
+{
+	TIMED(STATS_FSYNC, path, 0, datasync,
+	      vsfs_fsync(path, datasync, fi), false);
+}
 
-	return size;
+static int timed_ioctl(const char *path, int cmd, void *arg,
+                       struct fuse_file_info *fi, unsigned int flags,
+                       void *data)
+{
+	TIMED(STATS_IOCTL, path, 0, cmd,
+	      vsfs_ioctl(path, cmd, arg, fi, flags, data), false);
 }
 
 
-static struct fuse_operations vsfs_ops = {
+struct fuse_operations vsfs_ops = {
+	.init     = vsfs_start,
 	.destroy  = vsfs_destroy,
-	.statfs   = vsfs_statfs,
-	.getattr  = vsfs_getattr,
-	.readdir  = vsfs_readdir,
-	.mkdir    = vsfs_mkdir,
-	.rmdir    = vsfs_rmdir,
-	.create   = vsfs_create,
-	.unlink   = vsfs_unlink,
-	.utimens  = vsfs_utimens,
-	.truncate = vsfs_truncate,
-	.read     = vsfs_read,
-	.write    = vsfs_write,
+	.statfs   = timed_statfs,
+	.getattr  = timed_getattr,
+	.readdir  = timed_readdir,
+	.mkdir    = timed_mkdir,
+	.rmdir    = timed_rmdir,
+	.create   = timed_create,
+	.unlink   = timed_unlink,
+	.utimens  = timed_utimens,
+	.truncate = timed_truncate,
+	.open     = timed_open,
+	.read     = timed_read,
+	.write    = timed_write,
+	.release  = timed_release,
+	.fsync    = timed_fsync,
+	.ioctl    = timed_ioctl,
 };
 
+// vsfs-replay links this file without main() and runs vsfs_ops in-process
+#ifndef VSFS_NO_MAIN
 int main(int argc, char *argv[])
 {
 	vsfs_opts opts = {0};// defaults are all 0
@@ -1050,3 +3307,4 @@ int main(int argc, char *argv[])
 
 	return fuse_main(args.argc, args.argv, &vsfs_ops, &fs);
 }
+#endif
@@ -22,6 +22,7 @@
 #pragma once
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
 #include <sys/stat.h>
@@ -61,6 +62,9 @@ typedef uint32_t vsfs_ino_t;
 #define VSFS_DMAP_BLKNUM 2
 #define VSFS_ITBL_BLKNUM 3
 
+/** Number of words in the inode table initialization flags (see below). */
+#define VSFS_ITBL_FLAG_WORDS 8
+
 /** vsfs superblock. */
 
 typedef struct vsfs_superblock {	
@@ -71,8 +75,27 @@ typedef struct vsfs_superblock {
 	vsfs_blk_t num_blocks;  /* File system size in blocks */
 	vsfs_blk_t free_blocks; /* Number of available blocks in file system */
 	vsfs_blk_t data_region; /* First block after inode table */ 
+	uint32_t   features;    /* Optional on-disk features in use */
+	vsfs_blk_t refcount_blk;/* Reference count table (VSFS_FEATURE_DEDUP) */
+	vsfs_blk_t csum_blk;    /* Block checksum table (VSFS_FEATURE_CSUM) */
+	uint32_t   stripe_count;/* Number of images (VSFS_FEATURE_STRIPE) */
+	vsfs_blk_t stripe_unit; /* Stripe unit in blocks (VSFS_FEATURE_STRIPE) */
+	/* Inode table blocks not initialized yet (VSFS_FEATURE_LAZY_ITABLE) */
+	uint64_t   itbl_uninit[VSFS_ITBL_FLAG_WORDS];
 } vsfs_superblock;
 
+/**
+ * Superblock feature flags. A driver must not mount an image that uses
+ * features it doesn't know about. mkfs sets CSUM, STRIPE and LAZY_ITABLE as
+ * requested; the driver sets COMPRESS and DEDUP when it first uses them.
+ */
+#define VSFS_FEATURE_COMPRESS    0x01u /* some clusters are compressed */
+#define VSFS_FEATURE_DEDUP       0x02u /* some data blocks are shared */
+#define VSFS_FEATURE_CSUM        0x04u /* blocks have checksums (set by mkfs) */
+#define VSFS_FEATURE_STRIPE      0x08u /* striped over images (set by mkfs) */
+#define VSFS_FEATURE_LAZY_ITABLE 0x10u /* itable not all zeroed (set by mkfs) */
+#define VSFS_FEATURES_ALL        0x1fu
+
 // Superblock must fit into a single disk sector
 static_assert(sizeof(vsfs_superblock) <= VSFS_BLOCK_SIZE,
               "superblock is too large");
@@ -112,6 +135,64 @@ typedef struct vsfs_inode {
 	vsfs_blk_t i_indirect;
 } vsfs_inode;
 
+/** Maximum number of data blocks in a file: direct plus one indirect block. */
+#define VSFS_MAX_FILE_BLOCKS \
+	(VSFS_NUM_DIRECT + VSFS_BLOCK_SIZE / sizeof(vsfs_blk_t))
+
+/** Maximum file size in bytes. */
+#define VSFS_MAX_FILE_SIZE ((uint64_t)VSFS_MAX_FILE_BLOCKS * VSFS_BLOCK_SIZE)
+
+/**
+ * Compression clusters.
+ *
+ * Data blocks of a file are grouped into clusters of VSFS_CLUSTER_BLOCKS
+ * consecutive blocks (file block idx belongs to cluster
+ * idx / VSFS_CLUSTER_BLOCKS). A complete cluster can be stored compressed in
+ * fewer blocks: its first k block pointers refer to the compressed data,
+ * and the remaining ones are 0 (never a valid data block). The compressed
+ * data starts with a vsfs_zheader and continues across the k blocks.
+ */
+#define VSFS_CLUSTER_BLOCKS 4
+
+/** Header of a compressed cluster. */
+typedef struct vsfs_zheader {
+	/** Size of the compressed data that follows the header. */
+	uint32_t z_size;
+	/** Reserved; must be 0. */
+	uint32_t z_reserved;
+} vsfs_zheader;
+
+/**
+ * Block sharing (deduplication).
+ *
+ * A file data block can be referred to by more than one block pointer, in
+ * the same file or in different files. The number of references to each
+ * block beyond the first one is kept in the reference count table: a run of
+ * VSFS_REFCOUNT_BLOCKS() data blocks starting at sb->refcount_blk, with one
+ * vsfs_refs_t per block of the file system. A block with a nonzero count is
+ * never modified in place (copy on write). Indirect blocks, directory blocks
+ * and compressed clusters are never shared.
+ */
+typedef uint16_t vsfs_refs_t;
+
+#define VSFS_REFS_MAX       UINT16_MAX
+#define VSFS_REFS_PER_BLOCK (VSFS_BLOCK_SIZE / sizeof(vsfs_refs_t))
+#define VSFS_REFCOUNT_BLOCKS(num_blocks) \
+	(((num_blocks) + VSFS_REFS_PER_BLOCK - 1) / VSFS_REFS_PER_BLOCK)
+
+/**
+ * Block checksums.
+ *
+ * Images formatted with checksums have a table with the CRC32C of every block
+ * of the file system: VSFS_CSUM_BLOCKS() data blocks starting at
+ * sb->csum_blk, allocated by mkfs. The entries for the table's own blocks
+ * are 0 and are not checked; the entries for free blocks are not checked
+ * either.
+ */
+#define VSFS_CSUMS_PER_BLOCK (VSFS_BLOCK_SIZE / sizeof(uint32_t))
+#define VSFS_CSUM_BLOCKS(num_blocks) \
+	(((num_blocks) + VSFS_CSUMS_PER_BLOCK - 1) / VSFS_CSUMS_PER_BLOCK)
+
 /** A single block must fit an integral number of inodes */
 static_assert(VSFS_BLOCK_SIZE % sizeof(vsfs_inode) == 0, "invalid inode size");
 
@@ -126,10 +207,45 @@ static_assert(VSFS_BLOCK_SIZE % sizeof(vsfs_inode) == 0, "invalid inode size");
  */
 #define VSFS_ROOT_INO 0
 
+/** Number of inodes in a block of the inode table. */
+#define VSFS_INODES_PER_BLOCK (VSFS_BLOCK_SIZE / sizeof(vsfs_inode))
+
 /** The root inode must be in the first block of the inode table. */
-static_assert(VSFS_ROOT_INO < (VSFS_BLOCK_SIZE / sizeof(vsfs_inode)),
+static_assert(VSFS_ROOT_INO < VSFS_INODES_PER_BLOCK,
 	      "invalid root inode number");
 
+/**
+ * Lazy inode table initialization.
+ *
+ * Unless it zeroes the whole image, mkfs only zeroes the first block of the
+ * inode table (which holds the root inode). The other blocks are flagged as
+ * uninitialized in sb->itbl_uninit (bit i for block i of the table) and may
+ * hold anything; all of their inodes are free. The driver zeroes a block
+ * before it allocates the first inode in it, and clears its flag; the
+ * feature is cleared along with the last flag.
+ */
+static_assert(VSFS_ITBL_FLAG_WORDS * 64 * VSFS_INODES_PER_BLOCK >=
+              VSFS_INO_MAX, "too few inode table flags");
+
+/** Check if block i of the inode table is not initialized yet. */
+static inline bool vsfs_itbl_uninit(const vsfs_superblock *sb, uint32_t i)
+{
+	return (sb->features & VSFS_FEATURE_LAZY_ITABLE) &&
+	       ((sb->itbl_uninit[i / 64] >> (i % 64)) & 1);
+}
+
+/** Clear the flag of block i of the inode table, once it is zeroed. */
+static inline void vsfs_itbl_set_init(vsfs_superblock *sb, uint32_t i)
+{
+	sb->itbl_uninit[i / 64] &= ~((uint64_t)1 << (i % 64));
+	for (int w = 0; w < VSFS_ITBL_FLAG_WORDS; ++w) {
+		if (sb->itbl_uninit[w] != 0) {
+			return;
+		}
+	}
+	sb->features &= ~VSFS_FEATURE_LAZY_ITABLE;
+}
+
 /**
  *  Since we only have 1 data bitmap block, there can be at most 
  *  VSFS_BLOCK_SIZE * bits_per_byte blocks in the file system.
@@ -0,0 +1,135 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - vsfs control ioctls.
+ *
+ * Shared by the file system and the vsfsctl tool. FUSE only forwards ioctls
+ * whose argument size is encoded in the command, so all of them are defined
+ * with _IOR/_IOW/_IOWR and a fixed size argument structure.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+
+/** Fragmentation of a file's data blocks. */
+typedef struct vsfs_frag {
+	/** Number of data blocks. */
+	uint32_t blocks;
+	/** Number of runs of adjacent blocks. */
+	uint32_t extents;
+	/**
+	 * 0 if the file is contiguous, 100 if no two consecutive blocks of the
+	 * file are adjacent: 100 * (extents - 1) / (blocks - 1).
+	 */
+	uint32_t score;
+} vsfs_frag;
+
+/** Result of defragmenting a file. */
+typedef struct vsfs_defrag {
+	vsfs_frag before;
+	vsfs_frag after;
+} vsfs_defrag;
+
+/** Result of deduplicating a file. */
+typedef struct vsfs_dedup {
+	/** Number of data blocks checked (blocks of compressed clusters are not). */
+	uint32_t blocks;
+	/** Number of them that now share an identical block. */
+	uint32_t shared;
+} vsfs_dedup;
+
+/** Argument of VSFS_IOC_RESIZE. */
+typedef struct vsfs_resize {
+	/** In: new size of the file system in bytes, a multiple of 4096. */
+	uint64_t size;
+	/** Out: previous size of the file system in bytes. */
+	uint64_t old_size;
+	/** Out: number of blocks moved out of the part that was cut off. */
+	uint32_t moved;
+	uint32_t pad;
+} vsfs_resize;
+
+/** Argument of VSFS_IOC_HOTZONE. */
+typedef struct vsfs_hotzone {
+	/** In: maximum number of files to move; 0 for no limit. */
+	uint32_t max_files;
+	/** Out: number of files accessed recently (see heat.h). */
+	uint32_t hot_files;
+	/** Out: number of the hottest files moved, and of their blocks. */
+	uint32_t moved;
+	uint32_t blocks;
+} vsfs_hotzone;
+
+/** Maximum length of a path in vsfs, including the terminating '\0'. */
+#define VSFS_IOC_PATH_MAX 256
+
+/** Argument of VSFS_IOC_COPY_RANGE and VSFS_IOC_CLONE_RANGE. */
+typedef struct vsfs_copy_range {
+	/** In: path of the source file within the file system, e.g. "/file". */
+	char src_path[VSFS_IOC_PATH_MAX];
+	/** In: offset in the source file. */
+	uint64_t src_offset;
+	/** In: offset in the destination file. */
+	uint64_t dst_offset;
+	/**
+	 * In: number of bytes; 0 (or more than there are) to copy up to the end
+	 * of the source file. Out: number of bytes copied.
+	 */
+	uint64_t length;
+	/** Out: number of blocks shared with the source file. */
+	uint64_t shared;
+} vsfs_copy_range;
+
+
+#define VSFS_IOC_MAGIC 'v'
+
+/** Get the fragmentation of a file. */
+#define VSFS_IOC_GETFRAG _IOR(VSFS_IOC_MAGIC, 1, vsfs_frag)
+/** Move the blocks of a file into one contiguous run. */
+#define VSFS_IOC_DEFRAG  _IOR(VSFS_IOC_MAGIC, 2, vsfs_defrag)
+/**
+ * Share the blocks of a file with identical blocks seen so far (by earlier
+ * VSFS_IOC_DEDUP calls or, with the dedup option, written) since mount.
+ */
+#define VSFS_IOC_DEDUP   _IOR(VSFS_IOC_MAGIC, 3, vsfs_dedup)
+/**
+ * Grow or shrink the mounted file system (and its image file). Can be issued
+ * on any file or directory, e.g. the mount point. When shrinking, the blocks
+ * in use past the new end are moved down first.
+ */
+#define VSFS_IOC_RESIZE  _IOWR(VSFS_IOC_MAGIC, 4, vsfs_resize)
+/**
+ * Copy a range of another file into the file, inside the image. The
+ * destination is extended (with zeros up to the range) if needed.
+ */
+#define VSFS_IOC_COPY_RANGE  _IOWR(VSFS_IOC_MAGIC, 5, vsfs_copy_range)
+/**
+ * Like VSFS_IOC_COPY_RANGE, but the destination shares the data blocks of
+ * the source (copy-on-write) instead of copying them. The offsets must be
+ * multiples of the block size, and so must the length unless the range ends
+ * at the end of the source file and at or past the end of the destination.
+ */
+#define VSFS_IOC_CLONE_RANGE _IOWR(VSFS_IOC_MAGIC, 6, vsfs_copy_range)
+/**
+ * Move the data blocks of the files accessed most since mount (the hottest
+ * first, up to max_files of them) each into one contiguous run, as close to
+ * the metadata as it fits. Files are only moved closer; cold files are left
+ * where they are. Like VSFS_IOC_RESIZE, it can be issued on any file or
+ * directory, and is best run when the file system is otherwise idle.
+ */
+#define VSFS_IOC_HOTZONE _IOWR(VSFS_IOC_MAGIC, 7, vsfs_hotzone)
@@ -0,0 +1,49 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - vsfs driver interface header file.
+ *
+ * Lets tools other than the vsfs program (see replay.c) run the file system
+ * in-process: mount with vsfs_init() and vsfs_ops.init(), call the other
+ * vsfs_ops callbacks, and unmount with vsfs_ops.destroy(). The callbacks find
+ * the file system context with fuse_get_context(), so its private_data must
+ * point to it.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Using 2.9.x FUSE API
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 29
+#endif
+#include <fuse.h>
+
+#include "fs_ctx.h"
+#include "options.h"
+
+
+/** vsfs callbacks. */
+extern struct fuse_operations vsfs_ops;
+
+/**
+ * Mount the file system.
+ *
+ * @param fs    file system context to initialize.
+ * @param opts  mount options; must stay valid until unmount.
+ * @return      true on success; false on failure.
+ */
+bool vsfs_init(fs_ctx *fs, vsfs_opts *opts);
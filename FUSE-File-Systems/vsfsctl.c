@@ -0,0 +1,281 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid, Angela Demke Brown
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2022 Angela Demke Brown
+ */
+
+/**
+ * CSC369 Assignment 5 - vsfs control tool.
+ *
+ * Sends control ioctls (see vsfs_ioctl.h) to files in a mounted vsfs.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vsfs_ioctl.h"
+
+
+/* Each command is represented by a structure with its name, a description of
+ * its arguments, and a function that runs it on one file. A command can take
+ * one argument before the files; it is passed to the function as "arg". The
+ * files are opened with the given flags (created if O_CREAT is set).
+ */
+typedef struct vsfsctl_cmd {
+	const char *name;
+	const char *help;
+	bool takes_arg;
+	int flags;
+	bool (*run)(int fd, const char *path, const char *arg);
+} vsfsctl_cmd;
+
+
+static void print_frag(const vsfs_frag *f)
+{
+	printf("%u blocks, %u extent%s, score %u", f->blocks, f->extents,
+	       f->extents == 1 ? "" : "s", f->score);
+}
+
+static bool cmd_frag(int fd, const char *path, const char *arg)
+{
+	(void)arg;// unused
+	vsfs_frag f;
+	if (ioctl(fd, VSFS_IOC_GETFRAG, &f) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: ", path);
+	print_frag(&f);
+	printf("\n");
+	return true;
+}
+
+static bool cmd_defrag(int fd, const char *path, const char *arg)
+{
+	(void)arg;// unused
+	vsfs_defrag d;
+	if (ioctl(fd, VSFS_IOC_DEFRAG, &d) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: ", path);
+	print_frag(&d.before);
+	printf(" -> ");
+	print_frag(&d.after);
+	printf("\n");
+	return true;
+}
+
+static bool cmd_dedup(int fd, const char *path, const char *arg)
+{
+	(void)arg;// unused
+	vsfs_dedup d;
+	if (ioctl(fd, VSFS_IOC_DEDUP, &d) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: %u of %u blocks shared\n", path, d.shared, d.blocks);
+	return true;
+}
+
+// Parse a size in bytes with an optional K, M or G suffix
+static bool parse_size(const char *s, uint64_t *size)
+{
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(s, &end, 10);
+	if (errno != 0 || end == s || s[0] == '-') {
+		return false;
+	}
+	int shift = 0;
+	switch (*end) {
+		case 'K': case 'k': shift = 10; end++; break;
+		case 'M': case 'm': shift = 20; end++; break;
+		case 'G': case 'g': shift = 30; end++; break;
+	}
+	if (*end != '\0' || n > (UINT64_MAX >> shift)) {
+		return false;
+	}
+	*size = (uint64_t)n << shift;
+	return true;
+}
+
+static bool cmd_resize(int fd, const char *path, const char *arg)
+{
+	vsfs_resize r = {0};
+	if (!parse_size(arg, &r.size)) {
+		fprintf(stderr, "Invalid size: %s\n", arg);
+		return false;
+	}
+	if (ioctl(fd, VSFS_IOC_RESIZE, &r) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: %lu -> %lu bytes", path, r.old_size, r.size);
+	if (r.moved > 0) {
+		printf(", %u blocks moved", r.moved);
+	}
+	printf("\n");
+	return true;
+}
+
+static bool cmd_hot(int fd, const char *path, const char *arg)
+{
+	vsfs_hotzone h = {0};
+	char *end;
+	errno = 0;
+	unsigned long max = strtoul(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || arg[0] == '-' ||
+	    max > UINT32_MAX) {
+		fprintf(stderr, "Invalid number of files: %s\n", arg);
+		return false;
+	}
+	h.max_files = max;
+	if (ioctl(fd, VSFS_IOC_HOTZONE, &h) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: %u hot files, %u moved (%u blocks)\n", path, h.hot_files,
+	       h.moved, h.blocks);
+	return true;
+}
+
+// Copy (or clone) all of file "src" into the file, which is in the same vsfs
+static bool copy_file(int fd, const char *path, const char *src, bool clone)
+{
+	struct stat src_st, dst_st;
+	if (stat(src, &src_st) < 0 || fstat(fd, &dst_st) < 0) {
+		perror(src);
+		return false;
+	}
+	if (src_st.st_dev != dst_st.st_dev) {
+		fprintf(stderr, "%s: not in the same file system as %s\n", src, path);
+		return false;
+	}
+
+	// vsfs has only the root directory
+	vsfs_copy_range r = {0};
+	char *name = strdup(src);
+	if (name == NULL) {
+		perror(src);
+		return false;
+	}
+	int len = snprintf(r.src_path, sizeof(r.src_path), "/%s", basename(name));
+	free(name);
+	if (len >= (int)sizeof(r.src_path)) {
+		fprintf(stderr, "%s: name too long\n", src);
+		return false;
+	}
+	if (ioctl(fd, clone ? VSFS_IOC_CLONE_RANGE : VSFS_IOC_COPY_RANGE, &r) < 0) {
+		perror(path);
+		return false;
+	}
+	printf("%s: %lu bytes %s", path, r.length, clone ? "cloned" : "copied");
+	if (r.shared > 0) {
+		printf(", %lu blocks shared", r.shared);
+	}
+	printf("\n");
+	return true;
+}
+
+static bool cmd_copy(int fd, const char *path, const char *arg)
+{
+	return copy_file(fd, path, arg, false);
+}
+
+static bool cmd_clone(int fd, const char *path, const char *arg)
+{
+	return copy_file(fd, path, arg, true);
+}
+
+#define COPY_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+
+static const vsfsctl_cmd cmds[] = {
+	{ "frag"  , "FILE...", false, O_RDONLY, cmd_frag   },
+	{ "defrag", "FILE...", false, O_RDONLY, cmd_defrag },
+	{ "dedup" , "FILE...", false, O_RDONLY, cmd_dedup  },
+	{ "resize", "SIZE FILE", true, O_RDONLY, cmd_resize },
+	{ "copy"  , "SRC DST...", true, COPY_FLAGS, cmd_copy  },
+	{ "clone" , "SRC DST...", true, COPY_FLAGS, cmd_clone },
+	{ "hot"   , "MAX FILE", true, O_RDONLY, cmd_hot },
+};
+static const size_t num_cmds = sizeof(cmds) / sizeof(cmds[0]);
+
+
+static void print_help(FILE *f, const char *progname)
+{
+	fprintf(f, "Usage: %s command args\n\nCommands:\n", progname);
+	for (size_t i = 0; i < num_cmds; ++i) {
+		fprintf(f, "    %-8s %s\n", cmds[i].name, cmds[i].help);
+	}
+	fprintf(f, "\n"
+	        "frag shows how fragmented the files are; the score is 0 for a\n"
+	        "contiguous file and 100 if no two blocks are adjacent.\n"
+	        "defrag moves the blocks of each file into one contiguous run.\n"
+	        "dedup shares the blocks of each file with identical blocks of\n"
+	        "the files before it (and of files written since mount).\n"
+	        "resize grows or shrinks the file system that FILE (e.g. the\n"
+	        "mount point) is in to SIZE bytes; K, M and G suffixes are\n"
+	        "accepted.\n"
+	        "copy copies file SRC to each DST (created or truncated) in the\n"
+	        "same vsfs, without moving the data through user space.\n"
+	        "clone does the same, but DST shares the blocks of SRC until\n"
+	        "either file is modified.\n"
+	        "hot moves the files of the vsfs that FILE is in that were read\n"
+	        "or written most since mount (the MAX hottest, or all of them if\n"
+	        "MAX is 0) close to the metadata; run it while the file system\n"
+	        "is idle, e.g. periodically.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || strcmp(argv[1], "-h") == 0 ||
+	    strcmp(argv[1], "--help") == 0) {
+		print_help(argc < 2 ? stderr : stdout, argv[0]);
+		return argc < 2 ? 1 : 0;
+	}
+
+	const vsfsctl_cmd *cmd = NULL;
+	for (size_t i = 0; i < num_cmds; ++i) {
+		if (strcmp(cmds[i].name, argv[1]) == 0) {
+			cmd = &cmds[i];
+			break;
+		}
+	}
+	int first = cmd != NULL && cmd->takes_arg ? 3 : 2;
+	if (cmd == NULL || argc <= first) {
+		print_help(stderr, argv[0]);
+		return 1;
+	}
+	const char *arg = cmd->takes_arg ? argv[2] : NULL;
+
+	int ret = 0;
+	for (int i = first; i < argc; ++i) {
+		int fd = open(argv[i], cmd->flags, 0666);
+		if (fd < 0) {
+			perror(argv[i]);
+			ret = 1;
+			continue;
+		}
+		if (!cmd->run(fd, argv[i], arg)) {
+			ret = 1;
+		}
+		close(fd);
+	}
+	return ret;
+}